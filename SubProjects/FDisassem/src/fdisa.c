@@ -6,7 +6,7 @@
 void disassemble(uint16_t instruction, char* code, uint16_t address)
 {
     static char stack_letters[6] = { 'd', 'r', 'c', 't', '?', '?' };
-    static char size_letters[6]  = { '?', 'b', 'w', '?', 'l', '?' };
+    static char size_letters[8]  = { '?', 'b', 'w', '?', 'l', '?', '?', '?' };
 
     code[0] = '\0';
 
@@ -106,7 +106,7 @@ void disassemble(uint16_t instruction, char* code, uint16_t address)
                 if (func == 0x0B) {
                     uint8_t size;
                     bool is_io;
-                    size = instruction & 0x03;
+                    size = instruction & 0x07;
                     is_io = instruction & 0x40;
                     char size_letter = size_letters[size];
                     if (is_io) {
@@ -172,8 +172,8 @@ void disassemble(uint16_t instruction, char* code, uint16_t address)
                         break;
                     case 0x02:
                         {
-                            uint8_t size = instruction & 0x03;
-                            bool is_io = instruction & 0x40;
+                            uint8_t size = instruction & 0x07;
+                            bool is_io = instruction & 0x80;
                             char size_letter = size_letters[size];
                             if (is_io) {
                                 sprintf(code, "%s %c", "ird", size_letter);
@@ -0,0 +1,24 @@
+#!/bin/bash
+#
+# Run each image with each execution core and report the speed.
+#
+# Build fpemu with optimization first, see 'make bench' in ..
+#
+
+FPEMU=../fpemu
+CORES="switch tos block fused table threaded jit"
+
+printf "%-28s %-10s %12s %9s %9s\n" "image" "core" "instructions" "seconds" "MIPS"
+for image in "$@"; do
+    for core in $CORES; do
+        $FPEMU -r $image -i /dev/null -o /dev/null -c $core -b |
+            awk -v image=$image -v core=$core '
+                /^Executed/ { found = 1; sub(/\(/, "", $7);
+                    printf "%-28s %-10s %12s %9s %9s\n",
+                           image, core, $2, $5, $7 }
+                END { if (!found) printf "%-28s %-10s %12s\n",
+                           image, core, "not available" }'
+    done
+done
+
+# ------------------------ End of file -----------------------------
@@ -0,0 +1,31 @@
+; vi: ft=smasm
+;
+; Benchmark: tight nested count down loops on the data stack,
+; the outer counter lives on the temp stack.
+;
+.org $F000
+    ld    t 1000
+outer:
+    ld    d 50000
+inner:
+    ldl   d 1
+    neg
+    add
+    dup   d
+    ldl   d 0
+    eq
+    bif   inner
+    drop  d
+    mov   t d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d t
+    ldl   d 0
+    eq
+    bif   outer
+    drop  t
+    halt
+
+; --------------- end of file ----------------------
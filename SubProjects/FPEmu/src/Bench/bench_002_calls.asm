@@ -0,0 +1,48 @@
+; vi: ft=smasm
+;
+; Benchmark: subroutine calls, every iteration enters two levels deep.
+;
+.org $F000
+    ld    t 600
+outer:
+    ld    d 20000
+inner:
+    enter square_plus_one
+    drop  d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    ldl   d 0
+    eq
+    bif   inner
+    drop  d
+    mov   t d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d t
+    ldl   d 0
+    eq
+    bif   outer
+    drop  t
+    halt
+
+; ( n -- n n*n+1 )
+.align l
+square_plus_one:
+    dup   d
+    dup   d
+    mul
+    enter increment
+    leave
+
+; ( n -- n+1 )
+.align l
+increment:
+    ldl   d 1
+    add
+    leave
+
+; --------------- end of file ----------------------
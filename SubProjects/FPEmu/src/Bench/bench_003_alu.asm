@@ -0,0 +1,55 @@
+; vi: ft=smasm
+;
+; Benchmark: a mix of arithmetic, logic, shift and compare operations
+; (a xorshift style pseudo random generator).
+;
+.org $F000
+    ld    t 300
+    ld    d $ACE1
+outer:
+    ld    c 30000
+inner:
+    dup   d
+    ldl   d 7
+    lsl
+    xor
+    dup   d
+    ldl   d 9
+    lsr
+    xor
+    dup   d
+    ldl   d 8
+    lsl
+    xor
+    dup   d
+    ldl   d $FF
+    and
+    ldl   d $80
+    gtu
+    bif   skip
+    ld    d $1234
+    or
+skip:
+    mov   c d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d c
+    ldl   d 0
+    eq
+    bif   inner
+    drop  c
+    mov   t d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d t
+    ldl   d 0
+    eq
+    bif   outer
+    drop  t
+    halt
+
+; --------------- end of file ----------------------
@@ -0,0 +1,45 @@
+; vi: ft=smasm
+;
+; Benchmark: copy 4K of memory one byte at a time, 500 times.  Compare
+; with bench_005 and bench_006, which copy the same with words and longs.
+;
+.def source      $1000
+.def destination $2000
+.def size        $1000
+
+.org $F000
+    ld    t 500
+pass:
+    ldl   d 0
+copy:
+    dup   d
+    ld    d destination
+    add
+    swap  d
+    dup   d
+    ld    d source
+    add
+    swap  d
+    mov   d c
+    rd    b
+    sto   b
+    mov   c d
+    ldl   d 1
+    add
+    dup   d
+    ld    d size
+    eq
+    bif   copy
+    drop  d
+    mov   t d
+    ld    d $FFFF
+    add
+    dup   d
+    mov   d t
+    ldl   d 0
+    eq
+    bif   pass
+    drop  t
+    halt
+
+; --------------- end of file ----------------------
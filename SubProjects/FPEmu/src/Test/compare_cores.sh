@@ -0,0 +1,44 @@
+#!/bin/bash
+#
+# Run programs on every core and compare the final processor state and
+# the serial output with those of the switch core.  Serial input comes
+# from file.in if there is one.  OPTIONS are passed on to fpemu.
+#
+#   compare_cores.sh <start address> file.hex ...
+#
+
+FPEMU=${FPEMU:-../fpemu}
+CORES=${CORES:-"switch tos block fused table threaded jit"}
+OPTIONS=${OPTIONS:-}
+START=$1
+shift
+
+WORK=$(mktemp -d)
+trap 'rm -rf $WORK' EXIT
+
+failed=0
+for hex in "$@"; do
+    input=${hex%.hex}.in
+    [ -f $input ] || input=/dev/null
+    for core in $CORES; do
+        : > $WORK/out_$core.txt
+        $FPEMU -r $hex -i $input -o $WORK/out_$core.txt -c $core \
+               -p $START -d $OPTIONS 2>&1 |
+            grep -v -E "^(Loading|Serial|Block cache|Fusion|JIT)" > $WORK/log_$core.txt
+    done
+    result="ok"
+    for core in $CORES; do
+        if ! cmp -s $WORK/log_switch.txt $WORK/log_$core.txt ||
+           ! cmp -s $WORK/out_switch.txt $WORK/out_$core.txt; then
+            result="FAILED"
+            failed=1
+            echo "--- $hex: $core differs from switch"
+            diff $WORK/log_switch.txt $WORK/log_$core.txt
+        fi
+    done
+    printf "%-60s %s\n" "$hex" "$result"
+done
+
+exit $failed
+
+# --------------- end of file -----------------------------------------
@@ -0,0 +1,115 @@
+; vi: ft=smasm
+;
+; Every operation in a hot loop.  The checksum left on the data stack
+; must be the same for all cores.
+;
+.org $F000
+    ld    d $1234
+    ld    t 200
+loop:
+    ; x = (x * 3) ^ $5A5A
+    ldl   d 3
+    mul
+    ld    d $5A5A
+    xor
+    ; x = x + (x asr 5)
+    dup   d
+    ldl   d 5
+    asr
+    add
+    ; x = x + (x lsl counter), the count goes well past 16
+    dup   d
+    mov   t d
+    dup   d
+    mov   d t
+    lsl
+    add
+    ; x = x ^ (x lsr 3)
+    dup   d
+    ldl   d 3
+    lsr
+    xor
+    ; comparisons, signed and unsigned
+    dup   d
+    ld    d $7F00
+    lt
+    xor
+    dup   d
+    ld    d $7F00
+    ltu
+    ldl   d $11
+    and
+    add
+    dup   d
+    ld    d $8123
+    gt
+    ldl   d $22
+    and
+    add
+    dup   d
+    ld    d $8123
+    gtu
+    ldl   d $44
+    and
+    add
+    dup   d
+    dup   d
+    lte
+    ldl   d $88
+    and
+    add
+    dup   d
+    ldl   d 7
+    lteu
+    or
+    dup   d
+    ld    d $C000
+    gte
+    ldl   d $101
+    and
+    add
+    dup   d
+    ld    d $C000
+    gteu
+    ldl   d $202
+    and
+    xor
+    dup   d
+    ldl   d 0
+    eq
+    add
+    ; constants only
+    ldl   d 6
+    ldl   d 7
+    mul
+    add
+    ; the other stacks
+    dup   d
+    mov   d r
+    ldl   r 5
+    swap  r
+    drop  r
+    ldh   r 1
+    dup   r
+    drop  r
+    mov   r d
+    add
+    ldl   d 9
+    swap  d
+    xor
+    not
+    neg
+    ; count down
+    mov   t d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d t
+    ldl   d 0
+    eq
+    bif   loop
+    drop  t
+    halt
+
+; --------------- end of file ----------------------
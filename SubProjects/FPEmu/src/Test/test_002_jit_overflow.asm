@@ -0,0 +1,31 @@
+; vi: ft=smasm
+;
+; The data stack grows by one on every pass of the outer loop, until the
+; hot inner loop overflows it.
+;
+.org $F000
+outer:
+    ldl   d 0
+    ld    r 30
+inner:
+    ldl   d 1
+    ldl   d 2
+    ldl   d 3
+    add
+    add
+    drop  d
+    mov   r d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d r
+    ldl   d 0
+    eq
+    bif   inner
+    drop  r
+    ldl   d 0
+    bif   outer
+    halt
+
+; --------------- end of file ----------------------
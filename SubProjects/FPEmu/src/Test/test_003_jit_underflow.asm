@@ -0,0 +1,32 @@
+; vi: ft=smasm
+;
+; The data stack shrinks by one on every pass of the outer loop, until
+; the hot inner loop underflows it.
+;
+.org $F000
+    ldl   d 1
+    ldl   d 2
+    ldl   d 3
+    ldl   d 4
+    ldl   d 5
+outer:
+    ld    r 20
+inner:
+    swap  d
+    swap  d
+    mov   r d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d r
+    ldl   d 0
+    eq
+    bif   inner
+    drop  r
+    drop  d
+    ldl   d 0
+    bif   outer
+    halt
+
+; --------------- end of file ----------------------
@@ -0,0 +1,17 @@
+; vi: ft=smasm
+;
+; Recursion without end, the return stack overflows in a hot subroutine.
+;
+.org $F000
+    ldl   d 0
+    enter down
+    halt
+    nop
+
+down:
+    ldl   d 1
+    add
+    enter down
+    leave
+
+; --------------- end of file ----------------------
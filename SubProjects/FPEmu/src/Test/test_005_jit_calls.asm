@@ -0,0 +1,35 @@
+; vi: ft=smasm
+;
+; Hot subroutines that return, mixed with loops.
+;
+.org $F000
+    ldl   d 0
+    ld    t 500
+loop:
+    enter twice
+    enter plus3
+    mov   t d
+    ldl   d 1
+    neg
+    add
+    dup   d
+    mov   d t
+    ldl   d 0
+    eq
+    bif   loop
+    drop  t
+    halt
+
+twice:
+    dup   d
+    add
+    ld    d $3FF
+    and
+    leave
+
+plus3:
+    ldl   d 3
+    add
+    leave
+
+; --------------- end of file ----------------------
@@ -0,0 +1,18 @@
+; vi: ft=smasm
+;
+; Superinstructions in a loop that grows the temp stack by one on every
+; pass, until the LDL of an LD overflows it.
+;
+.org $F000
+    ldl   d 0
+loop:
+    ld    t $1234
+    ldl   d 2
+    add
+    dup   d
+    ldl   d 40
+    eq
+    bif   loop
+    halt
+
+; --------------- end of file ----------------------
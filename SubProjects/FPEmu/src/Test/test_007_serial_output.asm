@@ -0,0 +1,33 @@
+; vi: ft=smasm
+;
+; Serial output with a line that does not end in a newline, it must
+; still appear when the processor halts.
+;
+.def serial_out $0000
+
+text:
+.str "line 1"
+.b   $0a
+.str "line 2"
+.b   $0a
+.str "no newline"
+text_end:
+
+.org $F000
+    ldl   d text
+loop:
+    dup   d
+    rd    b
+    ldl   d serial_out
+    swap  d
+    isto  b
+    ldl   d 1
+    add
+    dup   d
+    ldl   d text_end
+    eq
+    bif   loop
+    drop  d
+    halt
+
+; --------------- end of file ----------------------
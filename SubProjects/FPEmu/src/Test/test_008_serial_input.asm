@@ -0,0 +1,31 @@
+; vi: ft=smasm
+;
+; Echo serial input, see test_008_serial_input.in, until a '.'.  Waits
+; for the output and input status ports like a real program would.
+;
+.def serial_out        $0000
+.def serial_out_status $0001
+.def serial_in         $0002
+.def serial_in_status  $0003
+
+.org $F000
+loop:
+    ldl   d serial_in_status
+    ird   b
+    bif   loop
+    ldl   d serial_in
+    ird   b
+wait_out:
+    ldl   d serial_out_status
+    ird   b
+    bif   wait_out
+    dup   d
+    ldl   d serial_out
+    swap  d
+    isto  b
+    ldl   d '.'
+    eq
+    bif   loop
+    halt
+
+; --------------- end of file ----------------------
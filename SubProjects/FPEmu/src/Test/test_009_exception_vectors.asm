@@ -0,0 +1,62 @@
+; vi: ft=smasm
+;
+; Each exception enters its handler through the vectors in page 0.  The
+; handlers print a letter, and return, or go on with the next part.
+; fa numbers the C and R stacks the other way around than fpemu, drop c
+; drops a return address.
+;
+.def serial_out $0000
+
+.org $0002
+.b $00 $F1
+.b $40 $F1
+.b $80 $F1
+
+.org $F000
+    ; Overflow the data stack, the handler returns to the bif with a 1
+    ; on top, which ends the loop
+fill:
+    ldl   d 1
+    ldl   d 0
+    bif   fill
+    ; Then empty it until it underflows
+drain:
+    drop  d
+    ldl   d 0
+    bif   drain
+    halt
+
+.align l
+illegal:
+    drop  c
+    .b $00 $00
+    ldl   d serial_out
+    ldl   d $0a
+    isto  b
+    halt
+
+.org $F100
+overflow:
+    drop  d
+    drop  d
+    ldl   d serial_out
+    ldl   d 'O'
+    isto  b
+    leave
+
+.org $F140
+underflow:
+    ldl   d serial_out
+    ldl   d 'U'
+    isto  b
+    drop  c
+    enter illegal
+
+.org $F180
+illegal_instruction:
+    ldl   d serial_out
+    ldl   d 'I'
+    isto  b
+    leave
+
+; --------------- end of file ----------------------
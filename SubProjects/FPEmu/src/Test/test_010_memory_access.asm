@@ -0,0 +1,106 @@
+; vi: ft=smasm
+;
+; RD and STO of bytes, words and longs, at odd addresses and across the
+; end of memory.  Then code that changes itself, every core must run the
+; new instructions.
+;
+.def serial_out $0000
+
+.org $F000
+    ; A word at an odd address, and a long right after it
+    ld    d $1001
+    ld    d $4241
+    sto   w
+    ld    d $1003
+    ld    d $4443
+    ld    d $4645
+    sto   l
+    ; A word at the last address wraps around to 0000
+    ld    d $FFFF
+    ld    d $4847
+    sto   w
+    ; ABCDEFGH
+    ld    d $1001
+    enter print
+    ld    d $1002
+    enter print
+    ld    d $1003
+    enter print
+    ld    d $1004
+    enter print
+    ld    d $1005
+    enter print
+    ld    d $1006
+    enter print
+    ld    d $FFFF
+    enter print
+    ldl   d $0000
+    enter print
+    ; W
+    ld    d $1002
+    rd    w
+    ld    d $4342
+    eq
+    bif   fail
+    ldl   d 'W'
+    enter put
+    ; L
+    ld    d $1001
+    rd    l
+    ld    d $4443
+    eq
+    bif   fail
+    ld    d $4241
+    eq
+    bif   fail
+    ldl   d 'L'
+    enter put
+    ; XY, the second pass runs the patched instruction, of a block that
+    ; is translated already
+    ldl   d 2
+    ldl   d 0
+    bif   patch
+patch:
+    ldl   d 'X'
+    enter put
+    ld    d patch
+    ld    d $C059
+    sto   w
+    ld    d $FFFF
+    add
+    dup   d
+    ldl   d 0
+    eq
+    bif   patch
+    drop  d
+    ; Z, patched just before it runs
+    ld    d ahead
+    ld    d $C05A
+    sto   w
+ahead:
+    ldl   d '?'
+    enter put
+    ldl   d $0a
+    enter put
+    halt
+fail:
+    ldl   d '!'
+    enter put
+    halt
+
+; ( address -- ) print the byte at the address
+.align l
+print:
+    rd    b
+    enter put
+    leave
+
+; ( n -- ) print the lower 8 bits
+.align l
+put:
+    ldl   d serial_out
+    swap  d
+    isto  b
+    leave
+
+; --------------- end of file ----------------------
@@ -0,0 +1,181 @@
+; vi: ft=smasm
+;
+; The video device: two tiles, a palette, a map and a sprite, two frames
+; with the sprite moved in between.  Then the graphics RAM is read back,
+; and written and read as words and longs.
+; Run with -V 'frame%lu.ppm' to look at the frames.
+;
+.def serial_out $0000
+.def tile_1     $0120
+.def tile_2     $0140
+.def tile_3     $0160
+.def map        $2100
+.def sprite_0   $2400
+.def palette    $2500
+.def frame      $2530
+.def unmapped   $3000
+.def word       $2140
+
+.org $F000
+    ; Tile 1 all color 1
+    ld    d tile_1
+fill_1:
+    dup   d
+    ldl   d $11
+    isto  b
+    ldl   d 1
+    add
+    dup   d
+    ld    d tile_2
+    eq
+    bif   fill_1
+    ; Tile 2 color 2, the left half transparent
+fill_2:
+    ldl   d 2
+    add
+    dup   d
+    ldl   d $22
+    isto  b
+    ldl   d 1
+    add
+    dup   d
+    ldl   d $22
+    isto  b
+    ldl   d 1
+    add
+    dup   d
+    ld    d tile_3
+    eq
+    bif   fill_2
+    drop  d
+    ; Color 1 red, color 2 green
+    ld    d palette
+    ldl   d 3
+    add
+    ld    d $FF
+    isto  b
+    ld    d palette
+    ldl   d 7
+    add
+    ld    d $FF
+    isto  b
+    ; Tile 1 at the top left, and one down and right of it
+    ld    d map
+    ldl   d 1
+    isto  b
+    ld    d map
+    ldl   d 33
+    add
+    ldl   d 1
+    isto  b
+    ; Sprite 0 at 4, 4
+    ld    d sprite_0
+    ldl   d 4
+    isto  b
+    ld    d sprite_0
+    ldl   d 1
+    add
+    ldl   d 4
+    isto  b
+    ld    d sprite_0
+    ldl   d 2
+    add
+    ldl   d 2
+    isto  b
+    ld    d sprite_0
+    ldl   d 3
+    add
+    ldl   d 1
+    isto  b
+    ld    d frame
+    ldl   d 0
+    isto  b
+    ; Moved right, only its lines are drawn again
+    ld    d sprite_0
+    ldl   d 1
+    add
+    ldl   d 12
+    isto  b
+    ld    d frame
+    ldl   d 0
+    isto  b
+    ; F, two frames
+    ld    d frame
+    ird   b
+    ldl   d 2
+    eq
+    bif   fail
+    ldl   d 'F'
+    enter put
+    ; M, the map reads back
+    ld    d map
+    ldl   d 33
+    add
+    ird   b
+    ldl   d 1
+    eq
+    bif   fail
+    ldl   d 'M'
+    enter put
+    ; U, nothing mapped past the graphics RAM
+    ld    d unmapped
+    ird   b
+    ldl   d 0
+    eq
+    bif   fail
+    ldl   d 'U'
+    enter put
+    ; W, words and longs go to two and four ports, the low byte first
+    ld    d word
+    ld    d $1234
+    isto  w
+    ld    d word
+    ird   b
+    ld    d $34
+    eq
+    bif   fail
+    ld    d word
+    ldl   d 1
+    add
+    ird   b
+    ld    d $12
+    eq
+    bif   fail
+    ld    d word
+    ld    d $5678
+    ld    d $9ABC
+    isto  l
+    ld    d word
+    ldl   d 2
+    add
+    ird   w
+    ld    d $9ABC
+    eq
+    bif   fail
+    ld    d word
+    ird   l
+    ld    d $9ABC
+    eq
+    bif   fail
+    ld    d $5678
+    eq
+    bif   fail
+    ldl   d 'W'
+    enter put
+    ldl   d $0a
+    enter put
+    halt
+fail:
+    ldl   d '!'
+    enter put
+    halt
+
+; ( n -- ) print the lower 8 bits
+.align l
+put:
+    ldl   d serial_out
+    swap  d
+    isto  b
+    leave
+
+; --------------- end of file ----------------------
@@ -0,0 +1,84 @@
+; vi: ft=smasm
+;
+; Timers: the polls until a timer expires, and the expirations of one
+; timer while another, with a period past the end of the scheduler's
+; wheel, runs once.  Every core must see the events at the same cycle.
+;
+.def serial_out     $0000
+.def timer_0        $0010
+.def timer_0_high   $0011
+.def timer_0_scale  $0012
+.def timer_0_ctrl   $0013
+.def timer_1        $0014
+.def timer_1_high   $0015
+.def timer_1_scale  $0016
+.def timer_1_ctrl   $0017
+
+.org $F000
+    ; Every 100 cycles, 5 per poll
+    ldl   d timer_0
+    ldl   d 100
+    isto  b
+    ldl   d timer_0_ctrl
+    ldl   d 1
+    isto  b
+    ldl   d 0
+wait_0:
+    ldl   d 1
+    add
+    ldl   d timer_0_ctrl
+    ird   b
+    bif   wait_0
+    ldl   d 'A'
+    add
+    enter put
+    ldl   d timer_0_ctrl
+    ldl   d 0
+    isto  b
+    ; Timer 0 every 4096 cycles, timer 1 after 65536
+    ldl   d timer_0
+    ldl   d 1
+    isto  b
+    ldl   d timer_0_scale
+    ldl   d 12
+    isto  b
+    ldl   d timer_1_high
+    ldl   d $80
+    isto  b
+    ldl   d timer_1_scale
+    ldl   d 1
+    isto  b
+    ldl   d timer_1_ctrl
+    ldl   d 1
+    isto  b
+    ldl   d timer_0_ctrl
+    ldl   d 1
+    isto  b
+wait_1:
+    ldl   d timer_1_ctrl
+    ird   b
+    bif   wait_1
+    ldl   d timer_0_ctrl
+    ird   b
+    ldl   d 'A'
+    add
+    enter put
+    ldl   d timer_0_ctrl
+    ldl   d 0
+    isto  b
+    ldl   d timer_1_ctrl
+    ldl   d 0
+    isto  b
+    ldl   d $0a
+    enter put
+    halt
+
+; ( n -- ) print the lower 8 bits
+.align l
+put:
+    ldl   d serial_out
+    swap  d
+    isto  b
+    leave
+
+; --------------- end of file ----------------------
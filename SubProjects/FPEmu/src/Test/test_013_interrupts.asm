@@ -0,0 +1,93 @@
+; vi: ft=smasm
+;
+; Interrupts: timer 0 through a vector set up by the assembler, then
+; vsync through one the program stores.  The timer handler counts and
+; turns interrupts back on, the main loop only polls the count.  Every
+; core must take the interrupts at the same cycle.
+;
+.def serial_out     $0000
+.def timer_0        $0010
+.def timer_0_ctrl   $0013
+.def irq_enable     $0021
+.def irq_control    $0022
+.def vsync_vector   $0008
+.def ticks          $1000
+.def vsynced        $1001
+
+.org $000A
+.b $00 $F1
+
+.org $F000
+    ; Timer 0 every 100 cycles, on line 1
+    ldl   d irq_enable
+    ldl   d 2
+    isto  b
+    ldl   d irq_control
+    ldl   d 1
+    isto  b
+    ldl   d timer_0
+    ldl   d 100
+    isto  b
+    ldl   d timer_0_ctrl
+    ldl   d 1
+    isto  b
+wait_ticks:
+    ld    d ticks
+    rd    b
+    ldl   d 5
+    eq
+    bif   wait_ticks
+    ldl   d timer_0_ctrl
+    ldl   d 0
+    isto  b
+    ; Then vsync, on line 0
+    ldl   d vsync_vector
+    ld    d vsync
+    sto   w
+    ldl   d irq_enable
+    ldl   d 1
+    isto  b
+    ldl   d irq_control
+    ldl   d 1
+    isto  b
+wait_vsync:
+    ld    d vsynced
+    rd    b
+    bif   wait_vsync
+    ldl   d $0a
+    enter put
+    halt
+
+; ( n -- ) print the lower 8 bits
+.align l
+put:
+    ldl   d serial_out
+    swap  d
+    isto  b
+    leave
+
+.org $F100
+tick:
+    ldl   d 'T'
+    enter put
+    ld    d ticks
+    dup   d
+    rd    b
+    ldl   d 1
+    add
+    sto   b
+    ldl   d irq_control
+    ldl   d 1
+    isto  b
+    leave
+
+.align l
+vsync:
+    ld    d vsynced
+    ldl   d 1
+    sto   b
+    ldl   d 'V'
+    enter put
+    leave
+
+; --------------- end of file ----------------------
@@ -0,0 +1,64 @@
+; vi: ft=smasm
+;
+; Idle loop: echo serial input, then keep polling for more after it ran
+; out.  The emulator skips the passes of the poll loop up to each vsync,
+; the vsync handler prints a 'V' and halts at the third.  Every core must
+; end at the same cycle.
+;
+.def serial_out        $0000
+.def serial_in         $0002
+.def serial_in_status  $0003
+.def irq_enable        $0021
+.def irq_control       $0022
+.def vsyncs            $1000
+
+.org $0008
+.b $00 $F1
+
+.org $F000
+    ldl   d irq_enable
+    ldl   d 1
+    isto  b
+    ldl   d irq_control
+    ldl   d 1
+    isto  b
+poll:
+    ldl   d serial_in_status
+    ird   b
+    bif   poll
+    ldl   d serial_in
+    ird   b
+    enter put
+    ldl   d 0
+    bif   poll
+
+; ( n -- ) print the lower 8 bits
+.align l
+put:
+    ldl   d serial_out
+    swap  d
+    isto  b
+    leave
+
+.org $F100
+vsync:
+    ldl   d 'V'
+    enter put
+    ld    d vsyncs
+    dup   d
+    rd    b
+    ldl   d 1
+    add
+    dup   d
+    ldl   d 3
+    eq
+    bif   more
+    halt
+more:
+    sto   b
+    ldl   d irq_control
+    ldl   d 1
+    isto  b
+    leave
+
+; --------------- end of file ----------------------
@@ -0,0 +1,23 @@
+; vi: ft=smasm
+;
+; A return to an odd address, which shares its block cache slot with the
+; block that returns there.  The subroutine is entered again afterwards,
+; that block takes the slot back.
+;
+; As code the bytes at sub are NOP and LEAVE, read from sub + 1 they are
+; LEAVE as well.
+;
+.org $F000
+    ld    c back
+    ld    c $F011          ; sub + 1
+    ldl   d 0
+    bif   sub
+back:
+    enter sub
+    halt
+
+.align l
+sub:
+    .b    $00 $80 $81 $81
+
+; --------------- end of file ----------------------
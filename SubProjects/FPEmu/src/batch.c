@@ -0,0 +1,476 @@
+/**
+ * Stack-master 16 emulator -- batch runner
+ *
+ * Runs a list of images on a pool of worker threads, instead of one
+ * fpemu process per image.  Each worker has its own emulator, which is
+ * cleared between images.  Serial output is kept in memory and compared
+ * with the expected output.
+ *
+ * The list has one image per line, '#' starts a comment:
+ *
+ *   <image.hex> [<instruction limit> [<expected output> [<serial input>
+ *       [<stop>]]]]
+ *
+ * An image is a hex file, or a snapshot if its name ends in .snap.  A
+ * '-' leaves a field out.  The stop is halt, the default, or the name of
+ * an exception, as in StackOverflow.  An image passes when it stops that
+ * way within the limit, and its serial output is the expected output.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "snapshot.h"
+#include "batch.h"
+
+/**
+ * One line of the list, and what happened when it ran.
+ */
+struct Job {
+    char* image;
+    uint64_t limit;          /* UINT64_MAX: none */
+    char* expected;          /* NULL: output is not checked */
+    char* input;             /* NULL: no serial input */
+    enum ExceptionCode stop;     /* AllIsOK: HALT */
+    const struct FpemuSnapshot* snapshot;  /* The image, if a snapshot */
+    /* Result */
+    bool passed;
+    const char* verdict;
+    uint64_t instructions;
+    double seconds;
+};
+
+struct Batch {
+    struct Job* jobs;
+    size_t count;
+    size_t next;             /* First job no worker has taken yet */
+    pthread_mutex_t lock;
+    enum CoreType core;
+    int32_t start_address;   /* -1: the reset address */
+    /* Snapshots are mapped once, and shared by all jobs that use them */
+    struct FpemuSnapshot** snapshots;
+    char** snapshot_names;
+    size_t snapshot_count;
+};
+
+/* How an image may stop, by exception code */
+static const char* stop_names[] = {
+    "halt",
+    "StackOverflow",
+    "StackUnderflow",
+    "IllegalInstruction",
+    "IllegalStackID"
+};
+#define STOPS (sizeof(stop_names) / sizeof(stop_names[0]))
+
+/* --------------------------------------------------------------------*/
+
+static char* read_file(const char* filename, size_t* size);
+static char* optional_field(char* field);
+static bool parse_stop(const char* field, enum ExceptionCode* stop);
+static bool is_snapshot(const char* filename);
+static const struct FpemuSnapshot* map_snapshot(
+        struct Batch* batch, const char* filename);
+static bool parse_list(const char* list_file_name, struct Batch* batch);
+static void run_job(struct Batch* batch, struct Fpemu* emu, struct Job* job);
+static void* worker(void* arg);
+static double elapsed(const struct timespec* start);
+static void free_jobs(struct Batch* batch);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * The whole file in a malloc()ed buffer, NULL if it cannot be read.
+ */
+static char* read_file(const char* filename, size_t* size)
+{
+    FILE* inpf = fopen(filename, "r");
+    char* text = NULL;
+    size_t n;
+
+    *size = 0;
+    if (inpf == NULL) {
+        return NULL;
+    }
+    do {
+        char* bigger = realloc(text, *size + BUFSIZ);
+        if (bigger == NULL) {
+            free(text);
+            fclose(inpf);
+            return NULL;
+        }
+        text = bigger;
+        n = fread(text + *size, 1, BUFSIZ, inpf);
+        *size += n;
+    } while (n == BUFSIZ);
+    fclose(inpf);
+
+    return text;
+}
+
+static char* optional_field(char* field)
+{
+    if ((field == NULL) || (strcmp(field, "-") == 0)) {
+        return NULL;
+    }
+    return strdup(field);
+}
+
+/**
+ * A stop name, or '-' or none for halt.  Returns false if unknown.
+ */
+static bool parse_stop(const char* field, enum ExceptionCode* stop)
+{
+    *stop = AllIsOK;
+    if ((field == NULL) || (strcmp(field, "-") == 0)) {
+        return true;
+    }
+    for (unsigned i = 0; i < STOPS; ++i) {
+        if (strcmp(field, stop_names[i]) == 0) {
+            *stop = (enum ExceptionCode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Images with a name that ends in .snap are snapshots, see snapshot.h.
+ */
+static bool is_snapshot(const char* filename)
+{
+    size_t length = strlen(filename);
+
+    return (length >= 5) && (strcmp(filename + length - 5, ".snap") == 0);
+}
+
+/**
+ * The snapshot in a file, mapped the first time it is asked for.  NULL if
+ * it cannot be mapped.
+ */
+static const struct FpemuSnapshot* map_snapshot(
+        struct Batch* batch, const char* filename)
+{
+    struct FpemuSnapshot* snapshot;
+    struct FpemuSnapshot** snapshots;
+    char** names;
+    size_t n = batch->snapshot_count;
+
+    for (size_t i = 0; i < n; ++i) {
+        if (strcmp(batch->snapshot_names[i], filename) == 0) {
+            return batch->snapshots[i];
+        }
+    }
+    snapshot = fpemu_snapshot_map(filename);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshots = realloc(batch->snapshots, (n + 1) * sizeof(*snapshots));
+    if (snapshots != NULL) {
+        batch->snapshots = snapshots;
+    }
+    names = realloc(batch->snapshot_names, (n + 1) * sizeof(*names));
+    if (names != NULL) {
+        batch->snapshot_names = names;
+    }
+    if ((snapshots == NULL) || (names == NULL)) {
+        fpemu_snapshot_free(snapshot);
+        return NULL;
+    }
+    snapshots[n] = snapshot;
+    names[n] = strdup(filename);
+    ++(batch->snapshot_count);
+
+    return snapshot;
+}
+
+static bool parse_list(const char* list_file_name, struct Batch* batch)
+{
+    static const char* separators = " \t\r\n";
+    char line[BATCH_MAX_LINE];
+    unsigned line_number = 0;
+    size_t allocated = 0;
+    FILE* inpf = fopen(list_file_name, "r");
+
+    if (inpf == NULL) {
+        perror(list_file_name);
+        return false;
+    }
+    while (fgets(line, sizeof(line), inpf) != NULL) {
+        char* save = NULL;
+        char* comment = strchr(line, '#');
+        char* image;
+        char* limit;
+        char* stop;
+        struct Job* job;
+
+        ++line_number;
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        image = strtok_r(line, separators, &save);
+        if (image == NULL) {
+            continue;
+        }
+        if (batch->count == allocated) {
+            size_t size = (allocated == 0) ? 64 : 2 * allocated;
+            struct Job* bigger =
+                realloc(batch->jobs, size * sizeof(struct Job));
+            if (bigger == NULL) {
+                fprintf(stderr, "out of memory\n");
+                fclose(inpf);
+                return false;
+            }
+            batch->jobs = bigger;
+            allocated = size;
+        }
+        job = &(batch->jobs[batch->count]);
+        memset(job, 0, sizeof(struct Job));
+        ++(batch->count);
+
+        job->image = strdup(image);
+        if (is_snapshot(image)) {
+            job->snapshot = map_snapshot(batch, image);
+        }
+        job->limit = UINT64_MAX;
+        limit = strtok_r(NULL, separators, &save);
+        if ((limit != NULL) && (strcmp(limit, "-") != 0)) {
+            char* end;
+            job->limit = strtoull(limit, &end, 0);
+            if ((*end != '\0') || (job->limit == 0)) {
+                fprintf(stderr, "%s:%u: bad instruction limit '%s'\n",
+                        list_file_name, line_number, limit);
+                fclose(inpf);
+                return false;
+            }
+        }
+        job->expected = optional_field(strtok_r(NULL, separators, &save));
+        job->input = optional_field(strtok_r(NULL, separators, &save));
+        stop = strtok_r(NULL, separators, &save);
+        if (!parse_stop(stop, &(job->stop))) {
+            fprintf(stderr, "%s:%u: unknown stop '%s'\n",
+                    list_file_name, line_number, stop);
+            fclose(inpf);
+            return false;
+        }
+    }
+    fclose(inpf);
+
+    return true;
+}
+
+static double elapsed(const struct timespec* start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) +
+           (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Load, run and check one image.
+ */
+static void run_job(struct Batch* batch, struct Fpemu* emu, struct Job* job)
+{
+    struct timespec start;
+    int fd_in = -1;
+    char* text;
+    size_t size;
+    bool loaded;
+    enum FpemuResult result;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    job->passed = false;
+    if (job->input != NULL) {
+        fd_in = open(job->input, O_RDONLY);
+        if (fd_in < 0) {
+            job->verdict = "no serial input";
+            return;
+        }
+    }
+    fpemu_clear(emu, fd_in);
+
+    if (is_snapshot(job->image)) {
+        text = NULL;
+        loaded = (job->snapshot != NULL);
+        if (loaded) {
+            fpemu_restore(emu, job->snapshot);
+        }
+    } else {
+        text = read_file(job->image, &size);
+        loaded = (text != NULL) && fpemu_load_hex(emu, text, size);
+    }
+    if (!loaded) {
+        job->verdict = "could not load";
+    } else {
+        if (batch->start_address >= 0) {
+            fpemu_set_pc(emu, (uint16_t)batch->start_address);
+        }
+        result = fpemu_run(emu, job->limit);
+        job->instructions = fpemu_instruction_count(emu);
+        if (result == FpemuLimit) {
+            job->verdict = "limit reached";
+        } else {
+            enum ExceptionCode stop = (result == FpemuHalted) ?
+                                      AllIsOK : fpemu_exception(emu);
+            job->passed = (stop == job->stop);
+            job->verdict = (result == FpemuHalted) ? "halted" :
+                           exception_descriptions[stop];
+        }
+    }
+    free(text);
+
+    if (job->passed && (job->expected != NULL)) {
+        size_t expected_size;
+        char* expected = read_file(job->expected, &expected_size);
+        size_t output_size;
+        const uint8_t* output = fpemu_output(emu, &output_size);
+
+        if (expected == NULL) {
+            job->passed = false;
+            job->verdict = "no expected output";
+        } else if ((expected_size != output_size) ||
+                   ((output_size != 0) &&
+                    (memcmp(expected, output, output_size) != 0))) {
+            job->passed = false;
+            job->verdict = "output differs";
+        }
+        free(expected);
+    }
+    if (fd_in >= 0) {
+        close(fd_in);
+    }
+    job->seconds = elapsed(&start);
+}
+
+static void* worker(void* arg)
+{
+    struct Batch* batch = arg;
+    struct Fpemu* emu = fpemu_create(batch->core, -1, -1);
+
+    for (;;) {
+        size_t i;
+
+        pthread_mutex_lock(&(batch->lock));
+        i = (batch->next)++;
+        pthread_mutex_unlock(&(batch->lock));
+        if (i >= batch->count) {
+            break;
+        }
+        if (emu == NULL) {
+            batch->jobs[i].verdict = "out of memory";
+        } else {
+            run_job(batch, emu, &(batch->jobs[i]));
+        }
+    }
+    fpemu_destroy(emu);
+
+    return NULL;
+}
+
+static void free_jobs(struct Batch* batch)
+{
+    for (size_t i = 0; i < batch->count; ++i) {
+        free(batch->jobs[i].image);
+        free(batch->jobs[i].expected);
+        free(batch->jobs[i].input);
+    }
+    free(batch->jobs);
+    for (size_t i = 0; i < batch->snapshot_count; ++i) {
+        fpemu_snapshot_free(batch->snapshots[i]);
+        free(batch->snapshot_names[i]);
+    }
+    free(batch->snapshots);
+    free(batch->snapshot_names);
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Run every image in the list on the given number of threads, and print
+ * a table with the results.
+ *
+ * Returns EXIT_SUCCESS if all images passed.
+ */
+int run_batch(
+        const char* list_file_name, enum CoreType core,
+        int32_t start_address, unsigned workers)
+{
+    struct Batch batch;
+    pthread_t* threads;
+    struct timespec start;
+    double seconds;
+    uint64_t instructions = 0;
+    unsigned started = 0;
+    unsigned passed = 0;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.core = core;
+    batch.start_address = start_address;
+    pthread_mutex_init(&(batch.lock), NULL);
+    if (!parse_list(list_file_name, &batch)) {
+        free_jobs(&batch);
+        return EXIT_FAILURE;
+    }
+    if (workers == 0) {
+        workers = 1;
+    }
+    if (workers > batch.count) {
+        workers = (batch.count > 0) ? (unsigned)batch.count : 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    threads = calloc(workers, sizeof(pthread_t));
+    for (unsigned i = 0; (threads != NULL) && (i < workers); ++i) {
+        if (pthread_create(&(threads[i]), NULL, worker, &batch) != 0) {
+            break;
+        }
+        ++started;
+    }
+    if (started == 0) {
+        /* No threads, do the work here */
+        (void)worker(&batch);
+    }
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    seconds = elapsed(&start);
+    free(threads);
+    pthread_mutex_destroy(&(batch.lock));
+
+    printf("%-44s %14s %10s  %s\n", "Image", "Instructions", "Time ms",
+           "Result");
+    for (size_t i = 0; i < batch.count; ++i) {
+        const struct Job* job = &(batch.jobs[i]);
+        printf("%-44s %14lu %10.3f  %s (%s)\n",
+               job->image, (unsigned long)job->instructions,
+               job->seconds * 1e3, job->passed ? "pass" : "FAIL",
+               job->verdict);
+        instructions += job->instructions;
+        if (job->passed) {
+            ++passed;
+        }
+    }
+    printf("%lu images, %u passed, %lu failed, "
+           "%lu instructions in %.3f s on %u threads (%.2f MIPS)\n",
+           (unsigned long)batch.count, passed,
+           (unsigned long)(batch.count - passed),
+           (unsigned long)instructions, seconds,
+           (started > 0) ? started : 1,
+           (seconds > 0.0) ? (instructions / seconds / 1e6) : 0.0);
+    free_jobs(&batch);
+
+    return (passed == batch.count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,17 @@
+#ifndef HG_BATCH_H
+#define HG_BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "snapshot.h"
+
+/* Longest line in a batch list */
+#define BATCH_MAX_LINE 1024
+
+extern int run_batch(
+        const char* list_file_name, enum CoreType core,
+        int32_t start_address, unsigned workers);
+
+#endif /* HG_BATCH_H */
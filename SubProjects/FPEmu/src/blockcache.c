@@ -0,0 +1,827 @@
+/**
+ * Stack-master 16 emulator -- predecoded basic-block cache
+ *
+ * Each straight-line run of instructions is decoded once into an array of
+ * handler + operand records.  Blocks are looked up by their start address
+ * and chained to their successors, so a hot loop runs without any fetch or
+ * decode work.  Stores into memory that holds translated code invalidate
+ * the affected blocks.
+ *
+ * With fusion enabled frequent sequences, such as the LDL+LDH pair of fa's
+ * LD, are translated to superinstructions.  These take a fast path when no
+ * stack can overflow or underflow, otherwise they run the original ops one
+ * by one so exceptions stop at the same instruction.
+ *
+ * Behaviour must be identical to run_switch() in cpu.c.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fpemu.h"
+#include "decode.h"
+#include "blockcache.h"
+#include "clocks.h"
+#include "breakpoints.h"
+#ifdef FPEMU_JIT
+#include "jit_x64.h"
+#endif
+
+#define STACK_AT(c, offset) ((struct Stack*)((char*)(c) + (offset)))
+
+/* --------------------------------------------------------------------*/
+
+static uint16_t stack_offset(uint16_t stack_id);
+static bool decode(uint16_t instruction, uint16_t pc, struct DecodedOp* op);
+static struct Block* translate(
+        struct BlockCache* cache, uint8_t* memory, uint16_t pc);
+static struct Block* lookup(
+        struct BlockCache* cache, uint8_t* memory, uint16_t pc);
+static void chain(struct Link* link, struct Block* to);
+static void unchain(struct Link* link);
+static void retire(struct BlockCache* cache, struct Block* block);
+static void free_retired(struct BlockCache* cache);
+static void fuse(
+        struct BlockCache* cache, struct DecodedOp* ops, uint16_t count);
+static void execute_block(
+        struct CPU_Context* c, uint8_t* memory, const struct Block* b);
+#ifdef FPEMU_JIT
+static bool hot_edge(const struct CPU_Context* c, const struct Block* b);
+static void flush_native(struct BlockCache* cache);
+#endif
+
+/* --------------------------------------------------------------------*/
+/* Handlers.  Control transfers find c->pc preset to the fall through
+ * address, all other handlers leave the pc alone. */
+
+static void op_enter(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)memory;
+    push(c, &(c->return_stack), c->pc);
+    c->pc = op->operand;
+}
+
+static void op_bif(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)memory;
+    if (!pop(c, &(c->data_stack))) {
+        c->pc = op->operand;
+    }
+}
+
+static void op_leave(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)memory;
+    (void)op;
+    c->pc = pop(c, &(c->return_stack));
+}
+
+static void op_nop(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)c;
+    (void)memory;
+    (void)op;
+}
+
+static void op_halt(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)memory;
+    (void)op;
+    c->keep_going = false;
+}
+
+static void op_illegal(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)memory;
+    (void)op;
+    c->exception = IllegalInstruction;
+    c->keep_going = false;
+}
+
+static void op_drop(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)memory;
+    (void)pop(c, STACK_AT(c, op->source));
+}
+
+static void op_dup(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = STACK_AT(c, op->source);
+    uint16_t value;
+
+    (void)memory;
+    value = pop(c, stack);
+    push(c, stack, value);
+    push(c, stack, value);
+}
+
+static void op_swap(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = STACK_AT(c, op->source);
+    uint16_t value;
+    uint16_t value2;
+
+    (void)memory;
+    value = pop(c, stack);
+    value2 = pop(c, stack);
+    push(c, stack, value);
+    push(c, stack, value2);
+}
+
+static void op_mov(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    uint16_t value;
+
+    (void)memory;
+    value = pop(c, STACK_AT(c, op->source));
+    push(c, STACK_AT(c, op->target), value);
+}
+
+static void op_ldl(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    (void)memory;
+    push(c, STACK_AT(c, op->target), op->operand);
+}
+
+static void op_ldh(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = STACK_AT(c, op->target);
+    uint16_t value;
+
+    (void)memory;
+    value = pop(c, stack);
+    push(c, stack, value | op->operand);
+}
+
+/* Two value operators on the data stack, n1 is the top of the stack */
+#define BINARY_OP(name, expression) \
+static void name( \
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op) \
+{ \
+    struct Stack* stack = &(c->data_stack); \
+    uint16_t n1, n2; \
+    (void)memory; \
+    (void)op; \
+    n1 = pop(c, stack); \
+    n2 = pop(c, stack); \
+    push(c, stack, (expression)); \
+}
+
+BINARY_OP(op_add,  (uint16_t)(n1 + n2))
+BINARY_OP(op_mul,  (uint16_t)(n1 * n2))
+BINARY_OP(op_eq,   (n2 == n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_asr,  (uint16_t)((int16_t)n2 >> (int16_t)n1))
+BINARY_OP(op_lt,   ((int16_t)n2 <  (int16_t)n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_ltu,  (n2 <  n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_gt,   ((int16_t)n2 >  (int16_t)n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_gtu,  (n2 >  n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_lte,  ((int16_t)n2 <= (int16_t)n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_lteu, (n2 <= n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_gte,  ((int16_t)n2 >= (int16_t)n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_gteu, (n2 >= n1) ? 0xFFFF : 0x0000)
+BINARY_OP(op_shl,  (uint16_t)(n2 << n1))
+BINARY_OP(op_shr,  (uint16_t)(n2 >> n1))
+BINARY_OP(op_and,  n2 & n1)
+BINARY_OP(op_or,   n2 | n1)
+BINARY_OP(op_xor,  n2 ^ n1)
+
+static void op_neg(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = &(c->data_stack);
+    uint16_t n1;
+
+    (void)memory;
+    (void)op;
+    n1 = pop(c, stack);
+    push(c, stack, (uint16_t)(0 - n1));
+}
+
+static void op_not(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = &(c->data_stack);
+    uint16_t n1;
+
+    (void)memory;
+    (void)op;
+    n1 = pop(c, stack);
+    push(c, stack, (uint16_t)~n1);
+}
+
+/* Devices see the instruction count of the access, like on every core */
+static void op_store(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    uint64_t count = c->instruction_count;
+
+    c->instruction_count += (uint64_t)(op - c->block_cache->running) + 1;
+    exec_store(c, memory, op->instruction);
+    c->instruction_count = count;
+}
+
+static void op_read(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    uint64_t count = c->instruction_count;
+
+    c->instruction_count += (uint64_t)(op - c->block_cache->running) + 1;
+    exec_read(c, memory, op->instruction);
+    c->instruction_count = count;
+}
+
+/* --------------------------------------------------------------------*/
+/* Superinstructions.  op[1] .. op[length - 1] are the original ops of the
+ * rest of the sequence. */
+
+/**
+ * Run the ops of a superinstruction one at a time, first is the handler
+ * of the op it replaced.  Records how far it got if one of them stops.
+ */
+static void run_parts(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op,
+        op_handler_type* first)
+{
+    first(c, memory, op);
+    for (unsigned i = 1; i < op->length; ++i) {
+        if (!(c->keep_going)) {
+            c->block_cache->partial = (uint8_t)i;
+            return;
+        }
+        op[i].handler(c, memory, &(op[i]));
+    }
+}
+
+/* LDL x, LDH y on the same stack: push a 16 bit literal */
+static void op_ldl_ldh(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = STACK_AT(c, op->target);
+
+    (void)memory;
+    push(c, stack, op->operand);
+    if (!(c->keep_going)) {
+        /* LDL overflowed, LDH never ran */
+        c->block_cache->partial = 1;
+    } else {
+        stack->values[stack->top - 1] = op->operand | op[1].operand;
+    }
+}
+
+/* LDL d x, ADD: add a literal to the top of the data stack */
+static void op_ldl_add(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = &(c->data_stack);
+
+    if ((stack->top >= 1) && (stack->top + 1 < stack->size)) {
+        stack->values[stack->top - 1] += op->operand;
+    } else {
+        run_parts(c, memory, op, op_ldl);
+    }
+}
+
+/* DUP d, LDL d x, EQ, BIF: branch unless the top of the stack equals x */
+static void op_dup_ldl_eq_bif(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op)
+{
+    struct Stack* stack = &(c->data_stack);
+
+    if ((stack->top >= 1) && (stack->top + 2 < stack->size)) {
+        if (stack->values[stack->top - 1] != op[1].operand) {
+            c->pc = op[3].operand;
+        }
+    } else {
+        run_parts(c, memory, op, op_dup);
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+static uint16_t stack_offset(uint16_t stack_id)
+{
+    uint16_t offset;
+
+    switch (stack_id) {
+        case RETURN_STACK:
+            offset = offsetof(struct CPU_Context, return_stack);
+            break;
+        case CONTROL_STACK:
+            offset = offsetof(struct CPU_Context, control_stack);
+            break;
+        case TEMP_STACK:
+            offset = offsetof(struct CPU_Context, temp_stack);
+            break;
+        default:
+            offset = offsetof(struct CPU_Context, data_stack);
+            break;
+    }
+    return offset;
+}
+
+static op_handler_type* const handlers[OP_COUNT] = {
+    [OP_ILLEGAL] = op_illegal,
+    [OP_ENTER]   = op_enter,
+    [OP_BIF]     = op_bif,
+    [OP_LEAVE]   = op_leave,
+    [OP_NOP]     = op_nop,
+    [OP_HALT]    = op_halt,
+    [OP_DROP]    = op_drop,
+    [OP_DUP]     = op_dup,
+    [OP_SWAP]    = op_swap,
+    [OP_MOV]     = op_mov,
+    [OP_LDL]     = op_ldl,
+    [OP_LDH]     = op_ldh,
+    [OP_ADD]     = op_add,
+    [OP_MUL]     = op_mul,
+    [OP_EQ]      = op_eq,
+    [OP_ASR]     = op_asr,
+    [OP_LT]      = op_lt,
+    [OP_LTU]     = op_ltu,
+    [OP_GT]      = op_gt,
+    [OP_GTU]     = op_gtu,
+    [OP_LTE]     = op_lte,
+    [OP_LTEU]    = op_lteu,
+    [OP_GTE]     = op_gte,
+    [OP_GTEU]    = op_gteu,
+    [OP_SHL]     = op_shl,
+    [OP_SHR]     = op_shr,
+    [OP_STO]     = op_store,
+    [OP_AND]     = op_and,
+    [OP_OR]      = op_or,
+    [OP_XOR]     = op_xor,
+    [OP_NEG]     = op_neg,
+    [OP_NOT]     = op_not,
+    [OP_RD]      = op_read
+};
+
+/**
+ * Decode a single instruction into op.
+ *
+ * Returns true if the instruction ends a block.
+ */
+static bool decode(uint16_t instruction, uint16_t pc, struct DecodedOp* op)
+{
+    struct Decoded d;
+
+    decode_instruction(instruction, &d);
+    op->handler = handlers[d.op];
+    op->instruction = instruction;
+    op->operand = d.operand;
+    op->source = stack_offset(d.source);
+    op->target = stack_offset(d.target);
+    op->length = 1;
+    if (d.op == OP_BIF) {
+        op->operand = pc + d.operand;
+    }
+
+    return d.ends_block;
+}
+
+/**
+ * Replace the first op of each frequent sequence by a superinstruction.
+ * Sequences do not overlap, the first match from the left wins.  Use
+ * the -s option of fpemu to find out which sequences are worth it.
+ */
+static void fuse(
+        struct BlockCache* cache, struct DecodedOp* ops, uint16_t count)
+{
+    const uint16_t data = offsetof(struct CPU_Context, data_stack);
+    unsigned i = 0;
+
+    while (i < count) {
+        struct DecodedOp* op = &(ops[i]);
+        unsigned left = count - i;
+
+        if ((left >= 4) && (op->handler == op_dup) && (op->source == data) &&
+            (op[1].handler == op_ldl) && (op[1].target == data) &&
+            (op[2].handler == op_eq) && (op[3].handler == op_bif)) {
+            op->handler = op_dup_ldl_eq_bif;
+            op->length = 4;
+        } else if ((left >= 2) && (op->handler == op_ldl) &&
+                   (op[1].handler == op_ldh) && (op[1].target == op->target)) {
+            op->handler = op_ldl_ldh;
+            op->length = 2;
+        } else if ((left >= 2) && (op->handler == op_ldl) &&
+                   (op->target == data) && (op[1].handler == op_add)) {
+            op->handler = op_ldl_add;
+            op->length = 2;
+        }
+        if (op->length > 1) {
+            ++(cache->fused);
+        }
+        i += op->length;
+    }
+}
+
+/**
+ * Decode the block that starts at pc and add it to the cache.
+ */
+static struct Block* translate(
+        struct BlockCache* cache, uint8_t* memory, uint16_t pc)
+{
+    struct DecodedOp ops[BC_MAX_BLOCK_LENGTH];
+    struct Block* block;
+    uint16_t address = pc;
+    uint16_t count = 0;
+    uint32_t clocks = 0;
+    bool done = false;
+
+    while (!done) {
+        uint16_t instruction = fetch_instruction(memory, address);
+        done = decode(instruction, address, &(ops[count]));
+        clocks += instruction_clocks(instruction);
+        ++count;
+        address += 2;
+        if ((count == BC_MAX_BLOCK_LENGTH) || (address < 2)) {
+            /* Full, or about to wrap around the end of memory */
+            done = true;
+        }
+        if ((cache->breakpoints != NULL) &&
+            is_breakpoint(cache->breakpoints, address)) {
+            /* The next instruction starts a block, its entry is checked */
+            done = true;
+        }
+    }
+
+    if (cache->fuse) {
+        fuse(cache, ops, count);
+    }
+
+    block = malloc(sizeof(struct Block) + count * sizeof(struct DecodedOp));
+    if (block == NULL) {
+        fprintf(stderr, "Block cache: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    block->start = pc;
+    block->end = address;
+    block->count = count;
+    block->clocks = clocks;
+    block->link[0].to = NULL;
+    block->link[1].to = NULL;
+    block->incoming = NULL;
+    block->heat = 0;
+    block->native = NULL;
+    memcpy(block->ops, ops, count * sizeof(struct DecodedOp));
+
+    block->next = cache->live;
+    cache->live = block;
+    ++(cache->code_pages[pc / BC_PAGE_SIZE]);
+    ++(cache->code_pages[(uint16_t)(address - 1) / BC_PAGE_SIZE]);
+    cache->blocks[pc / 2] = block;
+    ++(cache->translated);
+
+    return block;
+}
+
+static struct Block* lookup(
+        struct BlockCache* cache, uint8_t* memory, uint16_t pc)
+{
+    struct Block* block = cache->blocks[pc / 2];
+
+    if ((block == NULL) || (block->start != pc)) {
+        if (block != NULL) {
+            /* An odd start address that shares a slot */
+            retire(cache, block);
+        }
+        block = translate(cache, memory, pc);
+    }
+    return block;
+}
+
+/**
+ * Point the link at a block, instead of where it pointed before.
+ */
+static void chain(struct Link* link, struct Block* to)
+{
+    unchain(link);
+    link->to = to;
+    link->next = to->incoming;
+    link->prev = &(to->incoming);
+    if (to->incoming != NULL) {
+        to->incoming->prev = &(link->next);
+    }
+    to->incoming = link;
+}
+
+static void unchain(struct Link* link)
+{
+    if (link->to != NULL) {
+        *(link->prev) = link->next;
+        if (link->next != NULL) {
+            link->next->prev = link->prev;
+        }
+        link->to = NULL;
+    }
+}
+
+/**
+ * Remove a block from the cache.  It is not freed until the block
+ * is no longer executing.
+ */
+static void retire(struct BlockCache* cache, struct Block* block)
+{
+    struct Block** b;
+
+    for (b = &(cache->live); *b != NULL; b = &((*b)->next)) {
+        if (*b == block) {
+            *b = block->next;
+            break;
+        }
+    }
+    if (cache->blocks[block->start / 2] == block) {
+        cache->blocks[block->start / 2] = NULL;
+    }
+    --(cache->code_pages[block->start / BC_PAGE_SIZE]);
+    --(cache->code_pages[(uint16_t)(block->end - 1) / BC_PAGE_SIZE]);
+
+    /* Nothing may be chained to it anymore, links elsewhere are kept */
+    unchain(&(block->link[0]));
+    unchain(&(block->link[1]));
+    while (block->incoming != NULL) {
+        unchain(block->incoming);
+    }
+
+    block->next = cache->retired;
+    cache->retired = block;
+    ++(cache->invalidated);
+}
+
+static void free_retired(struct BlockCache* cache)
+{
+    while (cache->retired != NULL) {
+        struct Block* block = cache->retired;
+        cache->retired = block->next;
+        free(block);
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+struct BlockCache* block_cache_create(void)
+{
+    return calloc(1, sizeof(struct BlockCache));
+}
+
+void block_cache_destroy(struct BlockCache* cache)
+{
+    if (cache != NULL) {
+        while (cache->live != NULL) {
+            struct Block* block = cache->live;
+            cache->live = block->next;
+            free(block);
+        }
+        free_retired(cache);
+        free(cache);
+    }
+}
+
+/**
+ * Invalidate all blocks that contain code in the given address range.
+ * Must be called for every write to memory.
+ */
+void block_cache_invalidate(
+        struct BlockCache* cache, uint16_t address, uint16_t size)
+{
+    uint32_t first = address;
+    uint32_t last = (uint32_t)address + size - 1;
+    bool code = false;
+
+    for (uint32_t page = first / BC_PAGE_SIZE;
+         page <= last / BC_PAGE_SIZE; ++page) {
+        if (cache->code_pages[page % BC_NUMBER_OF_PAGES] != 0) {
+            code = true;
+            break;
+        }
+    }
+    if (!code) {
+        /* Fast path, no code in the pages written to */
+    } else {
+        struct Block* block = cache->live;
+        while (block != NULL) {
+            struct Block* next = block->next;
+            uint32_t start = block->start;
+            uint32_t end = (uint32_t)block->end - 1;
+            if ((start <= last) && (first <= end)) {
+                retire(cache, block);
+            }
+            block = next;
+        }
+    }
+}
+
+void block_cache_report(const struct BlockCache* cache, FILE* outpf)
+{
+    fprintf(outpf, "Block cache: %lu translated, %lu executed, "
+                   "%lu chained, %lu invalidated\n",
+            (unsigned long)cache->translated,
+            (unsigned long)cache->executed,
+            (unsigned long)cache->chained,
+            (unsigned long)cache->invalidated);
+    if (cache->fuse) {
+        fprintf(outpf, "Fusion: %lu superinstructions translated\n",
+                (unsigned long)cache->fused);
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+static void execute_block(
+        struct CPU_Context* c, uint8_t* memory, const struct Block* b)
+{
+    const struct DecodedOp* op = b->ops;
+    const struct DecodedOp* end = b->ops + b->count;
+    unsigned done;
+
+    c->pc = b->end;
+    c->block_cache->running = b->ops;
+    for (;;) {
+        op->handler(c, memory, op);
+        if (!(c->keep_going)) {
+            break;
+        }
+        op += op->length;
+        if (op == end) {
+            c->instruction = b->ops[b->count - 1].instruction;
+            c->instruction_count += b->count;
+            c->clocks += b->clocks;
+            return;
+        }
+    }
+
+    /* Stopped, a superinstruction may have stopped halfway */
+    done = (unsigned)(op - b->ops) + op->length;
+    if (c->block_cache->partial != 0) {
+        done = (unsigned)(op - b->ops) + c->block_cache->partial;
+        c->block_cache->partial = 0;
+    }
+    if (done != b->count) {
+        /* Stopped halfway, the pc points past the instruction */
+        c->pc = b->start + 2 * (uint16_t)done;
+    }
+    c->instruction = b->ops[done - 1].instruction;
+    c->instruction_count += done;
+    for (unsigned i = 0; i < done; ++i) {
+        c->clocks += instruction_clocks(b->ops[i].instruction);
+    }
+}
+
+#ifdef FPEMU_JIT
+/**
+ * True if the block was left by a call or by a branch backwards, this
+ * is where hot code is detected.
+ */
+static bool hot_edge(const struct CPU_Context* c, const struct Block* b)
+{
+    const struct DecodedOp* last = b->ops + (b->count - 1);
+
+    if (last->handler == op_enter) {
+        return true;
+    }
+    return (last->handler == op_bif) && (c->pc == last->operand) &&
+           (last->operand < b->end);
+}
+
+/**
+ * The JIT buffer is full: forget all native code, blocks that are still
+ * hot get compiled again.
+ */
+static void flush_native(struct BlockCache* cache)
+{
+    for (struct Block* b = cache->live; b != NULL; b = b->next) {
+        b->native = NULL;
+        b->heat = 0;
+    }
+    for (struct Block* b = cache->retired; b != NULL; b = b->next) {
+        b->native = NULL;
+    }
+    jit_flush(cache->jit);
+}
+#endif
+
+/**
+ * The block loop, with or without a breakpoint check at each block entry,
+ * see run_blocks().
+ */
+static inline __attribute__((always_inline)) void blocks_loop(
+        struct CPU_Context* c, uint8_t* memory,
+        const struct Breakpoints* breakpoints)
+{
+    struct BlockCache* cache = c->block_cache;
+    struct Block* b = NULL;
+#ifdef FPEMU_JIT
+    bool ran_native = false;
+#endif
+
+    while (c->keep_going && (c->instruction_count < c->instruction_limit)) {
+        struct Block* next;
+        uint64_t left;
+#ifdef FPEMU_JIT
+        /* Code that follows native code is hot as well, so a compiled
+         * region grows from its entry */
+        bool hot = (cache->jit != NULL) && (b != NULL) &&
+                   (ran_native || hot_edge(c, b));
+#endif
+
+        if ((breakpoints != NULL) &&
+            break_here(breakpoints, c->pc, c->instruction_count)) {
+            break_at(c, BreakPoint, c->pc);
+            break;
+        }
+        if (b == NULL) {
+            next = lookup(cache, memory, c->pc);
+        } else {
+            unsigned slot = (c->pc == b->end) ? 0 : 1;
+            next = b->link[slot].to;
+            if ((next != NULL) && (next->start == c->pc)) {
+                ++(cache->chained);
+            } else {
+                next = lookup(cache, memory, c->pc);
+                /* An odd pc in the slot of b retires b, a retired block
+                 * is not chained */
+                if (cache->blocks[b->start / 2] == b) {
+                    chain(&(b->link[slot]), next);
+                }
+            }
+        }
+        b = next;
+        left = c->instruction_limit - c->instruction_count;
+        if (left < b->count) {
+            /* The limit is inside this block */
+            while (c->keep_going && (c->instruction_count < c->instruction_limit)) {
+                if ((breakpoints != NULL) &&
+                    break_here(breakpoints, c->pc, c->instruction_count)) {
+                    break_at(c, BreakPoint, c->pc);
+                    break;
+                }
+                step(c, memory);
+            }
+            break;
+        }
+#ifdef FPEMU_JIT
+        if (cache->jit != NULL) {
+            /* Every pass through a native loop runs the whole block */
+            uint64_t budget = left / b->count;
+            if (hot && (b->native == NULL) && (++(b->heat) == JIT_THRESHOLD)) {
+                if (jit_full(cache->jit)) {
+                    flush_native(cache);
+                }
+                b->native = jit_compile(cache->jit, b);
+            }
+            if (budget > JIT_LOOP_BUDGET) {
+                budget = JIT_LOOP_BUDGET;
+            }
+            if ((breakpoints != NULL) && is_breakpoint(breakpoints, b->start)) {
+                /* Back to the block entry check after each pass */
+                budget = 1;
+            }
+            if ((b->native != NULL) && b->native(c, (uint32_t)budget)) {
+                /* Native code never writes memory, nothing got retired */
+                ++(cache->executed);
+                ran_native = true;
+                continue;
+            }
+        }
+        ran_native = false;
+#endif
+        execute_block(c, memory, b);
+        ++(cache->executed);
+
+        if (cache->retired != NULL) {
+            free_retired(cache);
+            b = NULL;
+        }
+    }
+}
+
+/**
+ * Run the processor using the block cache.  With a JIT attached, hot
+ * blocks run as native code whenever their entry checks allow it.
+ */
+void run_blocks(struct CPU_Context* c, uint8_t* memory)
+{
+    c->block_cache->breakpoints = c->breakpoints;
+    if (c->breakpoints != NULL) {
+        blocks_loop(c, memory, c->breakpoints);
+    } else {
+        blocks_loop(c, memory, NULL);
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
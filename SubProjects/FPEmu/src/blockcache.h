@@ -0,0 +1,109 @@
+#ifndef HG_BLOCKCACHE_H
+#define HG_BLOCKCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fpemu.h"
+
+/* Maximum number of instructions in a single block */
+#define BC_MAX_BLOCK_LENGTH 32
+/* Granularity used to track which memory contains translated code */
+#define BC_PAGE_SIZE 256
+#define BC_NUMBER_OF_PAGES (MEMORY_SIZE / BC_PAGE_SIZE)
+
+struct DecodedOp;
+
+typedef void op_handler_type(
+        struct CPU_Context* c, uint8_t* memory, const struct DecodedOp* op);
+
+/**
+ * Native code for a block, see jit_x64.c.  Returns 0, without touching the
+ * context, if the block has to be run by the interpreter instead.
+ */
+typedef int native_block_type(struct CPU_Context* c, uint32_t budget);
+
+/**
+ * A single predecoded instruction.
+ *
+ * All fields are extracted from the instruction word once, when the block
+ * is translated.  The stacks are stored as offsets into the CPU_Context so
+ * the handlers do not need get_stack().
+ *
+ * A superinstruction replaces the handler of the first op of a sequence,
+ * the ops it covers stay in place so it can fall back on them.
+ */
+struct DecodedOp {
+    op_handler_type* handler;
+    uint16_t instruction;  /* Original instruction word */
+    uint16_t operand;      /* Literal value or destination address */
+    uint16_t source;       /* Offset of the source stack */
+    uint16_t target;       /* Offset of the target stack */
+    uint8_t length;        /* Instructions covered, more than 1 if fused */
+};
+
+struct Block;
+
+/**
+ * A chained successor.  The links into a block are kept in a list, so
+ * they can be cut when the block is retired.
+ */
+struct Link {
+    struct Block* to;        /* NULL: not chained */
+    struct Link* next;       /* Next link into the same block */
+    struct Link** prev;      /* What points to this link */
+};
+
+/**
+ * A straight-line run of instructions that ends with a control transfer
+ * (ENTER, BIF, LEAVE, HALT), a memory store, an illegal instruction, or
+ * after BC_MAX_BLOCK_LENGTH instructions.
+ */
+struct Block {
+    uint16_t start;          /* Address of the first instruction */
+    uint16_t end;            /* Address following the last instruction */
+    uint16_t count;          /* Number of decoded instructions */
+    uint32_t clocks;         /* Clock cycles of all of them */
+    /* Chained successors: [0] fall through, [1] branch taken/call/return.
+     * Used as a one entry prediction, always checked against the pc. */
+    struct Link link[2];
+    struct Link* incoming;   /* Links of blocks chained to this one */
+    struct Block* next;      /* All live (or retired) blocks */
+    uint32_t heat;           /* Entries by ENTER or a backward BIF */
+    native_block_type* native;  /* Compiled code, NULL if none */
+    struct DecodedOp ops[];
+};
+
+struct Jit;
+
+struct BlockCache {
+    struct Block* blocks[MEMORY_SIZE / 2];  /* Indexed by pc / 2 */
+    uint16_t code_pages[BC_NUMBER_OF_PAGES];  /* Blocks per page */
+    struct Block* live;
+    struct Block* retired;   /* Invalidated, freed at a safe point */
+    struct Jit* jit;         /* Compiles hot blocks, NULL if disabled */
+    bool fuse;               /* Translate to superinstructions */
+    uint8_t partial;         /* Ops done by a superinstruction that stopped */
+    /* First op of the block that runs, the instruction count is only
+     * brought up to date at the end of a block */
+    const struct DecodedOp* running;
+    /* Of the run, NULL: none.  Blocks end before a breakpoint, so the
+     * check is only needed at block entry */
+    const struct Breakpoints* breakpoints;
+    /* Statistics */
+    uint64_t translated;
+    uint64_t executed;
+    uint64_t chained;
+    uint64_t invalidated;
+    uint64_t fused;          /* Superinstructions translated */
+};
+
+extern struct BlockCache* block_cache_create(void);
+extern void block_cache_destroy(struct BlockCache* cache);
+extern void block_cache_invalidate(
+        struct BlockCache* cache, uint16_t address, uint16_t size);
+extern void block_cache_report(const struct BlockCache* cache, FILE* outpf);
+extern void run_blocks(struct CPU_Context* c, uint8_t* memory);
+
+#endif /* HG_BLOCKCACHE_H */
@@ -0,0 +1,191 @@
+/**
+ * Stack-master 16 emulator -- breakpoints and watchpoints
+ *
+ * Breakpoints are a bit per instruction address.  Watchpoints are a short
+ * list of address ranges, with a table of the pages they overlap, so an
+ * access to an unwatched page costs one lookup.
+ *
+ * The selected core checks them, see fpemu_set_breakpoints().  Each core
+ * has a copy of its loop with the breakpoint check, and one without that
+ * runs while nothing is set.  Block cores end blocks before breakpoints,
+ * so they check only at block entry.  Watchpoints are checked in
+ * exec_read() and exec_store(), which every core uses for memory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fpemu.h"
+#include "symbols.h"
+#include "breakpoints.h"
+
+/* --------------------------------------------------------------------*/
+
+static bool overlaps(
+        const struct Watchpoint* watch, uint16_t address, uint16_t size);
+static void update_pages(struct Breakpoints* breakpoints);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Does the access of size bytes at address touch the watched range.
+ * Both can wrap around the end of memory.
+ */
+static bool overlaps(
+        const struct Watchpoint* watch, uint16_t address, uint16_t size)
+{
+    return ((uint16_t)(address - watch->address) < watch->size) ||
+           ((uint16_t)(watch->address - address) < size);
+}
+
+static void update_pages(struct Breakpoints* breakpoints)
+{
+    memset(breakpoints->pages, 0, sizeof(breakpoints->pages));
+    for (unsigned i = 0; i < breakpoints->watch_count; ++i) {
+        const struct Watchpoint* watch = &(breakpoints->watches[i]);
+        uint32_t last = (uint32_t)watch->address + watch->size - 1;
+
+        for (uint32_t page = watch->address / WATCH_PAGE_SIZE;
+             page <= last / WATCH_PAGE_SIZE; ++page) {
+            breakpoints->pages[page % WATCH_PAGES] |= watch->kinds;
+        }
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * The kind if a watchpoint of that kind covers part of the access, else
+ * 0.  watched() checks the page table first.
+ */
+uint8_t watchpoint_hit(
+        const struct Breakpoints* breakpoints, uint8_t kind,
+        uint16_t address, uint16_t size)
+{
+    for (unsigned i = 0; i < breakpoints->watch_count; ++i) {
+        const struct Watchpoint* watch = &(breakpoints->watches[i]);
+        if ((watch->kinds & kind) && overlaps(watch, address, size)) {
+            return kind;
+        }
+    }
+    return 0;
+}
+
+struct Breakpoints* breakpoints_create(void)
+{
+    return calloc(1, sizeof(struct Breakpoints));
+}
+
+void breakpoints_destroy(struct Breakpoints* breakpoints)
+{
+    free(breakpoints);
+}
+
+bool breakpoints_active(const struct Breakpoints* breakpoints)
+{
+    return (breakpoints != NULL) &&
+           ((breakpoints->breakpoint_count > 0) ||
+            (breakpoints->watch_count > 0));
+}
+
+void breakpoint_set(struct Breakpoints* breakpoints, uint16_t pc)
+{
+    uint16_t index = pc / 2;
+
+    if (!is_breakpoint(breakpoints, pc)) {
+        breakpoints->pcs[index / 64] |= (uint64_t)1 << (index % 64);
+        ++(breakpoints->breakpoint_count);
+    }
+}
+
+/**
+ * Returns false if there was no breakpoint at pc.
+ */
+bool breakpoint_clear(struct Breakpoints* breakpoints, uint16_t pc)
+{
+    uint16_t index = pc / 2;
+
+    if (!is_breakpoint(breakpoints, pc)) {
+        return false;
+    }
+    breakpoints->pcs[index / 64] &= ~((uint64_t)1 << (index % 64));
+    --(breakpoints->breakpoint_count);
+    return true;
+}
+
+/**
+ * Watch size bytes from address on for the kinds of access.  A
+ * watchpoint at the same address is replaced.  Returns false if there
+ * are too many.
+ */
+bool watchpoint_set(
+        struct Breakpoints* breakpoints, uint16_t address, uint16_t size,
+        uint8_t kinds)
+{
+    struct Watchpoint* watch = NULL;
+
+    for (unsigned i = 0; i < breakpoints->watch_count; ++i) {
+        if (breakpoints->watches[i].address == address) {
+            watch = &(breakpoints->watches[i]);
+        }
+    }
+    if (watch == NULL) {
+        if (breakpoints->watch_count == MAX_WATCHPOINTS) {
+            return false;
+        }
+        watch = &(breakpoints->watches[(breakpoints->watch_count)++]);
+    }
+    watch->address = address;
+    watch->size = (size == 0) ? 1 : size;
+    watch->kinds = kinds;
+    update_pages(breakpoints);
+
+    return true;
+}
+
+/**
+ * Returns false if no watchpoint starts at address.
+ */
+bool watchpoint_clear(struct Breakpoints* breakpoints, uint16_t address)
+{
+    for (unsigned i = 0; i < breakpoints->watch_count; ++i) {
+        if (breakpoints->watches[i].address == address) {
+            breakpoints->watches[i] =
+                breakpoints->watches[--(breakpoints->watch_count)];
+            update_pages(breakpoints);
+            return true;
+        }
+    }
+    return false;
+}
+
+void breakpoints_clear_all(struct Breakpoints* breakpoints)
+{
+    memset(breakpoints, 0, sizeof(struct Breakpoints));
+}
+
+void breakpoints_list(
+        const struct Breakpoints* breakpoints, const struct Symbols* symbols,
+        FILE* outpf)
+{
+    char name[SYMBOL_MAX_NAME + 16];
+
+    for (uint32_t pc = 0; pc < MEMORY_SIZE; pc += 2) {
+        if (is_breakpoint(breakpoints, (uint16_t)pc)) {
+            symbols_format(symbols, (uint16_t)pc, name, sizeof(name));
+            fprintf(outpf, "break %04x %s\n", pc, name);
+        }
+    }
+    for (unsigned i = 0; i < breakpoints->watch_count; ++i) {
+        const struct Watchpoint* watch = &(breakpoints->watches[i]);
+        symbols_format(symbols, watch->address, name, sizeof(name));
+        fprintf(outpf, "watch %04x %u %s%s %s\n", watch->address,
+                watch->size, (watch->kinds & WATCH_READ) ? "r" : "",
+                (watch->kinds & WATCH_WRITE) ? "w" : "", name);
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,128 @@
+#ifndef HG_BREAKPOINTS_H
+#define HG_BREAKPOINTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fpemu.h"
+#include "symbols.h"
+
+#define MAX_WATCHPOINTS 16
+/* Granularity of the watch table */
+#define WATCH_PAGE_SIZE 256
+#define WATCH_PAGES (MEMORY_SIZE / WATCH_PAGE_SIZE)
+
+/* Watchpoint kinds, a bit mask */
+#define WATCH_READ  0x01
+#define WATCH_WRITE 0x02
+
+enum BreakReason {
+    BreakNone = 0U,
+    BreakPoint,              /* pc reached a breakpoint */
+    BreakRead,               /* a watched byte was read */
+    BreakWrite               /* a watched byte was written */
+};
+
+struct Watchpoint {
+    uint16_t address;
+    uint16_t size;           /* Bytes watched from address on */
+    uint8_t kinds;
+};
+
+/**
+ * Breakpoints, one bit per instruction address, and watchpoints.  pages
+ * has the kinds of all watchpoints that overlap a page, so most memory
+ * accesses need a single lookup.
+ */
+struct Breakpoints {
+    uint64_t pcs[MEMORY_SIZE / 2 / 64];
+    uint8_t pages[WATCH_PAGES];
+    unsigned breakpoint_count;
+    unsigned watch_count;
+    struct Watchpoint watches[MAX_WATCHPOINTS];
+    /* Why the run stopped, and the pc or memory address */
+    enum BreakReason reason;
+    uint16_t address;
+    /* Instruction count the run started at, a breakpoint there does not
+     * stop it */
+    uint64_t start;
+};
+
+extern uint8_t watchpoint_hit(
+        const struct Breakpoints* breakpoints, uint8_t kind,
+        uint16_t address, uint16_t size);
+
+/* --------------------------------------------------------------------*/
+
+static inline bool is_breakpoint(
+        const struct Breakpoints* breakpoints, uint16_t pc)
+{
+    uint16_t index = pc / 2;
+
+    return (breakpoints->pcs[index / 64] >> (index % 64)) & 1;
+}
+
+/**
+ * True if the instruction at pc, the next one to run, must not run.
+ */
+static inline bool break_here(
+        const struct Breakpoints* breakpoints, uint16_t pc, uint64_t count)
+{
+    return is_breakpoint(breakpoints, pc) && (count != breakpoints->start);
+}
+
+/**
+ * Stop the core, like HALT does, and tell why.  A stop by a watchpoint
+ * comes after the access.
+ */
+static inline void break_at(
+        struct CPU_Context* c, enum BreakReason reason, uint16_t address)
+{
+    c->breakpoints->reason = reason;
+    c->breakpoints->address = address;
+    c->yield = true;
+    c->keep_going = false;
+}
+
+/**
+ * True once a run stopped at a breakpoint or watchpoint.
+ */
+static inline bool stopped_at_break(const struct CPU_Context* c)
+{
+    return (c->breakpoints != NULL) && (c->breakpoints->reason != BreakNone);
+}
+
+/**
+ * The kind if a watchpoint of that kind covers part of the access of
+ * size bytes at address, else 0.  Accesses to other pages return here.
+ */
+static inline uint8_t watched(
+        const struct Breakpoints* breakpoints, uint8_t kind,
+        uint16_t address, uint16_t size)
+{
+    uint16_t last = (uint16_t)(address + size - 1);
+
+    if (((breakpoints->pages[address / WATCH_PAGE_SIZE] |
+          breakpoints->pages[last / WATCH_PAGE_SIZE]) & kind) == 0) {
+        return 0;
+    }
+    return watchpoint_hit(breakpoints, kind, address, size);
+}
+
+extern struct Breakpoints* breakpoints_create(void);
+extern void breakpoints_destroy(struct Breakpoints* breakpoints);
+extern bool breakpoints_active(const struct Breakpoints* breakpoints);
+extern void breakpoint_set(struct Breakpoints* breakpoints, uint16_t pc);
+extern bool breakpoint_clear(struct Breakpoints* breakpoints, uint16_t pc);
+extern bool watchpoint_set(
+        struct Breakpoints* breakpoints, uint16_t address, uint16_t size,
+        uint8_t kinds);
+extern bool watchpoint_clear(
+        struct Breakpoints* breakpoints, uint16_t address);
+extern void breakpoints_clear_all(struct Breakpoints* breakpoints);
+extern void breakpoints_list(
+        const struct Breakpoints* breakpoints, const struct Symbols* symbols,
+        FILE* outpf);
+
+#endif /* HG_BREAKPOINTS_H */
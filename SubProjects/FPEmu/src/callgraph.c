@@ -0,0 +1,380 @@
+/**
+ * Stack-master 16 emulator -- call graph profile
+ *
+ * Follows ENTER and LEAVE with a call stack of its own, and counts the
+ * instructions executed per function, inclusive and exclusive of the
+ * functions it calls, and per caller/callee pair.  Instructions are also
+ * counted per call chain, written as folded stacks ("A;B;C count" per
+ * line) for flame graph tools.
+ *
+ * Programs can change the return stack with MOV, DROP and so on, so a
+ * LEAVE does not have to return to the last call.  A LEAVE returns from
+ * the most recent call that was made from the address before the one it
+ * jumps to, and from every call above that one.  A LEAVE that matches no
+ * call is a jump, it does not change the call stack.
+ *
+ * A function that is on the call stack more than once (recursion) gets
+ * its inclusive count when the outermost call returns, so nothing is
+ * counted twice.  Calls still open when the processor stops are closed
+ * there.
+ *
+ * Runs on the reference interpreter, one step() at a time.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fpemu.h"
+#include "symbols.h"
+#include "callgraph.h"
+
+/* Parent of the root node */
+#define CG_NO_PARENT CG_NODES
+
+struct Ranked {
+    uint32_t index;
+    uint64_t count;
+};
+
+/* --------------------------------------------------------------------*/
+
+static struct CallEdge* find_edge(
+        struct CallGraph* graph, uint32_t caller, uint32_t callee);
+static uint32_t find_node(
+        struct CallGraph* graph, uint32_t parent, uint32_t function);
+static void open_frame(
+        struct CallGraph* graph, uint32_t function, uint16_t return_address,
+        uint64_t count);
+static void return_to(struct CallGraph* graph, uint16_t pc, uint64_t count);
+static void close_frame(struct CallGraph* graph, uint64_t count);
+static void function_name(
+        const struct CallGraph* graph, const struct Symbols* symbols,
+        uint32_t function, char* text, size_t size);
+static int by_count(const void* a, const void* b);
+static double percentage(uint64_t count, uint64_t total);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * NULL if the table is full.
+ */
+static struct CallEdge* find_edge(
+        struct CallGraph* graph, uint32_t caller, uint32_t callee)
+{
+    uint32_t key = caller * CG_FUNCTIONS + callee;
+    uint32_t slot = ((key * 2654435761U) >> 16) & (CG_EDGES - 1);
+
+    for (unsigned i = 0; i < CG_EDGES; ++i) {
+        struct CallEdge* edge = &(graph->edges[slot]);
+        if (!(edge->used)) {
+            edge->used = true;
+            edge->caller = caller;
+            edge->callee = callee;
+            return edge;
+        }
+        if ((edge->caller == caller) && (edge->callee == callee)) {
+            return edge;
+        }
+        slot = (slot + 1) & (CG_EDGES - 1);
+    }
+    return NULL;
+}
+
+/**
+ * The node for function called in the chain parent.  If there is no room
+ * for another node the time is counted in the parent.
+ */
+static uint32_t find_node(
+        struct CallGraph* graph, uint32_t parent, uint32_t function)
+{
+    uint32_t key = parent * CG_FUNCTIONS + function;
+    uint32_t slot = ((key * 2654435761U) >> 15) & (2 * CG_NODES - 1);
+
+    for (;;) {
+        int32_t index = graph->node_slots[slot];
+        if (index < 0) {
+            break;
+        }
+        if ((graph->nodes[index].parent == parent) &&
+            (graph->nodes[index].function == function)) {
+            return (uint32_t)index;
+        }
+        slot = (slot + 1) & (2 * CG_NODES - 1);
+    }
+    if (graph->node_count == CG_NODES) {
+        graph->nodes_full = true;
+        return parent;
+    }
+    graph->node_slots[slot] = (int32_t)graph->node_count;
+    graph->nodes[graph->node_count].parent = parent;
+    graph->nodes[graph->node_count].function = function;
+    graph->nodes[graph->node_count].exclusive = 0;
+
+    return (graph->node_count)++;
+}
+
+static void open_frame(
+        struct CallGraph* graph, uint32_t function, uint16_t return_address,
+        uint64_t count)
+{
+    struct CallFrame* frame;
+    struct CallFrame* caller;
+
+    if (graph->depth == CG_MAX_DEPTH) {
+        ++(graph->lost);
+        return;
+    }
+    caller = (graph->depth > 0) ? &(graph->frames[graph->depth - 1]) : NULL;
+    frame = &(graph->frames[graph->depth]);
+    frame->function = function;
+    frame->return_address = return_address;
+    frame->start = count;
+    if (caller == NULL) {
+        frame->node = find_node(graph, CG_NO_PARENT, function);
+        frame->edge = NULL;
+    } else {
+        frame->node = find_node(graph, caller->node, function);
+        frame->edge = find_edge(graph, caller->function, function);
+    }
+    ++(graph->depth);
+
+    ++(graph->functions[function].calls);
+    ++(graph->functions[function].active);
+    if (frame->edge != NULL) {
+        ++(frame->edge->counts.calls);
+        ++(frame->edge->counts.active);
+    }
+}
+
+/**
+ * A LEAVE that jumped to pc
+ */
+static void return_to(struct CallGraph* graph, uint16_t pc, uint64_t count)
+{
+    for (unsigned i = graph->depth; i > 1; --i) {
+        if (graph->frames[i - 1].return_address == pc) {
+            while (graph->depth >= i) {
+                close_frame(graph, count);
+            }
+            return;
+        }
+    }
+}
+
+static void close_frame(struct CallGraph* graph, uint64_t count)
+{
+    struct CallFrame* frame = &(graph->frames[--(graph->depth)]);
+    struct CallCounts* function = &(graph->functions[frame->function]);
+    uint64_t spent = count - frame->start;
+
+    if (--(function->active) == 0) {
+        function->inclusive += spent;
+    }
+    if ((frame->edge != NULL) && (--(frame->edge->counts.active) == 0)) {
+        frame->edge->counts.inclusive += spent;
+    }
+}
+
+static void function_name(
+        const struct CallGraph* graph, const struct Symbols* symbols,
+        uint32_t function, char* text, size_t size)
+{
+    uint16_t address = (function == CG_ROOT) ?
+                       graph->root_address : (uint16_t)(function * 4);
+
+    symbols_format(symbols, address, text, size);
+}
+
+/* Descending by count */
+static int by_count(const void* a, const void* b)
+{
+    const struct Ranked* ra = a;
+    const struct Ranked* rb = b;
+
+    if (ra->count != rb->count) {
+        return (ra->count < rb->count) ? 1 : -1;
+    }
+    return (ra->index < rb->index) ? -1 : (ra->index > rb->index);
+}
+
+static double percentage(uint64_t count, uint64_t total)
+{
+    return (total > 0) ? (100.0 * count / total) : 0.0;
+}
+
+/* --------------------------------------------------------------------*/
+
+struct CallGraph* call_graph_create(void)
+{
+    struct CallGraph* graph = calloc(1, sizeof(struct CallGraph));
+
+    if (graph != NULL) {
+        memset(graph->node_slots, 0xFF, sizeof(graph->node_slots));
+    }
+    return graph;
+}
+
+void call_graph_destroy(struct CallGraph* graph)
+{
+    free(graph);
+}
+
+/**
+ * Run the processor with the reference interpreter, following calls.
+ */
+void run_call_graph(
+        struct CPU_Context* c, uint8_t* memory, struct CallGraph* graph)
+{
+    if (graph->depth == 0) {
+        graph->root_address = c->pc;
+        open_frame(graph, CG_ROOT, 0, c->instruction_count);
+    }
+    while (c->keep_going && (c->instruction_count < c->instruction_limit)) {
+        uint16_t pc = c->pc;
+        uint16_t instruction = fetch_instruction(memory, pc);
+        struct CallFrame* frame = &(graph->frames[graph->depth - 1]);
+
+        ++(graph->functions[frame->function].exclusive);
+        ++(graph->nodes[frame->node].exclusive);
+        step(c, memory);
+        if (!(c->keep_going)) {
+            (void)take_exception(c, memory);
+        }
+
+        if ((instruction & 0xC000) == 0x4000) {
+            /* ENTER */
+            open_frame(graph, instruction & 0x3FFF, pc + 2,
+                       c->instruction_count);
+        } else if ((instruction & 0xFF00) == 0x8100) {
+            /* LEAVE */
+            return_to(graph, c->pc, c->instruction_count);
+        }
+    }
+    if (!(c->keep_going)) {
+        while (graph->depth > 0) {
+            close_frame(graph, c->instruction_count);
+        }
+    }
+}
+
+/**
+ * Print the functions and the calls with the highest inclusive counts.
+ */
+void call_graph_report(
+        const struct CallGraph* graph, const struct Symbols* symbols,
+        FILE* outpf)
+{
+    struct Ranked* ranked = malloc(CG_FUNCTIONS * sizeof(struct Ranked));
+    uint64_t total = 0;
+    uint64_t calls = 0;
+    unsigned n = 0;
+    char caller[SYMBOL_MAX_NAME + 16];
+    char callee[SYMBOL_MAX_NAME + 16];
+    char pair[2 * SYMBOL_MAX_NAME + 40];
+
+    if (ranked == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < CG_FUNCTIONS; ++i) {
+        const struct CallCounts* counts = &(graph->functions[i]);
+        total += counts->exclusive;
+        if (i != CG_ROOT) {
+            calls += counts->calls;
+        }
+        if (counts->calls != 0) {
+            ranked[n].index = i;
+            ranked[n].count = counts->inclusive;
+            ++n;
+        }
+    }
+    qsort(ranked, n, sizeof(struct Ranked), by_count);
+
+    fprintf(outpf, "Call graph: %lu instructions, %lu calls\n",
+            (unsigned long)total, (unsigned long)calls);
+    fprintf(outpf, "  %-24s %10s %12s %8s %12s %8s\n", "Function", "Calls",
+            "Inclusive", "%", "Exclusive", "%");
+    for (unsigned i = 0; (i < n) && (i < CG_REPORT_COUNT); ++i) {
+        const struct CallCounts* counts = &(graph->functions[ranked[i].index]);
+        function_name(graph, symbols, ranked[i].index, callee, sizeof(callee));
+        fprintf(outpf, "  %-24s %10lu %12lu %7.2f%% %12lu %7.2f%%\n", callee,
+                (unsigned long)counts->calls,
+                (unsigned long)counts->inclusive,
+                percentage(counts->inclusive, total),
+                (unsigned long)counts->exclusive,
+                percentage(counts->exclusive, total));
+    }
+
+    n = 0;
+    for (uint32_t i = 0; i < CG_EDGES; ++i) {
+        if (graph->edges[i].used) {
+            ranked[n].index = i;
+            ranked[n].count = graph->edges[i].counts.inclusive;
+            ++n;
+        }
+    }
+    qsort(ranked, n, sizeof(struct Ranked), by_count);
+    fprintf(outpf, "  %-24s %10s %12s %8s\n", "Caller -> callee", "Calls",
+            "Inclusive", "%");
+    for (unsigned i = 0; (i < n) && (i < CG_REPORT_COUNT); ++i) {
+        const struct CallEdge* edge = &(graph->edges[ranked[i].index]);
+        function_name(graph, symbols, edge->caller, caller, sizeof(caller));
+        function_name(graph, symbols, edge->callee, callee, sizeof(callee));
+        snprintf(pair, sizeof(pair), "%s -> %s", caller, callee);
+        fprintf(outpf, "  %-24s %10lu %12lu %7.2f%%\n", pair,
+                (unsigned long)edge->counts.calls,
+                (unsigned long)edge->counts.inclusive,
+                percentage(edge->counts.inclusive, total));
+    }
+    if (graph->lost != 0) {
+        fprintf(outpf, "Call graph: %lu calls too deep to follow\n",
+                (unsigned long)graph->lost);
+    }
+    if (graph->nodes_full) {
+        fprintf(outpf, "Call graph: too many call chains, "
+                       "deep chains are merged into their callers\n");
+    }
+    free(ranked);
+}
+
+/**
+ * Write one line per call chain: the functions from the root down,
+ * separated by ';', and the instructions executed in the last one.
+ *
+ * Returns false if the file could not be written.
+ */
+bool call_graph_write_folded(
+        const struct CallGraph* graph, const struct Symbols* symbols,
+        const char* filename)
+{
+    char name[SYMBOL_MAX_NAME + 16];
+    uint32_t chain[CG_MAX_DEPTH + 1];
+    FILE* outpf = fopen(filename, "w");
+
+    if (outpf == NULL) {
+        perror(filename);
+        return false;
+    }
+    for (uint32_t i = 0; i < graph->node_count; ++i) {
+        unsigned length = 0;
+
+        if (graph->nodes[i].exclusive == 0) {
+            continue;
+        }
+        for (uint32_t node = i;
+             (node != CG_NO_PARENT) && (length <= CG_MAX_DEPTH);
+             node = graph->nodes[node].parent) {
+            chain[length++] = graph->nodes[node].function;
+        }
+        while (length > 0) {
+            function_name(graph, symbols, chain[--length], name, sizeof(name));
+            fprintf(outpf, "%s%c", name, (length > 0) ? ';' : ' ');
+        }
+        fprintf(outpf, "%lu\n", (unsigned long)graph->nodes[i].exclusive);
+    }
+    return fclose(outpf) == 0;
+}
+
+/* ------------------------ end of file -------------------------------*/
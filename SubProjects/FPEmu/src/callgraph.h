@@ -0,0 +1,81 @@
+#ifndef HG_CALLGRAPH_H
+#define HG_CALLGRAPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fpemu.h"
+#include "symbols.h"
+
+/* Deepest call chain followed, the return stack holds fewer */
+#define CG_MAX_DEPTH 64
+/* ENTER targets are 4 byte aligned, one more entry for the start */
+#define CG_FUNCTIONS (MEMORY_SIZE / 4 + 1)
+#define CG_ROOT (MEMORY_SIZE / 4)
+/* Caller/callee pairs, a power of two */
+#define CG_EDGES 4096
+/* Distinct call chains for the folded stacks, a power of two */
+#define CG_NODES 16384
+/* Functions and edges printed by call_graph_report() */
+#define CG_REPORT_COUNT 20
+
+struct CallCounts {
+    uint64_t calls;
+    uint64_t inclusive;      /* Instructions in the function and callees */
+    uint64_t exclusive;      /* Only the function itself, not for edges */
+    unsigned active;         /* Frames on the call stack, for recursion */
+};
+
+struct CallEdge {
+    uint32_t caller;         /* Function indexes */
+    uint32_t callee;
+    bool used;
+    struct CallCounts counts;
+};
+
+/* A call chain: its caller chain plus a function */
+struct CallNode {
+    uint32_t parent;
+    uint32_t function;
+    uint64_t exclusive;
+};
+
+struct CallFrame {
+    uint32_t function;
+    uint32_t node;
+    struct CallEdge* edge;   /* NULL for the root */
+    uint16_t return_address;
+    uint64_t start;          /* Instruction count at entry */
+};
+
+/**
+ * Call graph built from ENTER and LEAVE.  A function is identified by the
+ * address ENTER jumps to, the code running before the first ENTER is the
+ * root.
+ */
+struct CallGraph {
+    uint16_t root_address;
+    struct CallFrame frames[CG_MAX_DEPTH];
+    unsigned depth;          /* Frames in use, frames[0] is the root */
+    uint64_t lost;           /* Calls too deep to follow */
+    bool nodes_full;
+    struct CallCounts functions[CG_FUNCTIONS];
+    struct CallEdge edges[CG_EDGES];
+    unsigned node_count;
+    struct CallNode nodes[CG_NODES];
+    int32_t node_slots[2 * CG_NODES];  /* Hash of nodes, -1: empty */
+};
+
+extern struct CallGraph* call_graph_create(void);
+extern void call_graph_destroy(struct CallGraph* graph);
+extern void run_call_graph(
+        struct CPU_Context* c, uint8_t* memory, struct CallGraph* graph);
+extern void call_graph_report(
+        const struct CallGraph* graph, const struct Symbols* symbols,
+        FILE* outpf);
+extern bool call_graph_write_folded(
+        const struct CallGraph* graph, const struct Symbols* symbols,
+        const char* filename);
+
+#endif /* HG_CALLGRAPH_H */
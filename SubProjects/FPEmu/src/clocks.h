@@ -0,0 +1,57 @@
+#ifndef HG_CLOCKS_H
+#define HG_CLOCKS_H
+
+#include <stdint.h>
+
+/* Assumed clock of the FPGA design, which does not specify one.  What -f
+ * defaults to in reports */
+#define CLOCK_HZ 12000000
+
+/**
+ * Clock cycles of each instruction group, by the top 4 bits of the
+ * instruction.  A model of the FPGA design, not measured on it.  Every
+ * instruction takes a clock to fetch and one to run on the stack unit.
+ * Operations with two values from the data stack need an extra clock for
+ * the second read, and control transfers one to load the pc.  RD, STO,
+ * IRD and ISTO take a clock more per byte on the 8 bit data bus, see
+ * instruction_clocks().
+ */
+static const uint8_t group_clocks[16] = {
+    2,  /* 0x0 illegal */
+    3,  /* 0x1 BIF */
+    2,  /* 0x2 illegal */
+    2,  /* 0x3 illegal */
+    3,  /* 0x4 ENTER */
+    3,  /* 0x5 ENTER */
+    3,  /* 0x6 ENTER */
+    3,  /* 0x7 ENTER */
+    2,  /* 0x8 NOP HALT RESET, LEAVE takes one more */
+    2,  /* 0x9 illegal */
+    2,  /* 0xA illegal */
+    2,  /* 0xB DROP DUP SWAP MOV */
+    2,  /* 0xC LDL */
+    2,  /* 0xD LDH */
+    3,  /* 0xE two values */
+    2   /* 0xF one value */
+};
+
+/**
+ * Clock cycles the model gives an instruction.  It only depends
+ * on the instruction word, so a block of instructions has a fixed cost.
+ */
+static inline unsigned instruction_clocks(uint16_t instruction)
+{
+    unsigned clocks = group_clocks[instruction >> 12];
+
+    if (((instruction & 0xFF80) == 0xE580) ||
+        ((instruction & 0xFF00) == 0xF200)) {
+        /* STO ISTO, RD IRD: the size is the number of bytes */
+        clocks += instruction & 0x07;
+    } else if ((instruction & 0xFF00) == 0x8100) {
+        /* LEAVE */
+        ++clocks;
+    }
+    return clocks;
+}
+
+#endif /* HG_CLOCKS_H */
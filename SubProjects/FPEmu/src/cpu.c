@@ -0,0 +1,840 @@
+/**
+ * Stack-master 16 emulator -- CPU state and reference interpreter
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "fpemu.h"
+#include "iobus.h"
+#include "scheduler.h"
+#include "interrupt.h"
+#include "clocks.h"
+#include "idle.h"
+#include "breakpoints.h"
+#include "blockcache.h"
+#include "threaded.h"
+
+char* exception_descriptions[] = {
+    "All is OK",
+    "Stack overflow",
+    "Stack underflow",
+    "Illegal instruction",
+    "Illegal stack id"
+};
+
+/* --------------------------------------------------------------------*/
+
+static void invalidate(struct CPU_Context* c, uint16_t address, uint16_t size);
+static void written(struct CPU_Context* c, uint16_t address, uint16_t size);
+static void rescheduled(struct CPU_Context* c);
+static void io_store(struct CPU_Context* c, uint16_t port, uint16_t value,
+                     unsigned bytes);
+static uint16_t io_load(struct CPU_Context* c, uint16_t port, unsigned bytes);
+
+/* --------------------------------------------------------------------*/
+
+static void invalidate(struct CPU_Context* c, uint16_t address, uint16_t size)
+{
+    if (c->block_cache != NULL) {
+        block_cache_invalidate(c->block_cache, address, size);
+    }
+#ifdef FPEMU_THREADED
+    if (c->threaded_code != NULL) {
+        threaded_code_invalidate(c->threaded_code, address, size);
+    }
+#endif
+}
+
+/**
+ * Bookkeeping after a store of size bytes, which may wrap around the end
+ * of memory: the pages are dirty, and translated code is out of date.
+ */
+static void written(struct CPU_Context* c, uint16_t address, uint16_t size)
+{
+    uint16_t first = size;
+
+    mark_dirty(c, address, size);
+    if ((uint32_t)address + size > MEMORY_SIZE) {
+        first = (uint16_t)(MEMORY_SIZE - address);
+        invalidate(c, 0x0000, size - first);
+    }
+    invalidate(c, address, first);
+}
+
+/**
+ * After an IO access: a device may have scheduled an event before the
+ * instruction limit the core works to.  Stop the core, like HALT does,
+ * so the limit is set again.
+ */
+static void rescheduled(struct CPU_Context* c)
+{
+    if (c->scheduler->next < c->instruction_limit) {
+        c->yield = true;
+        c->keep_going = false;
+    }
+}
+
+/**
+ * Ports are bytes, a word goes to two ports, the low byte first.
+ */
+static void io_store(struct CPU_Context* c, uint16_t port, uint16_t value,
+                     unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; ++i) {
+        io_write(c->io, (uint16_t)(port + i), (uint8_t)(value >> (8 * i)),
+                 cpu_cycles(c));
+    }
+}
+
+static uint16_t io_load(struct CPU_Context* c, uint16_t port, unsigned bytes)
+{
+    uint16_t value = 0;
+
+    for (unsigned i = 0; i < bytes; ++i) {
+        value |= (uint16_t)(io_read(c->io, (uint16_t)(port + i),
+                                    cpu_cycles(c)) << (8 * i));
+    }
+    return value;
+}
+
+/* --------------------------------------------------------------------*/
+
+/* Perform CPU reset */
+void cpu_reset(struct CPU_Context* c)
+{
+    c->data_stack.size    = DSTACK_SIZE;
+    c->data_stack.top     = 0U;
+    c->return_stack.size  = RSTACK_SIZE;
+    c->return_stack.top   = 0U;
+    c->control_stack.size = CSTACK_SIZE;
+    c->control_stack.top  = 0U;
+    c->temp_stack.size    = TSTACK_SIZE;
+    c->temp_stack.top     = 0U;
+
+    c->pc          = 0xF000;  /* program counter */
+    c->instruction = 0x0000;  /* current instruction */
+    c->keep_going  = true;
+    c->single_step = false;   /* Run on instruction then stop */
+    c->exception   = AllIsOK;
+    c->instruction_count = 0;
+    c->clocks = 0;
+    c->instruction_limit = UINT64_MAX;
+    c->exceptions_handled = 0;
+    c->yield = false;
+}
+
+/**
+ * Get pointer to the stack indicated by the stack ID.
+ */
+struct Stack* get_stack(struct CPU_Context* c, uint16_t stack_id)
+{
+    struct Stack* stack;
+
+    switch (stack_id) {
+        case DATA_STACK:
+            stack = &(c->data_stack);
+            break;
+        case RETURN_STACK:
+            stack = &(c->return_stack);
+            break;
+        case CONTROL_STACK:
+            stack = &(c->control_stack);
+            break;
+        case TEMP_STACK:
+            stack = &(c->temp_stack);
+            break;
+        default:
+            stack = &(c->data_stack);
+            c->exception = IllegalStackID;
+            c->keep_going = false;
+    }
+
+    return stack;
+}
+
+/**
+ * STO / ISTO
+ *
+ * Shared by all cores so memory and IO stores behave the same everywhere.
+ * The value is on top of the address, ( address n -- ) for b and w, and
+ * ( address n1 n2 -- ) for l, which stores n1 at address and n2 at
+ * address + 2.  ISTO does the same with ports, see io_store().  Nothing
+ * is stored after an underflow.
+ */
+void exec_store(struct CPU_Context* c, uint8_t* memory, uint16_t instruction)
+{
+    uint16_t address;
+    uint16_t n;
+    uint16_t n1 = 0;
+    uint8_t size;
+    uint16_t is_io;
+    struct Stack* stack = &(c->data_stack);
+
+    size = instruction & 0x07;
+    is_io = instruction & 0x40;
+    n = pop(c, stack);
+    if (size == 4) {
+        n1 = pop(c, stack);
+    }
+    address = pop(c, stack);
+    if (c->exception != AllIsOK) {
+        return;
+    }
+    ++(c->idle->effects);
+    if (is_io) {
+        switch (size) {
+            case 1:
+            case 2:
+                io_store(c, address, n, size);
+                break;
+            case 4:
+                io_store(c, address, n1, 2);
+                io_store(c, (uint16_t)(address + 2), n, 2);
+                break;
+            default:
+                c->exception = IllegalInstruction;
+                c->keep_going = false;
+                return;
+        }
+        rescheduled(c);
+    } else {
+        switch (size) {
+            case 1:
+                memory[address] = (uint8_t)n;
+                break;
+            case 2:
+                write_word(memory, address, n);
+                break;
+            case 4:
+                write_word(memory, address, n1);
+                write_word(memory, (uint16_t)(address + 2), n);
+                break;
+            default:
+                c->exception = IllegalInstruction;
+                c->keep_going = false;
+                return;
+        }
+        written(c, address, size);
+        if ((c->breakpoints != NULL) &&
+            watched(c->breakpoints, WATCH_WRITE, address, size)) {
+            break_at(c, BreakWrite, address);
+        }
+    }
+}
+
+/**
+ * RD / IRD
+ *
+ * Shared by all cores so memory and IO reads behave the same everywhere.
+ * IRD reads ports on the IO bus, see iobus.h and io_load().
+ * RD l pushes the word at the address, then the one at address + 2.
+ */
+void exec_read(struct CPU_Context* c, uint8_t* memory, uint16_t instruction)
+{
+    uint16_t address;
+    uint8_t size;
+    uint16_t is_io;
+    bool watch;
+    struct Stack* stack = &(c->data_stack);
+
+    address = pop(c, stack);
+    /* Only a read of a valid address can hit a watchpoint */
+    watch = (c->breakpoints != NULL) && (c->exception == AllIsOK);
+    size = (instruction & 0x07);
+    is_io = instruction & 0x80;
+    if (is_io) {
+        ++(c->idle->effects);
+        switch (size) {
+            case 1: {
+                uint8_t value = io_read(c->io, address, cpu_cycles(c));
+                push(c, stack, value);
+                if ((value == 0) &&
+                    (io_handler(c->io, address)->wait != NULL) &&
+                    (c->exception == AllIsOK)) {
+                    idle_polled(c, address);
+                }
+                break;
+            }
+            case 2:
+                push(c, stack, io_load(c, address, 2));
+                break;
+            case 4:
+                push(c, stack, io_load(c, address, 2));
+                push(c, stack, io_load(c, (uint16_t)(address + 2), 2));
+                break;
+            default:
+                c->exception = IllegalInstruction;
+                c->keep_going = false;
+                return;
+        }
+        rescheduled(c);
+    } else {
+        switch (size) {
+            case 1: /* byte */
+                push(c, stack, (uint16_t)memory[address]);
+                break;
+            case 2: /* word */
+                push(c, stack, read_word(memory, address));
+                break;
+            case 4: /* long */
+                push(c, stack, read_word(memory, address));
+                push(c, stack, read_word(memory, (uint16_t)(address + 2)));
+                break;
+            default:
+                c->exception = IllegalInstruction;
+                c->keep_going = false;
+                return;
+        }
+        if (watch && watched(c->breakpoints, WATCH_READ, address, size)) {
+            break_at(c, BreakRead, address);
+        }
+    }
+}
+
+/**
+ * After the processor stopped on an exception, enter its handler, if the
+ * vector in page 0 points to one.  Returns true if it did, the processor
+ * then runs again.
+ *
+ * The address the processor would have continued at is pushed on the
+ * return stack, so the handler can LEAVE to it.  The entry that did not
+ * fit on a stack that overflowed is dropped.  If the return stack is
+ * full it is emptied first, its return addresses are lost anyway.
+ * IllegalStackID uses the illegal instruction vector.
+ */
+bool take_exception(struct CPU_Context* c, uint8_t* memory)
+{
+    struct Stack* stacks[4] = {
+        &(c->data_stack), &(c->return_stack),
+        &(c->control_stack), &(c->temp_stack)
+    };
+    struct Stack* stack = &(c->return_stack);
+    uint16_t vector;
+    uint16_t handler;
+
+    switch (c->exception) {
+        case StackOverflow:
+            vector = VECTOR_STACK_OVERFLOW;
+            break;
+        case StackUnderflow:
+            vector = VECTOR_STACK_UNDERFLOW;
+            break;
+        case IllegalInstruction:
+        case IllegalStackID:
+            vector = VECTOR_ILLEGAL_INSTRUCTION;
+            break;
+        default:
+            return false;
+    }
+    handler = fetch_instruction(memory, vector);
+    if (c->halt_on_exception || (handler == 0x0000)) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < 4; ++i) {
+        if (stacks[i]->top >= stacks[i]->size) {
+            stacks[i]->top = stacks[i]->size - 1;
+        }
+    }
+    if (stack->top + 1 >= stack->size) {
+        stack->top = 0;
+    }
+    push(c, stack, c->pc);
+    c->pc = handler;
+    c->exception = AllIsOK;
+    c->keep_going = true;
+    ++(c->exceptions_handled);
+
+    return true;
+}
+
+/**
+ * Enter the handler of the first interrupt that can be taken, through
+ * its vector in page 0.  The pc goes on the return stack, like ENTER
+ * does, LEAVE returns.  Returns false if there is none.
+ */
+bool take_interrupt(struct CPU_Context* c, uint8_t* memory)
+{
+    int line;
+
+    while ((line = interrupts_next(c->interrupts)) >= 0) {
+        uint16_t handler = fetch_instruction(
+                memory, (uint16_t)(IRQ_VECTORS + 2 * line));
+        interrupts_taken(c->interrupts, (unsigned)line, cpu_cycles(c),
+                         handler != 0x0000);
+        if (handler != 0x0000) {
+            push(c, &(c->return_stack), c->pc);
+            c->pc = handler;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Reference interpreter, executes one instruction.
+ *
+ * Fetches and decodes every instruction.  All other cores must behave
+ * exactly like this one, and use it for whatever they do not handle
+ * themselves.
+ *
+ * Inlined in run_switch(), step() is the same for the other cores.
+ */
+
+static inline void execute(struct CPU_Context* c, uint8_t* memory)
+{
+    c->instruction = fetch_instruction(memory, c->pc);
+    ++(c->instruction_count);
+    c->clocks += instruction_clocks(c->instruction);
+
+    uint16_t group = (c->instruction & 0xF000);
+    // printf("%04x %04x\n", c->pc, c->instruction);
+    switch (group) {
+        case 0x4000:
+        case 0x5000:
+        case 0x6000:
+        case 0x7000:
+            {
+                /* ENTER */
+                struct Stack* stack = &(c->return_stack);
+                uint16_t address = ((c->instruction & 0x3FFF) << 2);
+                push(c, stack, (c->pc) + 2);
+                c->pc = address;
+            }
+            break;
+        case 0x1000: /* BIF */
+            {
+                uint16_t truth_value;
+                struct Stack* stack = &(c->data_stack);
+                truth_value = pop(c, stack);
+                if (truth_value) {
+                    (c->pc) += 2;
+                } else {
+                    int16_t offset = (c->instruction & 0x0FFF);
+                    if (offset & 0x0800) {
+                        /* sign extend */
+                        offset = offset | 0xF000;
+                    }
+                    if (offset < 0) {
+                        offset = (0 - offset);
+                        c->pc -= (uint16_t)offset;
+                    } else {
+                        c->pc += offset;
+                    }
+                }
+            }
+            break;
+        case 0x8000:
+            {
+                uint16_t func = (c->instruction & 0x0F00);
+                switch (func) {
+                    case 0x0000: /* NOP */
+                        (c->pc) += 2;
+                        break;
+                    case 0x0100: /* LEAVE */
+                        {
+                            struct Stack* stack = &(c->return_stack);
+                            c->pc = pop(c, stack);
+                        }
+                        break;
+                    case 0x0200: /* HALT */
+                        (c->pc) += 2;
+                        c->keep_going = false;
+                        break;
+                    default:
+                        c->exception = IllegalInstruction;
+                        c->keep_going = false;
+                        (c->pc) += 2;
+                }
+            }
+            break;
+        case 0xB000:
+            {
+                uint16_t value;
+                uint16_t value2;
+                struct Stack* source_stack;
+                struct Stack* target_stack;
+                uint16_t func = (c->instruction & 0x0F00);
+                uint16_t source_stack_id = (c->instruction & 0x00C0) >> 6;
+                uint16_t target_stack_id   = (c->instruction & 0x0030) >> 4;
+                source_stack = get_stack(c, source_stack_id);
+                target_stack = get_stack(c, target_stack_id);
+                switch (func) {
+                    case 0x0000: /* DROP */
+                        (void)pop(c, source_stack);
+                        break;
+                    case 0x0100: /* DUP */
+                        value = pop(c, source_stack);
+                        push(c, source_stack, value);
+                        push(c, source_stack, value);
+                        break;
+                    case 0x0200: /* SWAP */
+                        value = pop(c, source_stack);
+                        value2 = pop(c, source_stack);
+                        push(c, source_stack, value);
+                        push(c, source_stack, value2);
+                        break;
+                    case 0x0300: /* MOV */
+                        value = pop(c, source_stack);
+                        push(c, target_stack, value);
+                        break;
+                    default:
+                        c->exception = IllegalInstruction;
+                        c->keep_going = false;
+                }
+                (c->pc) += 2;
+            }
+            break;
+        case 0xC000: /* Load:  LDL */
+            {
+                struct Stack* stack;
+                uint16_t stack_id = (c->instruction & 0x0C00) >> 10;
+                uint16_t value = (c->instruction & 0x03FF);
+                stack = get_stack(c, stack_id);
+                push(c, stack, value);
+                (c->pc) += 2;
+            }
+            break;
+        case 0xD000: /* Load: LDH */
+            {
+                struct Stack* stack;
+                uint16_t value;
+                uint16_t stack_id = (c->instruction & 0x0C00) >> 10;
+                uint16_t high_bits_value = (c->instruction & 0x003F);
+                stack = get_stack(c, stack_id);
+                value = pop(c, stack);
+                value = value | (high_bits_value << 10);
+                push(c, stack, value);
+                (c->pc) += 2;
+            }
+            break;
+        case 0xE000: /* 2 value operators */
+            {
+                uint16_t func = (c->instruction & 0x0F80) >> 7;
+                uint16_t is_signed = (c->instruction & 0x0010);
+                struct Stack* stack = &(c->data_stack);
+                switch (func) {
+                    case 0x00: /* ADD(U) */
+                        {
+                            if (is_signed) {
+                                int16_t s1, s2;
+                                s1 = pop(c, stack);
+                                s2 = pop(c, stack);
+                                s1 = s1 + s2;
+                                push(c, stack, (uint16_t)s1);
+                            } else {
+                                uint16_t u1, u2;
+                                u1 = pop(c, stack);
+                                u2 = pop(c, stack);
+                                u1 = u1 + u2;
+                                push(c, stack, u1);
+                            }
+                        }
+                        break;
+                    case 0x01: /* MUL(U) */
+                        {
+                            if (is_signed) {
+                                int16_t s1, s2;
+                                s1 = pop(c, stack);
+                                s2 = pop(c, stack);
+                                s1 = s1 * s2;
+                                push(c, stack, (uint16_t)s1);
+                            } else {
+                                uint16_t u1, u2;
+                                u1 = pop(c, stack);
+                                u2 = pop(c, stack);
+                                u1 = u1 * u2;
+                                push(c, stack, u1);
+                            }
+                        }
+                        break;
+                    case 0x03: /* EQ */
+                        {
+                            uint16_t t;
+                            uint16_t n1, n2;
+                            n1 = pop(c, stack);
+                            n2 = pop(c, stack);
+                            t = (n2 == n1) ? 0xFFFF : 0x0000;
+                            push(c, stack, t);
+                        }
+                        break;
+                    case 0x04: /* ASR */
+                        {
+                            int16_t r;
+                            if (is_signed) {
+                                int16_t s1, s2;
+                                s1 = (int16_t)pop(c, stack);
+                                s2 = (int16_t)pop(c, stack);
+                                r = (s2 >> s1);
+                                push(c, stack, r);
+                            } else {
+                                c->exception = IllegalInstruction;
+                                c->keep_going = false;
+                            }
+                        }
+                        break;
+                    case 0x05: /* LT / LTU */
+                        {
+                            uint16_t t;
+                            if (is_signed) {
+                                int16_t s1, s2;
+                                s1 = (int16_t)pop(c, stack);
+                                s2 = (int16_t)pop(c, stack);
+                                t = (s2 < s1) ? 0xFFFF : 0x0000;
+                            } else {
+                                uint16_t u1, u2;
+                                u1 = pop(c, stack);
+                                u2 = pop(c, stack);
+                                t = (u2 < u1) ? 0xFFFF : 0x0000;
+                            }
+                            push(c, stack, t);
+                        }
+                        break;
+                    case 0x06: /* GT(U) */
+                        {
+                            uint16_t t;
+                            if (is_signed) {
+                                int16_t s1, s2;
+                                s1 = (int16_t)pop(c, stack);
+                                s2 = (int16_t)pop(c, stack);
+                                t = (s2 > s1) ? 0xFFFF : 0x0000;
+                            } else {
+                                uint16_t u1, u2;
+                                u1 = pop(c, stack);
+                                u2 = pop(c, stack);
+                                t = (u2 > u1) ? 0xFFFF : 0x0000;
+                            }
+                            push(c, stack, t);
+                        }
+                        break;
+                    case 0x07: /* LTE(U) */
+                        {
+                            uint16_t t;
+                            if (is_signed) {
+                                int16_t s1, s2;
+                                s1 = (int16_t)pop(c, stack);
+                                s2 = (int16_t)pop(c, stack);
+                                t = (s2 <= s1) ? 0xFFFF : 0x0000;
+                            } else {
+                                uint16_t u1, u2;
+                                u1 = pop(c, stack);
+                                u2 = pop(c, stack);
+                                t = (u2 <= u1) ? 0xFFFF : 0x0000;
+                            }
+                            push(c, stack, t);
+                        }
+                        break;
+                    case 0x08: /* GTE(U) */
+                        {
+                            uint16_t t;
+                            if (is_signed) {
+                                int16_t s1, s2;
+                                s1 = (int16_t)pop(c, stack);
+                                s2 = (int16_t)pop(c, stack);
+                                t = (s2 >= s1) ? 0xFFFF : 0x0000;
+                            } else {
+                                uint16_t u1, u2;
+                                u1 = pop(c, stack);
+                                u2 = pop(c, stack);
+                                t = (u2 >= u1) ? 0xFFFF : 0x0000;
+                            }
+                            push(c, stack, t);
+                        }
+                        break;
+                    case 0x09: /* LSR */
+                        {
+                            uint16_t r;
+                            uint16_t n1, n2;
+                            n1 = pop(c, stack);
+                            n2 = pop(c, stack);
+                            r = (n2 << n1);
+                            push(c, stack, r);
+                        }
+                        break;
+                    case 0x0A: /* LSL */
+                        {
+                            uint16_t r;
+                            uint16_t n1, n2;
+                            n1 = pop(c, stack);
+                            n2 = pop(c, stack);
+                            r = (n2 >> n1);
+                            push(c, stack, r);
+                        }
+                        break;
+                    case 0x0B: /* STO / ISTO */
+                        exec_store(c, memory, c->instruction);
+                        break;
+                    case 0x0D: /* AND */
+                        {
+                            uint16_t r;
+                            uint16_t n1, n2;
+                            n1 = pop(c, stack);
+                            n2 = pop(c, stack);
+                            r = (n2 & n1);
+                            push(c, stack, r);
+                        }
+                        break;
+                    case 0x0E: /* OR */
+                        {
+                            uint16_t r;
+                            uint16_t n1, n2;
+                            n1 = pop(c, stack);
+                            n2 = pop(c, stack);
+                            r = (n2 | n1);
+                            push(c, stack, r);
+                        }
+                        break;
+                    case 0x0F: /* XOR */
+                        {
+                            uint16_t r;
+                            uint16_t n1, n2;
+                            n1 = pop(c, stack);
+                            n2 = pop(c, stack);
+                            r = (n2 ^ n1);
+                            push(c, stack, r);
+                        }
+                        break;
+                    default:
+                        c->exception = IllegalInstruction;
+                        c->keep_going = false;
+                }
+                (c->pc) += 2;
+            }
+            break;
+        case 0xF000:
+            {
+                uint16_t func = (c->instruction & 0x0F00) >> 8;
+                struct Stack* stack = &(c->data_stack);
+
+                switch (func) {
+                    case 0x00: /* NEG */
+                        {
+                            int16_t r;
+                            int16_t s1;
+                            s1 = pop(c, stack);
+                            r = 0 - s1;
+                            push(c, stack, r);
+                        }
+                        break;
+                    case 0x01: /* NOT */
+                        {
+                            uint16_t r;
+                            uint16_t n1;
+                            n1 = pop(c, stack);
+                            r = ~n1;
+                            push(c, stack, r);
+                        }
+                        break;
+                    case 0x02: /* RD / IRD */
+                        exec_read(c, memory, c->instruction);
+                        break;
+                    default:
+                        // TODO
+                        c->exception = IllegalInstruction;
+                        c->keep_going = false;
+                        break;
+                }
+                (c->pc) += 2;
+                break;
+            }
+        default:
+            c->exception = IllegalInstruction;
+            c->keep_going = false;
+            (c->pc) += 2;
+    }
+}
+
+/**
+ * One instruction, then the events that are due and the interrupt they
+ * raised.  For the loops that step, every instruction is a block
+ * boundary.
+ */
+void step(struct CPU_Context* c, uint8_t* memory)
+{
+    execute(c, memory);
+    if (c->yield) {
+        c->yield = false;
+        c->keep_going = true;
+    }
+    scheduler_poll(c->scheduler, cpu_cycles(c));
+    if (c->keep_going) {
+        (void)take_interrupt(c, memory);
+    }
+}
+
+/**
+ * The switch core.  With breakpoints the pc is checked before every
+ * instruction, without them the loop has no check, see run_switch().
+ */
+static inline __attribute__((always_inline)) void switch_loop(
+        struct CPU_Context* c, uint8_t* memory,
+        struct Breakpoints* breakpoints)
+{
+    do {
+        while (c->keep_going &&
+               (c->instruction_count < c->instruction_limit)) {
+            if ((breakpoints != NULL) &&
+                break_here(breakpoints, c->pc, c->instruction_count)) {
+                break_at(c, BreakPoint, c->pc);
+                break;
+            }
+            execute(c, memory);
+            /* In single step mode we only do one instruction at a time */
+            if (c->single_step) {
+                c->keep_going = false;
+            }
+        }
+    } while (take_exception(c, memory) && !(c->single_step) &&
+             !stopped_at_break(c));
+}
+
+void run_switch(struct CPU_Context* c, uint8_t* memory)
+{
+    if (c->breakpoints != NULL) {
+        switch_loop(c, memory, c->breakpoints);
+    } else {
+        switch_loop(c, memory, NULL);
+    }
+}
+
+/**
+ * Run a core up to the instruction limit, with the first event as its
+ * limit, and dispatch the events when it gets there, then take an
+ * interrupt if one was raised.  The cores check their limit between
+ * blocks anyway, so events and interrupts cost nothing in the loop that
+ * runs the instructions.  A core that stopped in an idle loop skips
+ * ahead, see idle.c.
+ */
+void run_scheduled(
+        struct CPU_Context* c, uint8_t* memory,
+        void (*run)(struct CPU_Context* c, uint8_t* memory), uint64_t limit)
+{
+    struct Scheduler* s = c->scheduler;
+
+    while (c->keep_going && (cpu_cycles(c) < limit)) {
+        scheduler_poll(s, cpu_cycles(c));
+        (void)take_interrupt(c, memory);
+        if (!(c->keep_going)) {
+            break;
+        }
+        c->instruction_limit = (s->next < limit) ? s->next : limit;
+        run(c, memory);
+        if (c->yield) {
+            c->yield = false;
+            c->keep_going = !(c->single_step) && !stopped_at_break(c);
+        }
+        /* A skipped pass through an idle loop would not stop at a
+         * breakpoint in it */
+        if (c->keep_going && (c->breakpoints == NULL)) {
+            idle_skip(c, limit);
+        }
+    }
+    c->instruction_limit = limit;
+}
+
+/* ------------------------ end of file -------------------------------*/
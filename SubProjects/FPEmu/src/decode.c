@@ -0,0 +1,137 @@
+/**
+ * Stack-master 16 emulator -- instruction decoder
+ *
+ * The single place where the bit fields of an instruction word are
+ * interpreted for the predecoding cores.  Must agree with run_switch().
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "decode.h"
+
+const char* op_names[OP_COUNT] = {
+    "illegal", "enter", "bif", "leave", "nop", "halt",
+    "drop", "dup", "swap", "mov", "ldl", "ldh",
+    "add", "mul", "eq", "asr", "lt", "ltu", "gt", "gtu",
+    "lte", "lteu", "gte", "gteu", "lsl", "lsr", "sto",
+    "and", "or", "xor", "neg", "not", "rd"
+};
+
+/**
+ * Decode a single instruction.
+ *
+ * For BIF the operand is the sign extended offset, to be added to the
+ * address of the instruction.
+ */
+void decode_instruction(uint16_t instruction, struct Decoded* d)
+{
+    uint16_t group = (instruction & 0xF000);
+
+    d->op = OP_ILLEGAL;
+    d->source = DATA_STACK;
+    d->target = DATA_STACK;
+    d->ends_block = false;
+    d->operand = 0;
+
+    switch (group) {
+        case 0x4000:
+        case 0x5000:
+        case 0x6000:
+        case 0x7000: /* ENTER */
+            d->op = OP_ENTER;
+            d->operand = ((instruction & 0x3FFF) << 2);
+            break;
+        case 0x1000: /* BIF */
+            {
+                uint16_t offset = (instruction & 0x0FFF);
+                if (offset & 0x0800) {
+                    /* sign extend */
+                    offset = offset | 0xF000;
+                }
+                d->op = OP_BIF;
+                d->operand = offset;
+            }
+            break;
+        case 0x8000:
+            switch (instruction & 0x0F00) {
+                case 0x0000: d->op = OP_NOP;   break;
+                case 0x0100: d->op = OP_LEAVE; break;
+                case 0x0200: d->op = OP_HALT;  break;
+                default: break;
+            }
+            break;
+        case 0xB000:
+            d->source = (instruction & 0x00C0) >> 6;
+            d->target = (instruction & 0x0030) >> 4;
+            switch (instruction & 0x0F00) {
+                case 0x0000: d->op = OP_DROP; break;
+                case 0x0100: d->op = OP_DUP;  break;
+                case 0x0200: d->op = OP_SWAP; break;
+                case 0x0300: d->op = OP_MOV;  break;
+                default: break;
+            }
+            break;
+        case 0xC000: /* LDL */
+            d->op = OP_LDL;
+            d->target = (instruction & 0x0C00) >> 10;
+            d->operand = (instruction & 0x03FF);
+            break;
+        case 0xD000: /* LDH */
+            d->op = OP_LDH;
+            d->target = (instruction & 0x0C00) >> 10;
+            d->operand = (instruction & 0x003F) << 10;
+            break;
+        case 0xE000: /* 2 value operators */
+            {
+                bool is_signed = (instruction & 0x0010);
+                switch ((instruction & 0x0F80) >> 7) {
+                    case 0x00: d->op = OP_ADD; break;
+                    case 0x01: d->op = OP_MUL; break;
+                    case 0x03: d->op = OP_EQ;  break;
+                    case 0x04: d->op = is_signed ? OP_ASR : OP_ILLEGAL; break;
+                    case 0x05: d->op = is_signed ? OP_LT  : OP_LTU;  break;
+                    case 0x06: d->op = is_signed ? OP_GT  : OP_GTU;  break;
+                    case 0x07: d->op = is_signed ? OP_LTE : OP_LTEU; break;
+                    case 0x08: d->op = is_signed ? OP_GTE : OP_GTEU; break;
+                    case 0x09: d->op = OP_SHL; break;
+                    case 0x0A: d->op = OP_SHR; break;
+                    case 0x0B:
+                        d->op = OP_STO;
+                        /* A store to memory might overwrite code */
+                        d->ends_block = !(instruction & 0x40);
+                        break;
+                    case 0x0D: d->op = OP_AND; break;
+                    case 0x0E: d->op = OP_OR;  break;
+                    case 0x0F: d->op = OP_XOR; break;
+                    default: break;
+                }
+            }
+            break;
+        case 0xF000:
+            switch ((instruction & 0x0F00) >> 8) {
+                case 0x00: d->op = OP_NEG; break;
+                case 0x01: d->op = OP_NOT; break;
+                case 0x02: d->op = OP_RD;  break;
+                default: break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    switch (d->op) {
+        case OP_ILLEGAL:
+        case OP_ENTER:
+        case OP_BIF:
+        case OP_LEAVE:
+        case OP_HALT:
+            d->ends_block = true;
+            break;
+        default:
+            break;
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,62 @@
+#ifndef HG_DECODE_H
+#define HG_DECODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Operations, as seen by the predecoding cores */
+enum OpCode {
+    OP_ILLEGAL = 0U,
+    OP_ENTER,
+    OP_BIF,
+    OP_LEAVE,
+    OP_NOP,
+    OP_HALT,
+    OP_DROP,
+    OP_DUP,
+    OP_SWAP,
+    OP_MOV,
+    OP_LDL,
+    OP_LDH,
+    OP_ADD,
+    OP_MUL,
+    OP_EQ,
+    OP_ASR,
+    OP_LT,
+    OP_LTU,
+    OP_GT,
+    OP_GTU,
+    OP_LTE,
+    OP_LTEU,
+    OP_GTE,
+    OP_GTEU,
+    OP_SHL,
+    OP_SHR,
+    OP_STO,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_NEG,
+    OP_NOT,
+    OP_RD,
+
+    /* Should be the last entry */
+    OP_COUNT
+};
+
+/**
+ * The fields of an instruction word, extracted once.
+ */
+struct Decoded {
+    uint8_t op;          /* enum OpCode */
+    uint8_t source;      /* Source stack id */
+    uint8_t target;      /* Target stack id */
+    bool ends_block;     /* Control transfer, memory store, or illegal */
+    uint16_t operand;    /* Literal, ENTER destination, or BIF offset */
+};
+
+extern const char* op_names[OP_COUNT];
+
+extern void decode_instruction(uint16_t instruction, struct Decoded* d);
+
+#endif /* HG_DECODE_H */
@@ -0,0 +1,249 @@
+/**
+ * Stack-master 16 emulator -- fork server
+ *
+ * Instead of a fork() of the host process per run, one emulator is
+ * brought back to the base snapshot before each run.  Memory writes mark
+ * their page dirty, so a run only pays for the pages it modified, and
+ * translated code in the other pages stays valid from run to run.
+ *
+ * Serial output is captured, see fpemu_output().
+ *
+ * run_fork_server() runs one snapshot with every serial input in a list
+ * of files, for fuzzing, and reports the executions per second.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "serial.h"
+#include "snapshot.h"
+#include "forkserver.h"
+
+/* --------------------------------------------------------------------*/
+
+static char* read_input(const char* filename, size_t* size);
+static void free_inputs(char** names, char** inputs, size_t* sizes, size_t n);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Returns NULL if out of memory.  The base snapshot must stay until the
+ * server is destroyed.
+ */
+struct ForkServer* fork_server_create(
+        enum CoreType core, const struct FpemuSnapshot* base)
+{
+    struct ForkServer* server = calloc(1, sizeof(struct ForkServer));
+
+    if (server == NULL) {
+        return NULL;
+    }
+    server->emu = fpemu_create(core, -1, -1);
+    if (server->emu == NULL) {
+        free(server);
+        return NULL;
+    }
+    server->base = base;
+    fpemu_restore(server->emu, base);
+
+    return server;
+}
+
+void fork_server_destroy(struct ForkServer* server)
+{
+    if (server != NULL) {
+        fpemu_destroy(server->emu);
+        free(server);
+    }
+}
+
+/**
+ * One run from the base snapshot, with the given serial input following
+ * the input the snapshot had not read yet.  The input must stay until
+ * the next run.
+ */
+enum FpemuResult fork_server_run(
+        struct ForkServer* server, const uint8_t* input, size_t size,
+        uint64_t limit)
+{
+    struct CPU_Context* c = fpemu_context(server->emu);
+    enum FpemuResult result;
+
+    server->pages += fpemu_restore_dirty(server->emu, server->base);
+    serial_set_input(c->serial, input, size);
+    result = fpemu_run(server->emu, limit);
+
+    ++(server->runs);
+    server->instructions += c->instruction_count -
+                            server->base->h.instruction_count;
+    switch (result) {
+        case FpemuHalted:
+            ++(server->halted);
+            break;
+        case FpemuException:
+            ++(server->exceptions);
+            break;
+        default:
+            ++(server->limits);
+            break;
+    }
+    return result;
+}
+
+void fork_server_report(
+        const struct ForkServer* server, double seconds, FILE* outpf)
+{
+    double runs = (server->runs > 0) ? (double)server->runs : 1.0;
+
+    fprintf(outpf, "Fork server: %lu runs in %.3f s (%.0f executions/s), "
+                   "%.1f instructions and %.2f pages restored per run\n",
+            (unsigned long)server->runs, seconds,
+            (seconds > 0.0) ? (server->runs / seconds) : 0.0,
+            server->instructions / runs, server->pages / runs);
+    fprintf(outpf, "Fork server: %lu halted, %lu exceptions, "
+                   "%lu at the instruction limit\n",
+            (unsigned long)server->halted, (unsigned long)server->exceptions,
+            (unsigned long)server->limits);
+}
+
+/**
+ * The whole file in a malloc()ed buffer, NULL if it cannot be read.
+ */
+static char* read_input(const char* filename, size_t* size)
+{
+    FILE* inpf = fopen(filename, "r");
+    char* text = NULL;
+    size_t n;
+
+    *size = 0;
+    if (inpf == NULL) {
+        return NULL;
+    }
+    do {
+        char* bigger = realloc(text, *size + BUFSIZ);
+        if (bigger == NULL) {
+            free(text);
+            fclose(inpf);
+            return NULL;
+        }
+        text = bigger;
+        n = fread(text + *size, 1, BUFSIZ, inpf);
+        *size += n;
+    } while (n == BUFSIZ);
+    fclose(inpf);
+
+    return text;
+}
+
+static void free_inputs(char** names, char** inputs, size_t* sizes, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        free(names[i]);
+        free(inputs[i]);
+    }
+    free(names);
+    free(inputs);
+    free(sizes);
+}
+
+/**
+ * Run the base snapshot once for every file in the list, one name per
+ * line, with the file as serial input.  Runs that end in an exception or
+ * at the instruction limit are printed, then the executions per second.
+ *
+ * Returns EXIT_SUCCESS if the list could be read.
+ */
+int run_fork_server(
+        const struct FpemuSnapshot* base, enum CoreType core,
+        const char* list_file_name, uint64_t limit)
+{
+    static const char* separators = " \t\r\n";
+    char line[FORK_SERVER_MAX_LINE];
+    char** names = NULL;
+    char** inputs = NULL;
+    size_t* sizes = NULL;
+    size_t n = 0;
+    size_t allocated = 0;
+    struct ForkServer* server;
+    struct timespec start;
+    struct timespec end;
+    FILE* inpf = fopen(list_file_name, "r");
+
+    if (inpf == NULL) {
+        perror(list_file_name);
+        return EXIT_FAILURE;
+    }
+    /* Read all input first, only the runs are timed */
+    while (fgets(line, sizeof(line), inpf) != NULL) {
+        char* save = NULL;
+        char* comment = strchr(line, '#');
+        char* name;
+
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        name = strtok_r(line, separators, &save);
+        if (name == NULL) {
+            continue;
+        }
+        if (n == allocated) {
+            size_t size = (allocated == 0) ? 64 : 2 * allocated;
+            char** bigger_names = realloc(names, size * sizeof(char*));
+            char** bigger_inputs = realloc(inputs, size * sizeof(char*));
+            size_t* bigger_sizes = realloc(sizes, size * sizeof(size_t));
+            names = (bigger_names != NULL) ? bigger_names : names;
+            inputs = (bigger_inputs != NULL) ? bigger_inputs : inputs;
+            sizes = (bigger_sizes != NULL) ? bigger_sizes : sizes;
+            if ((bigger_names == NULL) || (bigger_inputs == NULL) ||
+                (bigger_sizes == NULL)) {
+                fprintf(stderr, "out of memory\n");
+                fclose(inpf);
+                free_inputs(names, inputs, sizes, n);
+                return EXIT_FAILURE;
+            }
+            allocated = size;
+        }
+        names[n] = strdup(name);
+        inputs[n] = read_input(name, &(sizes[n]));
+        if (inputs[n] == NULL) {
+            perror(name);
+            fclose(inpf);
+            free_inputs(names, inputs, sizes, n + 1);
+            return EXIT_FAILURE;
+        }
+        ++n;
+    }
+    fclose(inpf);
+
+    server = fork_server_create(core, base);
+    if (server == NULL) {
+        fprintf(stderr, "out of memory\n");
+        free_inputs(names, inputs, sizes, n);
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) {
+        enum FpemuResult result = fork_server_run(
+                server, (const uint8_t*)inputs[i], sizes[i], limit);
+        if (result != FpemuHalted) {
+            printf("%s: %s at %04x\n", names[i],
+                   (result == FpemuLimit) ? "instruction limit" :
+                   exception_descriptions[fpemu_exception(server->emu)],
+                   fpemu_pc(server->emu));
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fork_server_report(server, (end.tv_sec - start.tv_sec) +
+                       (end.tv_nsec - start.tv_nsec) / 1e9, stdout);
+    fork_server_destroy(server);
+    free_inputs(names, inputs, sizes, n);
+
+    return EXIT_SUCCESS;
+}
+
+/* ------------------------ end of file -------------------------------*/
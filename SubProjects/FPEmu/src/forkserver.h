@@ -0,0 +1,44 @@
+#ifndef HG_FORKSERVER_H
+#define HG_FORKSERVER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "snapshot.h"
+
+/* Longest line in a list of input files */
+#define FORK_SERVER_MAX_LINE 1024
+
+/**
+ * Runs a program many times from the same snapshot, each time with other
+ * serial input.  Between runs only the memory pages the program wrote
+ * are copied back, see fpemu_restore_dirty().
+ */
+struct ForkServer {
+    struct Fpemu* emu;
+    const struct FpemuSnapshot* base;
+    /* Statistics */
+    uint64_t runs;
+    uint64_t pages;          /* Copied back from the snapshot */
+    uint64_t instructions;
+    uint64_t halted;
+    uint64_t exceptions;
+    uint64_t limits;         /* Runs stopped at the instruction limit */
+};
+
+extern struct ForkServer* fork_server_create(
+        enum CoreType core, const struct FpemuSnapshot* base);
+extern void fork_server_destroy(struct ForkServer* server);
+extern enum FpemuResult fork_server_run(
+        struct ForkServer* server, const uint8_t* input, size_t size,
+        uint64_t limit);
+extern void fork_server_report(
+        const struct ForkServer* server, double seconds, FILE* outpf);
+extern int run_fork_server(
+        const struct FpemuSnapshot* base, enum CoreType core,
+        const char* list_file_name, uint64_t limit);
+
+#endif /* HG_FORKSERVER_H */
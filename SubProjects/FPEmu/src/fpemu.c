@@ -13,607 +13,292 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <ctype.h>
+#include <time.h>
+#include <errno.h>
 
 #include "fdisa.h"
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "blockcache.h"
+#include "seqstats.h"
+#include "serial.h"
+#include "batch.h"
+#include "forkserver.h"
+#include "snapshot.h"
+#include "symbols.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "trace.h"
+#include "breakpoints.h"
+#include "timetravel.h"
+#include "video.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "clocks.h"
+#include "idle.h"
+#ifdef FPEMU_JIT
+#include "jit_x64.h"
+#endif
 
-#define MEMORY_SIZE 65536
-#define DSTACK_SIZE 16
-#define RSTACK_SIZE 32
-#define CSTACK_SIZE 32
-#define TSTACK_SIZE 16
-#define MAX_STACK_SIZE 64
 #define FPEM_MAX_FILENAME_LEN 255
-
-/* Stack IDs */
-#define DATA_STACK    0x00
-#define RETURN_STACK  0x01
-#define CONTROL_STACK 0x02
-#define TEMP_STACK    0x03
-
-enum ExceptionCode {
-    AllIsOK = 0U,
-    StackOverflow,
-    StackUnderflow,
-    IllegalInstruction,
-    IllegalStackID
-};
-
-char* exception_descriptions[] = {
-    "All is OK",
-    "Stack overflow",
-    "Stack underflow",
-    "Illegal instruction",
-    "Illegal stack id"
-};
-
-struct Stack {
-    uint16_t top;
-    uint16_t size;
-    uint16_t values[MAX_STACK_SIZE];
-};
-
-struct CPU_Context {
-    bool keep_going;
-    bool single_step;
-    uint16_t exception;
-    struct Stack data_stack;
-    struct Stack return_stack;
-    struct Stack control_stack;
-    struct Stack temp_stack;
-    uint16_t pc;
-    uint16_t instruction;
-    int fd_in;
-    int fd_out;
-};
-
-static uint8_t* memory = NULL;
+/* Hardware time -f runs between two sleeps */
+#define THROTTLE_SLICE_MS 10
+
+static bool report_speed = false;
+static bool dump_on_halt = false;
+static bool halt_on_exception = false;  /* -E */
+static int32_t start_address = -1;  /* -1: the reset address */
+static struct SequenceStats* sequence_stats = NULL;
+static struct Profile* profile = NULL;
+static struct CallGraph* call_graph = NULL;
+static const char* folded_file_name = NULL;  /* -G */
+static struct Trace* trace = NULL;  /* -T */
+static struct Breakpoints* breakpoints = NULL;  /* Set in the monitor */
+static struct TimeTravel* time_travel = NULL;  /* -k */
+static struct Symbols* symbols = NULL;
+static const char* symbol_file_name = NULL;  /* -y, else from -r */
+static const char* serial_policy = NULL;
+static const char* video_file_name = NULL;  /* -V */
+static double clock_hz = 0.0;  /* -f, 0: as fast as the host can */
+static const char* batch_list = NULL;
+static unsigned batch_threads = 0;  /* 0: one per processor */
+static const char* snapshot_file_name = NULL;  /* -S */
+static const char* restore_file_name = NULL;   /* -R */
+static int32_t trigger_address = -1;  /* -1: snapshot when halted */
+static const char* fork_list = NULL;  /* -F */
+static uint64_t fork_limit = 1000000;
 
 /* --------------------------------------------------------------------*/
 
-static void push(struct CPU_Context* c, struct Stack* s, uint16_t value);
-static uint16_t pop(struct CPU_Context* c, struct Stack* s);
-static void cpu_reset(struct CPU_Context* c);
-static uint16_t fetch_instruction(uint8_t* memory, uint16_t pc);
-static void run(struct CPU_Context* c, uint8_t* memory);
-static uint8_t hex_get_byte(char* line, unsigned n);
-static bool load_hex(char* filename, uint8_t* memory);
+static void run(struct Fpemu* emu);
+static void run_throttled(struct Fpemu* emu);
+static uint64_t nanoseconds(const struct timespec* t);
+static void dump_state(const struct CPU_Context* c);
+static void report_break(struct Fpemu* emu);
+static bool load_hex(char* filename, struct Fpemu* emu);
+static bool save_snapshot(struct Fpemu* emu, const char* filename);
+static bool restore_snapshot(struct Fpemu* emu, const char* filename);
+static bool run_to(struct Fpemu* emu, uint16_t address);
+static int fork_runs(struct Fpemu* emu, enum CoreType core);
+static struct Symbols* load_symbols(const char* image_file_name);
 
 /* --------------------------------------------------------------------*/
 
-static void push(struct CPU_Context* c, struct Stack* s, uint16_t value)
+/**
+ * run the processor
+ */
+
+static void run(struct Fpemu* emu)
 {
-    s->values[s->top] = value;
-    (s->top)++;
-    if (s->top == s->size) {
-        c->keep_going = false;
-        c->exception = StackOverflow;
+    struct CPU_Context* c = fpemu_context(emu);
+    struct timespec start;
+    struct timespec end;
+    uint64_t count = c->instruction_count;
+    uint64_t clocks = c->clocks;
+    bool stopped = false;  /* At a breakpoint or watchpoint */
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (time_travel != NULL) {
+        if (c->single_step) {
+            time_travel_run(time_travel, emu, NULL, count + 1);
+        } else {
+            time_travel_run(time_travel, emu, breakpoints, UINT64_MAX);
+            stopped = breakpoints_active(breakpoints) &&
+                      (breakpoints->reason != BreakNone);
+        }
+    } else if (c->single_step) {
+        (void)fpemu_step(emu);
+    } else if (breakpoints_active(breakpoints)) {
+        /* The selected core checks them, and stops at a hit */
+        fpemu_set_breakpoints(emu, breakpoints);
+        if (clock_hz > 0.0) {
+            run_throttled(emu);
+        } else {
+            (void)fpemu_run(emu, UINT64_MAX);
+        }
+        fpemu_set_breakpoints(emu, NULL);
+        stopped = (breakpoints->reason != BreakNone);
+    } else if (sequence_stats != NULL) {
+        c->keep_going = true;
+        run_sequence_stats(c, fpemu_memory(emu), sequence_stats);
+    } else if (profile != NULL) {
+        c->keep_going = true;
+        run_profile(c, fpemu_memory(emu), profile);
+    } else if (call_graph != NULL) {
+        c->keep_going = true;
+        run_call_graph(c, fpemu_memory(emu), call_graph);
+    } else if (trace != NULL) {
+        c->keep_going = true;
+        run_trace(c, fpemu_memory(emu), trace);
+    } else if (clock_hz > 0.0) {
+        run_throttled(emu);
+    } else {
+        (void)fpemu_run(emu, UINT64_MAX);
     }
-}
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    serial_flush(c->serial);
 
-static uint16_t pop(struct CPU_Context* c, struct Stack* s)
-{
-    if (s->top == 0) {
-        c->keep_going = false;
-        c->exception = StackUnderflow;
-        return 0xDEAD;
+    if (stopped) {
+        report_break(emu);
+    } else if (!c->single_step) {
+        printf("Processor halted\n");
+        printf("ExceptionCode: %d (%s)\n",
+                c->exception, exception_descriptions[c->exception]);
+        if (c->exceptions_handled > 0) {
+            printf("Exceptions handled: %lu\n",
+                   (unsigned long)c->exceptions_handled);
+        }
+        printf("Last instruction: 0x%04X\n", c->instruction);
+        serial_report(c->serial, stdout);
+        video_report(c->video, stdout);
+        timers_report(c->timers, stdout);
+        interrupts_report(c->interrupts, stdout);
+        idle_report(c->idle, stdout);
+        if (c->block_cache != NULL) {
+            block_cache_report(c->block_cache, stdout);
+#ifdef FPEMU_JIT
+            if (c->block_cache->jit != NULL) {
+                jit_report(c->block_cache->jit, stdout);
+            }
+#endif
+        }
+        if (sequence_stats != NULL) {
+            sequence_stats_report(sequence_stats, stdout);
+        }
+        if (profile != NULL) {
+            profile_report(profile, symbols, stdout);
+        }
+        if (call_graph != NULL) {
+            call_graph_report(call_graph, symbols, stdout);
+            (void)call_graph_write_folded(call_graph, symbols,
+                                          folded_file_name);
+        }
+        if (dump_on_halt) {
+            dump_state(c);
+        }
+        if (report_speed) {
+            double seconds = (end.tv_sec - start.tv_sec) +
+                             (end.tv_nsec - start.tv_nsec) / 1e9;
+            double hz = (clock_hz > 0.0) ? clock_hz : CLOCK_HZ;
+            count = c->instruction_count - count;
+            clocks = c->clocks - clocks;
+            printf("Executed %lu instructions in %.3f s (%.2f MIPS)\n",
+                   (unsigned long)count, seconds,
+                   (seconds > 0.0) ? (count / seconds / 1e6) : 0.0);
+            printf("Took %lu clock cycles, %.2f times the speed of the "
+                   "hardware at %.2f MHz\n", (unsigned long)clocks,
+                   (seconds > 0.0) ? (clocks / seconds / hz) : 0.0,
+                   hz / 1e6);
+        }
     } else {
-        (s->top)--;
-        return s->values[s->top];
+        printf("Did one step, new address %04x\n", c->pc);
     }
 }
 
+/**
+ * Run at the -f clock frequency.  The processor runs a slice of
+ * THROTTLE_SLICE_MS of hardware time, then the host sleeps until its own
+ * clock catches up, so there is nothing to slow down the instructions
+ * themselves.  A host that falls behind by more than a slice does not
+ * try to catch up afterwards.
+ */
+static void run_throttled(struct Fpemu* emu)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    double slice = clock_hz * THROTTLE_SLICE_MS / 1000.0;  /* Clocks */
+    uint64_t late = (uint64_t)THROTTLE_SLICE_MS * 1000000;
+    struct timespec now;
+    uint64_t start;
+    uint64_t start_clocks = c->clocks;
+    enum FpemuResult result;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    start = nanoseconds(&now);
+    do {
+        /* The instructions for a slice, at the clocks per instruction
+         * so far */
+        double cpi = (c->instruction_count > 0) ?
+                     (double)c->clocks / c->instruction_count : 2.0;
+        uint64_t due;
+
+        result = fpemu_run(emu, (uint64_t)(slice / cpi) + 1);
+        due = start + (uint64_t)((c->clocks - start_clocks) * 1e9 /
+                                 clock_hz);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (nanoseconds(&now) > due + late) {
+            start = nanoseconds(&now);
+            start_clocks = c->clocks;
+        } else if ((result == FpemuLimit) && (nanoseconds(&now) < due)) {
+            struct timespec wake = {
+                .tv_sec = (time_t)(due / 1000000000),
+                .tv_nsec = (long)(due % 1000000000)
+            };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                   &wake, NULL) == EINTR) {
+                /* Interrupted by a signal, sleep the rest */
+            }
+        }
+    } while (result == FpemuLimit);
+}
 
-/* Perform CPU reset */
-static void cpu_reset(struct CPU_Context* c)
+static uint64_t nanoseconds(const struct timespec* t)
 {
-    c->data_stack.size    = DSTACK_SIZE;
-    c->data_stack.top     = 0U;
-    c->return_stack.size  = RSTACK_SIZE;
-    c->return_stack.top   = 0U;
-    c->control_stack.size = CSTACK_SIZE;
-    c->control_stack.top  = 0U;
-    c->temp_stack.size    = TSTACK_SIZE;
-    c->temp_stack.top     = 0U;
-
-    c->pc          = 0xF000;  /* program counter */
-    c->instruction = 0x0000;  /* current instruction */
-    c->keep_going  = true;
-    c->single_step = false;   /* Run on instruction then stop */
-    c->exception   = AllIsOK;
+    return (uint64_t)t->tv_sec * 1000000000 + (uint64_t)t->tv_nsec;
 }
 
 /**
- * Get pointer to the stack indicated by the stack ID.
+ * Where a breakpoint or watchpoint stopped the run, and the next
+ * instruction.
  */
-struct Stack* get_stack(struct CPU_Context* c, uint16_t stack_id)
+static void report_break(struct Fpemu* emu)
 {
-    struct Stack* stack;
-
-    switch (stack_id) {
-        case DATA_STACK:
-            stack = &(c->data_stack);
-            break;
-        case RETURN_STACK:
-            stack = &(c->return_stack);
-            break;
-        case CONTROL_STACK:
-            stack = &(c->control_stack);
+    static char code[FDA_MAX_CODE_LENGTH];
+    char name[SYMBOL_MAX_NAME + 16];
+    uint16_t pc = fpemu_pc(emu);
+    uint16_t instr = fetch_instruction(fpemu_memory(emu), pc);
+
+    symbols_format(symbols, breakpoints->address, name, sizeof(name));
+    switch (breakpoints->reason) {
+        case BreakRead:
+            printf("Watchpoint: read of %04x %s\n", breakpoints->address,
+                   name);
             break;
-        case TEMP_STACK:
-            stack = &(c->temp_stack);
+        case BreakWrite:
+            printf("Watchpoint: write to %04x %s\n", breakpoints->address,
+                   name);
             break;
         default:
-            stack = &(c->data_stack);
-            c->exception = IllegalStackID;
-            c->keep_going = false;
+            printf("Breakpoint at %04x %s\n", breakpoints->address, name);
+            break;
     }
-
-    return stack;
+    disassemble(instr, code, pc);
+    printf("%04x %04x %s\n", pc, instr, code);
 }
 
-static uint16_t fetch_instruction(
-        uint8_t* memory,
-        uint16_t pc)
-{
-    uint8_t msb;
-    uint8_t lsb;
-    uint16_t instruction;
-
-    /* little endian */
-    lsb = *(memory + pc);
-    msb = *(memory + pc + 1);
-
-    instruction = msb;
-    instruction = (instruction << 8) + lsb;
-
-    return instruction;
-}
-
-
 /**
- * run the processor
+ * Print everything the program can observe, used to compare cores.
  */
-
-static void run(struct CPU_Context* c, uint8_t* memory)
+static void dump_state(const struct CPU_Context* c)
 {
-    while(c->keep_going) {
-        c->instruction = fetch_instruction(memory, c->pc);
-
-        uint16_t group = (c->instruction & 0xF000);
-        // printf("%04x %04x\n", c->pc, c->instruction);
-        switch (group) {
-            case 0x4000:
-            case 0x5000:
-            case 0x6000:
-            case 0x7000:
-                {
-                    /* ENTER */
-                    struct Stack* stack = &(c->return_stack);
-                    uint16_t address = ((c->instruction & 0x3FFF) << 2);
-                    push(c, stack, (c->pc) + 2);
-                    c->pc = address;
-                }
-                break;
-            case 0x1000: /* BIF */
-                {
-                    uint16_t truth_value;
-                    struct Stack* stack = &(c->data_stack);
-                    truth_value = pop(c, stack);
-                    if (truth_value) {
-                        (c->pc) += 2;
-                    } else {
-                        int16_t offset = (c->instruction & 0x0FFF);
-                        if (offset & 0x0800) {
-                            /* sign extend */
-                            offset = offset | 0xF000;
-                        }
-                        if (offset < 0) {
-                            offset = (0 - offset);
-                            c->pc -= (uint16_t)offset;
-                        } else {
-                            c->pc += offset;
-                        }
-                    }
-                }
-                break;
-            case 0x8000:
-                {
-                    uint16_t func = (c->instruction & 0x0F00);
-                    switch (func) {
-                        case 0x0000: /* NOP */
-                            (c->pc) += 2;
-                            break;
-                        case 0x0100: /* LEAVE */
-                            {
-                                struct Stack* stack = &(c->return_stack);
-                                c->pc = pop(c, stack);
-                            }
-                            break;
-                        case 0x0200: /* HALT */
-                            (c->pc) += 2;
-                            c->keep_going = false;
-                            break;
-                        default:
-                            c->exception = IllegalInstruction;
-                            c->keep_going = false;
-                    }
-                    (c->pc) += 2;
-                }
-                break;
-            case 0xB000:
-                {
-                    uint16_t value;
-                    uint16_t value2;
-                    struct Stack* source_stack;
-                    struct Stack* target_stack;
-                    uint16_t func = (c->instruction & 0x0F00);
-                    uint16_t source_stack_id = (c->instruction & 0x00C0) >> 6;
-                    uint16_t target_stack_id   = (c->instruction & 0x0030) >> 4;
-                    source_stack = get_stack(c, source_stack_id);
-                    target_stack = get_stack(c, target_stack_id);
-                    switch (func) {
-                        case 0x0000: /* DROP */
-                            (void)pop(c, source_stack);
-                            break;
-                        case 0x0100: /* DUP */
-                            value = pop(c, source_stack);
-                            push(c, source_stack, value);
-                            push(c, source_stack, value);
-                            break;
-                        case 0x0200: /* SWAP */
-                            value = pop(c, source_stack);
-                            value2 = pop(c, source_stack);
-                            push(c, source_stack, value);
-                            push(c, source_stack, value2);
-                            break;
-                        case 0x0300: /* MOV */
-                            value = pop(c, source_stack);
-                            push(c, target_stack, value);
-                            break;
-                        default:
-                            c->exception = IllegalInstruction;
-                            c->keep_going = false;
-                    }
-                    (c->pc) += 2;
-                }
-                break;
-            case 0xC000: /* Load:  LDL */
-                {
-                    struct Stack* stack;
-                    uint16_t stack_id = (c->instruction & 0x0C00) >> 10;
-                    uint16_t value = (c->instruction & 0x03FF);
-                    stack = get_stack(c, stack_id);
-                    push(c, stack, value);
-                    (c->pc) += 2;
-                }
-                break;
-            case 0xD000: /* Load: LDH */
-                {
-                    struct Stack* stack;
-                    uint16_t value;
-                    uint16_t stack_id = (c->instruction & 0x0C00) >> 10;
-                    uint16_t high_bits_value = (c->instruction & 0x003F);
-                    stack = get_stack(c, stack_id);
-                    value = pop(c, stack);
-                    value = value | (high_bits_value << 10);
-                    push(c, stack, value);
-                    (c->pc) += 2;
-                }
-                break;
-            case 0xE000: /* 2 value operators */
-                {
-                    uint16_t func = (c->instruction & 0x0F80) >> 7;
-                    uint16_t is_signed = (c->instruction & 0x0010);
-                    struct Stack* stack = &(c->data_stack);
-                    switch (func) {
-                        case 0x00: /* ADD(U) */
-                            {
-                                if (is_signed) {
-                                    int16_t s1, s2;
-                                    s1 = pop(c, stack);
-                                    s2 = pop(c, stack);
-                                    s1 = s1 + s2;
-                                    push(c, stack, (uint16_t)s1);
-                                } else {
-                                    uint16_t u1, u2;
-                                    u1 = pop(c, stack);
-                                    u2 = pop(c, stack);
-                                    u1 = u1 + u2;
-                                    push(c, stack, u1);
-                                }
-                            }
-                            break;
-                        case 0x01: /* MUL(U) */
-                            {
-                                if (is_signed) {
-                                    int16_t s1, s2;
-                                    s1 = pop(c, stack);
-                                    s2 = pop(c, stack);
-                                    s1 = s1 * s2;
-                                    push(c, stack, (uint16_t)s1);
-                                } else {
-                                    uint16_t u1, u2;
-                                    u1 = pop(c, stack);
-                                    u2 = pop(c, stack);
-                                    u1 = u1 * u2;
-                                    push(c, stack, u1);
-                                }
-                            }
-                            break;
-                        case 0x03: /* EQ */
-                            {
-                                uint16_t t;
-                                uint16_t n1, n2;
-                                n1 = pop(c, stack);
-                                n2 = pop(c, stack);
-                                t = (n2 == n1) ? 0xFFFF : 0x0000;
-                                push(c, stack, t);
-                            }
-                            break;
-                        case 0x04: /* ASR */
-                            {
-                                int16_t r;
-                                if (is_signed) {
-                                    int16_t s1, s2;
-                                    s1 = (int16_t)pop(c, stack);
-                                    s2 = (int16_t)pop(c, stack);
-                                    r = (s2 >> s1);
-                                    push(c, stack, r);
-                                } else {
-                                    c->exception = IllegalInstruction;
-                                    c->keep_going = false;
-                                }
-                            }
-                            break;
-                        case 0x05: /* LT / LTU */
-                            {
-                                uint16_t t;
-                                if (is_signed) {
-                                    int16_t s1, s2;
-                                    s1 = (int16_t)pop(c, stack);
-                                    s2 = (int16_t)pop(c, stack);
-                                    t = (s2 < s1) ? 0xFFFF : 0x0000;
-                                } else {
-                                    uint16_t u1, u2;
-                                    u1 = pop(c, stack);
-                                    u2 = pop(c, stack);
-                                    t = (u2 < u1) ? 0xFFFF : 0x0000;
-                                }
-                                push(c, stack, t);
-                            }
-                            break;
-                        case 0x06: /* GT(U) */
-                            {
-                                uint16_t t;
-                                if (is_signed) {
-                                    int16_t s1, s2;
-                                    s1 = (int16_t)pop(c, stack);
-                                    s2 = (int16_t)pop(c, stack);
-                                    t = (s2 > s1) ? 0xFFFF : 0x0000;
-                                } else {
-                                    uint16_t u1, u2;
-                                    u1 = pop(c, stack);
-                                    u2 = pop(c, stack);
-                                    t = (u2 > u1) ? 0xFFFF : 0x0000;
-                                }
-                                push(c, stack, t);
-                            }
-                            break;
-                        case 0x07: /* LTE(U) */
-                            {
-                                uint16_t t;
-                                if (is_signed) {
-                                    int16_t s1, s2;
-                                    s1 = (int16_t)pop(c, stack);
-                                    s2 = (int16_t)pop(c, stack);
-                                    t = (s2 <= s1) ? 0xFFFF : 0x0000;
-                                } else {
-                                    uint16_t u1, u2;
-                                    u1 = pop(c, stack);
-                                    u2 = pop(c, stack);
-                                    t = (u2 <= u1) ? 0xFFFF : 0x0000;
-                                }
-                                push(c, stack, t);
-                            }
-                            break;
-                        case 0x08: /* GTE(U) */
-                            {
-                                uint16_t t;
-                                if (is_signed) {
-                                    int16_t s1, s2;
-                                    s1 = (int16_t)pop(c, stack);
-                                    s2 = (int16_t)pop(c, stack);
-                                    t = (s2 >= s1) ? 0xFFFF : 0x0000;
-                                } else {
-                                    uint16_t u1, u2;
-                                    u1 = pop(c, stack);
-                                    u2 = pop(c, stack);
-                                    t = (u2 >= u1) ? 0xFFFF : 0x0000;
-                                }
-                                push(c, stack, t);
-                            }
-                            break;
-                        case 0x09: /* LSR */
-                            {
-                                uint16_t r;
-                                uint16_t n1, n2;
-                                n1 = pop(c, stack);
-                                n2 = pop(c, stack);
-                                r = (n2 << n1);
-                                push(c, stack, r);
-                            }
-                            break;
-                        case 0x0A: /* LSL */
-                            {
-                                uint16_t r;
-                                uint16_t n1, n2;
-                                n1 = pop(c, stack);
-                                n2 = pop(c, stack);
-                                r = (n2 >> n1);
-                                push(c, stack, r);
-                            }
-                            break;
-                        case 0x0B: /* STO / ISTO */
-                            {
-                                uint16_t address;
-                                uint16_t n;
-                                uint8_t size;
-                                uint16_t is_io;
-                                n = pop(c, stack);
-                                address = pop(c, stack);
-                                size = (c->instruction) & 0x03;
-                                is_io = (c->instruction) & 0x40;
-                                if (is_io) {
-                                    if (size == 1) {
-                                        if (address == 0x00) {
-                                            char buffer[2];
-                                            buffer[0] = n;
-                                            write(c->fd_out, buffer, 1);
-                                        }
-                                    } else {
-                                        // TODO
-                                        c->exception = IllegalInstruction;
-                                        c->keep_going = false;
-                                    }
-                                } else {
-                                    /* TODO */
-                                    c->exception = IllegalInstruction;
-                                    c->keep_going = false;
-                                }
-                            }
-                            break;
-                        case 0x0D: /* AND */
-                            {
-                                uint16_t r;
-                                uint16_t n1, n2;
-                                n1 = pop(c, stack);
-                                n2 = pop(c, stack);
-                                r = (n2 & n1);
-                                push(c, stack, r);
-                            }
-                            break;
-                        case 0x0E: /* OR */
-                            {
-                                uint16_t r;
-                                uint16_t n1, n2;
-                                n1 = pop(c, stack);
-                                n2 = pop(c, stack);
-                                r = (n2 | n1);
-                                push(c, stack, r);
-                            }
-                            break;
-                        case 0x0F: /* XOR */
-                            {
-                                uint16_t r;
-                                uint16_t n1, n2;
-                                n1 = pop(c, stack);
-                                n2 = pop(c, stack);
-                                r = (n2 ^ n1);
-                                push(c, stack, r);
-                            }
-                            break;
-                        default:
-                            c->exception = IllegalInstruction;
-                            c->keep_going = false;
-                    }
-                    (c->pc) += 2;
-                }
-                break;
-            case 0xF000:
-                {
-                    uint16_t func = (c->instruction & 0x0F00) >> 8;
-                    struct Stack* stack = &(c->data_stack);
-
-                    switch (func) {
-                        case 0x00: /* NEG */
-                            {
-                                int16_t r;
-                                int16_t s1;
-                                s1 = pop(c, stack);
-                                r = 0 - s1;
-                                push(c, stack, r);
-                            }
-                            break;
-                        case 0x01: /* NOT */
-                            {
-                                uint16_t r;
-                                uint16_t n1;
-                                n1 = pop(c, stack);
-                                r = ~n1;
-                                push(c, stack, r);
-                            }
-                            break;
-                        case 0x02: /* RD / IRD */
-                            {
-                                uint16_t address;
-                                uint8_t size;
-                                uint16_t is_io;
-
-                                address = pop(c, stack);
-                                size = (c->instruction & 0x03);
-                                is_io = (c->instruction) & 0x40;
-                                if (is_io) {
-                                    if (size == 1) {
-                                        if (address == 0x0000) {
-
-                                        }
-                                    }
-                                    /* TODO */
-                                    c->exception = IllegalInstruction;
-                                    c->keep_going = false;
-                                } else {
-                                    if (size == 1) { /* byte */
-                                        uint8_t byte = *(memory + address);
-                                        uint16_t value = (uint16_t)byte;
-                                        push(c, stack, value);
-                                    } else {
-                                        c->exception = IllegalInstruction;
-                                        c->keep_going = false;
-                                    }
-                                }
-                            }
-                            break;
-                        default:
-                            // TODO
-                            c->exception = IllegalInstruction;
-                            c->keep_going = false;
-                            break;
-                    }
-                    (c->pc) += 2;
-                    break;
-                }
-            default:
-                c->exception = IllegalInstruction;
-                c->keep_going = false;
-                (c->pc) += 2;
-        }
-        /* In single step mode we only do one instruction at a time */
-        if (c->single_step) {
-            c->keep_going = false;
+    const struct Stack* stacks[4] = {
+        &(c->data_stack), &(c->return_stack),
+        &(c->control_stack), &(c->temp_stack)
+    };
+    const char* names[4] = { "D", "R", "C", "T" };
+
+    printf("PC: 0x%04X\n", c->pc);
+    printf("Instructions: %lu\n", (unsigned long)c->instruction_count);
+    printf("Clocks: %lu\n", (unsigned long)c->clocks);
+    for (unsigned i = 0; i < 4; ++i) {
+        printf("%s:", names[i]);
+        for (unsigned j = 0; j < stacks[i]->top; ++j) {
+            printf(" %04X", stacks[i]->values[j]);
         }
-    }
-    if (!c->single_step) {
-        printf("Processor halted\n");
-        printf("ExceptionCode: %d (%s)\n",
-                c->exception, exception_descriptions[c->exception]);
-        printf("Last instruction: 0x%04X\n", c->instruction);
-    } else {
-        printf("Did one step, new address %04x\n", c->pc);
+        printf("\n");
     }
 }
 
 
-static uint8_t hex_get_byte(char* line, unsigned n)
-{
-    char c1 = line[n];
-    char c2 = line[n+1];
-    uint8_t u1 = (uint8_t)((c1 > '9') ? (c1 - 'A' + 10) : (c1 - '0'));
-    uint8_t u2 = (uint8_t)((c2 > '9') ? (c2 - 'A' + 10) : (c2 - '0'));
-    return u1*16+u2;
-}
-
-#define INPF_BUFFER_SIZE 1024
-
 /**
  * Load a with fasm assembled file.
  *
@@ -621,7 +306,7 @@ static uint8_t hex_get_byte(char* line, unsigned n)
  *
  * Returns false otherwise.
  */
-static bool load_hex(char* filename, uint8_t* memory)
+static bool load_hex(char* filename, struct Fpemu* emu)
 {
     bool ok;
     FILE *inpf;
@@ -631,48 +316,116 @@ static bool load_hex(char* filename, uint8_t* memory)
         perror("fopen");
         ok = false;
     } else {
-        char buffer[INPF_BUFFER_SIZE + 2];
-        char* line;
+        char* text = NULL;
+        size_t size = 0;
+        size_t n;
         ok = true;
-        line = fgets(buffer, INPF_BUFFER_SIZE, inpf);
-        while (line != NULL) {
-            uint8_t* address;
-            uint16_t location;
-            if (line[0] != ':') {
-                /* Ignore */
-            } else {
-                int n = strlen(line);
-                if (n < 11) {
-                    fprintf(stderr, "line in .hex is too short\n");
-                    ok = false;
-                    break;
-                } else {
-                    // TODO Check-sum check
-                    uint8_t count = hex_get_byte(line, 1);
-                    location = hex_get_byte(line, 3);
-                    location = location << 8;
-                    location += hex_get_byte(line, 5);
-                    uint8_t type = hex_get_byte(line, 7);
-                    if (type == 0) {
-                        address = (memory + location);
-                        for (uint8_t i = 0; i < count; ++i) {
-                            uint8_t value = hex_get_byte(line, 9 + 2*i);
-                            address[i] = (uint16_t)value;
-                        }
-                    } else if (type == 1) {
-                        /* End of data */
-                        break;
-                    }
-                }
+        do {
+            char* bigger = realloc(text, size + BUFSIZ);
+            if (bigger == NULL) {
+                fprintf(stderr, "out of memory\n");
+                ok = false;
+                break;
             }
-            line = fgets(buffer, INPF_BUFFER_SIZE, inpf);
+            text = bigger;
+            n = fread(text + size, 1, BUFSIZ, inpf);
+            size += n;
+        } while (n == BUFSIZ);
+        if (ok) {
+            ok = fpemu_load_hex(emu, text, size);
         }
+        free(text);
         fclose(inpf);
     }
 
     return ok;
 }
 
+/**
+ * Write a snapshot of the whole machine to a file.
+ */
+static bool save_snapshot(struct Fpemu* emu, const char* filename)
+{
+    struct FpemuSnapshot* snapshot = fpemu_snapshot(emu);
+    bool ok = (snapshot != NULL) && fpemu_snapshot_write(snapshot, filename);
+
+    fpemu_snapshot_free(snapshot);
+    if (ok) {
+        printf("Snapshot at %04x saved to %s\n", fpemu_pc(emu), filename);
+    }
+    return ok;
+}
+
+static bool restore_snapshot(struct Fpemu* emu, const char* filename)
+{
+    struct FpemuSnapshot* snapshot = fpemu_snapshot_map(filename);
+
+    if (snapshot == NULL) {
+        return false;
+    }
+    fpemu_restore(emu, snapshot);
+    fpemu_snapshot_free(snapshot);
+    printf("Restored %s\n", filename);
+    return true;
+}
+
+/**
+ * Single step until the pc is address.  Returns false if the processor
+ * stopped before that.
+ */
+static bool run_to(struct Fpemu* emu, uint16_t address)
+{
+    enum FpemuResult result = FpemuLimit;
+
+    while ((result == FpemuLimit) && (fpemu_pc(emu) != address)) {
+        result = fpemu_step(emu);
+    }
+    return result == FpemuLimit;
+}
+
+/**
+ * Run the state the emulator is in now with every input in the -F list.
+ */
+static int fork_runs(struct Fpemu* emu, enum CoreType core)
+{
+    struct FpemuSnapshot* base = fpemu_snapshot(emu);
+    int status;
+
+    if (base == NULL) {
+        fprintf(stderr, "No memory for the snapshot\n");
+        return EXIT_FAILURE;
+    }
+    status = run_fork_server(base, core, fork_list, fork_limit);
+    fpemu_snapshot_free(base);
+
+    return status;
+}
+
+/**
+ * The -y symbol file, or else the one fa wrote next to the hex file.
+ * NULL if there is none.
+ */
+static struct Symbols* load_symbols(const char* image_file_name)
+{
+    char name[FPEM_MAX_FILENAME_LEN + 8];
+    size_t length = strlen(image_file_name);
+    struct Symbols* loaded;
+
+    if (symbol_file_name != NULL) {
+        loaded = symbols_load(symbol_file_name);
+        if (loaded == NULL) {
+            perror(symbol_file_name);
+        }
+        return loaded;
+    }
+    if ((length < 4) || (strcmp(image_file_name + length - 4, ".hex") != 0)) {
+        return NULL;
+    }
+    snprintf(name, sizeof(name), "%.*s.sym", (int)(length - 4),
+             image_file_name);
+    return symbols_load(name);
+}
+
 
 #define FPEM_WORDSIZE (60)
 #define FPEM_MAX_COMMAND_LINE_SIZE (3*FPEM_WORDSIZE)
@@ -711,8 +464,24 @@ static void parse_command_line(char* cl, ParameterSet* p)
 }
 
 
-static void monitor(struct CPU_Context* context, uint8_t* memory)
+/**
+ * Create the breakpoints the first time one is set.
+ */
+static bool breakpoints_ready(void)
+{
+    if (breakpoints == NULL) {
+        breakpoints = breakpoints_create();
+        if (breakpoints == NULL) {
+            printf("No memory for breakpoints\n");
+        }
+    }
+    return breakpoints != NULL;
+}
+
+static void monitor(struct Fpemu* emu)
 {
+    struct CPU_Context* context = fpemu_context(emu);
+    uint8_t* memory = fpemu_memory(emu);
     static char code[FDA_MAX_CODE_LENGTH];
     static char commandline[FPEM_MAX_COMMAND_LINE_SIZE + 2];
     static ParameterSet p;
@@ -722,7 +491,10 @@ static void monitor(struct CPU_Context* context, uint8_t* memory)
     char command = 'h';
 
     while (do_monitor) {
-        fgets(commandline, FPEM_MAX_COMMAND_LINE_SIZE, stdin);
+        if (fgets(commandline, FPEM_MAX_COMMAND_LINE_SIZE, stdin) == NULL) {
+            /* End of input */
+            break;
+        }
 
         parse_command_line(commandline, &p);
         if (p.number_of_words > 0) {
@@ -748,7 +520,7 @@ static void monitor(struct CPU_Context* context, uint8_t* memory)
                     context->keep_going = true;
                     address = strtol(p.par1, NULL, 16);
                     printf("run %04x\n", address);
-                    run(context, memory);
+                    run(emu);
                 }
                 break;
             case 'd':
@@ -802,12 +574,25 @@ static void monitor(struct CPU_Context* context, uint8_t* memory)
                     printf("l <filename>        -- load hex file\n");
                     printf("q                   -- quit\n");
                     printf("p <address>         -- set program counter\n");
+                    printf("S <filename>        -- save snapshot\n");
+                    printf("R <filename>        -- restore snapshot\n");
+                    printf("b [address]         -- breakpoint, or list\n");
+                    printf("w <address> [count] -- watch writes to memory\n");
+                    printf("a <address> [count] -- watch reads and writes\n");
+                    printf("c [address]         -- clear the breakpoint or\n");
+                    printf("                       watchpoint, or all\n");
+                    printf("u                   -- step back (with -k)\n");
+                    printf("U                   -- run back to the last\n");
+                    printf("                       break- or watchpoint\n");
                 }
                 break;
             case 'p':
                 {
                     address = strtol(p.par1, NULL, 16);
                     context->pc = address;
+                    if (time_travel != NULL) {
+                        time_travel_reset(time_travel, emu);
+                    }
                     printf("PC set to %04x\n", address);
                     uint16_t instr = fetch_instruction(memory, address);
                     disassemble((uint16_t)instr, code, address);
@@ -818,13 +603,93 @@ static void monitor(struct CPU_Context* context, uint8_t* memory)
                 {
                     context->keep_going = true;
                     context->single_step = true;
-                    run(context, memory);
+                    run(emu);
                     address = context->pc;
                     uint16_t instr = fetch_instruction(memory, address);
                     disassemble((uint16_t)instr, code, address);
                     printf("%04x %04x %s\n", address, (uint16_t)instr, code);
                 }
                 break;
+            case 'S':
+                (void)save_snapshot(emu, p.par1);
+                break;
+            case 'R':
+                if (restore_snapshot(emu, p.par1)) {
+                    if (time_travel != NULL) {
+                        time_travel_reset(time_travel, emu);
+                    }
+                    address = context->pc;
+                    printf("PC is %04x\n", address);
+                }
+                break;
+            case 'b':
+                if (p.par1[0] == '\0') {
+                    if (breakpoints != NULL) {
+                        breakpoints_list(breakpoints, symbols, stdout);
+                    }
+                } else if (breakpoints_ready()) {
+                    address = strtol(p.par1, NULL, 16) & 0xFFFE;
+                    breakpoint_set(breakpoints, address);
+                    printf("Breakpoint at %04x\n", address);
+                }
+                break;
+            case 'w':
+            case 'a':
+                if (breakpoints_ready()) {
+                    uint8_t kinds = (command == 'a') ?
+                                    (WATCH_READ | WATCH_WRITE) : WATCH_WRITE;
+                    uint16_t size = (p.par2[0] == '\0') ?
+                                    1 : strtol(p.par2, NULL, 16);
+                    address = strtol(p.par1, NULL, 16);
+                    if (watchpoint_set(breakpoints, address, size, kinds)) {
+                        printf("Watching %04x %u\n", address, size);
+                    } else {
+                        printf("No more than %d watchpoints\n",
+                               MAX_WATCHPOINTS);
+                    }
+                }
+                break;
+            case 'c':
+                if (breakpoints == NULL) {
+                    /* Nothing set */
+                } else if (p.par1[0] == '\0') {
+                    breakpoints_clear_all(breakpoints);
+                    printf("Cleared all\n");
+                } else {
+                    bool cleared;
+                    address = strtol(p.par1, NULL, 16);
+                    cleared = watchpoint_clear(breakpoints, address);
+                    cleared = breakpoint_clear(breakpoints, address & 0xFFFE) ||
+                              cleared;
+                    printf("%s %04x\n", cleared ? "Cleared" : "Nothing at",
+                           address);
+                }
+                break;
+            case 'u':
+            case 'U':
+                if (time_travel == NULL) {
+                    printf("Time travel needs -k\n");
+                    break;
+                }
+                if (command == 'u') {
+                    if (!time_travel_step_back(time_travel, emu)) {
+                        printf("At the oldest checkpoint\n");
+                    }
+                } else if (time_travel_run_back(time_travel, emu,
+                                                breakpoints)) {
+                    report_break(emu);
+                } else {
+                    printf("Back at the oldest checkpoint\n");
+                }
+                address = context->pc;
+                printf("%lu instructions\n",
+                       (unsigned long)context->instruction_count);
+                {
+                    uint16_t instr = fetch_instruction(memory, address);
+                    disassemble((uint16_t)instr, code, address);
+                    printf("%04x %04x %s\n", address, (uint16_t)instr, code);
+                }
+                break;
             case 'q':
                 do_monitor = false;
                 break;
@@ -844,6 +709,63 @@ static void display_usage(void)
            "     -i <filename>  Device to for serial data input\n"
            "     -o <filename>  Device to use for serial data ouput\n"
            "     -m             Start in the monitor\n"
+           "     -c <core>      Execution core: switch (default), tos, block,\n"
+           "                    fused, table"
+#ifdef FPEMU_THREADED
+           ", threaded"
+#endif
+#ifdef FPEMU_JIT
+           ", jit"
+#endif
+           "\n"
+           "     -b             Report instructions executed, MIPS, and the\n"
+           "                    speed compared to the hardware\n"
+           "     -f <MHz>       Run at this clock frequency, not as fast as\n"
+           "                    possible (12 is assumed for the hardware)\n"
+           "     -p <address>   Start address (hex), instead of the reset address\n"
+           "     -d             Dump the processor state when it halts\n"
+           "     -E             Halt on exceptions, ignore the exception\n"
+           "                    vectors at 0002, 0004 and 0006\n"
+           "     -w <policy>    Serial output flush policy, comma separated:\n"
+           "                    each, newline, idle, full, <cycles>\n"
+           "                    (default newline,idle)\n"
+           "     -s             Report the most frequent instruction sequences,\n"
+           "                    runs the switch core\n"
+           "     -l <filename>  Run the images in a list on a thread pool, one\n"
+           "                    per line: <hex> [<limit> [<expected output>\n"
+           "                    [<serial input> [<stop>]]]], the stop is halt\n"
+           "                    or an exception, as in StackOverflow, no -i,\n"
+           "                    -o, -r needed\n"
+           "     -j <threads>   Threads for -l (default one per processor)\n"
+           "     -R <filename>  Start from a snapshot instead of a hex file\n"
+           "     -S <filename>  Save a snapshot when the processor halts, or\n"
+           "                    at the -t address\n"
+           "     -t <address>   Run up to this address (hex), save the -S\n"
+           "                    snapshot there and stop\n"
+           "     -F <filename>  Fuzz: run from the loaded state, or the -t\n"
+           "                    address, once for each serial input file in\n"
+           "                    a list, and report executions per second\n"
+           "     -n <count>     Instruction limit per -F run (default 1000000)\n"
+           "     -P             Report the most executed addresses and labels,\n"
+           "                    runs the switch core\n"
+           "     -y <filename>  Symbol file from fa -s, default: the -r file\n"
+           "                    with .sym instead of .hex\n"
+           "     -G <filename>  Report time per subroutine and per call, and\n"
+           "                    write folded stacks for flame graphs to the\n"
+           "                    file, runs the switch core\n"
+           "     -T <filename>  Write a binary trace of every instruction,\n"
+           "                    print it with fptrace, runs the switch core\n"
+           "     -k <kilobytes> Keep checkpoints of up to this size, to step\n"
+           "                    back in the monitor, runs the switch core\n"
+           "     -V <filename>  Write the video frames to the file, raw RGBA,\n"
+           "                    or with a %lu in the name to one PPM each\n"
+           "Idle loops:\n"
+           "   A loop that only polls the serial input status is skipped up\n"
+           "   to the next timer or vsync event while no input comes.  The\n"
+           "   instruction and clock counts go up as if it ran, and fpemu\n"
+           "   waits for input meanwhile, as long as the loop would take at\n"
+           "   12 MHz or at the -f frequency.  Not while breakpoints or\n"
+           "   watchpoints are set in the monitor.\n"
           );
 }
 
@@ -853,15 +775,17 @@ static void parse_options(
         char* input_file_name,
         char* output_file_name,
         char* memory_image_file_name,
-        bool* start_in_monitor
+        bool* start_in_monitor,
+        enum CoreType* core
         )
 {
     char c;
     output_file_name[0] = '\0';
     input_file_name[0] = '\0';
     *start_in_monitor = false;
+    *core = CoreSwitch;
 
-    while ((c = getopt(argc, argv, "hmi:o:r:")) != EOF) {
+    while ((c = getopt(argc, argv, "hmbdEsPi:o:r:c:p:w:l:j:R:S:t:F:n:y:G:T:k:V:f:")) != EOF) {
         switch (c) {
         case 'h':
             display_usage();
@@ -870,6 +794,83 @@ static void parse_options(
         case 'm':
             *start_in_monitor = true;
             break;
+        case 'b':
+            report_speed = true;
+            break;
+        case 'd':
+            dump_on_halt = true;
+            break;
+        case 'E':
+            halt_on_exception = true;
+            break;
+        case 's':
+            sequence_stats = sequence_stats_create();
+            if (sequence_stats == NULL) {
+                fprintf(stderr, "No memory for sequence statistics\n");
+            }
+            break;
+        case 'P':
+            profile = profile_create();
+            if (profile == NULL) {
+                fprintf(stderr, "No memory for the profile\n");
+            }
+            break;
+        case 'G':
+            folded_file_name = optarg;
+            call_graph = call_graph_create();
+            if (call_graph == NULL) {
+                fprintf(stderr, "No memory for the call graph\n");
+            }
+            break;
+        case 'T':
+            trace = trace_create(optarg);
+            if (trace == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'k':
+            time_travel = time_travel_create(
+                    (size_t)strtoul(optarg, NULL, 0) * 1024);
+            if (time_travel == NULL) {
+                fprintf(stderr, "No memory for time travel\n");
+            }
+            break;
+        case 'V':
+            video_file_name = optarg;
+            break;
+        case 'f':
+            clock_hz = strtod(optarg, NULL) * 1e6;
+            break;
+        case 'y':
+            symbol_file_name = optarg;
+            break;
+        case 'p':
+            start_address = strtol(optarg, NULL, 16) & 0xFFFF;
+            break;
+        case 'w':
+            serial_policy = optarg;
+            break;
+        case 'l':
+            batch_list = optarg;
+            break;
+        case 'j':
+            batch_threads = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            restore_file_name = optarg;
+            break;
+        case 'S':
+            snapshot_file_name = optarg;
+            break;
+        case 't':
+            trigger_address = strtol(optarg, NULL, 16) & 0xFFFF;
+            break;
+        case 'F':
+            fork_list = optarg;
+            break;
+        case 'n':
+            fork_limit = strtoull(optarg, NULL, 0);
+            break;
         case 'o':
             strncpy(output_file_name, optarg, FPEM_MAX_FILENAME_LEN);
             break;
@@ -879,6 +880,30 @@ static void parse_options(
         case 'r':
             strncpy(memory_image_file_name, optarg, FPEM_MAX_FILENAME_LEN);
             break;
+        case 'c':
+            if (strcmp(optarg, "switch") == 0) {
+                *core = CoreSwitch;
+            } else if (strcmp(optarg, "tos") == 0) {
+                *core = CoreTos;
+            } else if (strcmp(optarg, "block") == 0) {
+                *core = CoreBlock;
+            } else if (strcmp(optarg, "fused") == 0) {
+                *core = CoreFused;
+            } else if (strcmp(optarg, "table") == 0) {
+                *core = CoreTable;
+#ifdef FPEMU_THREADED
+            } else if (strcmp(optarg, "threaded") == 0) {
+                *core = CoreThreaded;
+#endif
+#ifdef FPEMU_JIT
+            } else if (strcmp(optarg, "jit") == 0) {
+                *core = CoreJit;
+#endif
+            } else {
+                fprintf(stderr, "Unknown core: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
             break;
         }
@@ -887,58 +912,110 @@ static void parse_options(
 
 int main(int argc, char** argv)
 {
-    struct CPU_Context c;
-    memory = (uint8_t *)malloc(MEMORY_SIZE);
     static char input_file_name[FPEM_MAX_FILENAME_LEN + 2];
     static char output_file_name[FPEM_MAX_FILENAME_LEN + 2];
     static char memory_image_file_name[FPEM_MAX_FILENAME_LEN + 2];
+    int fd_in;   /* input channel from terminal */
+    int fd_out;  /* ouput channel to the terminal */
+    bool start_in_monitor;
+    enum CoreType core;
+    int status = EXIT_SUCCESS;
+
+    parse_options(
+            argc, argv,
+            input_file_name, output_file_name,
+            memory_image_file_name,
+            &start_in_monitor,
+            &core
+            );
+    symbols = load_symbols(memory_image_file_name);
+
+    if (batch_list != NULL) {
+        if (batch_threads == 0) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            batch_threads = (n > 0) ? (unsigned)n : 1;
+        }
+        return run_batch(batch_list, core, start_address, batch_threads);
+    }
 
-    if (memory == NULL) {
-        printf("Memory allocation failed\n");
-    } else {
-        int fd_in;   /* input channel from terminal */
-        int fd_out;  /* ouput channel to the terminal */
-        bool start_in_monitor;
-
-        explicit_bzero(memory, MEMORY_SIZE);
-        parse_options(
-                argc, argv,
-                input_file_name, output_file_name,
-                memory_image_file_name,
-                &start_in_monitor
-                );
-
-        if ((input_file_name[0] != '\0') &&
-            (output_file_name[0] != '\0') &&
-            (memory_image_file_name[0] != '\0')) {
-
-            fd_in = open(input_file_name, O_RDONLY);
-            if (fd_in >= 0) {
-                fd_out = open(output_file_name, O_WRONLY);
-                if (fd_out >= 0) {
-                    if (load_hex(memory_image_file_name, memory)) {
-                        printf("Loading completed\n");
-                        char* starting = "FPEMU V0.0001\r\n\r\n";
-                        unsigned n = strlen(starting);
-                        c.fd_in = fd_in;
-                        c.fd_out = fd_out;
-                        write(fd_out, starting, n);
-                        cpu_reset(&c);
-                        if (start_in_monitor) {
-                            monitor(&c, memory);
-                        } else {
-                            run(&c, memory);
+    if ((input_file_name[0] != '\0') &&
+        (output_file_name[0] != '\0') &&
+        ((memory_image_file_name[0] != '\0') ||
+         (restore_file_name != NULL))) {
+
+        fd_in = open(input_file_name, O_RDONLY);
+        if (fd_in >= 0) {
+            fd_out = open(output_file_name, O_WRONLY);
+            if (fd_out >= 0) {
+                struct Fpemu* emu = fpemu_create(core, fd_in, fd_out);
+                if (emu == NULL) {
+                    printf("Memory allocation failed\n");
+                } else if ((restore_file_name != NULL) ?
+                           restore_snapshot(emu, restore_file_name) :
+                           load_hex(memory_image_file_name, emu)) {
+                    struct CPU_Context* c = fpemu_context(emu);
+                    printf("Loading completed\n");
+                    c->halt_on_exception = halt_on_exception;
+                    if (clock_hz > 0.0) {
+                        fpemu_set_clock(emu, clock_hz);
+                    }
+                    char* starting = "FPEMU V0.0001\r\n\r\n";
+                    unsigned n = strlen(starting);
+                    if ((serial_policy != NULL) &&
+                        !serial_set_policy(c->serial, serial_policy)) {
+                        fprintf(stderr, "Unknown flush policy: %s\n",
+                                serial_policy);
+                        exit(EXIT_FAILURE);
+                    }
+                    if ((video_file_name != NULL) &&
+                        !video_set_output(c->video, video_file_name)) {
+                        exit(EXIT_FAILURE);
+                    }
+                    write(fd_out, starting, n);
+                    if (start_address >= 0) {
+                        fpemu_set_pc(emu, (uint16_t)start_address);
+                    }
+                    bool ready = true;
+                    if (trigger_address >= 0) {
+                        ready = run_to(emu, (uint16_t)trigger_address);
+                        if (!ready) {
+                            printf("Processor halted before %04x\n",
+                                   (uint16_t)trigger_address);
+                        } else if (snapshot_file_name != NULL) {
+                            (void)save_snapshot(emu, snapshot_file_name);
                         }
-                    } else { fprintf(stderr, "could not load program\n"); }
-
-                } else { perror("open:"); }
-                close(fd_in);
+                    }
+                    if (fork_list != NULL) {
+                        if (ready) {
+                            status = fork_runs(emu, core);
+                        }
+                    } else if (trigger_address >= 0) {
+                        /* Stopped at the trigger */
+                    } else if (start_in_monitor) {
+                        monitor(emu);
+                    } else {
+                        run(emu);
+                        if (snapshot_file_name != NULL) {
+                            (void)save_snapshot(emu, snapshot_file_name);
+                        }
+                    }
+                } else { fprintf(stderr, "could not load program\n"); }
+                fpemu_destroy(emu);
+                sequence_stats_destroy(sequence_stats);
+                profile_destroy(profile);
+                call_graph_destroy(call_graph);
+                breakpoints_destroy(breakpoints);
+                time_travel_destroy(time_travel);
+                if (!trace_close(trace)) {
+                    status = EXIT_FAILURE;
+                }
+                symbols_destroy(symbols);
             } else { perror("open:"); }
-        } else { printf("Options -i, -o, -r are all needed\n"); }
-        free(memory);
-    }
+            close(fd_in);
+        } else { perror("open:"); }
+    } else { printf("Options -i, -o, and -r or -R are all needed\n"); }
 
-    return EXIT_SUCCESS;
+    return status;
 }
 
 /* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,223 @@
+#ifndef HG_FPEMU_H
+#define HG_FPEMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define MEMORY_SIZE 65536
+#define DSTACK_SIZE 16
+#define RSTACK_SIZE 32
+#define CSTACK_SIZE 32
+#define TSTACK_SIZE 16
+#define MAX_STACK_SIZE 64
+/* Granularity of the tracking of written memory, see mark_dirty() */
+#define DIRTY_PAGE_SIZE 256
+#define DIRTY_PAGES (MEMORY_SIZE / DIRTY_PAGE_SIZE)
+
+/* Page 0 holds pointers to the exception handlers, 0 for none */
+#define VECTOR_STACK_OVERFLOW      0x0002
+#define VECTOR_STACK_UNDERFLOW     0x0004
+#define VECTOR_ILLEGAL_INSTRUCTION 0x0006
+
+/* Stack IDs */
+#define DATA_STACK    0x00
+#define RETURN_STACK  0x01
+#define CONTROL_STACK 0x02
+#define TEMP_STACK    0x03
+
+enum ExceptionCode {
+    AllIsOK = 0U,
+    StackOverflow,
+    StackUnderflow,
+    IllegalInstruction,
+    IllegalStackID
+};
+
+/* Available execution cores */
+enum CoreType {
+    CoreSwitch = 0U,  /* Reference interpreter, decodes every instruction */
+    CoreBlock,        /* Predecoded basic-block cache */
+    CoreThreaded,     /* Direct threaded, needs FPEMU_THREADED */
+    CoreTable,        /* One specialized handler per instruction word */
+    CoreJit,          /* Block cache plus x86-64 JIT, needs FPEMU_JIT */
+    CoreFused,        /* Block cache with superinstructions */
+    CoreTos           /* Top of the data and return stacks cached */
+};
+
+extern char* exception_descriptions[];
+
+struct Stack {
+    uint16_t top;
+    uint16_t size;
+    uint16_t values[MAX_STACK_SIZE];
+};
+
+struct BlockCache;
+struct ThreadedCode;
+struct Breakpoints;
+struct Serial;
+struct IoBus;
+struct Video;
+struct Scheduler;
+struct Timers;
+struct Interrupts;
+struct IdleLoop;
+
+struct CPU_Context {
+    bool keep_going;
+    bool single_step;
+    uint16_t exception;
+    struct Stack data_stack;
+    struct Stack return_stack;
+    struct Stack control_stack;
+    struct Stack temp_stack;
+    uint16_t pc;
+    uint16_t instruction;
+    uint64_t instruction_count;  /* Instructions executed since reset */
+    uint64_t clocks;             /* Clock cycles of the hardware for them,
+                                    see instruction_clocks() */
+    /* Cores return, with keep_going still set, once instruction_count
+     * reaches this.  UINT64_MAX: no limit. */
+    uint64_t instruction_limit;
+    int fd_in;
+    int fd_out;
+    struct Serial* serial;           /* Buffered output to fd_out */
+    struct IoBus* io;                /* IRD and ISTO go here */
+    struct Video* video;             /* Graphics RAM on the IO bus */
+    struct Scheduler* scheduler;     /* Device events, see cpu_cycles() */
+    struct Timers* timers;
+    struct Interrupts* interrupts;
+    struct IdleLoop* idle;           /* Loops that only poll for input */
+    /* Stopped only because a device scheduled an event before the
+     * instruction limit, see run_scheduled() */
+    bool yield;
+    /* Stop on every exception, as before there were exception vectors */
+    bool halt_on_exception;
+    uint64_t exceptions_handled;     /* Handlers entered since reset */
+    enum CoreType core;
+    struct BlockCache* block_cache;  /* CoreBlock, CoreFused and CoreJit */
+    struct ThreadedCode* threaded_code;  /* Only used by CoreThreaded */
+    /* Checked by every core during a run, NULL: none, see
+     * fpemu_set_breakpoints() */
+    struct Breakpoints* breakpoints;
+    /* Pages written since the last snapshot restore, or time travel
+     * checkpoint, one bit per page */
+    uint64_t dirty_pages[DIRTY_PAGES / 64];
+};
+
+/* --------------------------------------------------------------------*/
+
+static inline void push(struct CPU_Context* c, struct Stack* s, uint16_t value)
+{
+    s->values[s->top] = value;
+    (s->top)++;
+    if (s->top == s->size) {
+        c->keep_going = false;
+        c->exception = StackOverflow;
+    }
+}
+
+static inline uint16_t pop(struct CPU_Context* c, struct Stack* s)
+{
+    if (s->top == 0) {
+        c->keep_going = false;
+        c->exception = StackUnderflow;
+        return 0xDEAD;
+    } else {
+        (s->top)--;
+        return s->values[s->top];
+    }
+}
+
+/**
+ * Remember that memory was written, so fpemu_restore_dirty() only has to
+ * copy back these pages.  Every write to memory must call this.  Only
+ * the pages of the first and the last byte are marked, size must not be
+ * more than DIRTY_PAGE_SIZE.
+ */
+static inline void mark_dirty(
+        struct CPU_Context* c, uint16_t address, uint16_t size)
+{
+    uint16_t first = address / DIRTY_PAGE_SIZE;
+    uint16_t last = (uint16_t)(address + size - 1) / DIRTY_PAGE_SIZE;
+
+    c->dirty_pages[first / 64] |= (uint64_t)1 << (first % 64);
+    c->dirty_pages[last / 64] |= (uint64_t)1 << (last % 64);
+}
+
+/**
+ * The cycle counter of the scheduler.  One cycle per instruction, all
+ * cores keep the count exact where they check the instruction limit.
+ * The clock cycles of the hardware are in c->clocks, they are only
+ * brought up to date at the end of a block.
+ */
+static inline uint64_t cpu_cycles(const struct CPU_Context* c)
+{
+    return c->instruction_count;
+}
+
+static inline uint16_t fetch_instruction(uint8_t* memory, uint16_t pc)
+{
+    uint8_t msb;
+    uint8_t lsb;
+    uint16_t instruction;
+
+    /* little endian */
+    lsb = *(memory + pc);
+    msb = *(memory + (uint16_t)(pc + 1));
+
+    instruction = msb;
+    instruction = (instruction << 8) + lsb;
+
+    return instruction;
+}
+
+/**
+ * Little endian words at any address, odd ones included.  A word at the
+ * last address wraps around to 0x0000.  Unaligned host loads and stores
+ * are done with memcpy().
+ */
+static inline uint16_t read_word(const uint8_t* memory, uint16_t address)
+{
+    uint16_t value;
+
+    if (address == MEMORY_SIZE - 1) {
+        return (uint16_t)(memory[address] | (memory[0] << 8));
+    }
+    memcpy(&value, memory + address, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+static inline void write_word(
+        uint8_t* memory, uint16_t address, uint16_t value)
+{
+    if (address == MEMORY_SIZE - 1) {
+        memory[address] = (uint8_t)value;
+        memory[0] = (uint8_t)(value >> 8);
+        return;
+    }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    memcpy(memory + address, &value, sizeof(value));
+}
+
+extern void cpu_reset(struct CPU_Context* c);
+extern struct Stack* get_stack(struct CPU_Context* c, uint16_t stack_id);
+extern void exec_store(
+        struct CPU_Context* c, uint8_t* memory, uint16_t instruction);
+extern void exec_read(
+        struct CPU_Context* c, uint8_t* memory, uint16_t instruction);
+extern bool take_exception(struct CPU_Context* c, uint8_t* memory);
+extern bool take_interrupt(struct CPU_Context* c, uint8_t* memory);
+extern void step(struct CPU_Context* c, uint8_t* memory);
+extern void run_switch(struct CPU_Context* c, uint8_t* memory);
+extern void run_scheduled(
+        struct CPU_Context* c, uint8_t* memory,
+        void (*run)(struct CPU_Context* c, uint8_t* memory), uint64_t limit);
+
+#endif /* HG_FPEMU_H */
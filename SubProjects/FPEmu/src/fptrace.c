@@ -0,0 +1,175 @@
+/**
+ * Stack-master 16 emulator -- trace decoder
+ *
+ * Prints a trace written by fpemu -T, one instruction per line:
+ *
+ *   <count> <pc> <instruction> <disassembly> D<depth>: <top> <next>
+ *   R<depth>: <top> [rd|sto|ird|isto <address>] [<exception>]
+ *
+ * Stack entries are only shown as deep as the stack was.  With a symbol
+ * file, a line with the label is printed before its instruction.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "fpemu.h"
+#include "trace.h"
+#include "symbols.h"
+#include "fdisa.h"
+
+/* Records read at a time */
+#define FPTRACE_BLOCK 4096
+
+static const char* symbol_file_name = NULL;   /* -y */
+static uint64_t first = 0;                    /* -s */
+static uint64_t count = UINT64_MAX;           /* -n */
+
+/* --------------------------------------------------------------------*/
+
+static void display_usage(void);
+static void print_record(
+        const struct TraceRecord* record, uint64_t index,
+        const struct Symbols* symbols);
+static bool decode(FILE* inpf, const struct Symbols* symbols);
+
+/* --------------------------------------------------------------------*/
+
+static void display_usage(void)
+{
+    printf("%s",
+           "Usage:\n"
+           "   fptrace <options> <trace file>\n"
+           "     -h             This message\n"
+           "     -y <filename>  Symbol file from fa -s, to show labels\n"
+           "     -s <count>     Start at this instruction count\n"
+           "     -n <count>     Print no more than this many instructions\n"
+          );
+}
+
+static void print_record(
+        const struct TraceRecord* record, uint64_t index,
+        const struct Symbols* symbols)
+{
+    static const char* accesses[] = {"rd", "sto", "ird", "isto"};
+    char code[FDA_MAX_CODE_LENGTH];
+    const struct Symbol* symbol = symbols_find(symbols, record->pc);
+
+    if ((symbol != NULL) && (symbol->address == record->pc)) {
+        printf("%s:\n", symbol->name);
+    }
+    disassemble(record->instruction, code, record->pc);
+    printf("%10lu %04x %04x %-20s D%u:", (unsigned long)index,
+           record->pc, record->instruction, code, record->data_depth);
+    if (record->data_depth > 0) {
+        printf(" %04x", record->data_top);
+    }
+    if (record->data_depth > 1) {
+        printf(" %04x", record->data_next);
+    }
+    printf(" R%u:", record->return_depth);
+    if (record->return_depth > 0) {
+        printf(" %04x", record->return_top);
+    }
+    if (record->flags & (TRACE_READ | TRACE_STORE)) {
+        unsigned access = ((record->flags & TRACE_STORE) ? 1 : 0) +
+                          ((record->flags & TRACE_IO) ? 2 : 0);
+        printf(" %s %04x", accesses[access], record->address);
+    }
+    if ((record->exception != AllIsOK) &&
+        (record->exception <= IllegalStackID)) {
+        printf(" %s", exception_descriptions[record->exception]);
+    }
+    printf("\n");
+}
+
+/**
+ * Returns false if the file is not a trace.
+ */
+static bool decode(FILE* inpf, const struct Symbols* symbols)
+{
+    static struct TraceRecord records[FPTRACE_BLOCK];
+    struct TraceHeader header;
+    uint64_t index;
+    uint64_t printed = 0;
+    size_t n;
+
+    if ((fread(&header, sizeof(header), 1, inpf) != 1) ||
+        (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.version != TRACE_VERSION) ||
+        (header.record_size != sizeof(struct TraceRecord))) {
+        return false;
+    }
+    index = header.first_instruction;
+    while ((printed < count) &&
+           ((n = fread(records, sizeof(struct TraceRecord), FPTRACE_BLOCK,
+                       inpf)) > 0)) {
+        for (size_t i = 0; (i < n) && (printed < count); ++i, ++index) {
+            if (index >= first) {
+                print_record(&(records[i]), index, symbols);
+                ++printed;
+            }
+        }
+    }
+    return true;
+}
+
+/* --------------------------------------------------------------------*/
+
+int main(int argc, char** argv)
+{
+    struct Symbols* symbols = NULL;
+    FILE* inpf;
+    int c;
+    bool ok;
+
+    while ((c = getopt(argc, argv, "hy:s:n:")) != EOF) {
+        switch (c) {
+        case 'h':
+            display_usage();
+            exit(EXIT_SUCCESS);
+            break;
+        case 'y':
+            symbol_file_name = optarg;
+            break;
+        case 's':
+            first = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        display_usage();
+        return EXIT_FAILURE;
+    }
+    if (symbol_file_name != NULL) {
+        symbols = symbols_load(symbol_file_name);
+        if (symbols == NULL) {
+            perror(symbol_file_name);
+        }
+    }
+    inpf = fopen(argv[optind], "rb");
+    if (inpf == NULL) {
+        perror(argv[optind]);
+        symbols_destroy(symbols);
+        return EXIT_FAILURE;
+    }
+    ok = decode(inpf, symbols);
+    if (!ok) {
+        fprintf(stderr, "%s: not a trace\n", argv[optind]);
+    }
+    fclose(inpf);
+    symbols_destroy(symbols);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,152 @@
+/**
+ * Stack-master 16 emulator -- generator for the specialized handler table
+ *
+ * Decodes every possible instruction word with decode_instruction(), the
+ * single source of truth for the instruction fields, and writes a C file
+ * with one handler for every operation and stack combination in use, plus
+ * the 65536 entry table that maps every word to its handler and operand.
+ * The handlers themselves are macros from spec_ops.h.
+ *
+ *   gen_spectable > spectable_gen.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "decode.h"
+
+#define MAX_NAME_LEN 32
+
+static const char stack_letters[4] = { 'd', 'r', 'c', 't' };
+
+static const char* const stack_names[4] = {
+    "data_stack", "return_stack", "control_stack", "temp_stack"
+};
+
+static const char* const macro_names[OP_COUNT] = {
+    [OP_ILLEGAL] = "SPEC_ILLEGAL",
+    [OP_ENTER]   = "SPEC_ENTER",
+    [OP_BIF]     = "SPEC_BIF",
+    [OP_LEAVE]   = "SPEC_LEAVE",
+    [OP_NOP]     = "SPEC_NOP",
+    [OP_HALT]    = "SPEC_HALT",
+    [OP_DROP]    = "SPEC_DROP",
+    [OP_DUP]     = "SPEC_DUP",
+    [OP_SWAP]    = "SPEC_SWAP",
+    [OP_MOV]     = "SPEC_MOV",
+    [OP_LDL]     = "SPEC_LDL",
+    [OP_LDH]     = "SPEC_LDH",
+    [OP_ADD]     = "SPEC_ADD",
+    [OP_MUL]     = "SPEC_MUL",
+    [OP_EQ]      = "SPEC_EQ",
+    [OP_ASR]     = "SPEC_ASR",
+    [OP_LT]      = "SPEC_LT",
+    [OP_LTU]     = "SPEC_LTU",
+    [OP_GT]      = "SPEC_GT",
+    [OP_GTU]     = "SPEC_GTU",
+    [OP_LTE]     = "SPEC_LTE",
+    [OP_LTEU]    = "SPEC_LTEU",
+    [OP_GTE]     = "SPEC_GTE",
+    [OP_GTEU]    = "SPEC_GTEU",
+    [OP_SHL]     = "SPEC_LSL",
+    [OP_SHR]     = "SPEC_LSR",
+    [OP_STO]     = "SPEC_STO",
+    [OP_AND]     = "SPEC_AND",
+    [OP_OR]      = "SPEC_OR",
+    [OP_XOR]     = "SPEC_XOR",
+    [OP_NEG]     = "SPEC_NEG",
+    [OP_NOT]     = "SPEC_NOT",
+    [OP_RD]      = "SPEC_RD"
+};
+
+static bool defined[OP_COUNT][4][4];
+
+/**
+ * Write the handler for the operation on the given stacks, the first
+ * time it is needed, and return its name.
+ */
+static void handler(const struct Decoded* d, char* name)
+{
+    uint8_t source = 0;
+    uint8_t target = 0;
+    char args[MAX_NAME_LEN * 2] = "";
+    int n;
+
+    n = snprintf(name, MAX_NAME_LEN, "h_%s", op_names[d->op]);
+    switch (d->op) {
+        case OP_DROP:
+        case OP_DUP:
+        case OP_SWAP:
+            source = d->source;
+            snprintf(name + n, MAX_NAME_LEN - n, "_%c", stack_letters[source]);
+            snprintf(args, sizeof(args), ", %s", stack_names[source]);
+            break;
+        case OP_MOV:
+            source = d->source;
+            target = d->target;
+            snprintf(name + n, MAX_NAME_LEN - n, "_%c_%c",
+                     stack_letters[source], stack_letters[target]);
+            snprintf(args, sizeof(args), ", %s, %s",
+                     stack_names[source], stack_names[target]);
+            break;
+        case OP_LDL:
+        case OP_LDH:
+            target = d->target;
+            snprintf(name + n, MAX_NAME_LEN - n, "_%c", stack_letters[target]);
+            snprintf(args, sizeof(args), ", %s", stack_names[target]);
+            break;
+        default:
+            break;
+    }
+    if (!defined[d->op][source][target]) {
+        defined[d->op][source][target] = true;
+        printf("%s(%s%s)\n", macro_names[d->op], name, args);
+    }
+}
+
+int main(void)
+{
+    static char names[MEMORY_SIZE][MAX_NAME_LEN];
+    static uint16_t operands[MEMORY_SIZE];
+    unsigned handlers = 0;
+
+    printf("/* Generated by gen_spectable from decode.c, do not edit */\n\n");
+    printf("#include \"spec_ops.h\"\n\n");
+
+    for (uint32_t word = 0; word < MEMORY_SIZE; ++word) {
+        struct Decoded d;
+
+        decode_instruction((uint16_t)word, &d);
+        handler(&d, names[word]);
+        switch (d.op) {
+            case OP_STO:
+            case OP_RD:
+                operands[word] = (uint16_t)word;
+                break;
+            default:
+                operands[word] = d.operand;
+                break;
+        }
+    }
+    for (unsigned op = 0; op < OP_COUNT; ++op) {
+        for (unsigned i = 0; i < 16; ++i) {
+            handlers += defined[op][i / 4][i % 4] ? 1 : 0;
+        }
+    }
+
+    printf("\nconst struct SpecEntry spec_table[MEMORY_SIZE] = {\n");
+    for (uint32_t word = 0; word < MEMORY_SIZE; ++word) {
+        printf("%s{ %s, 0x%04X }%s", ((word % 4) == 0) ? "    " : "",
+               names[word], operands[word],
+               ((word % 4) == 3) ? ",\n" : ", ");
+    }
+    printf("};\n\n");
+    printf("const unsigned spec_handler_count = %u;\n", handlers);
+
+    return EXIT_SUCCESS;
+}
+
+/* ------------------------ end of file -------------------------------*/
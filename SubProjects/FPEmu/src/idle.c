@@ -0,0 +1,189 @@
+/**
+ * Stack-master 16 emulator -- idle loops
+ *
+ * A program that waits for input spins on a status port:
+ *
+ *     wait:  ldl d serial_in_status
+ *            ird b
+ *            bif wait
+ *
+ * Every pass leaves the processor exactly as the one before, so the
+ * passes up to the next event are skipped: the instruction count and the
+ * clocks go up as if they ran.  Meanwhile the host sleeps until input
+ * comes, at most as long as the passes would take on the hardware.
+ *
+ * A read that gives 0 from a port with a wait function, see iobus.h,
+ * stops the core.  If the processor is then in the same state as at the
+ * stop before, same pc and stacks, and that read was the only store or
+ * IO access in between, the passes in between do the same every time:
+ * memory did not change, and the port reads 0 until something comes from
+ * outside.  Events may come during a pass, but a skip ends before the
+ * next one.  So skipping gives the same result as running the passes, on
+ * every core.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fpemu.h"
+#include "idle.h"
+#include "iobus.h"
+#include "scheduler.h"
+#include "clocks.h"
+
+/* --------------------------------------------------------------------*/
+
+static bool same_state(const struct CPU_Context* c, const struct IdleLoop* idle);
+static void arm(const struct CPU_Context* c, struct IdleLoop* idle);
+
+/* --------------------------------------------------------------------*/
+
+static bool same_state(const struct CPU_Context* c, const struct IdleLoop* idle)
+{
+    const struct Stack* stacks[4] = {
+        &(c->data_stack), &(c->return_stack),
+        &(c->control_stack), &(c->temp_stack)
+    };
+
+    if (!(idle->armed) || (c->pc != idle->pc) ||
+        (idle->effects != idle->effects_then + 1) ||
+        (c->instruction_count <= idle->count) ||
+        (c->instruction_count - idle->count > IDLE_MAX_LOOP)) {
+        return false;
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        if ((stacks[i]->top != idle->stacks[i].top) ||
+            (memcmp(stacks[i]->values, idle->stacks[i].values,
+                    stacks[i]->top * sizeof(uint16_t)) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void arm(const struct CPU_Context* c, struct IdleLoop* idle)
+{
+    idle->armed = true;
+    idle->pc = c->pc;
+    idle->count = c->instruction_count;
+    idle->clocks = c->clocks;
+    idle->effects_then = idle->effects;
+    idle->stacks[DATA_STACK] = c->data_stack;
+    idle->stacks[RETURN_STACK] = c->return_stack;
+    idle->stacks[CONTROL_STACK] = c->control_stack;
+    idle->stacks[TEMP_STACK] = c->temp_stack;
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Skipped loops take as long as at CLOCK_HZ, NULL if out of memory.
+ */
+struct IdleLoop* idle_create(void)
+{
+    struct IdleLoop* idle = calloc(1, sizeof(struct IdleLoop));
+
+    if (idle != NULL) {
+        idle->hz = CLOCK_HZ;
+    }
+    return idle;
+}
+
+void idle_destroy(struct IdleLoop* idle)
+{
+    free(idle);
+}
+
+/**
+ * Forget the last poll, after the processor state was replaced.  The
+ * clock frequency is kept.
+ */
+void idle_reset(struct IdleLoop* idle)
+{
+    idle->effects = 0;
+    idle->polled = false;
+    idle->armed = false;
+    idle->skips = 0;
+    idle->skipped = 0;
+}
+
+/**
+ * From exec_read(): port read 0 and has a wait function.  Stop the core,
+ * so idle_skip() sees the processor right after the read.
+ */
+void idle_polled(struct CPU_Context* c, uint16_t port)
+{
+    c->idle->polled = true;
+    c->idle->port = port;
+    c->yield = true;
+    c->keep_going = false;
+}
+
+/**
+ * From run_scheduled(), when a core stopped: skip the passes of an idle
+ * loop up to the next event or the limit, and sleep meanwhile.  Fewer
+ * are skipped when input came before they would have ended.
+ */
+void idle_skip(struct CPU_Context* c, uint64_t limit)
+{
+    struct IdleLoop* idle = c->idle;
+    uint64_t end = (c->scheduler->next < limit) ? c->scheduler->next : limit;
+    const struct IoHandler* handler;
+    uint64_t period;
+    uint64_t clocks;
+    uint64_t passes;
+    double ns;
+    int64_t waited;
+
+    if (!(idle->polled)) {
+        return;
+    }
+    idle->polled = false;
+    if (!same_state(c, idle) || (end <= c->instruction_count)) {
+        arm(c, idle);
+        return;
+    }
+    period = c->instruction_count - idle->count;
+    clocks = c->clocks - idle->clocks;
+    passes = (end - c->instruction_count) / period;
+    if (passes > (UINT64_MAX - c->clocks) / clocks) {
+        passes = (UINT64_MAX - c->clocks) / clocks;
+    }
+    if (passes == 0) {
+        arm(c, idle);
+        return;
+    }
+
+    handler = io_handler(c->io, idle->port);
+    ns = (double)passes * (double)clocks * 1e9 / idle->hz;
+    waited = handler->wait(handler->device, idle->port,
+                           (ns < (double)UINT64_MAX) ? (uint64_t)ns :
+                                                       UINT64_MAX);
+    if (waited < 0) {
+        arm(c, idle);
+        return;
+    }
+    if ((double)waited < ns) {
+        /* Input came, the pass it came in reads it */
+        passes = (uint64_t)((double)waited * idle->hz / 1e9 /
+                            (double)clocks);
+    }
+    c->instruction_count += passes * period;
+    c->clocks += passes * clocks;
+    ++(idle->skips);
+    idle->skipped += passes * period;
+    arm(c, idle);
+}
+
+void idle_report(const struct IdleLoop* idle, FILE* outpf)
+{
+    if (idle->skips > 0) {
+        fprintf(outpf, "Idle loops: %lu instructions skipped in %lu skips\n",
+                (unsigned long)idle->skipped, (unsigned long)idle->skips);
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,42 @@
+#ifndef HG_IDLE_H
+#define HG_IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fpemu.h"
+
+/* Longest loop, in instructions, that is skipped */
+#define IDLE_MAX_LOOP 64
+
+/**
+ * Idle loop detection, see idle.c.
+ */
+struct IdleLoop {
+    /* Memory stores and IO accesses since reset, an idle loop does only
+     * the one read */
+    uint64_t effects;
+    bool polled;              /* The core stopped after an empty poll */
+    double hz;                /* Skipped loops take as long as on this */
+    /* The processor at the last empty poll, if armed */
+    bool armed;
+    uint16_t port;
+    uint16_t pc;
+    uint64_t count;
+    uint64_t clocks;
+    uint64_t effects_then;
+    struct Stack stacks[4];
+    /* Statistics */
+    uint64_t skips;
+    uint64_t skipped;         /* Instructions */
+};
+
+extern struct IdleLoop* idle_create(void);
+extern void idle_destroy(struct IdleLoop* idle);
+extern void idle_reset(struct IdleLoop* idle);
+extern void idle_polled(struct CPU_Context* c, uint16_t port);
+extern void idle_skip(struct CPU_Context* c, uint64_t limit);
+extern void idle_report(const struct IdleLoop* idle, FILE* outpf);
+
+#endif /* HG_IDLE_H */
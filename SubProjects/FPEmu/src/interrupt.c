@@ -0,0 +1,219 @@
+/**
+ * Stack-master 16 emulator -- interrupt controller
+ *
+ * Devices raise lines from their events, which are dispatched where the
+ * cores check their instruction limit, and the processor takes an
+ * interrupt right after, see take_interrupt().  So interrupts are only
+ * looked at between blocks.  A write that lets a pending interrupt
+ * through schedules an event for the current cycle, which stops the
+ * core at once.
+ *
+ * The latency of an interrupt is the number of cycles from the cycle
+ * it was raised at to the one it was taken at.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "interrupt.h"
+#include "iobus.h"
+
+static const char* line_names[IRQ_LINES] = {
+    "vsync", "timer 0", "timer 1"
+};
+
+/* --------------------------------------------------------------------*/
+
+static void attention(void* device, uint64_t cycle);
+static uint8_t irq_read(void* device, uint16_t port, uint64_t cycle);
+static void irq_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle);
+
+/* --------------------------------------------------------------------*/
+
+/* Only stops the core */
+static void attention(void* device, uint64_t cycle)
+{
+    (void)device;
+    (void)cycle;
+}
+
+/* IO bus handlers */
+
+static uint8_t irq_read(void* device, uint16_t port, uint64_t cycle)
+{
+    struct Interrupts* irq = device;
+
+    (void)cycle;
+    switch (port) {
+        case IO_IRQ_PENDING:
+            return irq->pending;
+        case IO_IRQ_ENABLE:
+            return irq->enable;
+        default:
+            return irq->control;
+    }
+}
+
+static void irq_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle)
+{
+    struct Interrupts* irq = device;
+
+    switch (port) {
+        case IO_IRQ_PENDING:
+            irq->pending &= ~value;
+            break;
+        case IO_IRQ_ENABLE:
+            irq->enable = value;
+            break;
+        default:
+            irq->control = value & 1;
+            break;
+    }
+    if (interrupts_next(irq) >= 0) {
+        scheduler_add(irq->scheduler, &(irq->attention), cycle);
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Interrupts off, NULL if out of memory.
+ */
+struct Interrupts* interrupts_create(struct Scheduler* scheduler)
+{
+    struct Interrupts* irq = calloc(1, sizeof(struct Interrupts));
+
+    if (irq == NULL) {
+        return NULL;
+    }
+    irq->scheduler = scheduler;
+    event_init(&(irq->attention), attention, irq);
+
+    return irq;
+}
+
+void interrupts_destroy(struct Interrupts* irq)
+{
+    free(irq);
+}
+
+void interrupts_reset(struct Interrupts* irq)
+{
+    scheduler_remove(irq->scheduler, &(irq->attention));
+    irq->pending = 0;
+    irq->enable = 0;
+    irq->control = 0;
+    memset(irq->lines, 0, sizeof(irq->lines));
+}
+
+/**
+ * A raise of a line that is still pending is lost, it counts as masked.
+ * Raised from an event, the interrupt is taken once the events of the
+ * cycle are done.
+ */
+void interrupts_raise(struct Interrupts* irq, unsigned line, uint64_t cycle)
+{
+    struct IrqLine* l = &(irq->lines[line]);
+    uint8_t bit = (uint8_t)(1 << line);
+
+    (l->raised)++;
+    if ((irq->pending & bit) || !(irq->enable & bit) ||
+        !(irq->control & 1)) {
+        (l->masked)++;
+    }
+    if (!(irq->pending & bit)) {
+        irq->pending |= bit;
+        l->raised_at = cycle;
+    }
+    if (interrupts_next(irq) >= 0) {
+        scheduler_add(irq->scheduler, &(irq->attention), cycle);
+    }
+}
+
+/**
+ * The processor enters the handler of the line: the line is no longer
+ * pending, and interrupts are off until the handler turns them on.  A
+ * line without a handler is only cleared.
+ */
+void interrupts_taken(
+        struct Interrupts* irq, unsigned line, uint64_t cycle, bool handler)
+{
+    struct IrqLine* l = &(irq->lines[line]);
+    uint64_t latency = cycle - l->raised_at;
+
+    irq->pending &= (uint8_t)~(1 << line);
+    if (!handler) {
+        return;
+    }
+    irq->control &= (uint8_t)~1;
+    (l->taken)++;
+    l->latency += latency;
+    if (latency > l->max_latency) {
+        l->max_latency = latency;
+    }
+}
+
+void interrupts_save(
+        const struct Interrupts* irq, struct InterruptState* state)
+{
+    for (unsigned i = 0; i < IRQ_LINES; ++i) {
+        state->raised_at[i] = irq->lines[i].raised_at;
+    }
+    state->pending = irq->pending;
+    state->enable = irq->enable;
+    state->control = irq->control;
+}
+
+/**
+ * At the instruction count the state is restored to, the scheduler must
+ * have been reset to it.  An interrupt that can be taken is taken before
+ * the next instruction.
+ */
+void interrupts_restore(
+        struct Interrupts* irq, const struct InterruptState* state,
+        uint64_t cycle)
+{
+    for (unsigned i = 0; i < IRQ_LINES; ++i) {
+        irq->lines[i].raised_at = state->raised_at[i];
+    }
+    irq->pending = state->pending;
+    irq->enable = state->enable;
+    irq->control = state->control & 1;
+    if (interrupts_next(irq) >= 0) {
+        scheduler_add(irq->scheduler, &(irq->attention), cycle);
+    }
+}
+
+bool interrupts_map(struct Interrupts* irq, struct IoBus* bus)
+{
+    return io_bus_map(bus, IO_IRQ_PENDING, IO_IRQ_CONTROL,
+                      irq_read, irq_write, irq, "interrupts");
+}
+
+void interrupts_report(const struct Interrupts* irq, FILE* outpf)
+{
+    for (unsigned i = 0; i < IRQ_LINES; ++i) {
+        const struct IrqLine* l = &(irq->lines[i]);
+        if (l->raised == 0) {
+            continue;
+        }
+        fprintf(outpf, "Interrupt %u (%s): %lu raised, %lu masked, "
+                       "%lu taken", i,
+                (line_names[i] != NULL) ? line_names[i] : "unused",
+                (unsigned long)l->raised, (unsigned long)l->masked,
+                (unsigned long)l->taken);
+        if (l->taken > 0) {
+            fprintf(outpf, ", latency %.1f average, %lu max cycles",
+                    (double)l->latency / (double)l->taken,
+                    (unsigned long)l->max_latency);
+        }
+        fprintf(outpf, "\n");
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
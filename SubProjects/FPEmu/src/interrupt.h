@@ -0,0 +1,89 @@
+#ifndef HG_INTERRUPT_H
+#define HG_INTERRUPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "scheduler.h"
+
+/* IO ports, see the IO map in the programmers manual */
+#define IO_IRQ_PENDING 0x0020  /* Read: lines raised, write: 1s clear */
+#define IO_IRQ_ENABLE  0x0021  /* Lines that may interrupt */
+#define IO_IRQ_CONTROL 0x0022  /* Bit 0: interrupts on, off on entry */
+
+/* Page 0 holds pointers to the handlers, after the exception vectors.
+ * The vector of line n is at IRQ_VECTORS + 2n, 0 for none. */
+#define IRQ_VECTORS 0x0008
+
+/* Lines, a lower line goes first */
+#define IRQ_LINES   8
+#define IRQ_VSYNC   0
+#define IRQ_TIMER_0 1
+#define IRQ_TIMER_1 2
+
+struct IrqLine {
+    uint64_t raised_at;       /* Cycle it was raised */
+    /* Statistics */
+    uint64_t raised;
+    uint64_t masked;          /* Raised while it could not be taken */
+    uint64_t taken;
+    uint64_t latency;         /* Total cycles from raised to taken */
+    uint64_t max_latency;
+};
+
+/* The controller in a snapshot, see snapshot.h */
+struct InterruptState {
+    uint64_t raised_at[IRQ_LINES];
+    uint8_t pending;
+    uint8_t enable;
+    uint8_t control;
+};
+
+/**
+ * The interrupt controller.  Devices raise lines, the processor takes
+ * the first line that is pending and enabled while interrupts are on.
+ */
+struct Interrupts {
+    uint8_t pending;
+    uint8_t enable;
+    uint8_t control;
+    struct Scheduler* scheduler;
+    /* Now, to stop the core when a write lets an interrupt through */
+    struct Event attention;
+    struct IrqLine lines[IRQ_LINES];
+};
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * The line to take, -1 for none.
+ */
+static inline int interrupts_next(const struct Interrupts* irq)
+{
+    uint8_t ready = irq->pending & irq->enable;
+
+    if (!(irq->control & 1) || (ready == 0)) {
+        return -1;
+    }
+    return __builtin_ctz(ready);
+}
+
+struct IoBus;
+
+extern struct Interrupts* interrupts_create(struct Scheduler* scheduler);
+extern void interrupts_destroy(struct Interrupts* irq);
+extern void interrupts_reset(struct Interrupts* irq);
+extern void interrupts_raise(
+        struct Interrupts* irq, unsigned line, uint64_t cycle);
+extern void interrupts_taken(
+        struct Interrupts* irq, unsigned line, uint64_t cycle, bool handler);
+extern void interrupts_save(
+        const struct Interrupts* irq, struct InterruptState* state);
+extern void interrupts_restore(
+        struct Interrupts* irq, const struct InterruptState* state,
+        uint64_t cycle);
+extern bool interrupts_map(struct Interrupts* irq, struct IoBus* bus);
+extern void interrupts_report(const struct Interrupts* irq, FILE* outpf);
+
+#endif /* HG_INTERRUPT_H */
@@ -0,0 +1,109 @@
+/**
+ * Stack-master 16 emulator -- IO bus
+ *
+ * Every port has an entry in a 64K table with the index of its handler,
+ * so finding the device is one load, and the device is called without
+ * comparing the port to anything.  There are few handlers, a byte per
+ * port keeps the table small.  Handler 0 stands for the ports nothing is
+ * mapped to: reads return 0 and writes are ignored.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "iobus.h"
+
+/* --------------------------------------------------------------------*/
+
+static uint8_t unmapped_read(void* device, uint16_t port, uint64_t cycle);
+static void unmapped_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle);
+
+/* --------------------------------------------------------------------*/
+
+static uint8_t unmapped_read(void* device, uint16_t port, uint64_t cycle)
+{
+    (void)device;
+    (void)port;
+    (void)cycle;
+    return 0;
+}
+
+static void unmapped_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle)
+{
+    (void)device;
+    (void)port;
+    (void)value;
+    (void)cycle;
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * A bus with nothing mapped, NULL if out of memory.
+ */
+struct IoBus* io_bus_create(void)
+{
+    struct IoBus* bus = calloc(1, sizeof(struct IoBus));
+
+    if (bus == NULL) {
+        return NULL;
+    }
+    bus->handlers[0].read = unmapped_read;
+    bus->handlers[0].write = unmapped_write;
+    bus->handlers[0].name = "unmapped";
+    bus->count = 1;
+
+    return bus;
+}
+
+void io_bus_destroy(struct IoBus* bus)
+{
+    free(bus);
+}
+
+/**
+ * Map the ports first .. last to a device.  A NULL read or write makes
+ * those accesses behave as if nothing was mapped.  The ports are taken
+ * from whatever was mapped to them before.  Returns false if there are
+ * too many handlers.
+ */
+bool io_bus_map(
+        struct IoBus* bus, uint16_t first, uint16_t last,
+        IoRead read, IoWrite write, void* device, const char* name)
+{
+    struct IoHandler* handler;
+
+    if (bus->count == IO_MAX_HANDLERS) {
+        return false;
+    }
+    handler = &(bus->handlers[bus->count]);
+    handler->read = (read != NULL) ? read : unmapped_read;
+    handler->write = (write != NULL) ? write : unmapped_write;
+    handler->wait = NULL;
+    handler->device = device;
+    handler->name = name;
+    for (unsigned port = first; port <= last; ++port) {
+        bus->map[port] = (uint8_t)bus->count;
+    }
+    (bus->count)++;
+
+    return true;
+}
+
+/**
+ * Give the handler of a mapped port a wait function, for idle loops that
+ * poll it.  Returns false if nothing is mapped to the port.
+ */
+bool io_bus_set_wait(struct IoBus* bus, uint16_t port, IoWait wait)
+{
+    if (bus->map[port] == 0) {
+        return false;
+    }
+    bus->handlers[bus->map[port]].wait = wait;
+    return true;
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,73 @@
+#ifndef HG_IOBUS_H
+#define HG_IOBUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The IO bus: IRD and ISTO go through a table with an entry for every
+ * port, so each access is one indexed call, however many devices there
+ * are.  Device modules map their ports with io_bus_map().  Ports are a
+ * byte wide.
+ */
+
+#define IO_PORTS 65536
+/* Handlers, entry 0 is for the ports nothing is mapped to */
+#define IO_MAX_HANDLERS 32
+
+/* cycle is the instruction count of the access */
+typedef uint8_t (*IoRead)(void* device, uint16_t port, uint64_t cycle);
+typedef void (*IoWrite)(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle);
+/* For a port that reads 0 until something comes from outside the
+ * emulator: wait up to ns nanoseconds for it, UINT64_MAX for no limit.
+ * Returns the nanoseconds that passed with nothing coming, ns if nothing
+ * ever will, or -1 if the reads must not be skipped.  See idle.c. */
+typedef int64_t (*IoWait)(void* device, uint16_t port, uint64_t ns);
+
+struct IoHandler {
+    IoRead read;
+    IoWrite write;
+    IoWait wait;             /* NULL: events may change what it reads */
+    void* device;
+    const char* name;
+};
+
+struct IoBus {
+    unsigned count;
+    struct IoHandler handlers[IO_MAX_HANDLERS];
+    uint8_t map[IO_PORTS];  /* Index in handlers of every port */
+};
+
+/* --------------------------------------------------------------------*/
+
+static inline uint8_t io_read(
+        const struct IoBus* bus, uint16_t port, uint64_t cycle)
+{
+    const struct IoHandler* handler = &(bus->handlers[bus->map[port]]);
+
+    return handler->read(handler->device, port, cycle);
+}
+
+static inline const struct IoHandler* io_handler(
+        const struct IoBus* bus, uint16_t port)
+{
+    return &(bus->handlers[bus->map[port]]);
+}
+
+static inline void io_write(
+        const struct IoBus* bus, uint16_t port, uint8_t value, uint64_t cycle)
+{
+    const struct IoHandler* handler = &(bus->handlers[bus->map[port]]);
+
+    handler->write(handler->device, port, value, cycle);
+}
+
+extern struct IoBus* io_bus_create(void);
+extern void io_bus_destroy(struct IoBus* bus);
+extern bool io_bus_map(
+        struct IoBus* bus, uint16_t first, uint16_t last,
+        IoRead read, IoWrite write, void* device, const char* name);
+extern bool io_bus_set_wait(struct IoBus* bus, uint16_t port, IoWait wait);
+
+#endif /* HG_IOBUS_H */
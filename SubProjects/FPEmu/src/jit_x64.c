@@ -0,0 +1,1162 @@
+/**
+ * Stack-master 16 emulator -- x86-64 JIT for hot blocks
+ *
+ * Blocks of the block cache that are entered often by ENTER or by a
+ * backward BIF are compiled into native code.  The native code starts
+ * with checks on the depth of every stack it uses: when one of them fails
+ * an instruction in the block would raise an exception, and the block is
+ * left to the interpreter instead.  Past the checks nothing can go wrong,
+ * so the data stack is simulated at compile time and its values live in
+ * host registers until the block ends.  Blocks with RD or STO, which may
+ * do IO, are never compiled.
+ *
+ * A block that branches back to its own start loops in native code.
+ *
+ * The buffer is never writable and executable at once: the pages a block
+ * is written to are made writable for the compile, then read and execute
+ * only.  Code is not freed one block at a time.  When the buffer is full
+ * the block cache drops every native pointer and the buffer starts over,
+ * see jit_flush().
+ *
+ * Only compiled when FPEMU_JIT is defined.  Behaviour must be identical
+ * to run_switch() in cpu.c.
+ */
+
+#ifdef FPEMU_JIT
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fpemu.h"
+#include "decode.h"
+#include "blockcache.h"
+#include "jit_x64.h"
+
+/* Worst case size of the native code for one block */
+#define JIT_MAX_BLOCK_CODE 8192
+
+/* Host registers */
+enum {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+#define NO_INDEX (-1)
+
+/* Condition codes */
+enum {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_BE = 0x6, CC_A = 0x7, CC_L = 0xC, CC_GE = 0xD,
+    CC_LE = 0xE, CC_G = 0xF
+};
+
+/* Opcodes of the two register ALU instructions, "op r/m32, r32" */
+enum {
+    ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29,
+    ALU_XOR = 0x31, ALU_CMP = 0x39, ALU_MOV = 0x89, ALU_TEST = 0x85
+};
+
+/*
+ * Register usage in native code:
+ *   rdi        the CPU_Context
+ *   esi        remaining loop budget
+ *   edx        data stack top when the block was entered
+ *   eax, ecx   scratch
+ *   r15d       nonzero once the block completed at least once
+ *   others     data stack values
+ */
+static const uint8_t value_registers[] = {
+    R8, R9, R10, R11, RBX, RBP, R12, R13, R14
+};
+#define NUMBER_OF_VALUE_REGISTERS \
+    (sizeof(value_registers) / sizeof(value_registers[0]))
+
+static const uint8_t saved_registers[] = { RBX, RBP, R12, R13, R14, R15 };
+#define NUMBER_OF_SAVED_REGISTERS \
+    (sizeof(saved_registers) / sizeof(saved_registers[0]))
+
+static const uint16_t stack_sizes[4] = {
+    DSTACK_SIZE, RSTACK_SIZE, CSTACK_SIZE, TSTACK_SIZE
+};
+
+struct Jit {
+    uint8_t* buffer;         /* JIT_BUFFER_SIZE bytes */
+    size_t used;
+    size_t page_size;
+    /* Statistics */
+    uint32_t compiled;
+    uint32_t rejected;
+    uint32_t flushes;
+};
+
+/* Lowest and highest depth of a stack, relative to block entry */
+struct StackUse {
+    int lowest;
+    int highest;
+};
+
+/* Where a data stack value lives while compiling */
+enum ValueKind {
+    V_MEMORY = 0U,  /* Still in the stack, at position */
+    V_REGISTER,
+    V_CONSTANT
+};
+
+struct Value {
+    uint8_t kind;
+    uint8_t reg;
+    int16_t position;   /* Relative to the top at block entry */
+    uint16_t constant;
+};
+
+struct Compiler {
+    uint8_t* start;
+    uint8_t* p;
+    /* The simulated data stack, indexed by position + MAX_STACK_SIZE */
+    struct Value values[2 * MAX_STACK_SIZE + 1];
+    int depth;
+    bool used[16];
+    bool failed;            /* Ran out of registers */
+};
+
+#define VALUE(ci, position) (&((ci)->values[(position) + MAX_STACK_SIZE]))
+
+/* --------------------------------------------------------------------*/
+/* Offsets into the CPU_Context */
+
+static int32_t stack_base(uint8_t stack_id)
+{
+    switch (stack_id) {
+        case RETURN_STACK:  return offsetof(struct CPU_Context, return_stack);
+        case CONTROL_STACK: return offsetof(struct CPU_Context, control_stack);
+        case TEMP_STACK:    return offsetof(struct CPU_Context, temp_stack);
+        default:            return offsetof(struct CPU_Context, data_stack);
+    }
+}
+
+#define TOP_OF(id)    (stack_base(id) + (int32_t)offsetof(struct Stack, top))
+#define SIZE_OF(id)   (stack_base(id) + (int32_t)offsetof(struct Stack, size))
+#define VALUES_OF(id) (stack_base(id) + (int32_t)offsetof(struct Stack, values))
+
+#define PC_OFFSET ((int32_t)offsetof(struct CPU_Context, pc))
+#define INSTRUCTION_OFFSET ((int32_t)offsetof(struct CPU_Context, instruction))
+#define COUNT_OFFSET ((int32_t)offsetof(struct CPU_Context, instruction_count))
+#define CLOCKS_OFFSET ((int32_t)offsetof(struct CPU_Context, clocks))
+#define KEEP_GOING_OFFSET ((int32_t)offsetof(struct CPU_Context, keep_going))
+
+/* --------------------------------------------------------------------*/
+/* Instruction encoding */
+
+static void emit8(struct Compiler* ci, uint8_t byte)
+{
+    *(ci->p)++ = byte;
+}
+
+static void emit16(struct Compiler* ci, uint16_t value)
+{
+    emit8(ci, value & 0xFF);
+    emit8(ci, value >> 8);
+}
+
+static void emit32(struct Compiler* ci, uint32_t value)
+{
+    emit16(ci, value & 0xFFFF);
+    emit16(ci, value >> 16);
+}
+
+static void emit_rex(struct Compiler* ci, bool wide, int reg, int index, int base)
+{
+    uint8_t rex = 0x40;
+
+    rex |= wide ? 0x08 : 0;
+    rex |= (reg & 8) ? 0x04 : 0;
+    rex |= ((index != NO_INDEX) && (index & 8)) ? 0x02 : 0;
+    rex |= (base & 8) ? 0x01 : 0;
+    if (rex != 0x40) {
+        emit8(ci, rex);
+    }
+}
+
+static void emit_modrm(struct Compiler* ci, int mod, int reg, int rm)
+{
+    emit8(ci, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* [base + index * 2 + displacement] */
+static void emit_memory(
+        struct Compiler* ci, int reg, int base, int index, int32_t disp)
+{
+    if (index != NO_INDEX) {
+        emit_modrm(ci, 2, reg, 4);
+        emit8(ci, (1 << 6) | ((index & 7) << 3) | (base & 7));
+    } else if ((base & 7) == RSP) {
+        emit_modrm(ci, 2, reg, 4);
+        emit8(ci, (RSP << 3) | (base & 7));
+    } else {
+        emit_modrm(ci, 2, reg, base);
+    }
+    emit32(ci, (uint32_t)disp);
+}
+
+/* op dst, src */
+static void alu_rr(struct Compiler* ci, uint8_t opcode, int dst, int src)
+{
+    emit_rex(ci, false, src, NO_INDEX, dst);
+    emit8(ci, opcode);
+    emit_modrm(ci, 3, src, dst);
+}
+
+/* op dst16, src16 */
+static void alu_rr16(struct Compiler* ci, uint8_t opcode, int dst, int src)
+{
+    emit8(ci, 0x66);
+    alu_rr(ci, opcode, dst, src);
+}
+
+/* op dst, imm32, with ext the /digit of the 0x81 group */
+static void alu_ri(struct Compiler* ci, int ext, int dst, uint32_t imm)
+{
+    emit_rex(ci, false, 0, NO_INDEX, dst);
+    emit8(ci, 0x81);
+    emit_modrm(ci, 3, ext, dst);
+    emit32(ci, imm);
+}
+
+/* cmp dst16, imm16 */
+static void cmp_ri16(struct Compiler* ci, int dst, uint16_t imm)
+{
+    emit8(ci, 0x66);
+    emit_rex(ci, false, 0, NO_INDEX, dst);
+    emit8(ci, 0x81);
+    emit_modrm(ci, 3, 7, dst);
+    emit16(ci, imm);
+}
+
+/* mov dst, imm32 */
+static void mov_ri(struct Compiler* ci, int dst, uint32_t imm)
+{
+    emit_rex(ci, false, 0, NO_INDEX, dst);
+    emit8(ci, 0xB8 + (dst & 7));
+    emit32(ci, imm);
+}
+
+/* movzx / movsx dst, src16 */
+static void extend_rr16(struct Compiler* ci, bool sign, int dst, int src)
+{
+    emit_rex(ci, false, dst, NO_INDEX, src);
+    emit8(ci, 0x0F);
+    emit8(ci, sign ? 0xBF : 0xB7);
+    emit_modrm(ci, 3, dst, src);
+}
+
+/* movzx dst, word [base + index * 2 + disp] */
+static void load16(struct Compiler* ci, int dst, int base, int index, int32_t disp)
+{
+    emit_rex(ci, false, dst, index, base);
+    emit8(ci, 0x0F);
+    emit8(ci, 0xB7);
+    emit_memory(ci, dst, base, index, disp);
+}
+
+/* mov word [base + index * 2 + disp], src16 */
+static void store16(struct Compiler* ci, int base, int index, int32_t disp, int src)
+{
+    emit8(ci, 0x66);
+    emit_rex(ci, false, src, index, base);
+    emit8(ci, 0x89);
+    emit_memory(ci, src, base, index, disp);
+}
+
+/* mov word [base + index * 2 + disp], imm16 */
+static void store16_imm(
+        struct Compiler* ci, int base, int index, int32_t disp, uint16_t imm)
+{
+    emit8(ci, 0x66);
+    emit_rex(ci, false, 0, index, base);
+    emit8(ci, 0xC7);
+    emit_memory(ci, 0, base, index, disp);
+    emit16(ci, imm);
+}
+
+/* inc / dec word [base + disp] */
+static void step16(struct Compiler* ci, int base, int32_t disp, bool up)
+{
+    emit8(ci, 0x66);
+    emit_rex(ci, false, 0, NO_INDEX, base);
+    emit8(ci, 0xFF);
+    emit_memory(ci, up ? 0 : 1, base, NO_INDEX, disp);
+}
+
+/* add qword [base + disp], imm32 */
+static void add_m64(struct Compiler* ci, int base, int32_t disp, uint32_t imm)
+{
+    emit_rex(ci, true, 0, NO_INDEX, base);
+    emit8(ci, 0x81);
+    emit_memory(ci, 0, base, NO_INDEX, disp);
+    emit32(ci, imm);
+}
+
+/* mov byte [base + disp], imm8 */
+static void store8_imm(struct Compiler* ci, int base, int32_t disp, uint8_t imm)
+{
+    emit_rex(ci, false, 0, NO_INDEX, base);
+    emit8(ci, 0xC6);
+    emit_memory(ci, 0, base, NO_INDEX, disp);
+    emit8(ci, imm);
+}
+
+/* imul dst, src */
+static void imul_rr(struct Compiler* ci, int dst, int src)
+{
+    emit_rex(ci, false, dst, NO_INDEX, src);
+    emit8(ci, 0x0F);
+    emit8(ci, 0xAF);
+    emit_modrm(ci, 3, dst, src);
+}
+
+/* Single operand group 0xF7 (not 2, neg 3) and 0xFF (dec 1) */
+static void unary(struct Compiler* ci, uint8_t opcode, int ext, int dst)
+{
+    emit_rex(ci, false, 0, NO_INDEX, dst);
+    emit8(ci, opcode);
+    emit_modrm(ci, 3, ext, dst);
+}
+
+/* shl 4, shr 5, sar 7 dst, cl */
+static void shift_cl(struct Compiler* ci, int ext, int dst)
+{
+    emit_rex(ci, false, 0, NO_INDEX, dst);
+    emit8(ci, 0xD3);
+    emit_modrm(ci, 3, ext, dst);
+}
+
+static void push_r(struct Compiler* ci, int reg)
+{
+    emit_rex(ci, false, 0, NO_INDEX, reg);
+    emit8(ci, 0x50 + (reg & 7));
+}
+
+static void pop_r(struct Compiler* ci, int reg)
+{
+    emit_rex(ci, false, 0, NO_INDEX, reg);
+    emit8(ci, 0x58 + (reg & 7));
+}
+
+/* Conditional jump, returns the location of the offset for patch() */
+static uint8_t* jcc(struct Compiler* ci, int cc)
+{
+    emit8(ci, 0x0F);
+    emit8(ci, 0x80 + cc);
+    emit32(ci, 0);
+    return ci->p - 4;
+}
+
+static uint8_t* jmp(struct Compiler* ci)
+{
+    emit8(ci, 0xE9);
+    emit32(ci, 0);
+    return ci->p - 4;
+}
+
+static void patch(uint8_t* location, const uint8_t* target)
+{
+    int32_t offset = (int32_t)(target - (location + 4));
+
+    for (int i = 0; i < 4; ++i) {
+        location[i] = (uint8_t)((uint32_t)offset >> (8 * i));
+    }
+}
+
+/* --------------------------------------------------------------------*/
+/* The simulated data stack */
+
+static uint8_t allocate_register(struct Compiler* ci)
+{
+    for (unsigned i = 0; i < NUMBER_OF_VALUE_REGISTERS; ++i) {
+        uint8_t reg = value_registers[i];
+        if (!(ci->used[reg])) {
+            ci->used[reg] = true;
+            return reg;
+        }
+    }
+    ci->failed = true;
+    return value_registers[0];
+}
+
+static void release(struct Compiler* ci, const struct Value* v)
+{
+    if (v->kind == V_REGISTER) {
+        ci->used[v->reg] = false;
+    }
+}
+
+static int32_t value_offset(int position)
+{
+    return VALUES_OF(DATA_STACK) + 2 * position;
+}
+
+/* Make sure the value is in a register it owns */
+static void materialize(struct Compiler* ci, struct Value* v)
+{
+    uint8_t reg;
+
+    switch (v->kind) {
+        case V_CONSTANT:
+            reg = allocate_register(ci);
+            mov_ri(ci, reg, v->constant);
+            break;
+        case V_MEMORY:
+            reg = allocate_register(ci);
+            load16(ci, reg, RDI, RDX, value_offset(v->position));
+            break;
+        default:
+            return;
+    }
+    v->kind = V_REGISTER;
+    v->reg = reg;
+}
+
+static struct Value pop_value(struct Compiler* ci)
+{
+    --(ci->depth);
+    return *VALUE(ci, ci->depth);
+}
+
+static void push_value(struct Compiler* ci, struct Value v)
+{
+    *VALUE(ci, ci->depth) = v;
+    ++(ci->depth);
+}
+
+static struct Value constant(uint16_t value)
+{
+    struct Value v = { V_CONSTANT, 0, 0, value };
+    return v;
+}
+
+static struct Value in_register(uint8_t reg)
+{
+    struct Value v = { V_REGISTER, reg, 0, 0 };
+    return v;
+}
+
+/**
+ * Store the simulated data stack back into the context, from the lowest
+ * position the block reached up to the current depth, and set the top.
+ */
+static void write_back(struct Compiler* ci, int lowest)
+{
+    /* Values that moved within the stack must be read before
+     * anything is stored */
+    for (int position = lowest; position < ci->depth; ++position) {
+        struct Value* v = VALUE(ci, position);
+        if ((v->kind == V_MEMORY) && (v->position != position)) {
+            materialize(ci, v);
+        }
+    }
+    for (int position = lowest; position < ci->depth; ++position) {
+        struct Value* v = VALUE(ci, position);
+        if (v->kind == V_REGISTER) {
+            store16(ci, RDI, RDX, value_offset(position), v->reg);
+        } else if (v->kind == V_CONSTANT) {
+            store16_imm(ci, RDI, RDX, value_offset(position), v->constant);
+        }
+    }
+    if (ci->depth != 0) {
+        alu_rr(ci, ALU_MOV, RAX, RDX);
+        alu_ri(ci, 0, RAX, (uint32_t)ci->depth);
+        store16(ci, RDI, NO_INDEX, TOP_OF(DATA_STACK), RAX);
+    }
+}
+
+/* --------------------------------------------------------------------*/
+/* Other stacks stay in memory, the entry checks make these safe */
+
+static void push_other(struct Compiler* ci, uint8_t stack, const struct Value* v)
+{
+    load16(ci, RAX, RDI, NO_INDEX, TOP_OF(stack));
+    if (v->kind == V_CONSTANT) {
+        store16_imm(ci, RDI, RAX, VALUES_OF(stack), v->constant);
+    } else {
+        store16(ci, RDI, RAX, VALUES_OF(stack), v->reg);
+    }
+    step16(ci, RDI, TOP_OF(stack), true);
+}
+
+static void pop_other(struct Compiler* ci, uint8_t stack, uint8_t reg)
+{
+    load16(ci, RAX, RDI, NO_INDEX, TOP_OF(stack));
+    unary(ci, 0xFF, 1, RAX);
+    store16(ci, RDI, NO_INDEX, TOP_OF(stack), RAX);
+    load16(ci, reg, RDI, RAX, VALUES_OF(stack));
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Stack effect of one instruction.  Returns false for instructions that
+ * are never compiled.
+ */
+static bool analyse(const struct Decoded* d, struct StackUse use[4], int depth[4])
+{
+    uint8_t pop_stack = DATA_STACK;
+    uint8_t push_stack = DATA_STACK;
+    int pops = 0;
+    int pushes = 0;
+
+    switch (d->op) {
+        case OP_ILLEGAL:
+        case OP_STO:
+        case OP_RD:
+            return false;
+        case OP_NOP:
+        case OP_HALT:
+            break;
+        case OP_ENTER:
+            push_stack = RETURN_STACK;
+            pushes = 1;
+            break;
+        case OP_LEAVE:
+            pop_stack = RETURN_STACK;
+            pops = 1;
+            break;
+        case OP_BIF:
+            pops = 1;
+            break;
+        case OP_DROP:
+            pop_stack = d->source;
+            pops = 1;
+            break;
+        case OP_DUP:
+            pop_stack = push_stack = d->source;
+            pops = 1;
+            pushes = 2;
+            break;
+        case OP_SWAP:
+            pop_stack = push_stack = d->source;
+            pops = 2;
+            pushes = 2;
+            break;
+        case OP_MOV:
+            pop_stack = d->source;
+            push_stack = d->target;
+            pops = 1;
+            pushes = 1;
+            break;
+        case OP_LDL:
+            push_stack = d->target;
+            pushes = 1;
+            break;
+        case OP_LDH:
+            pop_stack = push_stack = d->target;
+            pops = 1;
+            pushes = 1;
+            break;
+        case OP_NEG:
+        case OP_NOT:
+            pops = 1;
+            pushes = 1;
+            break;
+        default: /* Two value operators */
+            pops = 2;
+            pushes = 1;
+            break;
+    }
+
+    depth[pop_stack] -= pops;
+    if (depth[pop_stack] < use[pop_stack].lowest) {
+        use[pop_stack].lowest = depth[pop_stack];
+    }
+    depth[push_stack] += pushes;
+    if (depth[push_stack] > use[push_stack].highest) {
+        use[push_stack].highest = depth[push_stack];
+    }
+    return true;
+}
+
+/**
+ * Jump to fail unless every stack has room for the block: no pop below
+ * the bottom and no push that reaches the size.  Loads edx.
+ */
+static void emit_checks(
+        struct Compiler* ci, const struct StackUse use[4],
+        uint8_t** fail, int* fails)
+{
+    load16(ci, RDX, RDI, NO_INDEX, TOP_OF(DATA_STACK));
+    for (uint8_t id = 0; id < 4; ++id) {
+        int top = RDX;
+        if (id != DATA_STACK) {
+            if ((use[id].lowest == 0) && (use[id].highest == 0)) {
+                continue;
+            }
+            top = RAX;
+            load16(ci, RAX, RDI, NO_INDEX, TOP_OF(id));
+        }
+        if (use[id].lowest < 0) {
+            alu_ri(ci, 7, top, (uint32_t)(-use[id].lowest));
+            fail[(*fails)++] = jcc(ci, CC_B);
+        }
+        if (use[id].highest > 0) {
+            if (top != RAX) {
+                alu_rr(ci, ALU_MOV, RAX, top);
+            }
+            alu_ri(ci, 0, RAX, (uint32_t)use[id].highest);
+            load16(ci, RCX, RDI, NO_INDEX, SIZE_OF(id));
+            alu_rr(ci, ALU_CMP, RAX, RCX);
+            fail[(*fails)++] = jcc(ci, CC_AE);
+        }
+    }
+}
+
+static void emit_epilogue(struct Compiler* ci)
+{
+    for (int i = NUMBER_OF_SAVED_REGISTERS - 1; i >= 0; --i) {
+        pop_r(ci, saved_registers[i]);
+    }
+    emit8(ci, 0xC3);
+}
+
+/* Leave with the pc set, the block ran */
+static void emit_exit(struct Compiler* ci, uint16_t pc)
+{
+    store16_imm(ci, RDI, NO_INDEX, PC_OFFSET, pc);
+    mov_ri(ci, RAX, 1);
+    emit_epilogue(ci);
+}
+
+/* The block ran to its end, same as execute_block() */
+static void emit_count(struct Compiler* ci, const struct Block* block)
+{
+    add_m64(ci, RDI, COUNT_OFFSET, block->count);
+    add_m64(ci, RDI, CLOCKS_OFFSET, block->clocks);
+}
+
+static int condition_code(uint8_t op)
+{
+    switch (op) {
+        case OP_LT:   return CC_L;
+        case OP_LTU:  return CC_B;
+        case OP_GT:   return CC_G;
+        case OP_GTU:  return CC_A;
+        case OP_LTE:  return CC_LE;
+        case OP_LTEU: return CC_BE;
+        case OP_GTE:  return CC_GE;
+        case OP_GTEU: return CC_AE;
+        default:      return CC_E;
+    }
+}
+
+/* Same expressions as the interpreters, used to fold constants */
+static uint16_t evaluate(uint8_t op, uint16_t n1, uint16_t n2)
+{
+    switch (op) {
+        case OP_ADD:  return (uint16_t)(n1 + n2);
+        case OP_MUL:  return (uint16_t)(n1 * n2);
+        case OP_EQ:   return (n2 == n1) ? 0xFFFF : 0x0000;
+        case OP_ASR:  return (uint16_t)((int16_t)n2 >> (int16_t)n1);
+        case OP_LT:   return ((int16_t)n2 <  (int16_t)n1) ? 0xFFFF : 0x0000;
+        case OP_LTU:  return (n2 <  n1) ? 0xFFFF : 0x0000;
+        case OP_GT:   return ((int16_t)n2 >  (int16_t)n1) ? 0xFFFF : 0x0000;
+        case OP_GTU:  return (n2 >  n1) ? 0xFFFF : 0x0000;
+        case OP_LTE:  return ((int16_t)n2 <= (int16_t)n1) ? 0xFFFF : 0x0000;
+        case OP_LTEU: return (n2 <= n1) ? 0xFFFF : 0x0000;
+        case OP_GTE:  return ((int16_t)n2 >= (int16_t)n1) ? 0xFFFF : 0x0000;
+        case OP_GTEU: return (n2 >= n1) ? 0xFFFF : 0x0000;
+        case OP_SHL:  return (uint16_t)(n2 << n1);
+        case OP_SHR:  return (uint16_t)(n2 >> n1);
+        case OP_AND:  return n2 & n1;
+        case OP_OR:   return n2 | n1;
+        default:      return n2 ^ n1;
+    }
+}
+
+static void compile_binary(struct Compiler* ci, uint8_t op)
+{
+    struct Value n1 = pop_value(ci);
+    struct Value n2 = pop_value(ci);
+    uint8_t r;
+
+    if ((n1.kind == V_CONSTANT) && (n2.kind == V_CONSTANT)) {
+        push_value(ci, constant(evaluate(op, n1.constant, n2.constant)));
+        return;
+    }
+    materialize(ci, &n2);
+    r = n2.reg;
+    if ((n1.kind == V_MEMORY) ||
+        ((n1.kind == V_CONSTANT) && (op == OP_MUL))) {
+        materialize(ci, &n1);
+    }
+
+    switch (op) {
+        case OP_ADD:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+            {
+                static const uint8_t opcodes[][2] = {
+                    { OP_ADD, ALU_ADD }, { OP_AND, ALU_AND },
+                    { OP_OR, ALU_OR }, { OP_XOR, ALU_XOR }
+                };
+                uint8_t opcode = 0;
+                int ext = 0;
+                for (unsigned i = 0; i < 4; ++i) {
+                    if (opcodes[i][0] == op) {
+                        opcode = opcodes[i][1];
+                        ext = opcode >> 3;
+                    }
+                }
+                if (n1.kind == V_CONSTANT) {
+                    alu_ri(ci, ext, r, n1.constant);
+                } else {
+                    alu_rr(ci, opcode, r, n1.reg);
+                }
+                if (op == OP_ADD) {
+                    extend_rr16(ci, false, r, r);
+                }
+            }
+            break;
+        case OP_MUL:
+            imul_rr(ci, r, n1.reg);
+            extend_rr16(ci, false, r, r);
+            break;
+        case OP_SHL:
+        case OP_SHR:
+        case OP_ASR:
+            if (n1.kind == V_CONSTANT) {
+                mov_ri(ci, RCX, n1.constant);
+            } else {
+                alu_rr(ci, ALU_MOV, RCX, n1.reg);
+            }
+            if (op == OP_ASR) {
+                extend_rr16(ci, true, r, r);
+                shift_cl(ci, 7, r);
+                extend_rr16(ci, false, r, r);
+            } else if (op == OP_SHL) {
+                shift_cl(ci, 4, r);
+                extend_rr16(ci, false, r, r);
+            } else {
+                shift_cl(ci, 5, r);
+            }
+            break;
+        default: /* Comparisons, a 16 bit compare gets both kinds right */
+            if (n1.kind == V_CONSTANT) {
+                cmp_ri16(ci, r, n1.constant);
+            } else {
+                alu_rr16(ci, ALU_CMP, r, n1.reg);
+            }
+            /* setcc al; movzx eax, al; neg eax; movzx r, ax */
+            emit8(ci, 0x0F);
+            emit8(ci, 0x90 + condition_code(op));
+            emit8(ci, 0xC0);
+            emit8(ci, 0x0F);
+            emit8(ci, 0xB6);
+            emit8(ci, 0xC0);
+            unary(ci, 0xF7, 3, RAX);
+            extend_rr16(ci, false, r, RAX);
+            break;
+    }
+    release(ci, &n1);
+    push_value(ci, in_register(r));
+}
+
+/* Everything but the control transfers */
+static void compile_op(struct Compiler* ci, const struct Decoded* d)
+{
+    struct Value v;
+    struct Value v2;
+    uint8_t r;
+
+    switch (d->op) {
+        case OP_NOP:
+            break;
+        case OP_LDL:
+            if (d->target == DATA_STACK) {
+                push_value(ci, constant(d->operand));
+            } else {
+                v = constant(d->operand);
+                push_other(ci, d->target, &v);
+            }
+            break;
+        case OP_LDH:
+            if (d->target == DATA_STACK) {
+                v = pop_value(ci);
+                if (v.kind == V_CONSTANT) {
+                    v.constant |= d->operand;
+                } else {
+                    materialize(ci, &v);
+                    alu_ri(ci, 1, v.reg, d->operand);
+                }
+                push_value(ci, v);
+            } else {
+                r = allocate_register(ci);
+                pop_other(ci, d->target, r);
+                alu_ri(ci, 1, r, d->operand);
+                v = in_register(r);
+                push_other(ci, d->target, &v);
+                release(ci, &v);
+            }
+            break;
+        case OP_DROP:
+            if (d->source == DATA_STACK) {
+                v = pop_value(ci);
+                release(ci, &v);
+            } else {
+                step16(ci, RDI, TOP_OF(d->source), false);
+            }
+            break;
+        case OP_DUP:
+            if (d->source == DATA_STACK) {
+                v = pop_value(ci);
+                if (v.kind != V_CONSTANT) {
+                    materialize(ci, &v);
+                    r = allocate_register(ci);
+                    alu_rr(ci, ALU_MOV, r, v.reg);
+                    push_value(ci, v);
+                    push_value(ci, in_register(r));
+                } else {
+                    push_value(ci, v);
+                    push_value(ci, v);
+                }
+            } else {
+                r = allocate_register(ci);
+                pop_other(ci, d->source, r);
+                v = in_register(r);
+                push_other(ci, d->source, &v);
+                push_other(ci, d->source, &v);
+                release(ci, &v);
+            }
+            break;
+        case OP_SWAP:
+            if (d->source == DATA_STACK) {
+                v = pop_value(ci);
+                v2 = pop_value(ci);
+                push_value(ci, v);
+                push_value(ci, v2);
+            } else {
+                v = in_register(allocate_register(ci));
+                v2 = in_register(allocate_register(ci));
+                pop_other(ci, d->source, v.reg);
+                pop_other(ci, d->source, v2.reg);
+                push_other(ci, d->source, &v);
+                push_other(ci, d->source, &v2);
+                release(ci, &v);
+                release(ci, &v2);
+            }
+            break;
+        case OP_MOV:
+            if (d->source == DATA_STACK) {
+                v = pop_value(ci);
+                if (d->target != DATA_STACK) {
+                    if (v.kind == V_MEMORY) {
+                        materialize(ci, &v);
+                    }
+                    push_other(ci, d->target, &v);
+                    release(ci, &v);
+                } else {
+                    push_value(ci, v);
+                }
+            } else {
+                v = in_register(allocate_register(ci));
+                pop_other(ci, d->source, v.reg);
+                if (d->target == DATA_STACK) {
+                    push_value(ci, v);
+                } else {
+                    push_other(ci, d->target, &v);
+                    release(ci, &v);
+                }
+            }
+            break;
+        case OP_NEG:
+        case OP_NOT:
+            v = pop_value(ci);
+            if (v.kind == V_CONSTANT) {
+                v.constant = (d->op == OP_NEG) ?
+                    (uint16_t)(0 - v.constant) : (uint16_t)~(v.constant);
+            } else {
+                materialize(ci, &v);
+                unary(ci, 0xF7, (d->op == OP_NEG) ? 3 : 2, v.reg);
+                extend_rr16(ci, false, v.reg, v.reg);
+            }
+            push_value(ci, v);
+            break;
+        default:
+            compile_binary(ci, d->op);
+            break;
+    }
+}
+
+/**
+ * Generate the native code for a block.  Returns false if the block
+ * needs more registers than there are.
+ */
+static bool generate(
+        struct Compiler* ci, const struct Block* block,
+        const struct Decoded* ops, const struct StackUse use[4])
+{
+    const struct Decoded* last = ops + (block->count - 1);
+    uint8_t* fail[8];
+    int fails = 0;
+    uint8_t* loop;
+    unsigned body = block->count;
+
+    for (int i = 0; i < 2 * MAX_STACK_SIZE + 1; ++i) {
+        ci->values[i].kind = V_MEMORY;
+        ci->values[i].position = i - MAX_STACK_SIZE;
+    }
+    ci->depth = 0;
+
+    /* Prologue, r15d tells whether a loop iteration completed */
+    for (unsigned i = 0; i < NUMBER_OF_SAVED_REGISTERS; ++i) {
+        push_r(ci, saved_registers[i]);
+    }
+    alu_rr(ci, ALU_XOR, R15, R15);
+
+    loop = ci->p;
+    emit_checks(ci, use, fail, &fails);
+
+    switch (last->op) {
+        case OP_ENTER:
+        case OP_BIF:
+        case OP_LEAVE:
+        case OP_HALT:
+            --body;
+            break;
+        default:
+            break;
+    }
+    for (unsigned i = 0; i < body; ++i) {
+        compile_op(ci, ops + i);
+    }
+    if (ci->failed) {
+        return false;
+    }
+
+    switch ((body == block->count) ? OP_NOP : last->op) {
+        case OP_NOP:
+            /* No control transfer, ran into the maximum length */
+            write_back(ci, use[DATA_STACK].lowest);
+            emit_count(ci, block);
+            store16_imm(ci, RDI, NO_INDEX, INSTRUCTION_OFFSET,
+                        block->ops[body - 1].instruction);
+            emit_exit(ci, block->end);
+            break;
+        case OP_BIF:
+            {
+                struct Value condition = pop_value(ci);
+                uint16_t target = block->ops[body].operand;
+                uint8_t* taken;
+
+                if (condition.kind == V_CONSTANT) {
+                    write_back(ci, use[DATA_STACK].lowest);
+                    emit_count(ci, block);
+                    store16_imm(ci, RDI, NO_INDEX, INSTRUCTION_OFFSET,
+                                block->ops[body].instruction);
+                    if (condition.constant) {
+                        emit_exit(ci, block->end);
+                        break;
+                    }
+                    taken = jmp(ci);
+                } else {
+                    /* The condition stays in its register over the write
+                     * back, test it after the last flag changing add */
+                    materialize(ci, &condition);
+                    write_back(ci, use[DATA_STACK].lowest);
+                    emit_count(ci, block);
+                    store16_imm(ci, RDI, NO_INDEX, INSTRUCTION_OFFSET,
+                                block->ops[body].instruction);
+                    alu_rr(ci, ALU_TEST, condition.reg, condition.reg);
+                    taken = jcc(ci, CC_E);
+                    emit_exit(ci, block->end);
+                }
+                patch(taken, ci->p);
+                if (target == block->start) {
+                    /* Loop in native code while the budget lasts */
+                    store16_imm(ci, RDI, NO_INDEX, PC_OFFSET, target);
+                    mov_ri(ci, R15, 1);
+                    unary(ci, 0xFF, 1, RSI);
+                    patch(jcc(ci, CC_NE), loop);
+                    mov_ri(ci, RAX, 1);
+                    emit_epilogue(ci);
+                } else {
+                    emit_exit(ci, target);
+                }
+            }
+            break;
+        case OP_ENTER:
+            {
+                struct Value ret = constant(block->end);
+                write_back(ci, use[DATA_STACK].lowest);
+                push_other(ci, RETURN_STACK, &ret);
+                emit_count(ci, block);
+                store16_imm(ci, RDI, NO_INDEX, INSTRUCTION_OFFSET,
+                            block->ops[body].instruction);
+                emit_exit(ci, block->ops[body].operand);
+            }
+            break;
+        case OP_LEAVE:
+            write_back(ci, use[DATA_STACK].lowest);
+            pop_other(ci, RETURN_STACK, RCX);
+            store16(ci, RDI, NO_INDEX, PC_OFFSET, RCX);
+            emit_count(ci, block);
+            store16_imm(ci, RDI, NO_INDEX, INSTRUCTION_OFFSET,
+                        block->ops[body].instruction);
+            mov_ri(ci, RAX, 1);
+            emit_epilogue(ci);
+            break;
+        default: /* HALT */
+            write_back(ci, use[DATA_STACK].lowest);
+            store8_imm(ci, RDI, KEEP_GOING_OFFSET, 0);
+            emit_count(ci, block);
+            store16_imm(ci, RDI, NO_INDEX, INSTRUCTION_OFFSET,
+                        block->ops[body].instruction);
+            emit_exit(ci, block->end);
+            break;
+    }
+
+    /* A failed check: nothing happened yet in this iteration.  Return
+     * whether an earlier iteration ran, the pc is already right then. */
+    for (int i = 0; i < fails; ++i) {
+        patch(fail[i], ci->p);
+    }
+    alu_rr(ci, ALU_MOV, RAX, R15);
+    emit_epilogue(ci);
+
+    return !(ci->failed);
+}
+
+/* --------------------------------------------------------------------*/
+
+struct Jit* jit_create(void)
+{
+    struct Jit* jit = calloc(1, sizeof(struct Jit));
+
+    if (jit != NULL) {
+        void* buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            free(jit);
+            return NULL;
+        }
+        jit->buffer = buffer;
+        jit->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return jit;
+}
+
+void jit_destroy(struct Jit* jit)
+{
+    if (jit != NULL) {
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+        free(jit);
+    }
+}
+
+/**
+ * True if there is no room for another block, see jit_flush().
+ */
+bool jit_full(const struct Jit* jit)
+{
+    return JIT_BUFFER_SIZE - jit->used < JIT_MAX_BLOCK_CODE;
+}
+
+/**
+ * Throw away all native code.  The caller must have dropped every
+ * pointer into it.
+ */
+void jit_flush(struct Jit* jit)
+{
+    jit->used = 0;
+    ++(jit->flushes);
+}
+
+/**
+ * Compile a block.  Returns NULL if it can not be compiled, the block
+ * then stays with the interpreter.
+ */
+native_block_type* jit_compile(struct Jit* jit, const struct Block* block)
+{
+    struct Decoded ops[BC_MAX_BLOCK_LENGTH];
+    struct StackUse use[4] = { { 0, 0 } };
+    int depth[4] = { 0 };
+    struct Compiler* ci;
+    native_block_type* native = NULL;
+    size_t first;
+    size_t last;
+    bool ok;
+
+    for (unsigned i = 0; i < block->count; ++i) {
+        decode_instruction(block->ops[i].instruction, &(ops[i]));
+        if (!analyse(&(ops[i]), use, depth)) {
+            ++(jit->rejected);
+            return NULL;
+        }
+    }
+    for (unsigned id = 0; id < 4; ++id) {
+        if ((-use[id].lowest > stack_sizes[id]) ||
+            (use[id].highest >= stack_sizes[id])) {
+            /* Would always end in an exception */
+            ++(jit->rejected);
+            return NULL;
+        }
+    }
+    if (jit_full(jit)) {
+        ++(jit->rejected);
+        return NULL;
+    }
+    /* The pages the code may go to, the first one can hold the end of
+     * the block before */
+    first = (size_t)jit->used & ~(jit->page_size - 1);
+    last = (jit->used + JIT_MAX_BLOCK_CODE + jit->page_size - 1) &
+           ~(jit->page_size - 1);
+    if (last > JIT_BUFFER_SIZE) {
+        last = JIT_BUFFER_SIZE;
+    }
+
+    ci = calloc(1, sizeof(struct Compiler));
+    if (ci == NULL) {
+        return NULL;
+    }
+    ci->start = jit->buffer + jit->used;
+    ci->p = ci->start;
+    if (mprotect(jit->buffer + first, last - first,
+                 PROT_READ | PROT_WRITE) != 0) {
+        free(ci);
+        ++(jit->rejected);
+        return NULL;
+    }
+    ok = generate(ci, block, ops, use);
+    if (mprotect(jit->buffer + first, last - first,
+                 PROT_READ | PROT_EXEC) != 0) {
+        /* Blocks compiled before would not run either */
+        perror("JIT");
+        exit(EXIT_FAILURE);
+    }
+    if (ok) {
+        native = (native_block_type*)(void*)ci->start;
+        jit->used += (size_t)(ci->p - ci->start);
+        /* Keep the next block aligned */
+        jit->used = (jit->used + 15) & ~(size_t)15;
+        ++(jit->compiled);
+    } else {
+        ++(jit->rejected);
+    }
+    free(ci);
+
+    return native;
+}
+
+void jit_report(const struct Jit* jit, FILE* outpf)
+{
+    fprintf(outpf, "JIT: %u blocks compiled, %u rejected, "
+                   "%lu bytes of native code, %u flushes\n",
+            jit->compiled, jit->rejected, (unsigned long)jit->used,
+            jit->flushes);
+}
+
+#endif /* FPEMU_JIT */
+
+/* ------------------------ end of file -------------------------------*/
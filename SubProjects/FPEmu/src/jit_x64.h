@@ -0,0 +1,31 @@
+#ifndef HG_JIT_X64_H
+#define HG_JIT_X64_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fpemu.h"
+#include "blockcache.h"
+
+#if defined(FPEMU_JIT) && !defined(__x86_64__)
+#error "The JIT core needs an x86-64 host"
+#endif
+
+/* Hot entries (ENTER or backward BIF) before a block is compiled */
+#define JIT_THRESHOLD 16
+/* Size of the buffer that holds all native code */
+#define JIT_BUFFER_SIZE (4 * 1024 * 1024)
+/* Iterations a native loop runs before returning to run_blocks() */
+#define JIT_LOOP_BUDGET 4096
+
+struct Jit;
+
+extern struct Jit* jit_create(void);
+extern void jit_destroy(struct Jit* jit);
+extern bool jit_full(const struct Jit* jit);
+extern void jit_flush(struct Jit* jit);
+extern native_block_type* jit_compile(struct Jit* jit, const struct Block* block);
+extern void jit_report(const struct Jit* jit, FILE* outpf);
+
+#endif /* HG_JIT_X64_H */
@@ -0,0 +1,521 @@
+/**
+ * Stack-master 16 emulator -- library interface
+ *
+ * Wraps a CPU_Context, its 64K of memory, and whatever the selected core
+ * needs, in one instance.  See libfpemu.h.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "blockcache.h"
+#include "threaded.h"
+#include "spectable.h"
+#include "tos.h"
+#include "serial.h"
+#include "iobus.h"
+#include "video.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "idle.h"
+#include "breakpoints.h"
+#ifdef FPEMU_JIT
+#include "jit_x64.h"
+#endif
+
+struct Fpemu {
+    struct CPU_Context c;
+    uint8_t memory[MEMORY_SIZE];
+};
+
+/* --------------------------------------------------------------------*/
+
+static void run_core(struct CPU_Context* c, uint8_t* memory);
+static enum FpemuResult result(const struct CPU_Context* c);
+static uint8_t hex_byte(const char* line);
+static struct Stack* stack_of(struct Fpemu* emu, uint16_t stack_id);
+static void invalidate_code(
+        struct CPU_Context* c, uint16_t address, size_t size);
+static void invalidate_breakpoints(
+        struct CPU_Context* c, const struct Breakpoints* breakpoints);
+
+/* --------------------------------------------------------------------*/
+
+static void run_core(struct CPU_Context* c, uint8_t* memory)
+{
+    switch (c->core) {
+        case CoreBlock:
+        case CoreFused:
+        case CoreJit:
+            run_blocks(c, memory);
+            break;
+#ifdef FPEMU_THREADED
+        case CoreThreaded:
+            run_threaded(c, memory);
+            break;
+#endif
+        case CoreTable:
+            run_spectable(c, memory);
+            break;
+        case CoreTos:
+            run_tos(c, memory);
+            break;
+        default:
+            run_switch(c, memory);
+            break;
+    }
+}
+
+static enum FpemuResult result(const struct CPU_Context* c)
+{
+    if (stopped_at_break(c)) {
+        return FpemuBreak;
+    }
+    if (c->exception != AllIsOK) {
+        return FpemuException;
+    }
+    return (c->keep_going) ? FpemuLimit : FpemuHalted;
+}
+
+static uint8_t hex_byte(const char* line)
+{
+    char c1 = line[0];
+    char c2 = line[1];
+    uint8_t u1 = (uint8_t)((c1 > '9') ? (c1 - 'A' + 10) : (c1 - '0'));
+    uint8_t u2 = (uint8_t)((c2 > '9') ? (c2 - 'A' + 10) : (c2 - '0'));
+    return u1*16+u2;
+}
+
+static struct Stack* stack_of(struct Fpemu* emu, uint16_t stack_id)
+{
+    switch (stack_id) {
+        case DATA_STACK:
+            return &(emu->c.data_stack);
+        case RETURN_STACK:
+            return &(emu->c.return_stack);
+        case CONTROL_STACK:
+            return &(emu->c.control_stack);
+        case TEMP_STACK:
+            return &(emu->c.temp_stack);
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Throw away translated code in a range of up to MEMORY_SIZE bytes.
+ */
+static void invalidate_code(
+        struct CPU_Context* c, uint16_t address, size_t size)
+{
+    for (size_t done = 0; done < size; done += MEMORY_SIZE / 2) {
+        size_t n = size - done;
+        if (n > MEMORY_SIZE / 2) {
+            n = MEMORY_SIZE / 2;
+        }
+        if (c->block_cache != NULL) {
+            block_cache_invalidate(c->block_cache, (uint16_t)(address + done),
+                                   (uint16_t)n);
+        }
+#ifdef FPEMU_THREADED
+        if (c->threaded_code != NULL) {
+            threaded_code_invalidate(c->threaded_code,
+                                     (uint16_t)(address + done), (uint16_t)n);
+        }
+#endif
+    }
+}
+
+/**
+ * Throw away translated code at the breakpoints, before a run that checks
+ * them and after it, so code without the check is translated again.
+ */
+static void invalidate_breakpoints(
+        struct CPU_Context* c, const struct Breakpoints* breakpoints)
+{
+    for (uint32_t pc = 0; pc < MEMORY_SIZE; pc += 2) {
+        if (is_breakpoint(breakpoints, (uint16_t)pc)) {
+            invalidate_code(c, (uint16_t)pc, 2);
+        }
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Create an emulator with empty memory, in the reset state.
+ *
+ * Serial input is read from fd_in, -1 for none.  Serial output goes to
+ * fd_out, or with -1 is kept for fpemu_output().  A core that cannot be
+ * set up falls back to a simpler one.  Returns NULL if out of memory.
+ */
+struct Fpemu* fpemu_create(enum CoreType core, int fd_in, int fd_out)
+{
+    struct Fpemu* emu = calloc(1, sizeof(struct Fpemu));
+    struct CPU_Context* c;
+
+    if (emu == NULL) {
+        return NULL;
+    }
+    c = &(emu->c);
+    cpu_reset(c);
+    c->fd_in = fd_in;
+    c->fd_out = fd_out;
+    c->io = io_bus_create();
+    c->idle = idle_create();
+    c->scheduler = scheduler_create();
+    if (c->scheduler != NULL) {
+        c->serial = serial_create(c->scheduler, fd_in, fd_out);
+        c->interrupts = interrupts_create(c->scheduler);
+    }
+    if (c->interrupts != NULL) {
+        c->video = video_create(c->scheduler, c->interrupts);
+        c->timers = timers_create(c->scheduler, c->interrupts);
+    }
+    if ((c->serial == NULL) || (c->io == NULL) || (c->idle == NULL) ||
+        (c->video == NULL) ||
+        (c->timers == NULL) ||
+        !serial_map(c->serial, c->io) || !video_map(c->video, c->io) ||
+        !timers_map(c->timers, c->io) ||
+        !interrupts_map(c->interrupts, c->io)) {
+        serial_destroy(c->serial);
+        io_bus_destroy(c->io);
+        idle_destroy(c->idle);
+        video_destroy(c->video);
+        timers_destroy(c->timers);
+        interrupts_destroy(c->interrupts);
+        scheduler_destroy(c->scheduler);
+        free(emu);
+        return NULL;
+    }
+    video_start(c->video);
+
+    c->core = core;
+    if ((core == CoreBlock) || (core == CoreFused) || (core == CoreJit)) {
+        c->block_cache = block_cache_create();
+        if (c->block_cache == NULL) {
+            fprintf(stderr, "No block cache, using switch core\n");
+            c->core = CoreSwitch;
+        } else {
+            c->block_cache->fuse = (core == CoreFused);
+        }
+    }
+#ifdef FPEMU_JIT
+    if ((core == CoreJit) && (c->block_cache != NULL)) {
+        c->block_cache->jit = jit_create();
+        if (c->block_cache->jit == NULL) {
+            fprintf(stderr, "No JIT, using block core\n");
+            c->core = CoreBlock;
+        }
+    }
+#endif
+#ifdef FPEMU_THREADED
+    if (core == CoreThreaded) {
+        c->threaded_code = threaded_code_create();
+        if (c->threaded_code == NULL) {
+            fprintf(stderr, "No threaded code, using switch core\n");
+            c->core = CoreSwitch;
+        }
+    }
+#endif
+    return emu;
+}
+
+void fpemu_destroy(struct Fpemu* emu)
+{
+    if (emu != NULL) {
+#ifdef FPEMU_JIT
+        if (emu->c.block_cache != NULL) {
+            jit_destroy(emu->c.block_cache->jit);
+        }
+#endif
+        block_cache_destroy(emu->c.block_cache);
+#ifdef FPEMU_THREADED
+        threaded_code_destroy(emu->c.threaded_code);
+#endif
+        serial_destroy(emu->c.serial);
+        io_bus_destroy(emu->c.io);
+        idle_destroy(emu->c.idle);
+        video_destroy(emu->c.video);
+        timers_destroy(emu->c.timers);
+        interrupts_destroy(emu->c.interrupts);
+        scheduler_destroy(emu->c.scheduler);
+        free(emu);
+    }
+}
+
+/**
+ * Reset the processor, the timers and the interrupt controller, memory
+ * is left alone.
+ */
+void fpemu_reset(struct Fpemu* emu)
+{
+    cpu_reset(&(emu->c));
+    scheduler_reset(emu->c.scheduler, 0);
+    timers_reset(emu->c.timers);
+    interrupts_reset(emu->c.interrupts);
+    idle_reset(emu->c.idle);
+    video_start(emu->c.video);
+}
+
+/**
+ * Back to the state fpemu_create() left the emulator in: memory cleared,
+ * no translated code, no serial output.  Serial input comes from fd_in
+ * from now on.
+ */
+void fpemu_clear(struct Fpemu* emu, int fd_in)
+{
+    struct CPU_Context* c = &(emu->c);
+
+    memset(emu->memory, 0, MEMORY_SIZE);
+    invalidate_code(c, 0x0000, MEMORY_SIZE);
+    fpemu_reset(emu);
+    c->fd_in = fd_in;
+    serial_reset(c->serial, fd_in);
+    video_reset(c->video);
+}
+
+/**
+ * Load an image in the Intel hex format that fa produces.
+ *
+ * Returns false if a line is malformed, what came before it is loaded.
+ */
+bool fpemu_load_hex(struct Fpemu* emu, const char* text, size_t size)
+{
+    const char* end = text + size;
+    const char* line = text;
+
+    while (line < end) {
+        const char* eol = memchr(line, '\n', (size_t)(end - line));
+        size_t length = (eol != NULL) ? (size_t)(eol - line) : (size_t)(end - line);
+
+        if ((length > 0) && (line[0] == ':')) {
+            uint8_t count;
+            uint16_t location;
+            uint8_t type;
+
+            if (length < 11) {
+                fprintf(stderr, "line in .hex is too short\n");
+                return false;
+            }
+            count = hex_byte(line + 1);
+            location = (uint16_t)((hex_byte(line + 3) << 8) + hex_byte(line + 5));
+            type = hex_byte(line + 7);
+            if (type == 1) {
+                /* End of data */
+                break;
+            }
+            if (type == 0) {
+                uint8_t data[256];
+                if (length < 11 + 2 * (size_t)count) {
+                    fprintf(stderr, "line in .hex is too short\n");
+                    return false;
+                }
+                for (unsigned i = 0; i < count; ++i) {
+                    data[i] = hex_byte(line + 9 + 2 * i);
+                }
+                fpemu_write_memory(emu, location, data, count);
+            }
+        }
+        line += length + 1;
+    }
+    return true;
+}
+
+/**
+ * Run until HALT, an exception without a handler, or the given number of
+ * instructions.
+ * Serial output is flushed before it returns.
+ */
+enum FpemuResult fpemu_run(struct Fpemu* emu, uint64_t instructions)
+{
+    struct CPU_Context* c = &(emu->c);
+    uint64_t limit = UINT64_MAX;
+
+    c->keep_going = true;
+    c->single_step = false;
+    c->exception = AllIsOK;
+    if (instructions < UINT64_MAX - c->instruction_count) {
+        limit = c->instruction_count + instructions;
+    }
+    do {
+        run_scheduled(c, emu->memory, run_core, limit);
+    } while (take_exception(c, emu->memory) && !stopped_at_break(c));
+    c->instruction_limit = UINT64_MAX;
+    serial_flush(c->serial);
+
+    return result(c);
+}
+
+/**
+ * Execute a single instruction, with the reference interpreter.
+ */
+enum FpemuResult fpemu_step(struct Fpemu* emu)
+{
+    struct CPU_Context* c = &(emu->c);
+
+    c->keep_going = true;
+    c->exception = AllIsOK;
+    step(c, emu->memory);
+    (void)take_exception(c, emu->memory);
+    serial_flush(c->serial);
+
+    return result(c);
+}
+
+/**
+ * Stop the runs from now on at the breakpoints and watchpoints, NULL or
+ * none set: run without checks.  A breakpoint at the pc the emulator is
+ * at now does not stop it.  Translated code at the breakpoints is thrown
+ * away, it is translated again with the check.
+ */
+void fpemu_set_breakpoints(
+        struct Fpemu* emu, struct Breakpoints* breakpoints)
+{
+    struct CPU_Context* c = &(emu->c);
+
+    if (c->breakpoints != NULL) {
+        invalidate_breakpoints(c, c->breakpoints);
+        c->breakpoints = NULL;
+    }
+    if (!breakpoints_active(breakpoints)) {
+        return;
+    }
+    c->breakpoints = breakpoints;
+    breakpoints->reason = BreakNone;
+    breakpoints->start = c->instruction_count;
+    invalidate_breakpoints(c, breakpoints);
+}
+
+/**
+ * The clock frequency of the hardware, in Hz.  The host sleeps in idle
+ * loops for as long as they would run on it.
+ */
+void fpemu_set_clock(struct Fpemu* emu, double hz)
+{
+    emu->c.idle->hz = hz;
+}
+
+uint16_t fpemu_pc(const struct Fpemu* emu)
+{
+    return emu->c.pc;
+}
+
+void fpemu_set_pc(struct Fpemu* emu, uint16_t pc)
+{
+    emu->c.pc = pc;
+}
+
+uint16_t fpemu_exception(const struct Fpemu* emu)
+{
+    return emu->c.exception;
+}
+
+uint64_t fpemu_instruction_count(const struct Fpemu* emu)
+{
+    return emu->c.instruction_count;
+}
+
+/**
+ * Copy memory, wrapping around at the end of the address space.
+ */
+void fpemu_read_memory(
+        const struct Fpemu* emu, uint16_t address, uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = emu->memory[(uint16_t)(address + i)];
+    }
+}
+
+/**
+ * Write memory, translated code in the range is thrown away.
+ */
+void fpemu_write_memory(
+        struct Fpemu* emu, uint16_t address, const uint8_t* data, size_t size)
+{
+    struct CPU_Context* c = &(emu->c);
+
+    if (size == 0) {
+        return;
+    }
+    if ((size_t)address + size <= MEMORY_SIZE) {
+        memcpy(emu->memory + address, data, size);
+    } else {
+        for (size_t i = 0; i < size; ++i) {
+            emu->memory[(uint16_t)(address + i)] = data[i];
+        }
+    }
+    for (size_t done = 0; done < size; done += DIRTY_PAGE_SIZE) {
+        mark_dirty(c, (uint16_t)(address + done), 1);
+    }
+    mark_dirty(c, (uint16_t)(address + size - 1), 1);
+    invalidate_code(c, address, size);
+}
+
+unsigned fpemu_stack_depth(const struct Fpemu* emu, uint16_t stack_id)
+{
+    const struct Stack* stack = stack_of((struct Fpemu*)emu, stack_id);
+
+    return (stack != NULL) ? stack->top : 0;
+}
+
+/**
+ * An entry of a stack, index 0 is the bottom.  0 if there is none.
+ */
+uint16_t fpemu_stack_value(
+        const struct Fpemu* emu, uint16_t stack_id, unsigned index)
+{
+    const struct Stack* stack = stack_of((struct Fpemu*)emu, stack_id);
+
+    if ((stack == NULL) || (index >= stack->top)) {
+        return 0;
+    }
+    return stack->values[index];
+}
+
+/**
+ * Replace the contents of a stack, values[0] is the bottom.
+ *
+ * Returns false if the stack does not exist, or would overflow.
+ */
+bool fpemu_set_stack(
+        struct Fpemu* emu, uint16_t stack_id,
+        const uint16_t* values, unsigned depth)
+{
+    struct Stack* stack = stack_of(emu, stack_id);
+
+    if ((stack == NULL) || (depth >= stack->size)) {
+        return false;
+    }
+    memcpy(stack->values, values, depth * sizeof(uint16_t));
+    stack->top = (uint16_t)depth;
+    return true;
+}
+
+/**
+ * Everything written to the serial port so far, if it is not written
+ * to a file.
+ */
+const uint8_t* fpemu_output(const struct Fpemu* emu, size_t* size)
+{
+    *size = emu->c.serial->captured;
+    return emu->c.serial->capture;
+}
+
+struct CPU_Context* fpemu_context(struct Fpemu* emu)
+{
+    return &(emu->c);
+}
+
+uint8_t* fpemu_memory(struct Fpemu* emu)
+{
+    return emu->memory;
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,65 @@
+#ifndef HG_LIBFPEMU_H
+#define HG_LIBFPEMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "fpemu.h"
+
+/**
+ * libfpemu -- the emulator as a library
+ *
+ * All state of an emulator, memory included, is inside its struct Fpemu,
+ * so any number of them can be used in one process.  One instance must
+ * not be used by two threads at the same time.
+ */
+
+struct Fpemu;
+
+/* Why fpemu_run() or fpemu_step() returned */
+enum FpemuResult {
+    FpemuHalted = 0U,   /* HALT */
+    FpemuException,     /* See fpemu_exception() */
+    FpemuLimit,         /* Ran the number of instructions asked for */
+    FpemuBreak          /* At a breakpoint or watchpoint */
+};
+
+/* Creation and loading */
+extern struct Fpemu* fpemu_create(enum CoreType core, int fd_in, int fd_out);
+extern void fpemu_destroy(struct Fpemu* emu);
+extern void fpemu_reset(struct Fpemu* emu);
+extern void fpemu_clear(struct Fpemu* emu, int fd_in);
+extern bool fpemu_load_hex(struct Fpemu* emu, const char* text, size_t size);
+
+/* Running */
+extern enum FpemuResult fpemu_run(struct Fpemu* emu, uint64_t instructions);
+extern enum FpemuResult fpemu_step(struct Fpemu* emu);
+extern void fpemu_set_clock(struct Fpemu* emu, double hz);
+extern void fpemu_set_breakpoints(
+        struct Fpemu* emu, struct Breakpoints* breakpoints);
+
+/* State */
+extern uint16_t fpemu_pc(const struct Fpemu* emu);
+extern void fpemu_set_pc(struct Fpemu* emu, uint16_t pc);
+extern uint16_t fpemu_exception(const struct Fpemu* emu);
+extern uint64_t fpemu_instruction_count(const struct Fpemu* emu);
+extern void fpemu_read_memory(
+        const struct Fpemu* emu, uint16_t address, uint8_t* data, size_t size);
+extern void fpemu_write_memory(
+        struct Fpemu* emu, uint16_t address, const uint8_t* data, size_t size);
+extern unsigned fpemu_stack_depth(const struct Fpemu* emu, uint16_t stack_id);
+extern uint16_t fpemu_stack_value(
+        const struct Fpemu* emu, uint16_t stack_id, unsigned index);
+extern bool fpemu_set_stack(
+        struct Fpemu* emu, uint16_t stack_id,
+        const uint16_t* values, unsigned depth);
+
+/* Serial output, when created with fd_out -1 */
+extern const uint8_t* fpemu_output(const struct Fpemu* emu, size_t* size);
+
+/* For the command line tool: the parts the API does not cover */
+extern struct CPU_Context* fpemu_context(struct Fpemu* emu);
+extern uint8_t* fpemu_memory(struct Fpemu* emu);
+
+#endif /* HG_LIBFPEMU_H */
@@ -0,0 +1,151 @@
+/**
+ * Stack-master 16 emulator -- execution profile
+ *
+ * Counts how often the instruction at each address is executed, and
+ * reports the hottest addresses and, with a symbol table, the hottest
+ * labels: the time spent from a label up to the next one.
+ *
+ * Runs on the reference interpreter, one step() at a time.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fpemu.h"
+#include "symbols.h"
+#include "profile.h"
+
+struct Hot {
+    uint32_t index;          /* pc / 2, or a symbol */
+    uint64_t count;
+};
+
+/* --------------------------------------------------------------------*/
+
+static int by_count(const void* a, const void* b);
+static double percentage(uint64_t count, uint64_t total);
+
+/* --------------------------------------------------------------------*/
+
+/* Descending by count */
+static int by_count(const void* a, const void* b)
+{
+    const struct Hot* ha = a;
+    const struct Hot* hb = b;
+
+    if (ha->count != hb->count) {
+        return (ha->count < hb->count) ? 1 : -1;
+    }
+    return (ha->index < hb->index) ? -1 : (ha->index > hb->index);
+}
+
+static double percentage(uint64_t count, uint64_t total)
+{
+    return (total > 0) ? (100.0 * count / total) : 0.0;
+}
+
+/* --------------------------------------------------------------------*/
+
+struct Profile* profile_create(void)
+{
+    return calloc(1, sizeof(struct Profile));
+}
+
+void profile_destroy(struct Profile* profile)
+{
+    free(profile);
+}
+
+/**
+ * Run the processor with the reference interpreter, counting the
+ * instructions executed at each address.
+ */
+void run_profile(
+        struct CPU_Context* c, uint8_t* memory, struct Profile* profile)
+{
+    while (c->keep_going && (c->instruction_count < c->instruction_limit)) {
+        ++(profile->counts[c->pc / 2]);
+        step(c, memory);
+        if (!(c->keep_going)) {
+            (void)take_exception(c, memory);
+        }
+    }
+}
+
+/**
+ * Print the hottest addresses, and the hottest symbols if there are any.
+ */
+void profile_report(
+        const struct Profile* profile, const struct Symbols* symbols,
+        FILE* outpf)
+{
+    size_t size = MEMORY_SIZE / 2;
+    struct Hot* hot;
+    uint64_t total = 0;
+    unsigned n = 0;
+    char name[SYMBOL_MAX_NAME + 16];
+
+    if ((symbols != NULL) && (symbols->count + 1 > size)) {
+        size = symbols->count + 1;
+    }
+    hot = malloc(size * sizeof(struct Hot));
+    if (hot == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < MEMORY_SIZE / 2; ++i) {
+        if (profile->counts[i] != 0) {
+            hot[n].index = i;
+            hot[n].count = profile->counts[i];
+            total += profile->counts[i];
+            ++n;
+        }
+    }
+    qsort(hot, n, sizeof(struct Hot), by_count);
+
+    fprintf(outpf, "Profile: %lu instructions at %u addresses\n",
+            (unsigned long)total, n);
+    fprintf(outpf, "  %12s %8s  %-7s %s\n", "Count", "%", "Address", "Symbol");
+    for (unsigned i = 0; (i < n) && (i < PROFILE_REPORT_COUNT); ++i) {
+        uint16_t address = (uint16_t)(hot[i].index * 2);
+        symbols_format(symbols, address, name, sizeof(name));
+        fprintf(outpf, "  %12lu %7.2f%%  %04x    %s\n",
+                (unsigned long)hot[i].count,
+                percentage(hot[i].count, total), address, name);
+    }
+
+    if ((symbols != NULL) && (symbols->count > 0)) {
+        /* Reuse hot, indexed by symbol; addresses before the first
+         * symbol go to index count */
+        unsigned m = symbols->count + 1;
+        memset(hot, 0, m * sizeof(struct Hot));
+        for (unsigned i = 0; i < m; ++i) {
+            hot[i].index = i;
+        }
+        for (uint32_t i = 0; i < MEMORY_SIZE / 2; ++i) {
+            if (profile->counts[i] != 0) {
+                const struct Symbol* symbol =
+                    symbols_find(symbols, (uint16_t)(i * 2));
+                unsigned s = (symbol == NULL) ? symbols->count :
+                             (unsigned)(symbol - symbols->symbols);
+                hot[s].count += profile->counts[i];
+            }
+        }
+        qsort(hot, m, sizeof(struct Hot), by_count);
+        fprintf(outpf, "Profile per symbol:\n");
+        fprintf(outpf, "  %12s %8s  %s\n", "Count", "%", "Symbol");
+        for (unsigned i = 0;
+             (i < m) && (i < PROFILE_REPORT_COUNT) && (hot[i].count != 0);
+             ++i) {
+            fprintf(outpf, "  %12lu %7.2f%%  %s\n",
+                    (unsigned long)hot[i].count,
+                    percentage(hot[i].count, total),
+                    (hot[i].index < symbols->count) ?
+                    symbols->symbols[hot[i].index].name : "(none)");
+        }
+    }
+    free(hot);
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,29 @@
+#ifndef HG_PROFILE_H
+#define HG_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fpemu.h"
+#include "symbols.h"
+
+/* Addresses and symbols printed by profile_report() */
+#define PROFILE_REPORT_COUNT 20
+
+/**
+ * Executions per instruction address.  Instructions are 2 byte aligned,
+ * so pc / 2 is the index.
+ */
+struct Profile {
+    uint64_t counts[MEMORY_SIZE / 2];
+};
+
+extern struct Profile* profile_create(void);
+extern void profile_destroy(struct Profile* profile);
+extern void run_profile(
+        struct CPU_Context* c, uint8_t* memory, struct Profile* profile);
+extern void profile_report(
+        const struct Profile* profile, const struct Symbols* symbols,
+        FILE* outpf);
+
+#endif /* HG_PROFILE_H */
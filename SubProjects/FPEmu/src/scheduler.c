@@ -0,0 +1,234 @@
+/**
+ * Stack-master 16 emulator -- event scheduler
+ *
+ * Every event in the wheel has its slot within WHEEL_SLOTS slots from
+ * the slot of base, so the first event is in the first slot that is not
+ * empty, counting from base.  Events before base, scheduled late, go in
+ * the slot of base.  When base moves on the events of the later list
+ * that fit are moved into the wheel.
+ *
+ * next is kept exact, it is the instruction limit of the cores.  Finding
+ * it again after a dispatch walks the wheel, which is cheap next to the
+ * instructions run between events.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+
+/* --------------------------------------------------------------------*/
+
+static uint64_t slot_of(const struct Scheduler* s, uint64_t cycle);
+static void insert(struct Scheduler* s, struct Event* e);
+static struct Event** first(struct Scheduler* s);
+static void advance(struct Scheduler* s, uint64_t cycle);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Slots from the slot of base, WHEEL_SLOTS or more: not in the wheel.
+ */
+static uint64_t slot_of(const struct Scheduler* s, uint64_t cycle)
+{
+    if (cycle < s->base) {
+        return 0;
+    }
+    return (cycle >> WHEEL_SHIFT) - (s->base >> WHEEL_SHIFT);
+}
+
+static void insert(struct Scheduler* s, struct Event* e)
+{
+    struct Event** list = &(s->later);
+
+    if (slot_of(s, e->cycle) < WHEEL_SLOTS) {
+        uint64_t slot = (s->base >> WHEEL_SHIFT) + slot_of(s, e->cycle);
+        list = &(s->slots[slot % WHEEL_SLOTS]);
+    }
+    e->next = *list;
+    *list = e;
+}
+
+/**
+ * The link to the first event, NULL if there is none.  Of events at the
+ * same cycle the one scheduled last comes first.
+ */
+static struct Event** first(struct Scheduler* s)
+{
+    struct Event** list = &(s->later);
+    struct Event** earliest = NULL;
+
+    for (unsigned i = 0; i < WHEEL_SLOTS; ++i) {
+        uint64_t slot = (s->base >> WHEEL_SHIFT) + i;
+        if (s->slots[slot % WHEEL_SLOTS] != NULL) {
+            list = &(s->slots[slot % WHEEL_SLOTS]);
+            break;
+        }
+    }
+    for (; *list != NULL; list = &((*list)->next)) {
+        if ((earliest == NULL) || ((*list)->cycle < (*earliest)->cycle)) {
+            earliest = list;
+        }
+    }
+    return earliest;
+}
+
+/**
+ * Move the wheel on to the cycle.  Every event in the wheel must be at
+ * this cycle or later.
+ */
+static void advance(struct Scheduler* s, uint64_t cycle)
+{
+    struct Event* later = s->later;
+
+    if ((cycle >> WHEEL_SHIFT) == (s->base >> WHEEL_SHIFT)) {
+        return;
+    }
+    s->base = cycle;
+    s->later = NULL;
+    while (later != NULL) {
+        struct Event* e = later;
+        later = later->next;
+        insert(s, e);
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Run the handlers of the events up to and at the cycle, in order.  A
+ * handler may schedule events, at this cycle too.
+ */
+void scheduler_dispatch(struct Scheduler* s, uint64_t cycle)
+{
+    while (s->next <= cycle) {
+        struct Event** link = first(s);
+        struct Event* e = *link;
+
+        *link = e->next;
+        e->pending = false;
+        if (e->cycle > s->base) {
+            advance(s, e->cycle);
+        }
+        link = first(s);
+        s->next = (link == NULL) ? UINT64_MAX : (*link)->cycle;
+        (s->dispatched)++;
+        e->handler(e->device, e->cycle);
+    }
+    advance(s, cycle);
+}
+
+/**
+ * An empty schedule at cycle 0, NULL if out of memory.
+ */
+struct Scheduler* scheduler_create(void)
+{
+    struct Scheduler* s = calloc(1, sizeof(struct Scheduler));
+
+    if (s != NULL) {
+        s->next = UINT64_MAX;
+    }
+    return s;
+}
+
+void scheduler_destroy(struct Scheduler* s)
+{
+    free(s);
+}
+
+/**
+ * Drop every event, the wheel starts again at the cycle: 0 after a
+ * reset, the instruction count of a snapshot when it is restored.  The
+ * devices have to forget their events, or schedule them again.
+ */
+void scheduler_reset(struct Scheduler* s, uint64_t cycle)
+{
+    for (unsigned i = 0; i <= WHEEL_SLOTS; ++i) {
+        struct Event* e = (i < WHEEL_SLOTS) ? s->slots[i] : s->later;
+        for (; e != NULL; e = e->next) {
+            e->pending = false;
+        }
+    }
+    for (unsigned i = 0; i < WHEEL_SLOTS; ++i) {
+        s->slots[i] = NULL;
+    }
+    s->later = NULL;
+    s->base = cycle;
+    s->next = UINT64_MAX;
+}
+
+void event_init(struct Event* e, EventHandler handler, void* device)
+{
+    e->cycle = 0;
+    e->handler = handler;
+    e->device = device;
+    e->next = NULL;
+    e->pending = false;
+}
+
+/**
+ * Schedule the event at the cycle, or move it there if it is pending.  A
+ * cycle in the past is dispatched as soon as possible.
+ */
+void scheduler_add(struct Scheduler* s, struct Event* e, uint64_t cycle)
+{
+    scheduler_remove(s, e);
+    e->cycle = cycle;
+    e->pending = true;
+    insert(s, e);
+    if (cycle < s->next) {
+        s->next = cycle;
+    }
+}
+
+void scheduler_remove(struct Scheduler* s, struct Event* e)
+{
+    struct Event** link;
+
+    if (!(e->pending)) {
+        return;
+    }
+    link = &(s->later);
+    if (slot_of(s, e->cycle) < WHEEL_SLOTS) {
+        uint64_t slot = (s->base >> WHEEL_SHIFT) + slot_of(s, e->cycle);
+        link = &(s->slots[slot % WHEEL_SLOTS]);
+    }
+    while (*link != e) {
+        link = &((*link)->next);
+    }
+    *link = e->next;
+    e->pending = false;
+    if (e->cycle == s->next) {
+        link = first(s);
+        s->next = (link == NULL) ? UINT64_MAX : (*link)->cycle;
+    }
+}
+
+/**
+ * Cycles from the cycle to the event, 0 if it is due, UINT64_MAX if it is
+ * not pending.  Snapshots keep events like this, so they can be put back
+ * at another cycle count with scheduler_add_in().
+ */
+uint64_t event_due_in(const struct Event* e, uint64_t cycle)
+{
+    if (!(e->pending)) {
+        return UINT64_MAX;
+    }
+    return (e->cycle > cycle) ? e->cycle - cycle : 0;
+}
+
+/**
+ * Schedule the event the cycles after the cycle, UINT64_MAX removes it.
+ */
+void scheduler_add_in(
+        struct Scheduler* s, struct Event* e, uint64_t cycle, uint64_t cycles)
+{
+    if (cycles == UINT64_MAX) {
+        scheduler_remove(s, e);
+    } else {
+        scheduler_add(s, e, cycle + cycles);
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,64 @@
+#ifndef HG_SCHEDULER_H
+#define HG_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Events at future cycles, for devices that do things in time.  A
+ * timing wheel: events in the next WHEEL_SLOTS slots of 2^WHEEL_SHIFT
+ * cycles hang in the slot of their cycle, later ones wait in one list
+ * until the wheel gets there.
+ *
+ * The cores never look at the scheduler.  next is their instruction
+ * limit, see run_scheduled().
+ */
+
+#define WHEEL_SLOTS 256
+#define WHEEL_SHIFT 6
+
+/* Called with the cycle the event was scheduled at */
+typedef void (*EventHandler)(void* device, uint64_t cycle);
+
+/* Part of the device, the scheduler allocates nothing */
+struct Event {
+    uint64_t cycle;
+    EventHandler handler;
+    void* device;
+    struct Event* next;
+    bool pending;
+};
+
+struct Scheduler {
+    uint64_t base;      /* The wheel starts at the slot of this cycle */
+    uint64_t next;      /* Cycle of the first event, UINT64_MAX: none */
+    struct Event* slots[WHEEL_SLOTS];
+    struct Event* later;
+    uint64_t dispatched;
+};
+
+/* --------------------------------------------------------------------*/
+
+extern void scheduler_dispatch(struct Scheduler* s, uint64_t cycle);
+
+/**
+ * Dispatch the events that are due.  Cheap when there are none.
+ */
+static inline void scheduler_poll(struct Scheduler* s, uint64_t cycle)
+{
+    if (cycle >= s->next) {
+        scheduler_dispatch(s, cycle);
+    }
+}
+
+extern struct Scheduler* scheduler_create(void);
+extern void scheduler_destroy(struct Scheduler* s);
+extern void scheduler_reset(struct Scheduler* s, uint64_t cycle);
+extern void event_init(struct Event* e, EventHandler handler, void* device);
+extern void scheduler_add(struct Scheduler* s, struct Event* e, uint64_t cycle);
+extern void scheduler_remove(struct Scheduler* s, struct Event* e);
+extern uint64_t event_due_in(const struct Event* e, uint64_t cycle);
+extern void scheduler_add_in(
+        struct Scheduler* s, struct Event* e, uint64_t cycle, uint64_t cycles);
+
+#endif /* HG_SCHEDULER_H */
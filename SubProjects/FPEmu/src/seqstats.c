@@ -0,0 +1,236 @@
+/**
+ * Stack-master 16 emulator -- instruction sequence statistics
+ *
+ * Counts how often each pair and triple of instructions is executed back
+ * to back, to find the sequences worth fusing into superinstructions (see
+ * fuse() in blockcache.c).  An instruction is classified by its operation
+ * and stacks, literals and addresses are ignored.  Sequences never
+ * continue past a control transfer or a store, like a block.
+ *
+ * Runs on the reference interpreter, one step() at a time.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "decode.h"
+#include "seqstats.h"
+
+/* Bits used for one instruction class in a key */
+#define SEQ_CLASS_BITS 10
+
+struct SequenceCount {
+    uint32_t key;      /* Classes, first instruction in the low bits */
+    uint8_t length;    /* 0: empty slot */
+    uint64_t count;
+};
+
+struct SequenceStats {
+    uint16_t history[SEQ_MAX_LENGTH - 1];  /* Classes, most recent first */
+    unsigned history_length;
+    uint16_t next_pc;                      /* Where the sequence continues */
+    unsigned used;
+    bool full;
+    struct SequenceCount table[SEQ_TABLE_SIZE];
+};
+
+/* --------------------------------------------------------------------*/
+
+static uint16_t classify(uint16_t instruction, bool* ends_sequence);
+static void count(struct SequenceStats* stats, uint32_t key, uint8_t length);
+static int by_count(const void* a, const void* b);
+static void print_class(uint16_t class, FILE* outpf);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * The operation in the low 6 bits, the stacks it uses above it.
+ */
+static uint16_t classify(uint16_t instruction, bool* ends_sequence)
+{
+    struct Decoded d;
+    uint16_t class;
+
+    decode_instruction(instruction, &d);
+    class = d.op;
+    switch (d.op) {
+        case OP_DROP:
+        case OP_DUP:
+        case OP_SWAP:
+            class |= (uint16_t)(d.source << 6);
+            break;
+        case OP_MOV:
+            class |= (uint16_t)((d.source << 6) | (d.target << 8));
+            break;
+        case OP_LDL:
+        case OP_LDH:
+            class |= (uint16_t)(d.target << 8);
+            break;
+        default:
+            break;
+    }
+    *ends_sequence = d.ends_block;
+    return class;
+}
+
+static void count(struct SequenceStats* stats, uint32_t key, uint8_t length)
+{
+    uint32_t slot = ((key * 2654435761U) >> 16) & (SEQ_TABLE_SIZE - 1);
+
+    for (;;) {
+        struct SequenceCount* entry = &(stats->table[slot]);
+        if ((entry->length == length) && (entry->key == key)) {
+            ++(entry->count);
+            return;
+        }
+        if (entry->length == 0) {
+            if (stats->used >= SEQ_TABLE_SIZE / 2) {
+                /* Keep probing short, drop new sequences */
+                stats->full = true;
+                return;
+            }
+            entry->key = key;
+            entry->length = length;
+            entry->count = 1;
+            ++(stats->used);
+            return;
+        }
+        slot = (slot + 1) & (SEQ_TABLE_SIZE - 1);
+    }
+}
+
+/* Descending by count */
+static int by_count(const void* a, const void* b)
+{
+    const struct SequenceCount* sa = *(const struct SequenceCount* const*)a;
+    const struct SequenceCount* sb = *(const struct SequenceCount* const*)b;
+
+    if (sa->count != sb->count) {
+        return (sa->count < sb->count) ? 1 : -1;
+    }
+    return (sa->key < sb->key) ? -1 : (sa->key > sb->key);
+}
+
+static void print_class(uint16_t class, FILE* outpf)
+{
+    static const char stack_letters[4] = { 'd', 'r', 'c', 't' };
+    uint16_t op = class & 0x3F;
+
+    fprintf(outpf, "%s", op_names[op]);
+    switch (op) {
+        case OP_DROP:
+        case OP_DUP:
+        case OP_SWAP:
+            fprintf(outpf, " %c", stack_letters[(class >> 6) & 3]);
+            break;
+        case OP_MOV:
+            fprintf(outpf, " %c %c", stack_letters[(class >> 6) & 3],
+                    stack_letters[(class >> 8) & 3]);
+            break;
+        case OP_LDL:
+        case OP_LDH:
+            fprintf(outpf, " %c", stack_letters[(class >> 8) & 3]);
+            break;
+        default:
+            break;
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+struct SequenceStats* sequence_stats_create(void)
+{
+    return calloc(1, sizeof(struct SequenceStats));
+}
+
+void sequence_stats_destroy(struct SequenceStats* stats)
+{
+    free(stats);
+}
+
+/**
+ * Run the processor with the reference interpreter, counting the
+ * sequences executed.
+ */
+void run_sequence_stats(
+        struct CPU_Context* c, uint8_t* memory, struct SequenceStats* stats)
+{
+    while (c->keep_going && (c->instruction_count < c->instruction_limit)) {
+        bool ends_sequence;
+        uint16_t class = classify(fetch_instruction(memory, c->pc),
+                                  &ends_sequence);
+        uint32_t key = class;
+
+        if (c->pc != stats->next_pc) {
+            stats->history_length = 0;
+        }
+        for (unsigned i = 0; i < stats->history_length; ++i) {
+            key = (key << SEQ_CLASS_BITS) | stats->history[i];
+            count(stats, key, (uint8_t)(i + 2));
+        }
+
+        if (ends_sequence) {
+            stats->history_length = 0;
+        } else {
+            for (unsigned i = SEQ_MAX_LENGTH - 2; i > 0; --i) {
+                stats->history[i] = stats->history[i - 1];
+            }
+            stats->history[0] = class;
+            if (stats->history_length < SEQ_MAX_LENGTH - 1) {
+                ++(stats->history_length);
+            }
+        }
+        stats->next_pc = c->pc + 2;
+
+        step(c, memory);
+        if (!(c->keep_going)) {
+            (void)take_exception(c, memory);
+        }
+    }
+}
+
+/**
+ * Print the most frequent sequences of each length.
+ */
+void sequence_stats_report(const struct SequenceStats* stats, FILE* outpf)
+{
+    const struct SequenceCount** sorted;
+    unsigned n = 0;
+
+    sorted = malloc((stats->used + 1) * sizeof(*sorted));
+    if (sorted == NULL) {
+        return;
+    }
+    for (unsigned i = 0; i < SEQ_TABLE_SIZE; ++i) {
+        if (stats->table[i].length != 0) {
+            sorted[n++] = &(stats->table[i]);
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), by_count);
+
+    for (uint8_t length = 2; length <= SEQ_MAX_LENGTH; ++length) {
+        unsigned printed = 0;
+        fprintf(outpf, "Most frequent sequences of %u:\n", length);
+        for (unsigned i = 0; (i < n) && (printed < SEQ_REPORT_COUNT); ++i) {
+            if (sorted[i]->length == length) {
+                uint32_t key = sorted[i]->key;
+                fprintf(outpf, "  %12lu  ", (unsigned long)sorted[i]->count);
+                for (unsigned j = 0; j < length; ++j) {
+                    print_class(key & ((1U << SEQ_CLASS_BITS) - 1), outpf);
+                    fprintf(outpf, "%s", (j + 1 < length) ? ", " : "\n");
+                    key >>= SEQ_CLASS_BITS;
+                }
+                ++printed;
+            }
+        }
+    }
+    if (stats->full) {
+        fprintf(outpf, "Sequence table full, not all sequences counted\n");
+    }
+    free(sorted);
+}
+
+/* ------------------------ end of file -------------------------------*/
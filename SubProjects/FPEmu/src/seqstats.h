@@ -0,0 +1,25 @@
+#ifndef HG_SEQSTATS_H
+#define HG_SEQSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fpemu.h"
+
+/* Longest sequence counted */
+#define SEQ_MAX_LENGTH 3
+/* Distinct sequences that can be counted, a power of two */
+#define SEQ_TABLE_SIZE 65536
+/* Sequences of each length printed by sequence_stats_report() */
+#define SEQ_REPORT_COUNT 12
+
+struct SequenceStats;
+
+extern struct SequenceStats* sequence_stats_create(void);
+extern void sequence_stats_destroy(struct SequenceStats* stats);
+extern void run_sequence_stats(
+        struct CPU_Context* c, uint8_t* memory, struct SequenceStats* stats);
+extern void sequence_stats_report(
+        const struct SequenceStats* stats, FILE* outpf);
+
+#endif /* HG_SEQSTATS_H */
@@ -0,0 +1,508 @@
+/**
+ * Stack-master 16 emulator -- serial port
+ *
+ * Bytes the program writes to the serial port are collected in a buffer
+ * and handed to write() in one go, instead of one system call per byte.
+ * When the buffer is flushed is set by a policy, see serial.h.
+ *
+ * Input is read from fd_in into a ring buffer, but only after poll()
+ * says there is something, so the processor never waits for the host.
+ * The ring is refilled when the program finds it empty.  A program that
+ * polls for input is idle, which may flush the output.
+ *
+ * For time travel the input the program sees can be logged: replaying
+ * from an earlier state then reads the same bytes at the same points,
+ * whatever the host has sent since.  Output written before is not
+ * written again.
+ *
+ * A program that only polls the input status is an idle loop, the host
+ * sleeps in poll() until input comes, see in_status_wait().
+ *
+ * Cycles are instruction counts, see cpu_cycles().  With the cycle
+ * policy the first byte in an empty buffer puts a flush on the
+ * scheduler, the output is written when it is that old.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include "serial.h"
+#include "iobus.h"
+
+/* --------------------------------------------------------------------*/
+
+static void deadline(void* device, uint64_t cycle);
+static void receive(struct Serial* serial);
+static void receive_data(struct Serial* serial);
+static bool input_ready(struct Serial* serial, uint64_t cycle);
+static void log_event(struct Serial* serial, uint8_t value);
+static void out_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle);
+static uint8_t out_status_read(void* device, uint16_t port, uint64_t cycle);
+static uint8_t in_read(void* device, uint16_t port, uint64_t cycle);
+static uint8_t in_status_read(void* device, uint16_t port, uint64_t cycle);
+static int64_t in_status_wait(void* device, uint16_t port, uint64_t ns);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Event handler, the oldest byte in the buffer is flush_cycles old.
+ */
+static void deadline(void* device, uint64_t cycle)
+{
+    (void)cycle;
+    serial_flush(device);
+}
+
+/**
+ * Move input given by serial_set_input() into the ring.
+ */
+static void receive_data(struct Serial* serial)
+{
+    while ((serial->in_used < serial->in_size) &&
+           (serial->in_head - serial->in_tail < SERIAL_INPUT_SIZE)) {
+        serial->in_buffer[serial->in_head % SERIAL_INPUT_SIZE] =
+            serial->in_data[serial->in_used];
+        ++(serial->in_head);
+        ++(serial->in_used);
+        ++(serial->received);
+    }
+    serial->in_eof = (serial->in_used == serial->in_size);
+}
+
+/**
+ * Move what the host has available into the ring, without blocking.
+ */
+static void receive(struct Serial* serial)
+{
+    struct pollfd fds;
+
+    if (serial->in_data != NULL) {
+        receive_data(serial);
+        return;
+    }
+    fds.fd = serial->fd_in;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (serial->fd_in < 0) {
+        serial->in_eof = true;
+    }
+    while (!(serial->in_eof) &&
+           (serial->in_head - serial->in_tail < SERIAL_INPUT_SIZE) &&
+           (poll(&fds, 1, 0) > 0)) {
+        unsigned head = serial->in_head % SERIAL_INPUT_SIZE;
+        unsigned space = SERIAL_INPUT_SIZE - (serial->in_head - serial->in_tail);
+        ssize_t n;
+
+        /* Only up to the end of the ring, the rest in the next round */
+        if (space > SERIAL_INPUT_SIZE - head) {
+            space = SERIAL_INPUT_SIZE - head;
+        }
+        n = read(serial->fd_in, serial->in_buffer + head, space);
+        if (n > 0) {
+            serial->in_head += (unsigned)n;
+            serial->received += (uint64_t)n;
+        } else if ((n == 0) || ((errno != EINTR) && (errno != EAGAIN))) {
+            /* End of file, or a device that went away */
+            serial->in_eof = true;
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * True if there is an input byte to read.  When there is none the
+ * program is polling, so it counts as idle.
+ */
+static bool input_ready(struct Serial* serial, uint64_t cycle)
+{
+    if (serial->in_head == serial->in_tail) {
+        receive(serial);
+    }
+    if (serial->in_head == serial->in_tail) {
+        serial_idle(serial, cycle);
+        return false;
+    }
+    return true;
+}
+
+static void log_event(struct Serial* serial, uint8_t value)
+{
+    if (!(serial->logging)) {
+        return;
+    }
+    if (serial->log_used - serial->log_first == serial->log_size) {
+        size_t size = (serial->log_size == 0) ? 4096 : 2 * serial->log_size;
+        uint8_t* log = realloc(serial->log, size);
+        if (log == NULL) {
+            fprintf(stderr, "Serial: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        serial->log = log;
+        serial->log_size = size;
+    }
+    serial->log[serial->log_used - serial->log_first] = value;
+    ++(serial->log_used);
+    serial->log_position = serial->log_used;
+}
+
+/* IO bus handlers, one per port */
+
+static void out_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle)
+{
+    (void)port;
+    serial_put(device, value, cycle);
+}
+
+static uint8_t out_status_read(void* device, uint16_t port, uint64_t cycle)
+{
+    (void)device;
+    (void)port;
+    (void)cycle;
+    /* Output never has to wait */
+    return 1;
+}
+
+static uint8_t in_read(void* device, uint16_t port, uint64_t cycle)
+{
+    (void)port;
+    return serial_get(device, cycle);
+}
+
+static uint8_t in_status_read(void* device, uint16_t port, uint64_t cycle)
+{
+    (void)port;
+    return serial_input_ready(device, cycle);
+}
+
+/**
+ * Sleep until there is input, or ns passed.  Input from memory or a file
+ * that ended has nothing more to wait for.  Input that is logged for
+ * time travel must be read by the program every time.
+ */
+static int64_t in_status_wait(void* device, uint16_t port, uint64_t ns)
+{
+    struct Serial* serial = device;
+    struct pollfd fds;
+    struct timespec start;
+    struct timespec end;
+    int timeout = -1;
+    uint64_t waited;
+
+    (void)port;
+    if (serial->logging || (serial->in_head != serial->in_tail)) {
+        return -1;
+    }
+    if ((serial->in_data != NULL) || (serial->fd_in < 0) ||
+        serial->in_eof) {
+        return (ns > INT64_MAX) ? INT64_MAX : (int64_t)ns;
+    }
+    serial_flush(serial);
+    if (ns / 1000000 < INT_MAX) {
+        /* Rounded up, a timeout of 0 would not sleep at all */
+        timeout = (int)((ns + 999999) / 1000000);
+    }
+    fds.fd = serial->fd_in;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (poll(&fds, 1, timeout) == 0) {
+        return (int64_t)ns;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    waited = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+             (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+    return (int64_t)((waited < ns) ? waited : ns);
+}
+
+/* --------------------------------------------------------------------*/
+
+struct Serial* serial_create(
+        struct Scheduler* scheduler, int fd_in, int fd_out)
+{
+    struct Serial* serial = calloc(1, sizeof(struct Serial));
+
+    if (serial != NULL) {
+        serial->fd_in = fd_in;
+        serial->fd_out = fd_out;
+        serial->policy = SERIAL_DEFAULT_POLICY;
+        serial->scheduler = scheduler;
+        event_init(&(serial->deadline), deadline, serial);
+    }
+    return serial;
+}
+
+void serial_destroy(struct Serial* serial)
+{
+    if (serial != NULL) {
+        serial_flush(serial);
+        free(serial->capture);
+        free(serial->log);
+        free(serial);
+    }
+}
+
+/**
+ * Forget all output and input, and read from fd_in from now on.  The
+ * policy is kept.
+ */
+void serial_reset(struct Serial* serial, int fd_in)
+{
+    scheduler_remove(serial->scheduler, &(serial->deadline));
+    serial->fd_in = fd_in;
+    serial->first_cycle = 0;
+    serial->used = 0;
+    serial->bytes = 0;
+    serial->writes = 0;
+    serial->captured = 0;
+    serial->in_head = 0;
+    serial->in_tail = 0;
+    serial->in_eof = false;
+    serial->received = 0;
+    serial->in_data = NULL;
+    serial->in_size = 0;
+    serial->in_used = 0;
+    serial->log_first = 0;
+    serial->log_used = 0;
+    serial->log_position = 0;
+    serial->quiet_until = 0;
+}
+
+/**
+ * Read input from memory, after what is already in the ring, instead of
+ * from fd_in.  The data must stay until the next serial_reset().
+ */
+void serial_set_input(struct Serial* serial, const uint8_t* data, size_t size)
+{
+    serial->in_data = data;
+    serial->in_size = size;
+    serial->in_used = 0;
+    serial->in_eof = false;
+}
+
+/**
+ * Log what the program reads from now on, an earlier log is dropped.
+ */
+void serial_start_log(struct Serial* serial)
+{
+    serial->logging = true;
+    serial->log_first = 0;
+    serial->log_used = 0;
+    serial->log_position = 0;
+}
+
+/**
+ * Events before position will not be replayed any more.  The memory is
+ * reused once they are half of the log.
+ */
+void serial_trim_log(struct Serial* serial, size_t position)
+{
+    size_t unused = position - serial->log_first;
+
+    if ((unused > 0) && (2 * unused >= serial->log_used - serial->log_first)) {
+        memmove(serial->log, serial->log + unused, serial->log_used - position);
+        serial->log_first = position;
+    }
+}
+
+/**
+ * Go back to the point where log_position events had been read and
+ * bytes written.  Input is replayed from the log up to where it was,
+ * output that was written already is dropped.
+ */
+void serial_rewind(struct Serial* serial, size_t log_position, uint64_t bytes)
+{
+    serial_flush(serial);
+    if (serial->bytes > serial->quiet_until) {
+        serial->quiet_until = serial->bytes;
+    }
+    serial->bytes = bytes;
+    serial->log_position = log_position;
+}
+
+/**
+ * Set the flush policy from a comma separated list of: each, newline,
+ * idle, full (only when the buffer is full), or a number of cycles.
+ *
+ * Returns false if the list contains something else.
+ */
+bool serial_set_policy(struct Serial* serial, const char* policy)
+{
+    char list[80];
+    char* word;
+    char* rest;
+
+    strncpy(list, policy, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    serial->policy = 0;
+    serial->flush_cycles = 0;
+    for (word = strtok_r(list, ",", &rest); word != NULL;
+         word = strtok_r(NULL, ",", &rest)) {
+        if (strcmp(word, "each") == 0) {
+            serial->policy |= SERIAL_FLUSH_EACH;
+        } else if (strcmp(word, "newline") == 0) {
+            serial->policy |= SERIAL_FLUSH_NEWLINE;
+        } else if (strcmp(word, "idle") == 0) {
+            serial->policy |= SERIAL_FLUSH_IDLE;
+        } else if (strcmp(word, "full") == 0) {
+            /* Always applies */
+        } else {
+            char* end;
+            serial->flush_cycles = strtoull(word, &end, 10);
+            if ((*end != '\0') || (serial->flush_cycles == 0)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * The program writes a byte to the serial port.
+ */
+void serial_put(struct Serial* serial, uint8_t byte, uint64_t cycle)
+{
+    if (serial->bytes < serial->quiet_until) {
+        /* Replayed */
+        ++(serial->bytes);
+        return;
+    }
+    if (serial->used == 0) {
+        serial->first_cycle = cycle;
+        if (serial->flush_cycles != 0) {
+            scheduler_add(serial->scheduler, &(serial->deadline),
+                          cycle + serial->flush_cycles);
+        }
+    }
+    serial->buffer[serial->used] = byte;
+    ++(serial->used);
+    ++(serial->bytes);
+    if ((serial->used == SERIAL_BUFFER_SIZE) ||
+        (serial->policy & SERIAL_FLUSH_EACH) ||
+        ((serial->policy & SERIAL_FLUSH_NEWLINE) && (byte == '\n'))) {
+        serial_flush(serial);
+    }
+}
+
+/**
+ * The program waits for input, whoever is watching should see all
+ * output by now.
+ */
+void serial_idle(struct Serial* serial, uint64_t cycle)
+{
+    (void)cycle;
+    if (serial->policy & SERIAL_FLUSH_IDLE) {
+        serial_flush(serial);
+    }
+}
+
+/**
+ * True if there is an input byte to read.
+ */
+bool serial_input_ready(struct Serial* serial, uint64_t cycle)
+{
+    bool ready;
+
+    if (serial->log_position < serial->log_used) {
+        return serial->log[(serial->log_position)++ - serial->log_first] != 0;
+    }
+    ready = input_ready(serial, cycle);
+    log_event(serial, ready);
+    return ready;
+}
+
+/**
+ * The next input byte, 0 if there is none.
+ */
+uint8_t serial_get(struct Serial* serial, uint64_t cycle)
+{
+    uint8_t byte = 0;
+
+    if (serial->log_position < serial->log_used) {
+        return serial->log[(serial->log_position)++ - serial->log_first];
+    }
+    if (input_ready(serial, cycle)) {
+        byte = serial->in_buffer[serial->in_tail % SERIAL_INPUT_SIZE];
+        ++(serial->in_tail);
+    }
+    log_event(serial, byte);
+    return byte;
+}
+
+void serial_flush(struct Serial* serial)
+{
+    unsigned done = 0;
+
+    scheduler_remove(serial->scheduler, &(serial->deadline));
+    if ((serial->fd_out < 0) && (serial->used != 0)) {
+        if (serial->captured + serial->used > serial->capture_size) {
+            size_t size = 2 * (serial->captured + serial->used);
+            uint8_t* capture = realloc(serial->capture, size);
+            if (capture == NULL) {
+                fprintf(stderr, "Serial: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            serial->capture = capture;
+            serial->capture_size = size;
+        }
+        memcpy(serial->capture + serial->captured, serial->buffer,
+               serial->used);
+        serial->captured += serial->used;
+        serial->used = 0;
+    }
+
+    while (done < serial->used) {
+        ssize_t n = write(serial->fd_out, serial->buffer + done,
+                          serial->used - done);
+        ++(serial->writes);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("serial write");
+            break;
+        }
+        done += (unsigned)n;
+    }
+    serial->used = 0;
+}
+
+/**
+ * Map the serial ports on the bus.  IRD b of 0x0001 is 1 (output ready),
+ * of 0x0002 the next input byte or 0 if there is none, of 0x0003 1 if
+ * there is input.  ISTO b to 0x0000 sends a byte.
+ */
+bool serial_map(struct Serial* serial, struct IoBus* bus)
+{
+    return io_bus_map(bus, IO_SERIAL_OUT, IO_SERIAL_OUT,
+                      NULL, out_write, serial, "serial out") &&
+           io_bus_map(bus, IO_SERIAL_OUT_STATUS, IO_SERIAL_OUT_STATUS,
+                      out_status_read, NULL, serial, "serial out status") &&
+           io_bus_map(bus, IO_SERIAL_IN, IO_SERIAL_IN,
+                      in_read, NULL, serial, "serial in") &&
+           io_bus_map(bus, IO_SERIAL_IN_STATUS, IO_SERIAL_IN_STATUS,
+                      in_status_read, NULL, serial, "serial in status") &&
+           io_bus_set_wait(bus, IO_SERIAL_IN_STATUS, in_status_wait);
+}
+
+void serial_report(const struct Serial* serial, FILE* outpf)
+{
+    fprintf(outpf, "Serial: %lu bytes in %lu writes, %lu system calls saved, "
+                   "%lu bytes received\n",
+            (unsigned long)serial->bytes, (unsigned long)serial->writes,
+            (unsigned long)((serial->bytes > serial->writes) ?
+                            (serial->bytes - serial->writes) : 0),
+            (unsigned long)serial->received);
+}
+
+/* ------------------------ end of file -------------------------------*/
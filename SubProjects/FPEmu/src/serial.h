@@ -0,0 +1,98 @@
+#ifndef HG_SERIAL_H
+#define HG_SERIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "scheduler.h"
+
+/* Bytes buffered before a write() is forced */
+#define SERIAL_BUFFER_SIZE 4096
+/* Input ring buffer, a power of two */
+#define SERIAL_INPUT_SIZE 1024
+
+/* IO ports, see the IO map in the programmers manual */
+#define IO_SERIAL_OUT        0x0000
+#define IO_SERIAL_OUT_STATUS 0x0001
+#define IO_SERIAL_IN         0x0002
+#define IO_SERIAL_IN_STATUS  0x0003
+
+/* Flush policy flags.  A full buffer and a stopped processor (HALT, an
+ * exception, or a single step) always flush. */
+#define SERIAL_FLUSH_EACH    0x01  /* Write every byte, no buffering */
+#define SERIAL_FLUSH_NEWLINE 0x02  /* After a '\n' */
+#define SERIAL_FLUSH_IDLE    0x04  /* When the program polls for input */
+
+/* Default policy, safe for interactive use */
+#define SERIAL_DEFAULT_POLICY (SERIAL_FLUSH_NEWLINE | SERIAL_FLUSH_IDLE)
+
+/**
+ * The UART: buffered output, and input read ahead from the host without
+ * ever blocking.
+ */
+struct Serial {
+    int fd_in;                /* -1: no input */
+    int fd_out;               /* -1: keep the output in capture */
+    unsigned policy;          /* SERIAL_FLUSH_* flags */
+    uint64_t flush_cycles;    /* Age of the oldest byte that forces a flush,
+                                 0: no limit */
+    uint64_t first_cycle;     /* Instruction count at the oldest byte */
+    struct Scheduler* scheduler;
+    struct Event deadline;    /* Flush at first_cycle + flush_cycles */
+    unsigned used;
+    /* Statistics */
+    uint64_t bytes;
+    uint64_t writes;          /* write() calls */
+    uint8_t buffer[SERIAL_BUFFER_SIZE];
+    /* Output kept in memory */
+    uint8_t* capture;
+    size_t captured;
+    size_t capture_size;
+    /* Input, bytes from in_tail up to in_head are unread */
+    unsigned in_head;
+    unsigned in_tail;
+    bool in_eof;              /* Nothing more will come from fd_in */
+    uint64_t received;
+    /* Input from memory instead of fd_in, see serial_set_input() */
+    const uint8_t* in_data;
+    size_t in_size;
+    size_t in_used;
+    uint8_t in_buffer[SERIAL_INPUT_SIZE];
+    /* What the program read from the input, to replay it, see
+     * serial_start_log().  Events are numbered from the start of the
+     * log, log[0] is event log_first.  Events before log_used are
+     * replayed from log_position on. */
+    bool logging;
+    uint8_t* log;
+    size_t log_size;
+    size_t log_first;
+    size_t log_used;
+    size_t log_position;
+    /* Output up to here was written before a rewind, it is dropped */
+    uint64_t quiet_until;
+};
+
+struct IoBus;
+
+extern struct Serial* serial_create(
+        struct Scheduler* scheduler, int fd_in, int fd_out);
+extern void serial_destroy(struct Serial* serial);
+extern void serial_reset(struct Serial* serial, int fd_in);
+extern void serial_set_input(
+        struct Serial* serial, const uint8_t* data, size_t size);
+extern void serial_start_log(struct Serial* serial);
+extern void serial_trim_log(struct Serial* serial, size_t position);
+extern void serial_rewind(
+        struct Serial* serial, size_t log_position, uint64_t bytes);
+extern bool serial_set_policy(struct Serial* serial, const char* policy);
+extern void serial_put(struct Serial* serial, uint8_t byte, uint64_t cycle);
+extern void serial_idle(struct Serial* serial, uint64_t cycle);
+extern bool serial_input_ready(struct Serial* serial, uint64_t cycle);
+extern uint8_t serial_get(struct Serial* serial, uint64_t cycle);
+extern void serial_flush(struct Serial* serial);
+extern bool serial_map(struct Serial* serial, struct IoBus* bus);
+extern void serial_report(const struct Serial* serial, FILE* outpf);
+
+#endif /* HG_SERIAL_H */
@@ -0,0 +1,304 @@
+/**
+ * Stack-master 16 emulator -- machine snapshots
+ *
+ * A snapshot is one fixed size block, see snapshot.h.  Snapshots are
+ * allocated with mmap(), whether they are taken from an emulator or
+ * mapped from a file, so both are released with munmap().  A mapped file
+ * is private, the file itself never changes.
+ *
+ * Restoring is a copy of the memory plus a few registers, instead of
+ * parsing a hex file and running the initialization code again.  The
+ * devices go back to what they were too, their events included, so a
+ * program that uses timers runs on as it would have.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "serial.h"
+#include "snapshot.h"
+#include "idle.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "video.h"
+#include "interrupt.h"
+
+_Static_assert(sizeof(((struct FpemuSnapshot*)0)->h) <= SNAPSHOT_HEADER_SIZE,
+               "snapshot header does not fit");
+
+/* --------------------------------------------------------------------*/
+
+static struct FpemuSnapshot* allocate(void);
+static bool valid(const struct FpemuSnapshot* snapshot);
+static void restore_registers(
+        struct Fpemu* emu, const struct FpemuSnapshot* snapshot);
+
+/* --------------------------------------------------------------------*/
+
+static struct FpemuSnapshot* allocate(void)
+{
+    void* p = mmap(NULL, sizeof(struct FpemuSnapshot), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/**
+ * A file could contain anything, check what is used as an index.
+ */
+static bool valid(const struct FpemuSnapshot* snapshot)
+{
+    if ((memcmp(snapshot->h.magic, SNAPSHOT_MAGIC,
+                sizeof(snapshot->h.magic)) != 0) ||
+        (snapshot->h.version != SNAPSHOT_VERSION) ||
+        (snapshot->h.size != sizeof(struct FpemuSnapshot)) ||
+        (snapshot->h.exception > IllegalStackID) ||
+        (snapshot->h.serial_unread > SERIAL_INPUT_SIZE)) {
+        return false;
+    }
+    for (unsigned i = 0; i < TIMERS; ++i) {
+        if (snapshot->h.devices.timers[i].prescale > 0x0F) {
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        const struct Stack* stack = &(snapshot->h.stacks[i]);
+        if ((stack->size > MAX_STACK_SIZE) || (stack->top > stack->size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Everything but memory.  Graphics RAM is small, it is always copied.
+ */
+static void restore_registers(
+        struct Fpemu* emu, const struct FpemuSnapshot* snapshot)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    struct Serial* serial = c->serial;
+
+    c->instruction_count = snapshot->h.instruction_count;
+    c->clocks = snapshot->h.clocks;
+    c->pc = snapshot->h.pc;
+    c->instruction = snapshot->h.instruction;
+    c->exception = snapshot->h.exception;
+    c->data_stack = snapshot->h.stacks[DATA_STACK];
+    c->return_stack = snapshot->h.stacks[RETURN_STACK];
+    c->control_stack = snapshot->h.stacks[CONTROL_STACK];
+    c->temp_stack = snapshot->h.stacks[TEMP_STACK];
+    c->keep_going = true;
+    c->single_step = false;
+    c->instruction_limit = UINT64_MAX;
+    idle_reset(c->idle);
+
+    serial_reset(serial, serial->fd_in);
+    serial->policy = snapshot->h.serial_policy;
+    serial->flush_cycles = snapshot->h.serial_flush_cycles;
+    memcpy(serial->in_buffer, snapshot->h.serial_input,
+           snapshot->h.serial_unread);
+    serial->in_head = snapshot->h.serial_unread;
+
+    fpemu_restore_devices(emu, &(snapshot->h.devices));
+    video_load_ram(c->video, snapshot->video_ram);
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Save the devices, for a snapshot or a checkpoint.
+ */
+void fpemu_save_devices(struct Fpemu* emu, struct DeviceState* state)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+
+    timers_save(c->timers, state->timers, c->instruction_count);
+    video_save(c->video, &(state->video), c->instruction_count);
+    interrupts_save(c->interrupts, &(state->interrupts));
+}
+
+/**
+ * Put the devices back, at the instruction count of the processor.  The
+ * events of the devices that are not saved are dropped.
+ */
+void fpemu_restore_devices(
+        struct Fpemu* emu, const struct DeviceState* state)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+
+    scheduler_reset(c->scheduler, c->instruction_count);
+    timers_restore(c->timers, state->timers, c->instruction_count);
+    video_restore(c->video, &(state->video), c->instruction_count);
+    interrupts_restore(c->interrupts, &(state->interrupts),
+                       c->instruction_count);
+}
+
+/**
+ * Take a snapshot of the emulator.  Pending serial output is written
+ * first.  Returns NULL if out of memory.
+ */
+struct FpemuSnapshot* fpemu_snapshot(struct Fpemu* emu)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    struct Serial* serial = c->serial;
+    struct FpemuSnapshot* snapshot = allocate();
+
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    serial_flush(serial);
+
+    memcpy(snapshot->h.magic, SNAPSHOT_MAGIC, sizeof(snapshot->h.magic));
+    snapshot->h.version = SNAPSHOT_VERSION;
+    snapshot->h.size = sizeof(struct FpemuSnapshot);
+    snapshot->h.instruction_count = c->instruction_count;
+    snapshot->h.clocks = c->clocks;
+    snapshot->h.pc = c->pc;
+    snapshot->h.instruction = c->instruction;
+    snapshot->h.exception = c->exception;
+    snapshot->h.stacks[DATA_STACK] = c->data_stack;
+    snapshot->h.stacks[RETURN_STACK] = c->return_stack;
+    snapshot->h.stacks[CONTROL_STACK] = c->control_stack;
+    snapshot->h.stacks[TEMP_STACK] = c->temp_stack;
+
+    snapshot->h.serial_policy = serial->policy;
+    snapshot->h.serial_flush_cycles = serial->flush_cycles;
+    snapshot->h.serial_unread = serial->in_head - serial->in_tail;
+    for (unsigned i = 0; i < snapshot->h.serial_unread; ++i) {
+        snapshot->h.serial_input[i] =
+            serial->in_buffer[(serial->in_tail + i) % SERIAL_INPUT_SIZE];
+    }
+    fpemu_save_devices(emu, &(snapshot->h.devices));
+
+    fpemu_read_memory(emu, 0x0000, snapshot->memory, MEMORY_SIZE);
+    memcpy(snapshot->video_ram, c->video->ram, VIDEO_RAM_SIZE);
+
+    return snapshot;
+}
+
+/**
+ * Put the emulator back in the state of the snapshot.  Serial input
+ * still comes from the same file, what the snapshot had not read yet
+ * comes first.  Output captured so far is dropped.
+ */
+void fpemu_restore(struct Fpemu* emu, const struct FpemuSnapshot* snapshot)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+
+    fpemu_write_memory(emu, 0x0000, snapshot->memory, MEMORY_SIZE);
+    memset(c->dirty_pages, 0, sizeof(c->dirty_pages));
+    restore_registers(emu, snapshot);
+}
+
+/**
+ * Like fpemu_restore(), for an emulator that was restored from the same
+ * snapshot before: only memory pages written since then are copied, and
+ * translated code in other pages is kept.
+ *
+ * Returns the number of pages copied.
+ */
+unsigned fpemu_restore_dirty(
+        struct Fpemu* emu, const struct FpemuSnapshot* snapshot)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    uint64_t dirty[DIRTY_PAGES / 64];
+    unsigned pages = 0;
+
+    memcpy(dirty, c->dirty_pages, sizeof(dirty));
+    for (unsigned i = 0; i < DIRTY_PAGES / 64; ++i) {
+        while (dirty[i] != 0) {
+            unsigned page = i * 64 + (unsigned)__builtin_ctzll(dirty[i]);
+            uint16_t address = (uint16_t)(page * DIRTY_PAGE_SIZE);
+            fpemu_write_memory(emu, address, snapshot->memory + address,
+                               DIRTY_PAGE_SIZE);
+            dirty[i] &= dirty[i] - 1;
+            ++pages;
+        }
+    }
+    memset(c->dirty_pages, 0, sizeof(c->dirty_pages));
+    restore_registers(emu, snapshot);
+
+    return pages;
+}
+
+/**
+ * Returns false if the file could not be written.
+ */
+bool fpemu_snapshot_write(
+        const struct FpemuSnapshot* snapshot, const char* filename)
+{
+    const uint8_t* data = (const uint8_t*)snapshot;
+    size_t done = 0;
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        perror(filename);
+        return false;
+    }
+    while (done < sizeof(struct FpemuSnapshot)) {
+        ssize_t n = write(fd, data + done, sizeof(struct FpemuSnapshot) - done);
+        if (n <= 0) {
+            perror(filename);
+            close(fd);
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return close(fd) == 0;
+}
+
+/**
+ * Map a snapshot file.  Returns NULL if it cannot be read, or is not a
+ * snapshot of this version.
+ */
+struct FpemuSnapshot* fpemu_snapshot_map(const char* filename)
+{
+    struct FpemuSnapshot* snapshot;
+    struct stat status;
+    void* p;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        perror(filename);
+        return NULL;
+    }
+    if ((fstat(fd, &status) != 0) ||
+        (status.st_size != (off_t)sizeof(struct FpemuSnapshot))) {
+        fprintf(stderr, "%s: not a snapshot\n", filename);
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, sizeof(struct FpemuSnapshot), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+    snapshot = p;
+    if (!valid(snapshot)) {
+        fprintf(stderr, "%s: not a snapshot\n", filename);
+        fpemu_snapshot_free(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+void fpemu_snapshot_free(struct FpemuSnapshot* snapshot)
+{
+    if (snapshot != NULL) {
+        munmap(snapshot, sizeof(struct FpemuSnapshot));
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,76 @@
+#ifndef HG_SNAPSHOT_H
+#define HG_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "serial.h"
+#include "timer.h"
+#include "video.h"
+#include "interrupt.h"
+
+#define SNAPSHOT_MAGIC "FPEMSNAP"
+#define SNAPSHOT_VERSION 3
+/* The header is padded to a page, so memory is page aligned */
+#define SNAPSHOT_HEADER_SIZE 4096
+
+/**
+ * The devices, in a snapshot and in a time travel checkpoint.  Pending
+ * events are kept as cycles from the instruction count, the scheduler
+ * is started again at the count that is restored.
+ */
+struct DeviceState {
+    struct TimerState timers[TIMERS];
+    struct VideoState video;
+    struct InterruptState interrupts;
+};
+
+/**
+ * The complete machine: processor, memory and devices.  This is also
+ * the layout of a snapshot file, in the byte order of the host, so a file
+ * is used as it is after mmap().
+ *
+ * Serial output is flushed before a snapshot is taken, unread input is
+ * part of it.
+ */
+struct FpemuSnapshot {
+    union {
+        struct {
+            char magic[8];
+            uint32_t version;
+            uint32_t size;               /* sizeof(struct FpemuSnapshot) */
+            uint64_t instruction_count;
+            uint64_t clocks;
+            uint16_t pc;
+            uint16_t instruction;
+            uint16_t exception;
+            struct Stack stacks[4];      /* Indexed by stack id */
+            /* Serial port */
+            uint32_t serial_policy;
+            uint64_t serial_flush_cycles;
+            uint32_t serial_unread;
+            uint8_t serial_input[SERIAL_INPUT_SIZE];
+            struct DeviceState devices;
+        } h;
+        uint8_t padding[SNAPSHOT_HEADER_SIZE];
+    };
+    uint8_t memory[MEMORY_SIZE];
+    uint8_t video_ram[VIDEO_RAM_SIZE];
+};
+
+extern void fpemu_save_devices(struct Fpemu* emu, struct DeviceState* state);
+extern void fpemu_restore_devices(
+        struct Fpemu* emu, const struct DeviceState* state);
+extern struct FpemuSnapshot* fpemu_snapshot(struct Fpemu* emu);
+extern void fpemu_restore(
+        struct Fpemu* emu, const struct FpemuSnapshot* snapshot);
+extern unsigned fpemu_restore_dirty(
+        struct Fpemu* emu, const struct FpemuSnapshot* snapshot);
+extern bool fpemu_snapshot_write(
+        const struct FpemuSnapshot* snapshot, const char* filename);
+extern struct FpemuSnapshot* fpemu_snapshot_map(const char* filename);
+extern void fpemu_snapshot_free(struct FpemuSnapshot* snapshot);
+
+#endif /* HG_SNAPSHOT_H */
@@ -0,0 +1,190 @@
+#ifndef HG_SPEC_OPS_H
+#define HG_SPEC_OPS_H
+
+/**
+ * Semantics of the specialized handlers in spectable_gen.c.
+ *
+ * gen_spectable writes one of these macros, with the stacks filled in,
+ * for every distinct operation.  The literal, destination or offset comes
+ * precomputed from the table entry as operand.  Every handler updates the
+ * pc itself.  Behaviour must be identical to step() in cpu.c.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "spectable.h"
+
+#define SPEC_HANDLER(name) \
+    static void name(struct CPU_Context* c, uint8_t* memory, uint16_t operand)
+
+#define SPEC_ILLEGAL(name) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        (void)operand; \
+        c->exception = IllegalInstruction; \
+        c->keep_going = false; \
+        c->pc += 2; \
+    }
+
+#define SPEC_ENTER(name) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        push(c, &(c->return_stack), c->pc + 2); \
+        c->pc = operand; \
+    }
+
+#define SPEC_BIF(name) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        if (pop(c, &(c->data_stack))) { \
+            c->pc += 2; \
+        } else { \
+            c->pc += operand; \
+        } \
+    }
+
+#define SPEC_LEAVE(name) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        (void)operand; \
+        c->pc = pop(c, &(c->return_stack)); \
+    }
+
+#define SPEC_NOP(name) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        (void)operand; \
+        c->pc += 2; \
+    }
+
+#define SPEC_HALT(name) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        (void)operand; \
+        c->keep_going = false; \
+        c->pc += 2; \
+    }
+
+#define SPEC_DROP(name, stack) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        (void)operand; \
+        (void)pop(c, &(c->stack)); \
+        c->pc += 2; \
+    }
+
+#define SPEC_DUP(name, stack) \
+    SPEC_HANDLER(name) { \
+        uint16_t value; \
+        (void)memory; \
+        (void)operand; \
+        value = pop(c, &(c->stack)); \
+        push(c, &(c->stack), value); \
+        push(c, &(c->stack), value); \
+        c->pc += 2; \
+    }
+
+#define SPEC_SWAP(name, stack) \
+    SPEC_HANDLER(name) { \
+        uint16_t value; \
+        uint16_t value2; \
+        (void)memory; \
+        (void)operand; \
+        value = pop(c, &(c->stack)); \
+        value2 = pop(c, &(c->stack)); \
+        push(c, &(c->stack), value); \
+        push(c, &(c->stack), value2); \
+        c->pc += 2; \
+    }
+
+#define SPEC_MOV(name, source, target) \
+    SPEC_HANDLER(name) { \
+        uint16_t value; \
+        (void)memory; \
+        (void)operand; \
+        value = pop(c, &(c->source)); \
+        push(c, &(c->target), value); \
+        c->pc += 2; \
+    }
+
+#define SPEC_LDL(name, stack) \
+    SPEC_HANDLER(name) { \
+        (void)memory; \
+        push(c, &(c->stack), operand); \
+        c->pc += 2; \
+    }
+
+#define SPEC_LDH(name, stack) \
+    SPEC_HANDLER(name) { \
+        uint16_t value; \
+        (void)memory; \
+        value = pop(c, &(c->stack)); \
+        push(c, &(c->stack), value | operand); \
+        c->pc += 2; \
+    }
+
+/* Two value operators on the data stack, n1 is the top of the stack */
+#define SPEC_BINARY(name, expression) \
+    SPEC_HANDLER(name) { \
+        uint16_t n1, n2; \
+        (void)memory; \
+        (void)operand; \
+        n1 = pop(c, &(c->data_stack)); \
+        n2 = pop(c, &(c->data_stack)); \
+        push(c, &(c->data_stack), (expression)); \
+        c->pc += 2; \
+    }
+
+#define SPEC_ADD(name)  SPEC_BINARY(name, (uint16_t)(n1 + n2))
+#define SPEC_MUL(name)  SPEC_BINARY(name, (uint16_t)(n1 * n2))
+#define SPEC_EQ(name)   SPEC_BINARY(name, (n2 == n1) ? 0xFFFF : 0x0000)
+#define SPEC_ASR(name)  SPEC_BINARY(name, (uint16_t)((int16_t)n2 >> (int16_t)n1))
+#define SPEC_LT(name)   SPEC_BINARY(name, ((int16_t)n2 <  (int16_t)n1) ? 0xFFFF : 0x0000)
+#define SPEC_LTU(name)  SPEC_BINARY(name, (n2 <  n1) ? 0xFFFF : 0x0000)
+#define SPEC_GT(name)   SPEC_BINARY(name, ((int16_t)n2 >  (int16_t)n1) ? 0xFFFF : 0x0000)
+#define SPEC_GTU(name)  SPEC_BINARY(name, (n2 >  n1) ? 0xFFFF : 0x0000)
+#define SPEC_LTE(name)  SPEC_BINARY(name, ((int16_t)n2 <= (int16_t)n1) ? 0xFFFF : 0x0000)
+#define SPEC_LTEU(name) SPEC_BINARY(name, (n2 <= n1) ? 0xFFFF : 0x0000)
+#define SPEC_GTE(name)  SPEC_BINARY(name, ((int16_t)n2 >= (int16_t)n1) ? 0xFFFF : 0x0000)
+#define SPEC_GTEU(name) SPEC_BINARY(name, (n2 >= n1) ? 0xFFFF : 0x0000)
+#define SPEC_LSL(name)  SPEC_BINARY(name, (uint16_t)(n2 << n1))
+#define SPEC_LSR(name)  SPEC_BINARY(name, (uint16_t)(n2 >> n1))
+#define SPEC_AND(name)  SPEC_BINARY(name, n2 & n1)
+#define SPEC_OR(name)   SPEC_BINARY(name, n2 | n1)
+#define SPEC_XOR(name)  SPEC_BINARY(name, n2 ^ n1)
+
+#define SPEC_NEG(name) \
+    SPEC_HANDLER(name) { \
+        uint16_t n1; \
+        (void)memory; \
+        (void)operand; \
+        n1 = pop(c, &(c->data_stack)); \
+        push(c, &(c->data_stack), (uint16_t)(0 - n1)); \
+        c->pc += 2; \
+    }
+
+#define SPEC_NOT(name) \
+    SPEC_HANDLER(name) { \
+        uint16_t n1; \
+        (void)memory; \
+        (void)operand; \
+        n1 = pop(c, &(c->data_stack)); \
+        push(c, &(c->data_stack), (uint16_t)~n1); \
+        c->pc += 2; \
+    }
+
+#define SPEC_STO(name) \
+    SPEC_HANDLER(name) { \
+        exec_store(c, memory, operand); \
+        c->pc += 2; \
+    }
+
+#define SPEC_RD(name) \
+    SPEC_HANDLER(name) { \
+        exec_read(c, memory, operand); \
+        c->pc += 2; \
+    }
+
+#endif /* HG_SPEC_OPS_H */
@@ -0,0 +1,60 @@
+/**
+ * Stack-master 16 emulator -- specialized handler table core
+ *
+ * Every 16 bit instruction word fully determines what the instruction
+ * does, so instead of decoding it the word indexes a table of 65536
+ * entries.  Each entry holds a handler specialized for the operation and
+ * its stacks, and the operand already extracted: no get_stack(), no masks
+ * and shifts at run time.  The table and the handlers are generated at
+ * build time by gen_spectable, from decode.c and spec_ops.h.
+ *
+ * Behaviour must be identical to run_switch() in cpu.c.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "spectable.h"
+#include "clocks.h"
+#include "breakpoints.h"
+
+/**
+ * The table loop, with or without a breakpoint check before each
+ * instruction, see run_spectable().
+ */
+static inline __attribute__((always_inline)) void spectable_loop(
+        struct CPU_Context* c, uint8_t* memory,
+        struct Breakpoints* breakpoints)
+{
+    uint64_t limit = c->instruction_limit;
+
+    /* The count is kept in the context, RD and STO pass it to devices */
+    while (c->keep_going && (c->instruction_count < limit)) {
+        if ((breakpoints != NULL) &&
+            break_here(breakpoints, c->pc, c->instruction_count)) {
+            break_at(c, BreakPoint, c->pc);
+            break;
+        }
+        uint16_t instruction = fetch_instruction(memory, c->pc);
+        const struct SpecEntry* entry = &(spec_table[instruction]);
+        c->instruction = instruction;
+        ++(c->instruction_count);
+        c->clocks += instruction_clocks(instruction);
+        entry->handler(c, memory, entry->operand);
+    }
+}
+
+/**
+ * Run the processor using the specialized handler table.
+ */
+void run_spectable(struct CPU_Context* c, uint8_t* memory)
+{
+    if (c->breakpoints != NULL) {
+        spectable_loop(c, memory, c->breakpoints);
+    } else {
+        spectable_loop(c, memory, NULL);
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
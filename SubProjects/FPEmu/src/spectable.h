@@ -0,0 +1,29 @@
+#ifndef HG_SPECTABLE_H
+#define HG_SPECTABLE_H
+
+#include <stdint.h>
+
+#include "fpemu.h"
+
+/**
+ * Handler for one operation, with the stacks it works on compiled in.
+ */
+typedef void spec_handler_type(
+        struct CPU_Context* c, uint8_t* memory, uint16_t operand);
+
+/**
+ * What an instruction word does: the handler, plus the literal, ENTER
+ * destination, BIF offset, or for RD and STO the instruction itself.
+ */
+struct SpecEntry {
+    spec_handler_type* handler;
+    uint16_t operand;
+};
+
+/* Generated by gen_spectable, see spectable_gen.c */
+extern const struct SpecEntry spec_table[MEMORY_SIZE];
+extern const unsigned spec_handler_count;
+
+extern void run_spectable(struct CPU_Context* c, uint8_t* memory);
+
+#endif /* HG_SPECTABLE_H */
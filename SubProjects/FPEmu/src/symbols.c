@@ -0,0 +1,154 @@
+/**
+ * Stack-master 16 emulator -- symbol tables
+ *
+ * Reads the symbol file fa writes with -s, one ".def NAME $ADDR" per
+ * line, to print addresses as a label plus an offset.  fa does not tell
+ * labels from .def constants, so a constant can name an address too.
+ * When two symbols have the same address the one defined last is used,
+ * labels usually follow the constants.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "symbols.h"
+
+/* Order in the file, to break ties between equal addresses */
+struct Entry {
+    struct Symbol symbol;
+    unsigned line;
+};
+
+/* --------------------------------------------------------------------*/
+
+static int by_address(const void* a, const void* b);
+
+/* --------------------------------------------------------------------*/
+
+static int by_address(const void* a, const void* b)
+{
+    const struct Entry* ea = a;
+    const struct Entry* eb = b;
+
+    if (ea->symbol.address != eb->symbol.address) {
+        return (ea->symbol.address < eb->symbol.address) ? -1 : 1;
+    }
+    return (ea->line < eb->line) ? -1 : (ea->line > eb->line);
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Returns NULL if the file cannot be read.  Lines that are not a .def
+ * are skipped.
+ */
+struct Symbols* symbols_load(const char* filename)
+{
+    char line[128];
+    struct Entry* entries = NULL;
+    unsigned allocated = 0;
+    unsigned n = 0;
+    struct Symbols* symbols;
+    FILE* inpf = fopen(filename, "r");
+
+    if (inpf == NULL) {
+        return NULL;
+    }
+    symbols = calloc(1, sizeof(struct Symbols));
+    if (symbols == NULL) {
+        fclose(inpf);
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), inpf) != NULL) {
+        char name[SYMBOL_MAX_NAME];
+        unsigned address;
+
+        if (sscanf(line, ".def %31s $%x", name, &address) != 2) {
+            continue;
+        }
+        if (n == allocated) {
+            unsigned size = (allocated == 0) ? 64 : 2 * allocated;
+            struct Entry* bigger = realloc(entries, size * sizeof(*entries));
+            if (bigger == NULL) {
+                break;
+            }
+            entries = bigger;
+            allocated = size;
+        }
+        entries[n].symbol.address = (uint16_t)address;
+        strcpy(entries[n].symbol.name, name);
+        entries[n].line = n;
+        ++n;
+    }
+    fclose(inpf);
+
+    if (n > 0) {
+        qsort(entries, n, sizeof(*entries), by_address);
+        symbols->symbols = malloc(n * sizeof(struct Symbol));
+        if (symbols->symbols != NULL) {
+            for (unsigned i = 0; i < n; ++i) {
+                symbols->symbols[i] = entries[i].symbol;
+            }
+            symbols->count = n;
+        }
+    }
+    free(entries);
+
+    return symbols;
+}
+
+void symbols_destroy(struct Symbols* symbols)
+{
+    if (symbols != NULL) {
+        free(symbols->symbols);
+        free(symbols);
+    }
+}
+
+/**
+ * The symbol at or else closest below the address, NULL if there is none.
+ */
+const struct Symbol* symbols_find(
+        const struct Symbols* symbols, uint16_t address)
+{
+    unsigned low = 0;
+    unsigned high;
+
+    if ((symbols == NULL) || (symbols->count == 0)) {
+        return NULL;
+    }
+    /* The last symbol with an address not above the address */
+    high = symbols->count;
+    while (low < high) {
+        unsigned middle = (low + high) / 2;
+        if (symbols->symbols[middle].address <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return (low == 0) ? NULL : &(symbols->symbols[low - 1]);
+}
+
+/**
+ * "NAME", "NAME+0x1a", or the address in hex without symbols.
+ */
+void symbols_format(
+        const struct Symbols* symbols, uint16_t address,
+        char* text, size_t size)
+{
+    const struct Symbol* symbol = symbols_find(symbols, address);
+
+    if (symbol == NULL) {
+        snprintf(text, size, "%04x", address);
+    } else if (symbol->address == address) {
+        snprintf(text, size, "%s", symbol->name);
+    } else {
+        snprintf(text, size, "%s+0x%x", symbol->name,
+                 (unsigned)(address - symbol->address));
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
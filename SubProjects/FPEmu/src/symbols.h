@@ -0,0 +1,32 @@
+#ifndef HG_SYMBOLS_H
+#define HG_SYMBOLS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Same limit as fa */
+#define SYMBOL_MAX_NAME 32
+
+struct Symbol {
+    uint16_t address;
+    char name[SYMBOL_MAX_NAME];
+};
+
+/**
+ * The labels of a program, from the .sym file fa writes with -s, sorted
+ * by address.
+ */
+struct Symbols {
+    unsigned count;
+    struct Symbol* symbols;
+};
+
+extern struct Symbols* symbols_load(const char* filename);
+extern void symbols_destroy(struct Symbols* symbols);
+extern const struct Symbol* symbols_find(
+        const struct Symbols* symbols, uint16_t address);
+extern void symbols_format(
+        const struct Symbols* symbols, uint16_t address,
+        char* text, size_t size);
+
+#endif /* HG_SYMBOLS_H */
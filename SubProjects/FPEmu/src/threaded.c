@@ -0,0 +1,360 @@
+/**
+ * Stack-master 16 emulator -- direct threaded core
+ *
+ * Memory is translated, one instruction at the time and only when it is
+ * first executed, into an array of handler addresses (GCC labels as
+ * values) plus operands.  Every handler ends with its own indirect jump
+ * to the next handler, there is no central dispatch loop and no switch.
+ *
+ * Only compiled when FPEMU_THREADED is defined.  Behaviour must be
+ * identical to run_switch() in cpu.c.
+ */
+
+#ifdef FPEMU_THREADED
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "decode.h"
+#include "threaded.h"
+#include "clocks.h"
+#include "breakpoints.h"
+
+/* --------------------------------------------------------------------*/
+
+struct ThreadedCode* threaded_code_create(void)
+{
+    return calloc(1, sizeof(struct ThreadedCode));
+}
+
+void threaded_code_destroy(struct ThreadedCode* code)
+{
+    free(code);
+}
+
+/**
+ * Force retranslation of the instructions in the given address range.
+ * Must be called for every write to memory.
+ */
+void threaded_code_invalidate(
+        struct ThreadedCode* code, uint16_t address, uint16_t size)
+{
+    if (code->translate != NULL) {
+        /* Every instruction that has a byte in the range */
+        uint32_t first = address / 2;
+        uint32_t last = ((uint32_t)address + size - 1) / 2;
+        for (uint32_t i = first; i <= last; ++i) {
+            code->ops[i % (MEMORY_SIZE / 2)].label = code->translate;
+        }
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+#define PC_OF(p) ((uint16_t)(((p) - code->ops) * 2))
+
+/* Jump to the handler of the instruction ip points to */
+#define DISPATCH() \
+    do { \
+        ++count; \
+        clocks += ip->clocks; \
+        goto *(ip->label); \
+    } while (0)
+
+/* Continue with the next instruction */
+#define NEXT() \
+    do { \
+        ++ip; \
+        if (!(c->keep_going) || (count == limit)) { \
+            goto stop; \
+        } \
+        DISPATCH(); \
+    } while (0)
+
+/* Continue at an arbitrary address */
+#define JUMP(address) \
+    do { \
+        c->pc = (address); \
+        goto jump; \
+    } while (0)
+
+/* Two value operators on the data stack, n1 is the top of the stack */
+#define BINARY(expression) \
+    do { \
+        n1 = pop(c, ds); \
+        n2 = pop(c, ds); \
+        push(c, ds, (expression)); \
+        NEXT(); \
+    } while (0)
+
+/**
+ * Run the processor using direct threaded code.
+ */
+void run_threaded(struct CPU_Context* c, uint8_t* memory)
+{
+    static const void* const labels[OP_COUNT] = {
+        [OP_ILLEGAL] = &&op_illegal,
+        [OP_ENTER]   = &&op_enter,
+        [OP_BIF]     = &&op_bif,
+        [OP_LEAVE]   = &&op_leave,
+        [OP_NOP]     = &&op_nop,
+        [OP_HALT]    = &&op_halt,
+        [OP_DROP]    = &&op_drop,
+        [OP_DUP]     = &&op_dup,
+        [OP_SWAP]    = &&op_swap,
+        [OP_MOV]     = &&op_mov,
+        [OP_LDL]     = &&op_ldl,
+        [OP_LDH]     = &&op_ldh,
+        [OP_ADD]     = &&op_add,
+        [OP_MUL]     = &&op_mul,
+        [OP_EQ]      = &&op_eq,
+        [OP_ASR]     = &&op_asr,
+        [OP_LT]      = &&op_lt,
+        [OP_LTU]     = &&op_ltu,
+        [OP_GT]      = &&op_gt,
+        [OP_GTU]     = &&op_gtu,
+        [OP_LTE]     = &&op_lte,
+        [OP_LTEU]    = &&op_lteu,
+        [OP_GTE]     = &&op_gte,
+        [OP_GTEU]    = &&op_gteu,
+        [OP_SHL]     = &&op_shl,
+        [OP_SHR]     = &&op_shr,
+        [OP_STO]     = &&op_sto,
+        [OP_AND]     = &&op_and,
+        [OP_OR]      = &&op_or,
+        [OP_XOR]     = &&op_xor,
+        [OP_NEG]     = &&op_neg,
+        [OP_NOT]     = &&op_not,
+        [OP_RD]      = &&op_rd
+    };
+    struct ThreadedCode* code = c->threaded_code;
+    struct Stack* const ds = &(c->data_stack);
+    struct Stack* const rs = &(c->return_stack);
+    struct Stack* const stacks[4] = {
+        &(c->data_stack), &(c->return_stack),
+        &(c->control_stack), &(c->temp_stack)
+    };
+    struct ThreadedOp* ip;
+    struct ThreadedOp* from = NULL;  /* Last control transfer */
+    uint64_t count = c->instruction_count;
+    uint64_t limit = c->instruction_limit;
+    uint64_t clocks = c->clocks;
+    uint16_t n1;
+    uint16_t n2;
+
+    if (code->translate == NULL) {
+        code->translate = &&translate;
+        for (unsigned i = 0; i < MEMORY_SIZE / 2; ++i) {
+            code->ops[i].label = &&translate;
+        }
+        code->ops[MEMORY_SIZE / 2].label = &&wrap;
+    }
+
+    if (!(c->keep_going) || (count >= limit)) {
+        return;
+    }
+    ip = NULL;
+    goto jump_entry;
+
+    /* ------------------------------------------------------------ */
+
+jump: /* c->pc holds the destination, ip the control transfer */
+    from = ip;
+    if (!(c->keep_going) || (count == limit)) {
+        c->instruction = ip->instruction;
+        goto done;
+    }
+jump_entry:
+    if (c->pc & 1) {
+        /* Odd addresses have no entry, use the reference interpreter */
+        if ((c->breakpoints != NULL) &&
+            break_here(c->breakpoints, c->pc, count)) {
+            break_at(c, BreakPoint, c->pc);
+            goto done;
+        }
+        c->instruction_count = count;
+        c->clocks = clocks;
+        step(c, memory);
+        count = c->instruction_count;
+        clocks = c->clocks;
+        from = NULL;
+        if (!(c->keep_going) || (count == limit)) {
+            goto done;
+        }
+        goto jump_entry;
+    }
+    ip = code->ops + (c->pc / 2);
+    DISPATCH();
+
+translate:
+    {
+        struct Decoded d;
+        uint16_t pc = PC_OF(ip);
+        uint16_t instruction = fetch_instruction(memory, pc);
+
+        decode_instruction(instruction, &d);
+        /* Dispatch counted the clocks of what was here before */
+        clocks -= ip->clocks;
+        ip->clocks = (uint8_t)instruction_clocks(instruction);
+        clocks += ip->clocks;
+        ip->op = (uint8_t)d.op;
+        ip->label = labels[d.op];
+        /* Only code translated while breakpoints are set checks them */
+        if ((c->breakpoints != NULL) && is_breakpoint(c->breakpoints, pc)) {
+            ip->label = &&breakpoint;
+        }
+        ip->instruction = instruction;
+        ip->operand = d.operand;
+        if (d.op == OP_BIF) {
+            ip->operand = pc + d.operand;
+        }
+        ip->source = d.source;
+        ip->target = d.target;
+        goto *(ip->label);
+    }
+
+wrap: /* Fell off the end of memory */
+    ip = code->ops;
+    clocks += ip->clocks;
+    goto *(ip->label);
+
+stop: /* Stopped, ip points to the instruction following the last one */
+    c->pc = PC_OF(ip);
+    c->instruction = (ip - 1)->instruction;
+    goto done;
+
+breakpoint: /* Dispatch counted the instruction, it has not run yet */
+    if ((c->breakpoints != NULL) &&
+        break_here(c->breakpoints, PC_OF(ip), count - 1)) {
+        --count;
+        clocks -= ip->clocks;
+        /* The pc is still the destination if a jump got here */
+        if (c->pc != PC_OF(ip)) {
+            c->instruction = (ip == code->ops) ?
+                code->ops[MEMORY_SIZE / 2 - 1].instruction :
+                (ip - 1)->instruction;
+        } else if (from != NULL) {
+            c->instruction = from->instruction;
+        }
+        c->pc = PC_OF(ip);
+        break_at(c, BreakPoint, c->pc);
+        goto done;
+    }
+    goto *(labels[ip->op]);
+
+    /* ------------------------------------------------------------ */
+
+op_enter:
+    push(c, rs, PC_OF(ip) + 2);
+    JUMP(ip->operand);
+
+op_bif:
+    if (pop(c, ds)) {
+        NEXT();
+    }
+    JUMP(ip->operand);
+
+op_leave:
+    JUMP(pop(c, rs));
+
+op_nop:
+    NEXT();
+
+op_halt:
+    c->keep_going = false;
+    NEXT();
+
+op_illegal:
+    c->exception = IllegalInstruction;
+    c->keep_going = false;
+    NEXT();
+
+op_drop:
+    (void)pop(c, stacks[ip->source]);
+    NEXT();
+
+op_dup:
+    {
+        struct Stack* stack = stacks[ip->source];
+        n1 = pop(c, stack);
+        push(c, stack, n1);
+        push(c, stack, n1);
+    }
+    NEXT();
+
+op_swap:
+    {
+        struct Stack* stack = stacks[ip->source];
+        n1 = pop(c, stack);
+        n2 = pop(c, stack);
+        push(c, stack, n1);
+        push(c, stack, n2);
+    }
+    NEXT();
+
+op_mov:
+    n1 = pop(c, stacks[ip->source]);
+    push(c, stacks[ip->target], n1);
+    NEXT();
+
+op_ldl:
+    push(c, stacks[ip->target], ip->operand);
+    NEXT();
+
+op_ldh:
+    {
+        struct Stack* stack = stacks[ip->target];
+        n1 = pop(c, stack);
+        push(c, stack, n1 | ip->operand);
+    }
+    NEXT();
+
+op_add:  BINARY((uint16_t)(n1 + n2));
+op_mul:  BINARY((uint16_t)(n1 * n2));
+op_eq:   BINARY((n2 == n1) ? 0xFFFF : 0x0000);
+op_asr:  BINARY((uint16_t)((int16_t)n2 >> (int16_t)n1));
+op_lt:   BINARY(((int16_t)n2 <  (int16_t)n1) ? 0xFFFF : 0x0000);
+op_ltu:  BINARY((n2 <  n1) ? 0xFFFF : 0x0000);
+op_gt:   BINARY(((int16_t)n2 >  (int16_t)n1) ? 0xFFFF : 0x0000);
+op_gtu:  BINARY((n2 >  n1) ? 0xFFFF : 0x0000);
+op_lte:  BINARY(((int16_t)n2 <= (int16_t)n1) ? 0xFFFF : 0x0000);
+op_lteu: BINARY((n2 <= n1) ? 0xFFFF : 0x0000);
+op_gte:  BINARY(((int16_t)n2 >= (int16_t)n1) ? 0xFFFF : 0x0000);
+op_gteu: BINARY((n2 >= n1) ? 0xFFFF : 0x0000);
+op_shl:  BINARY((uint16_t)(n2 << n1));
+op_shr:  BINARY((uint16_t)(n2 >> n1));
+op_and:  BINARY(n2 & n1);
+op_or:   BINARY(n2 | n1);
+op_xor:  BINARY(n2 ^ n1);
+
+op_neg:
+    n1 = pop(c, ds);
+    push(c, ds, (uint16_t)(0 - n1));
+    NEXT();
+
+op_not:
+    n1 = pop(c, ds);
+    push(c, ds, (uint16_t)~n1);
+    NEXT();
+
+op_sto:
+    c->instruction_count = count;
+    exec_store(c, memory, ip->instruction);
+    NEXT();
+
+op_rd:
+    c->instruction_count = count;
+    exec_read(c, memory, ip->instruction);
+    NEXT();
+
+done:
+    c->instruction_count = count;
+    c->clocks = clocks;
+}
+
+#endif /* FPEMU_THREADED */
+
+/* ------------------------ end of file -------------------------------*/
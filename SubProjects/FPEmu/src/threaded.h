@@ -0,0 +1,38 @@
+#ifndef HG_THREADED_H
+#define HG_THREADED_H
+
+#include <stdint.h>
+
+#include "fpemu.h"
+
+/**
+ * One predecoded instruction in direct threaded code.  There is one
+ * entry for every even address, so falling through to the next
+ * instruction is simply the next entry.
+ */
+struct ThreadedOp {
+    const void* label;     /* Handler inside run_threaded() */
+    uint16_t instruction;  /* Original instruction word */
+    uint16_t operand;      /* Literal value or destination address */
+    uint8_t source;        /* Source stack id */
+    uint8_t target;        /* Target stack id */
+    uint8_t clocks;        /* instruction_clocks(), counted on dispatch */
+    uint8_t op;            /* Decoded operation, label runs it after a
+                            * breakpoint check */
+};
+
+struct ThreadedCode {
+    /* Label of the translator, marks entries that need decoding.
+     * NULL until run_threaded() has run once. */
+    const void* translate;
+    /* One extra entry to wrap around the end of memory */
+    struct ThreadedOp ops[MEMORY_SIZE / 2 + 1];
+};
+
+extern struct ThreadedCode* threaded_code_create(void);
+extern void threaded_code_destroy(struct ThreadedCode* code);
+extern void threaded_code_invalidate(
+        struct ThreadedCode* code, uint16_t address, uint16_t size);
+extern void run_threaded(struct CPU_Context* c, uint8_t* memory);
+
+#endif /* HG_THREADED_H */
@@ -0,0 +1,196 @@
+/**
+ * Stack-master 16 emulator -- timers
+ *
+ * A running timer has an event on the scheduler at its next expiration.
+ * The next one is scheduled from the cycle the last one was due, not
+ * from when it was dispatched, so a timer does not drift.  A period of 0
+ * counts as 1.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "iobus.h"
+
+/* --------------------------------------------------------------------*/
+
+static uint64_t cycles(const struct Timer* timer);
+static void expire(void* device, uint64_t cycle);
+static uint8_t timer_read(void* device, uint16_t port, uint64_t cycle);
+static void timer_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle);
+
+/* --------------------------------------------------------------------*/
+
+static uint64_t cycles(const struct Timer* timer)
+{
+    uint64_t period = (timer->period == 0) ? 1 : timer->period;
+
+    return period << timer->prescale;
+}
+
+static void expire(void* device, uint64_t cycle)
+{
+    struct Timer* timer = device;
+
+    if (timer->expired < 0xFF) {
+        (timer->expired)++;
+    }
+    (timer->expirations)++;
+    interrupts_raise(timer->interrupts, timer->line, cycle);
+    scheduler_add(timer->scheduler, &(timer->event), cycle + cycles(timer));
+}
+
+/* IO bus handlers */
+
+static uint8_t timer_read(void* device, uint16_t port, uint64_t cycle)
+{
+    struct Timers* timers = device;
+    struct Timer* timer = &(timers->timer[(port - IO_TIMER) / TIMER_PORTS]);
+    uint8_t value = 0;
+
+    (void)cycle;
+    switch ((port - IO_TIMER) % TIMER_PORTS) {
+        case TIMER_PERIOD_LOW:
+            value = (uint8_t)timer->period;
+            break;
+        case TIMER_PERIOD_HIGH:
+            value = (uint8_t)(timer->period >> 8);
+            break;
+        case TIMER_PRESCALE:
+            value = timer->prescale;
+            break;
+        case TIMER_CONTROL:
+            value = timer->expired;
+            timer->expired = 0;
+            break;
+    }
+    return value;
+}
+
+/**
+ * A new period or prescale counts from the next start.
+ */
+static void timer_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle)
+{
+    struct Timers* timers = device;
+    struct Timer* timer = &(timers->timer[(port - IO_TIMER) / TIMER_PORTS]);
+
+    switch ((port - IO_TIMER) % TIMER_PORTS) {
+        case TIMER_PERIOD_LOW:
+            timer->period = (uint16_t)((timer->period & 0xFF00) | value);
+            break;
+        case TIMER_PERIOD_HIGH:
+            timer->period = (uint16_t)((timer->period & 0x00FF) |
+                                       (value << 8));
+            break;
+        case TIMER_PRESCALE:
+            timer->prescale = value & 0x0F;
+            break;
+        case TIMER_CONTROL:
+            timer->running = (value & 1);
+            if (timer->running) {
+                scheduler_add(timer->scheduler, &(timer->event),
+                              cycle + cycles(timer));
+            } else {
+                scheduler_remove(timer->scheduler, &(timer->event));
+            }
+            break;
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Stopped timers, NULL if out of memory.
+ */
+struct Timers* timers_create(
+        struct Scheduler* scheduler, struct Interrupts* interrupts)
+{
+    struct Timers* timers = calloc(1, sizeof(struct Timers));
+
+    if (timers == NULL) {
+        return NULL;
+    }
+    for (unsigned i = 0; i < TIMERS; ++i) {
+        timers->timer[i].scheduler = scheduler;
+        timers->timer[i].interrupts = interrupts;
+        timers->timer[i].line = IRQ_TIMER_0 + i;
+        event_init(&(timers->timer[i].event), expire, &(timers->timer[i]));
+    }
+    return timers;
+}
+
+void timers_destroy(struct Timers* timers)
+{
+    free(timers);
+}
+
+/**
+ * All stopped and cleared.
+ */
+void timers_reset(struct Timers* timers)
+{
+    for (unsigned i = 0; i < TIMERS; ++i) {
+        struct Timer* timer = &(timers->timer[i]);
+        scheduler_remove(timer->scheduler, &(timer->event));
+        timer->period = 0;
+        timer->prescale = 0;
+        timer->running = false;
+        timer->expired = 0;
+        timer->expirations = 0;
+    }
+}
+
+void timers_save(
+        const struct Timers* timers, struct TimerState* state, uint64_t cycle)
+{
+    for (unsigned i = 0; i < TIMERS; ++i) {
+        const struct Timer* timer = &(timers->timer[i]);
+        state[i].due = event_due_in(&(timer->event), cycle);
+        state[i].period = timer->period;
+        state[i].prescale = timer->prescale;
+        state[i].running = timer->running;
+        state[i].expired = timer->expired;
+    }
+}
+
+/**
+ * The timers as saved, at the instruction count the state is restored
+ * to.  The scheduler must have been reset to it.
+ */
+void timers_restore(
+        struct Timers* timers, const struct TimerState* state, uint64_t cycle)
+{
+    for (unsigned i = 0; i < TIMERS; ++i) {
+        struct Timer* timer = &(timers->timer[i]);
+        timer->period = state[i].period;
+        timer->prescale = state[i].prescale & 0x0F;
+        timer->running = state[i].running;
+        timer->expired = state[i].expired;
+        scheduler_add_in(timer->scheduler, &(timer->event), cycle,
+                         timer->running ? state[i].due : UINT64_MAX);
+    }
+}
+
+bool timers_map(struct Timers* timers, struct IoBus* bus)
+{
+    return io_bus_map(bus, IO_TIMER, IO_TIMER + TIMERS * TIMER_PORTS - 1,
+                      timer_read, timer_write, timers, "timers");
+}
+
+void timers_report(const struct Timers* timers, FILE* outpf)
+{
+    for (unsigned i = 0; i < TIMERS; ++i) {
+        if (timers->timer[i].expirations > 0) {
+            fprintf(outpf, "Timer %u: %lu expirations\n", i,
+                    (unsigned long)timers->timer[i].expirations);
+        }
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
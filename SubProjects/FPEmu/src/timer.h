@@ -0,0 +1,63 @@
+#ifndef HG_TIMER_H
+#define HG_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "scheduler.h"
+#include "interrupt.h"
+
+/* IO ports of timer n, see the IO map in the programmers manual */
+#define IO_TIMER              0x0010
+#define TIMERS                2
+#define TIMER_PORTS           4
+#define TIMER_PERIOD_LOW      0x00  /* Port offsets */
+#define TIMER_PERIOD_HIGH     0x01
+#define TIMER_PRESCALE        0x02  /* Period in cycles is period << this */
+#define TIMER_CONTROL         0x03  /* Write: 1 run, 0 stop.  Read:
+                                       expirations since the last read */
+
+struct Timer {
+    uint16_t period;
+    uint8_t prescale;
+    bool running;
+    uint8_t expired;          /* Since the last read, up to 255 */
+    uint64_t expirations;     /* Since reset */
+    struct Scheduler* scheduler;
+    struct Interrupts* interrupts;
+    unsigned line;            /* Raised on every expiration */
+    struct Event event;
+};
+
+/* A timer in a snapshot, see snapshot.h */
+struct TimerState {
+    uint64_t due;             /* Cycles to the expiration, event_due_in() */
+    uint16_t period;
+    uint8_t prescale;
+    uint8_t running;
+    uint8_t expired;
+};
+
+/**
+ * Periodic timers, they count expirations on the scheduler and raise
+ * interrupts.
+ */
+struct Timers {
+    struct Timer timer[TIMERS];
+};
+
+struct IoBus;
+
+extern struct Timers* timers_create(
+        struct Scheduler* scheduler, struct Interrupts* interrupts);
+extern void timers_destroy(struct Timers* timers);
+extern void timers_reset(struct Timers* timers);
+extern void timers_save(
+        const struct Timers* timers, struct TimerState* state, uint64_t cycle);
+extern void timers_restore(
+        struct Timers* timers, const struct TimerState* state, uint64_t cycle);
+extern bool timers_map(struct Timers* timers, struct IoBus* bus);
+extern void timers_report(const struct Timers* timers, FILE* outpf);
+
+#endif /* HG_TIMER_H */
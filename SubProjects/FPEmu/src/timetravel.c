@@ -0,0 +1,451 @@
+/**
+ * Stack-master 16 emulator -- time travel
+ *
+ * Going back is going to an earlier checkpoint and running forward again
+ * to the instruction wanted.  A checkpoint is taken every TT_INTERVAL
+ * instructions.  It holds the registers, and it is given the pages
+ * written before the next one, as they were at the checkpoint.  shadow
+ * is memory at the newest checkpoint, and the dirty page bits tell what
+ * was written since, so taking a checkpoint only copies those pages.
+ *
+ * Going back to checkpoint k copies shadow over the pages written since
+ * the newest checkpoint, then the pages of the checkpoints from the
+ * newest one down to k.  The checkpoints after k are dropped, running
+ * forward takes them again.  Graphics RAM is kept the same way, as one
+ * page that is compared with its shadow instead of marked dirty.
+ *
+ * Runs are repeated exactly: the serial input the program reads is
+ * logged and replayed, see serial.c, and the devices are saved with the
+ * registers, their events included.  The log counts as part of the
+ * budget.  Time travel owns the dirty page
+ * bits, do not mix it with fpemu_restore_dirty().
+ *
+ * Runs on the reference interpreter.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "serial.h"
+#include "breakpoints.h"
+#include "snapshot.h"
+#include "video.h"
+#include "timetravel.h"
+
+/* --------------------------------------------------------------------*/
+
+static struct Checkpoint* newest(struct TimeTravel* tt);
+static void save_pages(
+        struct TimeTravel* tt, struct Checkpoint* checkpoint,
+        const uint8_t* memory, const uint64_t* dirty);
+static void save_video(
+        struct TimeTravel* tt, struct Checkpoint* checkpoint,
+        const uint8_t* ram);
+static void take_checkpoint(struct TimeTravel* tt, struct Fpemu* emu);
+static void drop(struct TimeTravel* tt, struct Checkpoint* checkpoint);
+static void drop_oldest(struct TimeTravel* tt);
+static void restore(struct TimeTravel* tt, struct Fpemu* emu, unsigned k);
+static unsigned before(const struct TimeTravel* tt, uint64_t count);
+static bool find_hit(
+        struct TimeTravel* tt, struct Fpemu* emu,
+        struct Breakpoints* breakpoints, uint64_t end, uint64_t* hit,
+        enum BreakReason* reason, uint16_t* address);
+
+/* --------------------------------------------------------------------*/
+
+static struct Checkpoint* newest(struct TimeTravel* tt)
+{
+    return &(tt->checkpoints[tt->count - 1]);
+}
+
+/**
+ * Give a checkpoint the shadow copies of the dirty pages, and update
+ * shadow.
+ */
+static void save_pages(
+        struct TimeTravel* tt, struct Checkpoint* checkpoint,
+        const uint8_t* memory, const uint64_t* dirty)
+{
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < DIRTY_PAGES / 64; ++i) {
+        n += (unsigned)__builtin_popcountll(dirty[i]);
+    }
+    if (n == 0) {
+        return;
+    }
+    checkpoint->pages = malloc(n * sizeof(struct CheckpointPage));
+    if (checkpoint->pages == NULL) {
+        fprintf(stderr, "Time travel: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned i = 0; i < DIRTY_PAGES / 64; ++i) {
+        uint64_t bits = dirty[i];
+        while (bits != 0) {
+            unsigned page = i * 64 + (unsigned)__builtin_ctzll(bits);
+            struct CheckpointPage* saved =
+                &(checkpoint->pages[(checkpoint->page_count)++]);
+            saved->page = (uint16_t)page;
+            memcpy(saved->data, tt->shadow + page * DIRTY_PAGE_SIZE,
+                   DIRTY_PAGE_SIZE);
+            memcpy(tt->shadow + page * DIRTY_PAGE_SIZE,
+                   memory + page * DIRTY_PAGE_SIZE, DIRTY_PAGE_SIZE);
+            bits &= bits - 1;
+        }
+    }
+    tt->used += n * sizeof(struct CheckpointPage);
+}
+
+/**
+ * Like save_pages(), for graphics RAM.
+ */
+static void save_video(
+        struct TimeTravel* tt, struct Checkpoint* checkpoint,
+        const uint8_t* ram)
+{
+    if (memcmp(tt->video_shadow, ram, VIDEO_RAM_SIZE) == 0) {
+        return;
+    }
+    checkpoint->video_ram = malloc(VIDEO_RAM_SIZE);
+    if (checkpoint->video_ram == NULL) {
+        fprintf(stderr, "Time travel: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(checkpoint->video_ram, tt->video_shadow, VIDEO_RAM_SIZE);
+    memcpy(tt->video_shadow, ram, VIDEO_RAM_SIZE);
+    tt->used += VIDEO_RAM_SIZE;
+}
+
+static void take_checkpoint(struct TimeTravel* tt, struct Fpemu* emu)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    const uint8_t* memory = fpemu_memory(emu);
+    struct Checkpoint* checkpoint;
+
+    if (tt->count > 0) {
+        save_pages(tt, newest(tt), memory, c->dirty_pages);
+        save_video(tt, newest(tt), c->video->ram);
+    } else {
+        memcpy(tt->shadow, memory, MEMORY_SIZE);
+        memcpy(tt->video_shadow, c->video->ram, VIDEO_RAM_SIZE);
+    }
+    memset(c->dirty_pages, 0, sizeof(c->dirty_pages));
+
+    if (tt->count == tt->allocated) {
+        unsigned allocated = (tt->allocated == 0) ? 64 : 2 * tt->allocated;
+        struct Checkpoint* bigger =
+            realloc(tt->checkpoints, allocated * sizeof(struct Checkpoint));
+        if (bigger == NULL) {
+            fprintf(stderr, "Time travel: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        tt->checkpoints = bigger;
+        tt->allocated = allocated;
+    }
+    checkpoint = &(tt->checkpoints[(tt->count)++]);
+    checkpoint->instruction_count = c->instruction_count;
+    checkpoint->clocks = c->clocks;
+    checkpoint->pc = c->pc;
+    checkpoint->instruction = c->instruction;
+    checkpoint->stacks[DATA_STACK] = c->data_stack;
+    checkpoint->stacks[RETURN_STACK] = c->return_stack;
+    checkpoint->stacks[CONTROL_STACK] = c->control_stack;
+    checkpoint->stacks[TEMP_STACK] = c->temp_stack;
+    checkpoint->serial_bytes = c->serial->bytes;
+    checkpoint->serial_events = c->serial->log_position;
+    fpemu_save_devices(emu, &(checkpoint->devices));
+    checkpoint->page_count = 0;
+    checkpoint->pages = NULL;
+    checkpoint->video_ram = NULL;
+    tt->used += sizeof(struct Checkpoint);
+
+    while ((tt->used + c->serial->log_used - c->serial->log_first >
+            tt->budget) && (tt->count > 1)) {
+        drop_oldest(tt);
+        serial_trim_log(c->serial, tt->checkpoints[0].serial_events);
+    }
+}
+
+/**
+ * Free what a checkpoint holds, it stays in the list.
+ */
+static void drop(struct TimeTravel* tt, struct Checkpoint* checkpoint)
+{
+    tt->used -= sizeof(struct Checkpoint) +
+                checkpoint->page_count * sizeof(struct CheckpointPage);
+    free(checkpoint->pages);
+    checkpoint->pages = NULL;
+    checkpoint->page_count = 0;
+    if (checkpoint->video_ram != NULL) {
+        tt->used -= VIDEO_RAM_SIZE;
+        free(checkpoint->video_ram);
+        checkpoint->video_ram = NULL;
+    }
+}
+
+static void drop_oldest(struct TimeTravel* tt)
+{
+    drop(tt, &(tt->checkpoints[0]));
+    --(tt->count);
+    memmove(tt->checkpoints, tt->checkpoints + 1,
+            tt->count * sizeof(struct Checkpoint));
+}
+
+/**
+ * Go back to checkpoint k, the ones after it are dropped.
+ */
+static void restore(struct TimeTravel* tt, struct Fpemu* emu, unsigned k)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    struct Checkpoint* checkpoint = &(tt->checkpoints[k]);
+    uint64_t dirty[DIRTY_PAGES / 64];
+
+    /* Memory at the newest checkpoint */
+    memcpy(dirty, c->dirty_pages, sizeof(dirty));
+    for (unsigned i = 0; i < DIRTY_PAGES / 64; ++i) {
+        while (dirty[i] != 0) {
+            unsigned page = i * 64 + (unsigned)__builtin_ctzll(dirty[i]);
+            uint16_t address = (uint16_t)(page * DIRTY_PAGE_SIZE);
+            fpemu_write_memory(emu, address, tt->shadow + address,
+                               DIRTY_PAGE_SIZE);
+            dirty[i] &= dirty[i] - 1;
+        }
+    }
+    /* Then back one checkpoint at a time */
+    for (unsigned j = tt->count - 1; j-- > k;) {
+        const struct Checkpoint* older = &(tt->checkpoints[j]);
+        for (unsigned i = 0; i < older->page_count; ++i) {
+            const struct CheckpointPage* saved = &(older->pages[i]);
+            uint16_t address = (uint16_t)(saved->page * DIRTY_PAGE_SIZE);
+            fpemu_write_memory(emu, address, saved->data, DIRTY_PAGE_SIZE);
+            memcpy(tt->shadow + address, saved->data, DIRTY_PAGE_SIZE);
+        }
+        if (older->video_ram != NULL) {
+            memcpy(tt->video_shadow, older->video_ram, VIDEO_RAM_SIZE);
+        }
+    }
+    video_load_ram(c->video, tt->video_shadow);
+    while (tt->count > k + 1) {
+        drop(tt, newest(tt));
+        --(tt->count);
+    }
+    tt->used -= checkpoint->page_count * sizeof(struct CheckpointPage);
+    free(checkpoint->pages);
+    checkpoint->pages = NULL;
+    checkpoint->page_count = 0;
+    if (checkpoint->video_ram != NULL) {
+        tt->used -= VIDEO_RAM_SIZE;
+        free(checkpoint->video_ram);
+        checkpoint->video_ram = NULL;
+    }
+    memset(c->dirty_pages, 0, sizeof(c->dirty_pages));
+
+    c->instruction_count = checkpoint->instruction_count;
+    c->clocks = checkpoint->clocks;
+    c->pc = checkpoint->pc;
+    c->instruction = checkpoint->instruction;
+    c->data_stack = checkpoint->stacks[DATA_STACK];
+    c->return_stack = checkpoint->stacks[RETURN_STACK];
+    c->control_stack = checkpoint->stacks[CONTROL_STACK];
+    c->temp_stack = checkpoint->stacks[TEMP_STACK];
+    c->exception = AllIsOK;
+    c->keep_going = true;
+    serial_rewind(c->serial, checkpoint->serial_events,
+                  checkpoint->serial_bytes);
+    fpemu_restore_devices(emu, &(checkpoint->devices));
+}
+
+/**
+ * The newest checkpoint before instruction count, tt->count if none.
+ */
+static unsigned before(const struct TimeTravel* tt, uint64_t count)
+{
+    for (unsigned k = tt->count; k > 0; --k) {
+        if (tt->checkpoints[k - 1].instruction_count < count) {
+            return k - 1;
+        }
+    }
+    return tt->count;
+}
+
+/**
+ * Run forward to end, and find the last time before end that a
+ * breakpoint or watchpoint stopped the processor.
+ */
+static bool find_hit(
+        struct TimeTravel* tt, struct Fpemu* emu,
+        struct Breakpoints* breakpoints, uint64_t end, uint64_t* hit,
+        enum BreakReason* reason, uint16_t* address)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    bool found = false;
+
+    /* A run does not stop at the breakpoint it starts at */
+    if (is_breakpoint(breakpoints, c->pc)) {
+        found = true;
+        *hit = c->instruction_count;
+        *reason = BreakPoint;
+        *address = c->pc;
+    }
+    while (c->keep_going && (c->instruction_count < end)) {
+        time_travel_run(tt, emu, breakpoints, end);
+        if ((breakpoints->reason != BreakNone) &&
+            (c->instruction_count < end)) {
+            found = true;
+            *hit = c->instruction_count;
+            *reason = breakpoints->reason;
+            *address = breakpoints->address;
+        }
+    }
+    return found;
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Keep checkpoints of up to budget bytes, plus a 64K copy of memory.
+ * Returns NULL if out of memory.
+ */
+struct TimeTravel* time_travel_create(size_t budget)
+{
+    struct TimeTravel* tt = calloc(1, sizeof(struct TimeTravel));
+
+    if (tt != NULL) {
+        tt->budget = budget;
+    }
+    return tt;
+}
+
+void time_travel_destroy(struct TimeTravel* tt)
+{
+    if (tt != NULL) {
+        for (unsigned k = 0; k < tt->count; ++k) {
+            free(tt->checkpoints[k].pages);
+            free(tt->checkpoints[k].video_ram);
+        }
+        free(tt->checkpoints);
+        free(tt);
+    }
+}
+
+/**
+ * Forget the past, the emulator was changed from outside.  The first
+ * checkpoint is the state it is in now.
+ */
+void time_travel_reset(struct TimeTravel* tt, struct Fpemu* emu)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+
+    while (tt->count > 0) {
+        drop(tt, newest(tt));
+        --(tt->count);
+    }
+    serial_start_log(c->serial);
+    take_checkpoint(tt, emu);
+}
+
+/**
+ * Run until instruction count end, HALT, an exception, or a breakpoint
+ * or watchpoint, taking checkpoints on the way.  breakpoints can be
+ * NULL.  single_step is ignored, end sets how far to go.
+ */
+void time_travel_run(
+        struct TimeTravel* tt, struct Fpemu* emu,
+        struct Breakpoints* breakpoints, uint64_t end)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    uint8_t* memory = fpemu_memory(emu);
+    bool single_step = c->single_step;
+
+    if (tt->count == 0) {
+        time_travel_reset(tt, emu);
+    }
+    if (breakpoints != NULL) {
+        breakpoints->reason = BreakNone;
+    }
+    fpemu_set_breakpoints(emu, breakpoints);
+    c->keep_going = true;
+    c->single_step = false;
+    c->exception = AllIsOK;
+    while (c->keep_going && (c->instruction_count < end)) {
+        uint64_t next = newest(tt)->instruction_count + TT_INTERVAL;
+
+        if (c->instruction_count >= next) {
+            take_checkpoint(tt, emu);
+            continue;
+        }
+        c->instruction_limit = (end < next) ? end : next;
+        run_scheduled(c, memory, run_switch, c->instruction_limit);
+        if (stopped_at_break(c)) {
+            break;
+        }
+    }
+    fpemu_set_breakpoints(emu, NULL);
+    if (c->keep_going && (c->instruction_count ==
+                          newest(tt)->instruction_count + TT_INTERVAL)) {
+        take_checkpoint(tt, emu);
+    }
+    c->instruction_limit = UINT64_MAX;
+    c->single_step = single_step;
+    serial_flush(c->serial);
+}
+
+/**
+ * Go back one instruction.  Returns false at the oldest checkpoint.
+ */
+bool time_travel_step_back(struct TimeTravel* tt, struct Fpemu* emu)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    uint64_t target = c->instruction_count - 1;
+    unsigned k = before(tt, c->instruction_count);
+
+    if (k == tt->count) {
+        return false;
+    }
+    restore(tt, emu, k);
+    time_travel_run(tt, emu, NULL, target);
+    return true;
+}
+
+/**
+ * Go back to the last time a breakpoint or watchpoint stopped the
+ * processor, reason and address in breakpoints tell which.  Returns
+ * false, at the oldest checkpoint, if there is none.
+ */
+bool time_travel_run_back(
+        struct TimeTravel* tt, struct Fpemu* emu,
+        struct Breakpoints* breakpoints)
+{
+    struct CPU_Context* c = fpemu_context(emu);
+    uint64_t end = c->instruction_count;
+    unsigned k;
+
+    while ((k = before(tt, end)) < tt->count) {
+        uint64_t hit;
+        enum BreakReason reason;
+        uint16_t address;
+
+        restore(tt, emu, k);
+        if (breakpoints_active(breakpoints) &&
+            find_hit(tt, emu, breakpoints, end, &hit, &reason, &address)) {
+            restore(tt, emu, k);
+            time_travel_run(tt, emu, NULL, hit);
+            breakpoints->reason = reason;
+            breakpoints->address = address;
+            return true;
+        }
+        end = tt->checkpoints[k].instruction_count;
+    }
+    if ((tt->count > 0) &&
+        (c->instruction_count != tt->checkpoints[0].instruction_count)) {
+        restore(tt, emu, 0);
+    }
+    return false;
+}
+
+/* ------------------------ end of file -------------------------------*/
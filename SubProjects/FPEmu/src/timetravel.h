@@ -0,0 +1,66 @@
+#ifndef HG_TIMETRAVEL_H
+#define HG_TIMETRAVEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "fpemu.h"
+#include "libfpemu.h"
+#include "breakpoints.h"
+#include "snapshot.h"
+
+/* Instructions between checkpoints */
+#define TT_INTERVAL 10000
+
+struct CheckpointPage {
+    uint16_t page;
+    uint8_t data[DIRTY_PAGE_SIZE];
+};
+
+/**
+ * The processor and the devices at one instruction count.  pages has the contents, at
+ * that point, of the pages written before the next checkpoint.
+ */
+struct Checkpoint {
+    uint64_t instruction_count;
+    uint64_t clocks;
+    uint16_t pc;
+    uint16_t instruction;
+    struct Stack stacks[4];
+    uint64_t serial_bytes;       /* Bytes written to the serial port */
+    size_t serial_events;        /* Position in the serial input log */
+    struct DeviceState devices;
+    unsigned page_count;
+    struct CheckpointPage* pages;
+    /* Graphics RAM at that point, if it was written before the next */
+    uint8_t* video_ram;
+};
+
+/**
+ * Checkpoints, oldest first.  The oldest are dropped when they and the
+ * serial input log take more than budget bytes.
+ */
+struct TimeTravel {
+    size_t budget;
+    size_t used;
+    unsigned count;
+    unsigned allocated;
+    struct Checkpoint* checkpoints;
+    /* Memory and graphics RAM at the newest checkpoint */
+    uint8_t shadow[MEMORY_SIZE];
+    uint8_t video_shadow[VIDEO_RAM_SIZE];
+};
+
+extern struct TimeTravel* time_travel_create(size_t budget);
+extern void time_travel_destroy(struct TimeTravel* tt);
+extern void time_travel_reset(struct TimeTravel* tt, struct Fpemu* emu);
+extern void time_travel_run(
+        struct TimeTravel* tt, struct Fpemu* emu,
+        struct Breakpoints* breakpoints, uint64_t end);
+extern bool time_travel_step_back(struct TimeTravel* tt, struct Fpemu* emu);
+extern bool time_travel_run_back(
+        struct TimeTravel* tt, struct Fpemu* emu,
+        struct Breakpoints* breakpoints);
+
+#endif /* HG_TIMETRAVEL_H */
@@ -0,0 +1,404 @@
+/**
+ * Stack-master 16 emulator -- top-of-stack caching core
+ *
+ * A switch interpreter like step(), that keeps the top entry of the data
+ * stack and of the return stack, plus both stack depths, in local
+ * variables.  Only the entry below the top is in memory, so ADD is one
+ * load instead of pop, pop, push.  The cached top is spilled when a new
+ * value is pushed on top of it, and written back, together with the
+ * depths, pc, instruction count and clocks, whenever the context has to be
+ * complete: around exec_store() and exec_read(), and when the core stops.
+ *
+ * Depths change exactly like in push() and pop(), so overflow and
+ * underflow are raised at the same instruction with the same stack
+ * contents.  Behaviour must be identical to run_switch() in cpu.c.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+#include "tos.h"
+#include "clocks.h"
+#include "breakpoints.h"
+
+/**
+ * A stack with its top entry and depth cached.  values[top - 1] in
+ * memory is stale, the real value is in tos.
+ */
+struct Cached {
+    struct Stack* stack;
+    uint16_t top;
+    uint16_t size;
+    uint16_t tos;
+};
+
+/* --------------------------------------------------------------------*/
+
+static inline void cached_load(struct Cached* s, struct Stack* stack)
+{
+    s->stack = stack;
+    s->top = stack->top;
+    s->size = stack->size;
+    s->tos = (s->top != 0) ? stack->values[s->top - 1] : 0;
+}
+
+static inline void cached_store(const struct Cached* s)
+{
+    if (s->top != 0) {
+        s->stack->values[s->top - 1] = s->tos;
+    }
+    s->stack->top = s->top;
+}
+
+/* Same as push() */
+static inline void cached_push(
+        struct CPU_Context* c, struct Cached* s, uint16_t value)
+{
+    if (s->top != 0) {
+        s->stack->values[s->top - 1] = s->tos;
+    }
+    s->tos = value;
+    ++(s->top);
+    if (s->top == s->size) {
+        c->keep_going = false;
+        c->exception = StackOverflow;
+    }
+}
+
+/* Same as pop() */
+static inline uint16_t cached_pop(struct CPU_Context* c, struct Cached* s)
+{
+    uint16_t value;
+
+    if (s->top == 0) {
+        c->keep_going = false;
+        c->exception = StackUnderflow;
+        value = 0xDEAD;
+    } else {
+        value = s->tos;
+        --(s->top);
+        if (s->top != 0) {
+            s->tos = s->stack->values[s->top - 1];
+        }
+    }
+    return value;
+}
+
+/* --------------------------------------------------------------------*/
+
+/* Two value operators, n1 is the top of the stack.  With two entries on
+ * the stack nothing can go wrong, and the result replaces the top. */
+#define BINARY(expression) \
+    do { \
+        uint16_t n1, n2; \
+        if (d.top >= 2) { \
+            n1 = d.tos; \
+            n2 = d.stack->values[d.top - 2]; \
+            d.tos = (expression); \
+            --(d.top); \
+        } else { \
+            n1 = cached_pop(c, &d); \
+            n2 = cached_pop(c, &d); \
+            cached_push(c, &d, (expression)); \
+        } \
+    } while (0)
+
+#define TRUTH(condition) ((condition) ? 0xFFFF : 0x0000)
+
+/* One value operators, the result replaces the top */
+#define UNARY(expression) \
+    do { \
+        uint16_t n1; \
+        if (d.top >= 1) { \
+            n1 = d.tos; \
+            d.tos = (expression); \
+        } else { \
+            n1 = cached_pop(c, &d); \
+            cached_push(c, &d, (expression)); \
+        } \
+    } while (0)
+
+/* Make the context complete, for code outside this file */
+#define SYNC() \
+    do { \
+        cached_store(&d); \
+        cached_store(&r); \
+        c->pc = pc; \
+        c->instruction_count = count; \
+        c->clocks = clocks; \
+    } while (0)
+
+/* The other stacks are used as they are */
+static inline uint16_t pop_id(
+        struct CPU_Context* c, struct Cached* d, struct Cached* r,
+        uint16_t stack_id)
+{
+    switch (stack_id) {
+        case DATA_STACK:
+            return cached_pop(c, d);
+        case RETURN_STACK:
+            return cached_pop(c, r);
+        default:
+            return pop(c, get_stack(c, stack_id));
+    }
+}
+
+static inline void push_id(
+        struct CPU_Context* c, struct Cached* d, struct Cached* r,
+        uint16_t stack_id, uint16_t value)
+{
+    switch (stack_id) {
+        case DATA_STACK:
+            cached_push(c, d, value);
+            break;
+        case RETURN_STACK:
+            cached_push(c, r, value);
+            break;
+        default:
+            push(c, get_stack(c, stack_id), value);
+            break;
+    }
+}
+
+static inline void illegal(struct CPU_Context* c)
+{
+    c->exception = IllegalInstruction;
+    c->keep_going = false;
+}
+
+/**
+ * The caching loop, with or without a breakpoint check before each
+ * instruction, see run_tos().
+ */
+static inline __attribute__((always_inline)) void tos_loop(
+        struct CPU_Context* c, uint8_t* memory,
+        struct Breakpoints* breakpoints)
+{
+    struct Cached d;
+    struct Cached r;
+    uint16_t pc = c->pc;
+    uint16_t instruction = c->instruction;
+    uint64_t count = c->instruction_count;
+    uint64_t limit = c->instruction_limit;
+    uint64_t clocks = c->clocks;
+
+    cached_load(&d, &(c->data_stack));
+    cached_load(&r, &(c->return_stack));
+
+    while (c->keep_going && (count < limit)) {
+        if ((breakpoints != NULL) && break_here(breakpoints, pc, count)) {
+            break_at(c, BreakPoint, pc);
+            break;
+        }
+        instruction = fetch_instruction(memory, pc);
+        ++count;
+        clocks += instruction_clocks(instruction);
+
+        switch (instruction & 0xF000) {
+            case 0x4000:
+            case 0x5000:
+            case 0x6000:
+            case 0x7000: /* ENTER */
+                cached_push(c, &r, pc + 2);
+                pc = (instruction & 0x3FFF) << 2;
+                break;
+            case 0x1000: /* BIF */
+                if (cached_pop(c, &d)) {
+                    pc += 2;
+                } else {
+                    uint16_t offset = instruction & 0x0FFF;
+                    if (offset & 0x0800) {
+                        offset |= 0xF000;
+                    }
+                    pc += offset;
+                }
+                break;
+            case 0x8000:
+                switch (instruction & 0x0F00) {
+                    case 0x0000: /* NOP */
+                        pc += 2;
+                        break;
+                    case 0x0100: /* LEAVE */
+                        pc = cached_pop(c, &r);
+                        break;
+                    case 0x0200: /* HALT */
+                        pc += 2;
+                        c->keep_going = false;
+                        break;
+                    default:
+                        illegal(c);
+                        pc += 2;
+                        break;
+                }
+                break;
+            case 0xB000:
+                {
+                    uint16_t source = (instruction & 0x00C0) >> 6;
+                    uint16_t target = (instruction & 0x0030) >> 4;
+                    uint16_t value;
+                    uint16_t value2;
+
+                    switch (instruction & 0x0F00) {
+                        case 0x0000: /* DROP */
+                            (void)pop_id(c, &d, &r, source);
+                            break;
+                        case 0x0100: /* DUP */
+                            value = pop_id(c, &d, &r, source);
+                            push_id(c, &d, &r, source, value);
+                            push_id(c, &d, &r, source, value);
+                            break;
+                        case 0x0200: /* SWAP */
+                            value = pop_id(c, &d, &r, source);
+                            value2 = pop_id(c, &d, &r, source);
+                            push_id(c, &d, &r, source, value);
+                            push_id(c, &d, &r, source, value2);
+                            break;
+                        case 0x0300: /* MOV */
+                            value = pop_id(c, &d, &r, source);
+                            push_id(c, &d, &r, target, value);
+                            break;
+                        default:
+                            illegal(c);
+                            break;
+                    }
+                    pc += 2;
+                }
+                break;
+            case 0xC000: /* LDL */
+                push_id(c, &d, &r, (instruction & 0x0C00) >> 10,
+                        instruction & 0x03FF);
+                pc += 2;
+                break;
+            case 0xD000: /* LDH */
+                {
+                    uint16_t stack_id = (instruction & 0x0C00) >> 10;
+                    uint16_t high = (instruction & 0x003F) << 10;
+                    if ((stack_id == DATA_STACK) && (d.top >= 1)) {
+                        d.tos |= high;
+                    } else {
+                        uint16_t value = pop_id(c, &d, &r, stack_id);
+                        push_id(c, &d, &r, stack_id, value | high);
+                    }
+                    pc += 2;
+                }
+                break;
+            case 0xE000:
+                {
+                    bool is_signed = (instruction & 0x0010) != 0;
+
+                    switch ((instruction & 0x0F80) >> 7) {
+                        case 0x00: /* ADD(U) */
+                            BINARY((uint16_t)(n1 + n2));
+                            break;
+                        case 0x01: /* MUL(U) */
+                            BINARY((uint16_t)(n1 * n2));
+                            break;
+                        case 0x03: /* EQ */
+                            BINARY(TRUTH(n2 == n1));
+                            break;
+                        case 0x04: /* ASR */
+                            if (is_signed) {
+                                BINARY((uint16_t)((int16_t)n2 >> (int16_t)n1));
+                            } else {
+                                illegal(c);
+                            }
+                            break;
+                        case 0x05: /* LT(U) */
+                            if (is_signed) {
+                                BINARY(TRUTH((int16_t)n2 < (int16_t)n1));
+                            } else {
+                                BINARY(TRUTH(n2 < n1));
+                            }
+                            break;
+                        case 0x06: /* GT(U) */
+                            if (is_signed) {
+                                BINARY(TRUTH((int16_t)n2 > (int16_t)n1));
+                            } else {
+                                BINARY(TRUTH(n2 > n1));
+                            }
+                            break;
+                        case 0x07: /* LTE(U) */
+                            if (is_signed) {
+                                BINARY(TRUTH((int16_t)n2 <= (int16_t)n1));
+                            } else {
+                                BINARY(TRUTH(n2 <= n1));
+                            }
+                            break;
+                        case 0x08: /* GTE(U) */
+                            if (is_signed) {
+                                BINARY(TRUTH((int16_t)n2 >= (int16_t)n1));
+                            } else {
+                                BINARY(TRUTH(n2 >= n1));
+                            }
+                            break;
+                        case 0x09: /* LSR */
+                            BINARY((uint16_t)(n2 << n1));
+                            break;
+                        case 0x0A: /* LSL */
+                            BINARY((uint16_t)(n2 >> n1));
+                            break;
+                        case 0x0B: /* STO / ISTO */
+                            SYNC();
+                            exec_store(c, memory, instruction);
+                            cached_load(&d, &(c->data_stack));
+                            break;
+                        case 0x0D: /* AND */
+                            BINARY(n2 & n1);
+                            break;
+                        case 0x0E: /* OR */
+                            BINARY(n2 | n1);
+                            break;
+                        case 0x0F: /* XOR */
+                            BINARY(n2 ^ n1);
+                            break;
+                        default:
+                            illegal(c);
+                            break;
+                    }
+                    pc += 2;
+                }
+                break;
+            case 0xF000:
+                switch ((instruction & 0x0F00) >> 8) {
+                    case 0x00: /* NEG */
+                        UNARY((uint16_t)(0 - n1));
+                        break;
+                    case 0x01: /* NOT */
+                        UNARY((uint16_t)~n1);
+                        break;
+                    case 0x02: /* RD / IRD */
+                        SYNC();
+                        exec_read(c, memory, instruction);
+                        cached_load(&d, &(c->data_stack));
+                        break;
+                    default:
+                        illegal(c);
+                        break;
+                }
+                pc += 2;
+                break;
+            default:
+                illegal(c);
+                pc += 2;
+                break;
+        }
+    }
+
+    SYNC();
+    c->instruction = instruction;
+}
+
+/**
+ * Run the processor with the top of the data and return stacks cached.
+ */
+void run_tos(struct CPU_Context* c, uint8_t* memory)
+{
+    if (c->breakpoints != NULL) {
+        tos_loop(c, memory, c->breakpoints);
+    } else {
+        tos_loop(c, memory, NULL);
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
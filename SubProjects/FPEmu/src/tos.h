@@ -0,0 +1,10 @@
+#ifndef HG_TOS_H
+#define HG_TOS_H
+
+#include <stdint.h>
+
+#include "fpemu.h"
+
+extern void run_tos(struct CPU_Context* c, uint8_t* memory);
+
+#endif /* HG_TOS_H */
@@ -0,0 +1,173 @@
+/**
+ * Stack-master 16 emulator -- execution trace
+ *
+ * Writes a binary record per executed instruction, see trace.h, for
+ * fptrace to print later.  Records are filled in a 1 MB buffer and
+ * written with one write() when it is full, so tracing costs a few
+ * stores per instruction rather than a printf().
+ *
+ * Runs on the reference interpreter, one step() at a time.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fpemu.h"
+#include "trace.h"
+
+/* Stack entries are read without checking the depth */
+_Static_assert((MAX_STACK_SIZE & (MAX_STACK_SIZE - 1)) == 0,
+               "MAX_STACK_SIZE must be a power of 2");
+
+/* --------------------------------------------------------------------*/
+
+static inline uint16_t peek(const struct Stack* stack, unsigned n);
+static void write_all(struct Trace* trace, const void* data, size_t size);
+static void flush(struct Trace* trace);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * The nth entry from the top, 1 is the top.  Stale if the stack is not
+ * that deep.
+ */
+static inline uint16_t peek(const struct Stack* stack, unsigned n)
+{
+    return stack->values[(stack->top - n) & (MAX_STACK_SIZE - 1)];
+}
+
+static void write_all(struct Trace* trace, const void* data, size_t size)
+{
+    const uint8_t* bytes = data;
+    size_t done = 0;
+
+    while (!(trace->failed) && (done < size)) {
+        ssize_t n = write(trace->fd, bytes + done, size - done);
+        if (n <= 0) {
+            perror("trace");
+            trace->failed = true;
+        } else {
+            done += (size_t)n;
+        }
+    }
+}
+
+static void flush(struct Trace* trace)
+{
+    if (trace->used > 0) {
+        write_all(trace, trace->buffer,
+                  trace->used * sizeof(struct TraceRecord));
+        trace->used = 0;
+        ++(trace->writes);
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Returns NULL if the file cannot be created.
+ */
+struct Trace* trace_create(const char* filename)
+{
+    struct Trace* trace = malloc(sizeof(struct Trace));
+
+    if (trace == NULL) {
+        return NULL;
+    }
+    trace->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace->fd < 0) {
+        perror(filename);
+        free(trace);
+        return NULL;
+    }
+    trace->started = false;
+    trace->failed = false;
+    trace->used = 0;
+    trace->records = 0;
+    trace->writes = 0;
+
+    return trace;
+}
+
+/**
+ * Write what is buffered and close the file.  Returns false if
+ * something could not be written.
+ */
+bool trace_close(struct Trace* trace)
+{
+    bool ok;
+
+    if (trace == NULL) {
+        return true;
+    }
+    flush(trace);
+    ok = !(trace->failed) && (close(trace->fd) == 0);
+    free(trace);
+
+    return ok;
+}
+
+/**
+ * Run the processor with the reference interpreter, recording every
+ * instruction.
+ */
+void run_trace(struct CPU_Context* c, uint8_t* memory, struct Trace* trace)
+{
+    if (!(trace->started)) {
+        struct TraceHeader header;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(struct TraceRecord);
+        header.first_instruction = c->instruction_count;
+        write_all(trace, &header, sizeof(header));
+        trace->started = true;
+    }
+    while (c->keep_going && (c->instruction_count < c->instruction_limit)) {
+        struct TraceRecord* record = &(trace->buffer[trace->used]);
+        const struct Stack* data = &(c->data_stack);
+        const struct Stack* ret = &(c->return_stack);
+        uint16_t instruction = fetch_instruction(memory, c->pc);
+
+        record->pc = c->pc;
+        record->instruction = instruction;
+        record->data_depth = (uint8_t)data->top;
+        record->data_top = peek(data, 1);
+        record->data_next = peek(data, 2);
+        record->return_depth = (uint8_t)ret->top;
+        record->return_top = peek(ret, 1);
+        record->flags = 0;
+        record->address = 0;
+        if ((instruction & 0xFF00) == 0xF200) {
+            /* RD / IRD: address ( -- value ) */
+            record->flags = TRACE_READ | ((instruction & 0x0080) ?
+                                          TRACE_IO : 0);
+            record->address = record->data_top;
+        } else if ((instruction & 0xFF80) == 0xE580) {
+            /* STO / ISTO: address value ( -- ), l has two values */
+            record->flags = TRACE_STORE | ((instruction & 0x0040) ?
+                                           TRACE_IO : 0);
+            record->address = ((instruction & 0x0007) == 4) ?
+                              peek(data, 3) : record->data_next;
+        }
+
+        step(c, memory);
+        record->exception = (uint8_t)c->exception;
+        if (!(c->keep_going)) {
+            (void)take_exception(c, memory);
+        }
+
+        ++(trace->records);
+        if (++(trace->used) == TRACE_RECORDS) {
+            flush(trace);
+        }
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,64 @@
+#ifndef HG_TRACE_H
+#define HG_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpemu.h"
+
+#define TRACE_MAGIC "FPEMTRAC"
+#define TRACE_VERSION 1
+/* Records buffered before they are written, 1 MB */
+#define TRACE_RECORDS 65536
+
+/* TraceRecord flags */
+#define TRACE_READ   0x01    /* RD, address is valid */
+#define TRACE_STORE  0x02    /* STO */
+#define TRACE_IO     0x04    /* IRD or ISTO */
+
+/**
+ * The start of a trace file, followed by the records.
+ */
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t first_instruction;  /* instruction_count of the first record */
+};
+
+/**
+ * One executed instruction, with the state it started in.
+ */
+struct TraceRecord {
+    uint16_t pc;
+    uint16_t instruction;
+    uint16_t data_top;       /* Top of the data stack */
+    uint16_t data_next;      /* The value under it */
+    uint16_t return_top;     /* Top of the return stack */
+    uint16_t address;        /* Memory or IO address of RD and STO */
+    uint8_t data_depth;
+    uint8_t return_depth;
+    uint8_t flags;
+    uint8_t exception;       /* Exception code after the instruction */
+};
+
+/**
+ * A trace being written: records are collected in a buffer that is
+ * written out when it is full.
+ */
+struct Trace {
+    int fd;
+    bool started;            /* The header is written */
+    bool failed;             /* A write failed, nothing more is written */
+    unsigned used;           /* Records in the buffer */
+    uint64_t records;        /* Records written, plus the buffered ones */
+    uint64_t writes;
+    struct TraceRecord buffer[TRACE_RECORDS];
+};
+
+extern struct Trace* trace_create(const char* filename);
+extern bool trace_close(struct Trace* trace);
+extern void run_trace(
+        struct CPU_Context* c, uint8_t* memory, struct Trace* trace);
+
+#endif /* HG_TRACE_H */
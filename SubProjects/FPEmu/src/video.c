@@ -0,0 +1,459 @@
+/**
+ * Stack-master 16 emulator -- video
+ *
+ * The graphics RAM is a device on the IO bus: tile patterns, a map of
+ * 32 x 24 tiles, a list of sprites and a palette, see video.h.  Writing
+ * the frame port draws the frame.
+ *
+ * Writes only mark what changed: a map entry its 8 lines, a sprite the
+ * lines it covered and covers now, a pattern row the tiles and sprites
+ * that use it (found when the frame is drawn), the palette everything.
+ * A frame draws the marked lines only.
+ *
+ * A line is drawn as 4 bit colors first, sprites in front of the tiles,
+ * then expanded to RGBA through the palette.  On x86-64 the sprites are
+ * merged with SSE2, and the expansion uses AVX2 when the host has it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "video.h"
+#include "iobus.h"
+#include "interrupt.h"
+
+/* --------------------------------------------------------------------*/
+
+static void mark_lines(struct Video* video, unsigned first, unsigned count);
+static void mark_sprite(struct Video* video, unsigned sprite);
+static void mark_patterns(struct Video* video);
+static void make_palette(struct Video* video);
+static void merge_sprite(uint8_t* colors, const uint8_t* sprite);
+static void expand_line(
+        uint32_t* pixels, const uint8_t* colors, const uint32_t* palette);
+#ifdef __x86_64__
+static void expand_line_avx2(
+        uint32_t* pixels, const uint8_t* colors, const uint32_t* palette);
+#endif
+static void draw_line(struct Video* video, unsigned y);
+static void write_frame(struct Video* video);
+static bool frame_pattern(const char* name);
+static void vsync(void* device, uint64_t cycle);
+static uint8_t video_read(void* device, uint16_t port, uint64_t cycle);
+static void video_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle);
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Lines past the bottom are left alone.
+ */
+static void mark_lines(struct Video* video, unsigned first, unsigned count)
+{
+    for (unsigned y = first; (y < first + count) && (y < VIDEO_HEIGHT); ++y) {
+        video->dirty_lines[y / 64] |= (uint64_t)1 << (y % 64);
+    }
+}
+
+static void mark_sprite(struct Video* video, unsigned sprite)
+{
+    const uint8_t* s = video->ram + VIDEO_SPRITE_LIST + 4 * sprite;
+
+    if (s[3] & SPRITE_VISIBLE) {
+        mark_lines(video, s[0], 8);
+    }
+}
+
+/**
+ * The lines of the map rows and sprites with a pattern row written since
+ * the last frame.
+ */
+static void mark_patterns(struct Video* video)
+{
+    const uint8_t* map = video->ram + VIDEO_MAP;
+
+    for (unsigned row = 0; row < VIDEO_MAP_ROWS; ++row) {
+        uint8_t rows = 0;
+        for (unsigned column = 0; column < VIDEO_MAP_COLUMNS; ++column) {
+            rows |= video->dirty_rows[map[row * VIDEO_MAP_COLUMNS + column]];
+        }
+        for (unsigned i = 0; (i < 8) && (rows != 0); ++i, rows >>= 1) {
+            if (rows & 1) {
+                mark_lines(video, row * 8 + i, 1);
+            }
+        }
+    }
+    for (unsigned sprite = 0; sprite < VIDEO_SPRITES; ++sprite) {
+        const uint8_t* s = video->ram + VIDEO_SPRITE_LIST + 4 * sprite;
+        uint8_t rows = video->dirty_rows[s[2]];
+        if (!(s[3] & SPRITE_VISIBLE)) {
+            continue;
+        }
+        for (unsigned i = 0; (i < 8) && (rows != 0); ++i, rows >>= 1) {
+            if (rows & 1) {
+                mark_lines(video, s[0] + i, 1);
+            }
+        }
+    }
+    memset(video->dirty_rows, 0, sizeof(video->dirty_rows));
+}
+
+static void make_palette(struct Video* video)
+{
+    for (unsigned i = 0; i < VIDEO_COLORS; ++i) {
+        const uint8_t* rgb = video->ram + VIDEO_PALETTE + 3 * i;
+        uint8_t rgba[4] = { rgb[0], rgb[1], rgb[2], 0xFF };
+        memcpy(&(video->palette[i]), rgba, sizeof(rgba));
+    }
+    video->palette_dirty = false;
+}
+
+/**
+ * Put the 8 pixels of a sprite row over the line, color 0 is transparent.
+ */
+static void merge_sprite(uint8_t* colors, const uint8_t* sprite)
+{
+#ifdef __SSE2__
+    __m128i s = _mm_loadl_epi64((const __m128i*)sprite);
+    __m128i d = _mm_loadl_epi64((const __m128i*)colors);
+    __m128i clear = _mm_cmpeq_epi8(s, _mm_setzero_si128());
+
+    d = _mm_or_si128(_mm_and_si128(clear, d), _mm_andnot_si128(clear, s));
+    _mm_storel_epi64((__m128i*)colors, d);
+#else
+    for (unsigned i = 0; i < 8; ++i) {
+        if (sprite[i] != 0) {
+            colors[i] = sprite[i];
+        }
+    }
+#endif
+}
+
+static void expand_line(
+        uint32_t* pixels, const uint8_t* colors, const uint32_t* palette)
+{
+    for (unsigned x = 0; x < VIDEO_WIDTH; ++x) {
+        pixels[x] = palette[colors[x]];
+    }
+}
+
+#ifdef __x86_64__
+/**
+ * Eight pixels at a time: each half of the palette is looked up with a
+ * permute, bit 3 of the color picks the half.
+ */
+__attribute__((target("avx2")))
+static void expand_line_avx2(
+        uint32_t* pixels, const uint8_t* colors, const uint32_t* palette)
+{
+    __m256i low = _mm256_loadu_si256((const __m256i*)palette);
+    __m256i high = _mm256_loadu_si256((const __m256i*)(palette + 8));
+    __m256i seven = _mm256_set1_epi32(7);
+
+    for (unsigned x = 0; x < VIDEO_WIDTH; x += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(
+                _mm_loadl_epi64((const __m128i*)(colors + x)));
+        __m256i upper = _mm256_cmpgt_epi32(index, seven);
+        __m256i pixel = _mm256_blendv_epi8(
+                _mm256_permutevar8x32_epi32(low, index),
+                _mm256_permutevar8x32_epi32(high, index), upper);
+        _mm256_storeu_si256((__m256i*)(pixels + x), pixel);
+    }
+}
+#endif
+
+static void draw_line(struct Video* video, unsigned y)
+{
+    /* Room for a sprite at the right edge */
+    uint8_t colors[VIDEO_WIDTH + 8];
+    const uint8_t* map = video->ram + VIDEO_MAP +
+                         (y / 8) * VIDEO_MAP_COLUMNS;
+
+    for (unsigned column = 0; column < VIDEO_MAP_COLUMNS; ++column) {
+        const uint8_t* row = video->ram + VIDEO_PATTERNS +
+                             map[column] * VIDEO_TILE_SIZE + (y % 8) * 4;
+        for (unsigned i = 0; i < 4; ++i) {
+            colors[column * 8 + 2 * i] = row[i] >> 4;
+            colors[column * 8 + 2 * i + 1] = row[i] & 0x0F;
+        }
+    }
+    /* Backwards, so sprite 0 ends up in front */
+    for (unsigned sprite = VIDEO_SPRITES; sprite-- > 0;) {
+        const uint8_t* s = video->ram + VIDEO_SPRITE_LIST + 4 * sprite;
+        unsigned line = y - s[0];  /* Large above the sprite */
+        uint8_t pixels[8];
+        const uint8_t* row;
+        if (!(s[3] & SPRITE_VISIBLE) || (line >= 8)) {
+            continue;
+        }
+        row = video->ram + VIDEO_PATTERNS + s[2] * VIDEO_TILE_SIZE + line * 4;
+        for (unsigned i = 0; i < 4; ++i) {
+            pixels[2 * i] = row[i] >> 4;
+            pixels[2 * i + 1] = row[i] & 0x0F;
+        }
+        if (s[3] & SPRITE_MIRROR) {
+            for (unsigned i = 0; i < 4; ++i) {
+                uint8_t swap = pixels[i];
+                pixels[i] = pixels[7 - i];
+                pixels[7 - i] = swap;
+            }
+        }
+        merge_sprite(colors + s[1], pixels);
+    }
+    video->expand(video->frame[y], colors, video->palette);
+    (video->lines_drawn)++;
+}
+
+static void write_frame(struct Video* video)
+{
+    if (video->output != NULL) {
+        fwrite(video->frame, sizeof(video->frame), 1, video->output);
+    } else {
+        char name[512];
+        FILE* outpf;
+        snprintf(name, sizeof(name), video->pattern,
+                 (unsigned long)video->frames);
+        outpf = fopen(name, "wb");
+        if (outpf == NULL) {
+            perror(name);
+            return;
+        }
+        fprintf(outpf, "P6\n%d %d\n255\n", VIDEO_WIDTH, VIDEO_HEIGHT);
+        for (unsigned y = 0; y < VIDEO_HEIGHT; ++y) {
+            uint8_t rgb[VIDEO_WIDTH * 3];
+            const uint8_t* rgba = (const uint8_t*)video->frame[y];
+            for (unsigned x = 0; x < VIDEO_WIDTH; ++x) {
+                memcpy(rgb + 3 * x, rgba + 4 * x, 3);
+            }
+            fwrite(rgb, sizeof(rgb), 1, outpf);
+        }
+        fclose(outpf);
+    }
+}
+
+/**
+ * The name has one conversion for the frame number, %lu with a width
+ * or 0 flag, and no other % than %%.
+ */
+static bool frame_pattern(const char* name)
+{
+    unsigned conversions = 0;
+
+    for (const char* p = strchr(name, '%'); p != NULL;
+         p = strchr(p, '%')) {
+        ++p;
+        if (*p == '%') {
+            ++p;
+            continue;
+        }
+        p += strspn(p, "0123456789");
+        if (strncmp(p, "lu", 2) != 0) {
+            return false;
+        }
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+static void vsync(void* device, uint64_t cycle)
+{
+    struct Video* video = device;
+
+    interrupts_raise(video->interrupts, IRQ_VSYNC, cycle);
+    scheduler_add(video->scheduler, &(video->vsync),
+                  cycle + VIDEO_FRAME_CYCLES);
+}
+
+/* IO bus handlers */
+
+static uint8_t video_read(void* device, uint16_t port, uint64_t cycle)
+{
+    struct Video* video = device;
+    uint16_t offset = port - IO_VIDEO;
+
+    (void)cycle;
+    if (offset == VIDEO_FRAME) {
+        return (uint8_t)video->frames;
+    }
+    return video->ram[offset];
+}
+
+static void video_write(
+        void* device, uint16_t port, uint8_t value, uint64_t cycle)
+{
+    struct Video* video = device;
+    uint16_t offset = port - IO_VIDEO;
+
+    (void)cycle;
+    if (offset < VIDEO_MAP) {
+        video->dirty_rows[offset / VIDEO_TILE_SIZE] |=
+                1 << ((offset % VIDEO_TILE_SIZE) / 4);
+        video->ram[offset] = value;
+    } else if (offset < VIDEO_SPRITE_LIST) {
+        mark_lines(video, ((offset - VIDEO_MAP) / VIDEO_MAP_COLUMNS) * 8, 8);
+        video->ram[offset] = value;
+    } else if (offset < VIDEO_PALETTE) {
+        unsigned sprite = (offset - VIDEO_SPRITE_LIST) / 4;
+        mark_sprite(video, sprite);
+        video->ram[offset] = value;
+        mark_sprite(video, sprite);
+    } else if (offset < VIDEO_FRAME) {
+        video->palette_dirty = true;
+        mark_lines(video, 0, VIDEO_HEIGHT);
+        video->ram[offset] = value;
+    } else {
+        /* Nothing is drawn without an output */
+        if ((video->output != NULL) || (video->pattern != NULL)) {
+            if (video->palette_dirty) {
+                make_palette(video);
+            }
+            mark_patterns(video);
+            for (unsigned y = 0; y < VIDEO_HEIGHT; ++y) {
+                if (video->dirty_lines[y / 64] & ((uint64_t)1 << (y % 64))) {
+                    draw_line(video, y);
+                }
+            }
+            memset(video->dirty_lines, 0, sizeof(video->dirty_lines));
+            write_frame(video);
+        }
+        (video->frames)++;
+    }
+}
+
+/* --------------------------------------------------------------------*/
+
+/**
+ * Graphics RAM cleared, NULL if out of memory.  There are no vsyncs
+ * before video_start().
+ */
+struct Video* video_create(
+        struct Scheduler* scheduler, struct Interrupts* interrupts)
+{
+    struct Video* video = calloc(1, sizeof(struct Video));
+
+    if (video == NULL) {
+        return NULL;
+    }
+    video->scheduler = scheduler;
+    video->interrupts = interrupts;
+    event_init(&(video->vsync), vsync, video);
+    video->expand = expand_line;
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        video->expand = expand_line_avx2;
+    }
+#endif
+    video_reset(video);
+
+    return video;
+}
+
+void video_destroy(struct Video* video)
+{
+    if (video != NULL) {
+        if (video->output != NULL) {
+            fclose(video->output);
+        }
+        free(video);
+    }
+}
+
+/**
+ * Graphics RAM cleared, the next frame is drawn completely.  The output
+ * is kept.
+ */
+void video_reset(struct Video* video)
+{
+    memset(video->ram, 0, sizeof(video->ram));
+    memset(video->dirty_rows, 0, sizeof(video->dirty_rows));
+    mark_lines(video, 0, VIDEO_HEIGHT);
+    video->palette_dirty = true;
+    video->frames = 0;
+    video->lines_drawn = 0;
+}
+
+/**
+ * The first vsync comes a frame after cycle 0, for after a reset.
+ */
+void video_start(struct Video* video)
+{
+    scheduler_add(video->scheduler, &(video->vsync), VIDEO_FRAME_CYCLES);
+}
+
+void video_save(
+        const struct Video* video, struct VideoState* state, uint64_t cycle)
+{
+    state->vsync = event_due_in(&(video->vsync), cycle);
+    state->frames = video->frames;
+}
+
+/**
+ * At the instruction count the state is restored to, the scheduler must
+ * have been reset to it.
+ */
+void video_restore(
+        struct Video* video, const struct VideoState* state, uint64_t cycle)
+{
+    scheduler_add_in(video->scheduler, &(video->vsync), cycle, state->vsync);
+    video->frames = state->frames;
+}
+
+/**
+ * Graphics RAM from a snapshot, the next frame is drawn completely.
+ */
+void video_load_ram(struct Video* video, const uint8_t* ram)
+{
+    memcpy(video->ram, ram, sizeof(video->ram));
+    memset(video->dirty_rows, 0, sizeof(video->dirty_rows));
+    mark_lines(video, 0, VIDEO_HEIGHT);
+    video->palette_dirty = true;
+}
+
+/**
+ * Frames go to one PPM file each if the name has a printf() conversion
+ * for the frame number, as in "frame%04lu.ppm", else to one file of raw
+ * RGBA frames.  Returns false if the file cannot be created, or the name
+ * has a % that is not that conversion.
+ */
+bool video_set_output(struct Video* video, const char* name)
+{
+    if (strchr(name, '%') != NULL) {
+        if (!frame_pattern(name)) {
+            fprintf(stderr, "%s: the frame number needs one %%lu, "
+                            "use %%%% for a %%\n", name);
+            return false;
+        }
+        video->pattern = name;
+        return true;
+    }
+    video->output = fopen(name, "wb");
+    if (video->output == NULL) {
+        perror(name);
+        return false;
+    }
+    return true;
+}
+
+bool video_map(struct Video* video, struct IoBus* bus)
+{
+    return io_bus_map(bus, IO_VIDEO, IO_VIDEO + VIDEO_RAM_SIZE - 1,
+                      video_read, video_write, video, "video");
+}
+
+void video_report(const struct Video* video, FILE* outpf)
+{
+    if (video->frames > 0) {
+        fprintf(outpf, "Video: %lu frames, %lu lines drawn\n",
+                (unsigned long)video->frames,
+                (unsigned long)video->lines_drawn);
+    }
+}
+
+/* ------------------------ end of file -------------------------------*/
@@ -0,0 +1,87 @@
+#ifndef HG_VIDEO_H
+#define HG_VIDEO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "scheduler.h"
+
+/* First IO port of the graphics RAM, see the IO map in the manual */
+#define IO_VIDEO 0x0100
+
+#define VIDEO_WIDTH  256
+#define VIDEO_HEIGHT 192
+#define VIDEO_TILES  256
+#define VIDEO_COLORS 16
+#define VIDEO_SPRITES 64
+#define VIDEO_MAP_COLUMNS (VIDEO_WIDTH / 8)
+#define VIDEO_MAP_ROWS    (VIDEO_HEIGHT / 8)
+/* 8x8 pixels of 4 bits, the left pixel of a pair in the high nibble */
+#define VIDEO_TILE_SIZE 32
+
+/* Graphics RAM, offsets from IO_VIDEO */
+#define VIDEO_PATTERNS 0x0000  /* VIDEO_TILES tiles */
+#define VIDEO_MAP      0x2000  /* Tile numbers, row by row */
+#define VIDEO_SPRITE_LIST 0x2300  /* y, x, tile, flags per sprite */
+#define VIDEO_PALETTE  0x2400  /* r, g, b per color */
+#define VIDEO_FRAME    0x2430  /* Write: frame done, read: frame count */
+#define VIDEO_RAM_SIZE 0x2431
+
+/* Cycles from one vsync to the next */
+#define VIDEO_FRAME_CYCLES 100000
+
+/* Sprite flags */
+#define SPRITE_VISIBLE 0x01
+#define SPRITE_MIRROR  0x02
+
+/**
+ * Tiles and sprites, drawn line by line into an RGBA frame when the
+ * program writes VIDEO_FRAME.  Only the lines that changed since the
+ * last frame are drawn again.  The vsync interrupt comes every
+ * VIDEO_FRAME_CYCLES, whether frames are drawn or not.
+ */
+struct Video {
+    uint8_t ram[VIDEO_RAM_SIZE];
+    /* Pattern rows written since the last frame, a bit per row */
+    uint8_t dirty_rows[VIDEO_TILES];
+    uint64_t dirty_lines[(VIDEO_HEIGHT + 63) / 64];
+    bool palette_dirty;
+    uint32_t palette[VIDEO_COLORS];  /* R, G, B, A bytes */
+    /* Frames go to a file of raw RGBA frames, or one PPM file each */
+    FILE* output;
+    const char* pattern;             /* printf() pattern of the PPM names */
+    uint64_t frames;
+    uint64_t lines_drawn;
+    struct Scheduler* scheduler;
+    struct Interrupts* interrupts;
+    struct Event vsync;
+    void (*expand)(uint32_t* pixels, const uint8_t* colors,
+                   const uint32_t* palette);
+    uint32_t frame[VIDEO_HEIGHT][VIDEO_WIDTH];
+};
+
+/* The video device in a snapshot, see snapshot.h */
+struct VideoState {
+    uint64_t vsync;           /* Cycles to the next vsync, event_due_in() */
+    uint64_t frames;
+};
+
+struct IoBus;
+struct Interrupts;
+
+extern struct Video* video_create(
+        struct Scheduler* scheduler, struct Interrupts* interrupts);
+extern void video_destroy(struct Video* video);
+extern void video_reset(struct Video* video);
+extern void video_start(struct Video* video);
+extern void video_save(
+        const struct Video* video, struct VideoState* state, uint64_t cycle);
+extern void video_restore(
+        struct Video* video, const struct VideoState* state, uint64_t cycle);
+extern void video_load_ram(struct Video* video, const uint8_t* ram);
+extern bool video_set_output(struct Video* video, const char* name);
+extern bool video_map(struct Video* video, struct IoBus* bus);
+extern void video_report(const struct Video* video, FILE* outpf);
+
+#endif /* HG_VIDEO_H */